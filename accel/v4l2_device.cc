@@ -16,6 +16,7 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <algorithm>
 #include <set>
@@ -216,6 +217,9 @@ class V4L2BuffersList : public base::RefCountedThreadSafe<V4L2BuffersList> {
   base::Optional<size_t> GetFreeBuffer();
   // Get the buffer with specified index.
   base::Optional<size_t> GetFreeBuffer(size_t requested_buffer_id);
+  // Get the first of |buffer_ids| which is in the list.
+  base::Optional<size_t> GetFirstFreeBuffer(
+      const std::vector<size_t>& buffer_ids);
   // Number of buffers currently in this list.
   size_t size() const;
 
@@ -259,6 +263,19 @@ base::Optional<size_t> V4L2BuffersList::GetFreeBuffer(
              : base::nullopt;
 }
 
+base::Optional<size_t> V4L2BuffersList::GetFirstFreeBuffer(
+    const std::vector<size_t>& buffer_ids) {
+  base::AutoLock auto_lock(lock_);
+
+  for (size_t buffer_id : buffer_ids) {
+    if (free_buffers_.erase(buffer_id) > 0)
+      return buffer_id;
+  }
+
+  DVLOGF(4) << "No free buffer available!";
+  return base::nullopt;
+}
+
 size_t V4L2BuffersList::size() const {
   base::AutoLock auto_lock(lock_);
 
@@ -656,6 +673,20 @@ bool V4L2ReadableBuffer::IsKeyframe() const {
   return buffer_data_->v4l2_buffer_.flags & V4L2_BUF_FLAG_KEYFRAME;
 }
 
+bool V4L2ReadableBuffer::IsPFrame() const {
+  DCHECK_CALLED_ON_VALID_SEQUENCE(sequence_checker_);
+  DCHECK(buffer_data_);
+
+  return buffer_data_->v4l2_buffer_.flags & V4L2_BUF_FLAG_PFRAME;
+}
+
+bool V4L2ReadableBuffer::IsBFrame() const {
+  DCHECK_CALLED_ON_VALID_SEQUENCE(sequence_checker_);
+  DCHECK(buffer_data_);
+
+  return buffer_data_->v4l2_buffer_.flags & V4L2_BUF_FLAG_BFRAME;
+}
+
 struct timeval V4L2ReadableBuffer::GetTimeStamp() const {
   DCHECK_CALLED_ON_VALID_SEQUENCE(sequence_checker_);
   DCHECK(buffer_data_);
@@ -854,6 +885,12 @@ size_t V4L2Queue::AllocateBuffers(size_t count, enum v4l2_memory memory) {
     free_buffers_->ReturnBuffer(i);
   }
 
+  buffer_dmabuf_ids_.assign(buffers_.size(),
+                           std::vector<std::pair<dev_t, ino_t>>());
+  lru_buffer_ids_.resize(buffers_.size());
+  for (size_t i = 0; i < lru_buffer_ids_.size(); i++)
+    lru_buffer_ids_[i] = i;
+
   DCHECK(free_buffers_);
   DCHECK_EQ(free_buffers_->size(), buffers_.size());
   DCHECK_EQ(queued_buffers_.size(), 0u);
@@ -876,6 +913,8 @@ bool V4L2Queue::DeallocateBuffers() {
   weak_this_factory_.InvalidateWeakPtrs();
   buffers_.clear();
   free_buffers_ = nullptr;
+  buffer_dmabuf_ids_.clear();
+  lru_buffer_ids_.clear();
 
   // Free all buffers.
   struct v4l2_requestbuffers reqbufs;
@@ -942,6 +981,51 @@ base::Optional<V4L2WritableBufferRef> V4L2Queue::GetFreeBuffer(
       weak_this_factory_.GetWeakPtr());
 }
 
+// Return the identity of the DMABUF |fd| refers to, or nullopt on error.
+static base::Optional<std::pair<dev_t, ino_t>> GetDmabufId(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    VPLOGF(1) << "fstat() failed for fd " << fd;
+    return base::nullopt;
+  }
+  return std::make_pair(st.st_dev, st.st_ino);
+}
+
+base::Optional<V4L2WritableBufferRef> V4L2Queue::GetFreeBufferForDmabufs(
+    const std::vector<int>& fds) {
+  DCHECK_CALLED_ON_VALID_SEQUENCE(sequence_checker_);
+
+  // No buffers allocated at the moment?
+  if (!free_buffers_)
+    return base::nullopt;
+
+  // Only the fds of the planes are queued, |fds| might have more of them.
+  std::vector<std::pair<dev_t, ino_t>> ids;
+  for (size_t i = 0; i < std::min(fds.size(), planes_count_); i++) {
+    base::Optional<std::pair<dev_t, ino_t>> id = GetDmabufId(fds[i]);
+    if (!id) {
+      ids.clear();
+      break;
+    }
+    ids.push_back(*id);
+  }
+
+  base::Optional<size_t> buffer_id;
+  auto it = ids.empty() ? buffer_dmabuf_ids_.end()
+                        : std::find(buffer_dmabuf_ids_.begin(),
+                                    buffer_dmabuf_ids_.end(), ids);
+  if (it != buffer_dmabuf_ids_.end())
+    buffer_id = free_buffers_->GetFreeBuffer(it - buffer_dmabuf_ids_.begin());
+  if (!buffer_id.has_value())
+    buffer_id = free_buffers_->GetFirstFreeBuffer(lru_buffer_ids_);
+  if (!buffer_id.has_value())
+    return base::nullopt;
+
+  return V4L2BufferRefFactory::CreateWritableRef(
+      buffers_[buffer_id.value()]->v4l2_buffer(),
+      weak_this_factory_.GetWeakPtr());
+}
+
 bool V4L2Queue::QueueBuffer(struct v4l2_buffer* v4l2_buffer) {
   DCHECK_CALLED_ON_VALID_SEQUENCE(sequence_checker_);
   ATRACE_CALL();
@@ -955,6 +1039,33 @@ bool V4L2Queue::QueueBuffer(struct v4l2_buffer* v4l2_buffer) {
   auto inserted = queued_buffers_.emplace(v4l2_buffer->index);
   DCHECK_EQ(inserted.second, true);
 
+  if (memory_ == V4L2_MEMORY_DMABUF) {
+    // Remember which DMABUFs the driver imported for this buffer. A DMABUF
+    // queued with another buffer is only associated with the latest one.
+    std::vector<std::pair<dev_t, ino_t>>& ids =
+        buffer_dmabuf_ids_[v4l2_buffer->index];
+    ids.clear();
+    for (size_t i = 0; i < v4l2_buffer->length; i++) {
+      base::Optional<std::pair<dev_t, ino_t>> id =
+          GetDmabufId(v4l2_buffer->m.planes[i].m.fd);
+      if (!id) {
+        ids.clear();
+        break;
+      }
+      ids.push_back(*id);
+    }
+    for (size_t i = 0; i < buffer_dmabuf_ids_.size(); i++) {
+      if (i != v4l2_buffer->index && !ids.empty() &&
+          buffer_dmabuf_ids_[i] == ids)
+        buffer_dmabuf_ids_[i].clear();
+    }
+
+    auto lru_it = std::find(lru_buffer_ids_.begin(), lru_buffer_ids_.end(),
+                            v4l2_buffer->index);
+    DCHECK(lru_it != lru_buffer_ids_.end());
+    std::rotate(lru_it, lru_it + 1, lru_buffer_ids_.end());
+  }
+
   device_->SchedulePoll();
 
   return true;
@@ -1177,6 +1288,12 @@ uint32_t V4L2Device::VideoCodecProfileToV4L2PixFmt(VideoCodecProfile profile,
       return V4L2_PIX_FMT_VP9_FRAME;
     else
       return V4L2_PIX_FMT_VP9;
+  } else if (profile >= HEVCPROFILE_MIN && profile <= HEVCPROFILE_MAX) {
+    if (slice_based) {
+      LOG(ERROR) << "Slice-based HEVC is not supported";
+      return 0;
+    }
+    return V4L2_PIX_FMT_HEVC;
   } else {
     LOG(ERROR) << "Unknown profile: " << GetProfileName(profile);
     return 0;
@@ -1221,6 +1338,16 @@ VideoCodecProfile V4L2Device::V4L2ProfileToVideoCodecProfile(VideoCodec codec,
           return VP9PROFILE_PROFILE3;
       }
       break;
+    case kCodecHEVC:
+      switch (profile) {
+        case V4L2_MPEG_VIDEO_HEVC_PROFILE_MAIN:
+          return HEVCPROFILE_MAIN;
+        case V4L2_MPEG_VIDEO_HEVC_PROFILE_MAIN_10:
+          return HEVCPROFILE_MAIN10;
+        case V4L2_MPEG_VIDEO_HEVC_PROFILE_MAIN_STILL_PICTURE:
+          return HEVCPROFILE_MAIN_STILL_PICTURE;
+      }
+      break;
     default:
       VLOGF(2) << "Unknown codec: " << codec;
   }
@@ -1245,6 +1372,9 @@ std::vector<VideoCodecProfile> V4L2Device::V4L2PixFmtToVideoCodecProfiles(
       case kCodecVP9:
         query_id = V4L2_CID_MPEG_VIDEO_VP9_PROFILE;
         break;
+      case kCodecHEVC:
+        query_id = V4L2_CID_MPEG_VIDEO_HEVC_PROFILE;
+        break;
       default:
         return false;
     }
@@ -1295,6 +1425,13 @@ std::vector<VideoCodecProfile> V4L2Device::V4L2PixFmtToVideoCodecProfiles(
         profiles = {VP9PROFILE_PROFILE0};
       }
       break;
+    case V4L2_PIX_FMT_HEVC:
+      if (!get_supported_profiles(kCodecHEVC, &profiles)) {
+        DLOG(WARNING) << "Driver doesn't support QUERY HEVC profiles, "
+                      << "use default values, Main";
+        profiles = {HEVCPROFILE_MAIN};
+      }
+      break;
     default:
       VLOGF(1) << "Unhandled pixelformat " << FourccToString(pix_fmt);
       return {};
@@ -1816,6 +1953,15 @@ bool V4L2Device::StartPolling(V4L2DevicePoller::EventCallback event_callback,
   return ret;
 }
 
+bool V4L2Device::StartPollThread() {
+  if (!device_poller_) {
+    device_poller_ =
+        std::make_unique<V4L2DevicePoller>(this, "V4L2DeviceThreadPoller");
+  }
+
+  return device_poller_->StartThread();
+}
+
 bool V4L2Device::StopPolling() {
   DCHECK_CALLED_ON_VALID_SEQUENCE(client_sequence_checker_);
 
@@ -1857,6 +2003,24 @@ bool V4L2Device::SetExtCtrls(uint32_t ctrl_class,
   return Ioctl(VIDIOC_S_EXT_CTRLS, &ext_ctrls) == 0;
 }
 
+base::Optional<struct v4l2_ext_control> V4L2Device::GetCtrl(uint32_t ctrl_id) {
+  DCHECK_CALLED_ON_VALID_SEQUENCE(client_sequence_checker_);
+
+  struct v4l2_ext_control ctrl;
+  memset(&ctrl, 0, sizeof(ctrl));
+  ctrl.id = ctrl_id;
+
+  struct v4l2_ext_controls ext_ctrls;
+  memset(&ext_ctrls, 0, sizeof(ext_ctrls));
+  ext_ctrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+  ext_ctrls.count = 1;
+  ext_ctrls.controls = &ctrl;
+  if (Ioctl(VIDIOC_G_EXT_CTRLS, &ext_ctrls) != 0)
+    return base::nullopt;
+
+  return ctrl;
+}
+
 bool V4L2Device::IsCommandSupported(uint32_t command_id) {
   DCHECK_CALLED_ON_VALID_SEQUENCE(client_sequence_checker_);
 
@@ -26,8 +26,10 @@
 #include <linux/videodev2.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #include <queue>
+#include <utility>
 #include <vector>
 
 #include "base/containers/flat_map.h"
@@ -203,6 +205,10 @@ class V4L2ReadableBuffer
   bool IsLast() const;
   // Returns whether the V4L2_BUF_FLAG_KEYFRAME flag is set for this buffer.
   bool IsKeyframe() const;
+  // Returns whether the V4L2_BUF_FLAG_PFRAME flag is set for this buffer.
+  bool IsPFrame() const;
+  // Returns whether the V4L2_BUF_FLAG_BFRAME flag is set for this buffer.
+  bool IsBFrame() const;
   // Return the timestamp set by the driver on this buffer.
   struct timeval GetTimeStamp() const;
   // Returns the number of planes in this buffer.
@@ -311,6 +317,15 @@ class V4L2Queue : public base::RefCountedThreadSafe<V4L2Queue> {
   base::Optional<V4L2WritableBufferRef> GetFreeBuffer();
   base::Optional<V4L2WritableBufferRef> GetFreeBuffer(
       size_t requested_buffer_id);
+  // Return a reference to a free buffer to queue the DMABUF |fds| with, or
+  // nullopt if no buffer is currently free. The buffer the same DMABUFs were
+  // last queued with is preferred, so the driver doesn't need to import them
+  // again. The DMABUFs are identified by their inode rather than by the fd
+  // numbers, which may be reused for another DMABUF or differ for the same one.
+  // Otherwise the least recently queued free buffer is returned, keeping the
+  // imports of the DMABUFs queued more recently.
+  base::Optional<V4L2WritableBufferRef> GetFreeBufferForDmabufs(
+      const std::vector<int>& fds);
 
   // Attempt to dequeue a buffer, and return a reference to it if one was
   // available.
@@ -372,6 +387,11 @@ class V4L2Queue : public base::RefCountedThreadSafe<V4L2Queue> {
   scoped_refptr<V4L2BuffersList> free_buffers_;
   // Buffers that have been queued by the client, and not dequeued yet.
   std::set<size_t> queued_buffers_;
+  // The identities (st_dev, st_ino) of the DMABUFs each buffer was last queued
+  // with, empty if none.
+  std::vector<std::vector<std::pair<dev_t, ino_t>>> buffer_dmabuf_ids_;
+  // The buffer IDs, from the least to the most recently queued.
+  std::vector<size_t> lru_buffer_ids_;
 
   scoped_refptr<V4L2Device> device_;
   // Callback to call in this queue's destructor.
@@ -533,6 +553,10 @@ class V4L2Device : public base::RefCountedThreadSafe<V4L2Device> {
   // sequence if a polling error has occurred.
   bool StartPolling(V4L2DevicePoller::EventCallback event_callback,
                     base::RepeatingClosure error_callback);
+  // Start the poll thread ahead of |StartPolling()|, e.g. while the device is
+  // opened before its client needs it. Can be called from any sequence, but
+  // only before the device is used by its client.
+  bool StartPollThread();
   // Stop polling this V4L2Device if polling was active. No new events will
   // be posted after this method has returned.
   bool StopPolling();
@@ -545,6 +569,9 @@ class V4L2Device : public base::RefCountedThreadSafe<V4L2Device> {
   // Set the specified list of |ctrls| for the specified |ctrl_class|, returns
   // whether the operation succeeded.
   bool SetExtCtrls(uint32_t ctrl_class, std::vector<V4L2ExtCtrl> ctrls);
+  // Get the current value of the V4L2 control with specified |ctrl_id|, or
+  // nullopt if the control couldn't be read.
+  base::Optional<struct v4l2_ext_control> GetCtrl(uint32_t ctrl_id);
 
   // Check whether the V4L2 command with specified |command_id| is supported.
   bool IsCommandSupported(uint32_t command_id);
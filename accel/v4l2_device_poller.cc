@@ -49,7 +49,7 @@ bool V4L2DevicePoller::StartPolling(EventCallback event_callback,
   client_task_runner_ = base::SequencedTaskRunnerHandle::Get();
   error_callback_ = error_callback;
 
-  if (!poll_thread_.Start()) {
+  if (!poll_thread_.IsRunning() && !poll_thread_.Start()) {
     VLOGF(1) << "Failed to start device poll thread";
     return false;
   }
@@ -60,6 +60,7 @@ bool V4L2DevicePoller::StartPolling(EventCallback event_callback,
   poll_thread_.task_runner()->PostTask(
       FROM_HERE, base::BindOnce(&V4L2DevicePoller::DevicePollTask,
                                 base::Unretained(this)));
+  polling_ = true;
 
   DVLOGF(3) << "Polling thread started";
 
@@ -88,6 +89,7 @@ bool V4L2DevicePoller::StopPolling() {
 
   DVLOGF(3) << "Stop device poll thread";
   poll_thread_.Stop();
+  polling_ = false;
 
   if (!device_->ClearDevicePollInterrupt()) {
     VLOGF(1) << "Failed to clear interrupting device poll.";
@@ -99,10 +101,24 @@ bool V4L2DevicePoller::StopPolling() {
   return true;
 }
 
+bool V4L2DevicePoller::StartThread() {
+  // The client sequence isn't bound yet, so it isn't checked here.
+  if (poll_thread_.IsRunning())
+    return true;
+
+  if (!poll_thread_.Start()) {
+    VLOGF(1) << "Failed to start device poll thread";
+    return false;
+  }
+  // The thread is stopped by the client sequence.
+  poll_thread_.DetachFromSequence();
+  return true;
+}
+
 bool V4L2DevicePoller::IsPolling() const {
   DCHECK_CALLED_ON_VALID_SEQUENCE(client_sequence_checker_);
 
-  return poll_thread_.IsRunning();
+  return polling_;
 }
 
 void V4L2DevicePoller::SchedulePoll() {
@@ -50,6 +50,10 @@ class V4L2DevicePoller {
   // caller's sequence.
   bool StartPolling(EventCallback event_callback,
                     base::RepeatingClosure error_callback);
+  // Starts the poll thread ahead of |StartPolling()|, which then only has to
+  // post the poll task to it. Unlike the other methods, this can be called from
+  // any sequence, but only before the poller is used by its client.
+  bool StartThread();
   // Stop polling and stop the thread. The poller won't post any new event to
   // the caller's sequence after this method has returned.
   bool StopPolling();
@@ -88,6 +92,9 @@ class V4L2DevicePoller {
   // Set to true when we wish to stop polling, instructing the poller thread
   // to break its loop.
   std::atomic_bool stop_polling_;
+  // Whether |DevicePollTask()| is running on |poll_thread_|. The thread itself
+  // might have been started earlier by |StartThread()|.
+  bool polling_ = false;
 
   SEQUENCE_CHECKER(client_sequence_checker_);
 };
@@ -42,12 +42,47 @@ media::VideoCodecProfile c2ProfileToVideoCodecProfile(C2Config::profile_t profil
         return media::VideoCodecProfile::H264PROFILE_STEREOHIGH;
     case C2Config::PROFILE_AVC_MULTIVIEW_HIGH:
         return media::VideoCodecProfile::H264PROFILE_MULTIVIEWHIGH;
+    case C2Config::PROFILE_HEVC_MAIN:
+        return media::VideoCodecProfile::HEVCPROFILE_MAIN;
+    case C2Config::PROFILE_HEVC_MAIN_10:
+        return media::VideoCodecProfile::HEVCPROFILE_MAIN10;
+    case C2Config::PROFILE_HEVC_MAIN_STILL:
+        return media::VideoCodecProfile::HEVCPROFILE_MAIN_STILL_PICTURE;
+    case C2Config::PROFILE_VP8_0:
+    case C2Config::PROFILE_VP8_1:
+    case C2Config::PROFILE_VP8_2:
+    case C2Config::PROFILE_VP8_3:
+        return media::VideoCodecProfile::VP8PROFILE_ANY;
+    case C2Config::PROFILE_VP9_0:
+        return media::VideoCodecProfile::VP9PROFILE_PROFILE0;
+    case C2Config::PROFILE_VP9_1:
+        return media::VideoCodecProfile::VP9PROFILE_PROFILE1;
+    case C2Config::PROFILE_VP9_2:
+        return media::VideoCodecProfile::VP9PROFILE_PROFILE2;
+    case C2Config::PROFILE_VP9_3:
+        return media::VideoCodecProfile::VP9PROFILE_PROFILE3;
     default:
         ALOGE("Unrecognizable C2 profile (value = 0x%x)...", profile);
         return media::VideoCodecProfile::VIDEO_CODEC_PROFILE_UNKNOWN;
     }
 }
 
+media::VideoCodec videoCodecProfileToVideoCodec(media::VideoCodecProfile profile) {
+    if (profile >= media::H264PROFILE_MIN && profile <= media::H264PROFILE_MAX) {
+        return media::kCodecH264;
+    }
+    if (profile >= media::HEVCPROFILE_MIN && profile <= media::HEVCPROFILE_MAX) {
+        return media::kCodecHEVC;
+    }
+    if (profile >= media::VP8PROFILE_MIN && profile <= media::VP8PROFILE_MAX) {
+        return media::kCodecVP8;
+    }
+    if (profile >= media::VP9PROFILE_MIN && profile <= media::VP9PROFILE_MAX) {
+        return media::kCodecVP9;
+    }
+    return media::kUnknownVideoCodec;
+}
+
 uint8_t c2LevelToLevelIDC(C2Config::level_t level) {
     switch (level) {
     case C2Config::LEVEL_AVC_1:
@@ -108,9 +143,12 @@ android_ycbcr getGraphicBlockInfo(const C2ConstGraphicBlock& block) {
 }
 
 void extractCSDInfo(std::unique_ptr<C2StreamInitDataInfo::output>* const csd, const uint8_t* data,
-                    size_t length) {
-    constexpr uint8_t kTypeSeqParamSet = 7;
-    constexpr uint8_t kTypePicParamSet = 8;
+                    size_t length, media::VideoCodec codec) {
+    constexpr uint8_t kH264TypeSeqParamSet = 7;
+    constexpr uint8_t kH264TypePicParamSet = 8;
+    constexpr uint8_t kHevcTypeVideoParamSet = 32;
+    constexpr uint8_t kHevcTypeSeqParamSet = 33;
+    constexpr uint8_t kHevcTypePicParamSet = 34;
 
     // Android frameworks needs 4 bytes start code.
     constexpr uint8_t kStartCode[] = {0x00, 0x00, 0x00, 0x01};
@@ -127,9 +165,19 @@ void extractCSDInfo(std::unique_ptr<C2StreamInitDataInfo::output>* const csd, co
     NalParser parser(data, length);
     while (parser.locateNextNal()) {
         if (parser.length() == 0) continue;
-        uint8_t nalType = *parser.data() & 0x1f;
-        ALOGV("find next NAL: type=%d, length=%zu", nalType, parser.length());
-        if (nalType != kTypeSeqParamSet && nalType != kTypePicParamSet) continue;
+        bool isParamSet;
+        if (codec == media::kCodecHEVC) {
+            // The HEVC NAL unit type is stored in bits 1-6 of the 2-byte NAL unit header.
+            uint8_t nalType = (*parser.data() >> 1) & 0x3f;
+            ALOGV("find next NAL: type=%d, length=%zu", nalType, parser.length());
+            isParamSet = nalType == kHevcTypeVideoParamSet || nalType == kHevcTypeSeqParamSet ||
+                         nalType == kHevcTypePicParamSet;
+        } else {
+            uint8_t nalType = *parser.data() & 0x1f;
+            ALOGV("find next NAL: type=%d, length=%zu", nalType, parser.length());
+            isParamSet = nalType == kH264TypeSeqParamSet || nalType == kH264TypePicParamSet;
+        }
+        if (!isParamSet) continue;
 
         if (tmpOutput + kStartCodeLength + parser.length() > tmpConfigDataEnd) {
             ALOGE("Buffer overflow on extracting codec config data (length=%zu)", length);
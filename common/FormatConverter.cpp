@@ -99,7 +99,8 @@ std::unique_ptr<ImplDefinedToRGBXMap> ImplDefinedToRGBXMap::Create(
 std::unique_ptr<FormatConverter> FormatConverter::Create(media::VideoPixelFormat outFormat,
                                                          const media::Size& visibleSize,
                                                          uint32_t inputCount,
-                                                         const media::Size& codedSize) {
+                                                         const media::Size& codedSize,
+                                                         std::shared_ptr<C2BlockPool> pool) {
     if (outFormat != media::VideoPixelFormat::PIXEL_FORMAT_I420 &&
         outFormat != media::VideoPixelFormat::PIXEL_FORMAT_NV12) {
         ALOGE("Unsupported output format: %d", static_cast<int32_t>(outFormat));
@@ -107,7 +108,8 @@ std::unique_ptr<FormatConverter> FormatConverter::Create(media::VideoPixelFormat
     }
 
     std::unique_ptr<FormatConverter> converter(new FormatConverter);
-    if (converter->initialize(outFormat, visibleSize, inputCount, codedSize) != C2_OK) {
+    if (converter->initialize(outFormat, visibleSize, inputCount, codedSize, std::move(pool)) !=
+        C2_OK) {
         ALOGE("Failed to initialize FormatConverter");
         return nullptr;
     }
@@ -116,16 +118,19 @@ std::unique_ptr<FormatConverter> FormatConverter::Create(media::VideoPixelFormat
 
 c2_status_t FormatConverter::initialize(media::VideoPixelFormat outFormat,
                                         const media::Size& visibleSize, uint32_t inputCount,
-                                        const media::Size& codedSize) {
+                                        const media::Size& codedSize,
+                                        std::shared_ptr<C2BlockPool> pool) {
     ALOGV("initialize(out_format=%s, visible_size=%dx%d, input_count=%u, coded_size=%dx%d)",
           media::VideoPixelFormatToString(outFormat).c_str(), visibleSize.width(),
           visibleSize.height(), inputCount, codedSize.width(), codedSize.height());
 
-    std::shared_ptr<C2BlockPool> pool;
-    c2_status_t status = GetCodec2BlockPool(C2BlockPool::BASIC_GRAPHIC, nullptr, &pool);
-    if (status != C2_OK) {
-        ALOGE("Failed to get basic graphic block pool (err=%d)", status);
-        return status;
+    c2_status_t status = C2_OK;
+    if (!pool) {
+        status = GetCodec2BlockPool(C2BlockPool::BASIC_GRAPHIC, nullptr, &pool);
+        if (status != C2_OK) {
+            ALOGE("Failed to get basic graphic block pool (err=%d)", status);
+            return status;
+        }
     }
 
     HalPixelFormat halFormat;
@@ -155,6 +160,7 @@ c2_status_t FormatConverter::initialize(media::VideoPixelFormat outFormat,
 
     mOutFormat = outFormat;
     mVisibleSize = visibleSize;
+    mCodedSize = codedSize;
 
     mTempPlaneU = std::unique_ptr<uint8_t[]>(
             new uint8_t[mVisibleSize.width() * mVisibleSize.height() / 4]);
@@ -317,6 +323,24 @@ C2ConstGraphicBlock FormatConverter::convertBlock(uint64_t frameIndex,
     return outputBlock->share(C2Rect(mVisibleSize.width(), mVisibleSize.height()), C2Fence());
 }
 
+bool FormatConverter::setVisibleSize(const media::Size& visibleSize) {
+    ALOGV("setVisibleSize(visible_size=%dx%d)", visibleSize.width(), visibleSize.height());
+
+    if (visibleSize.width() > mCodedSize.width() || visibleSize.height() > mCodedSize.height()) {
+        return false;
+    }
+
+    // The temporary planes only need to be reallocated if the frames became larger.
+    if (visibleSize.GetArea() > mVisibleSize.GetArea()) {
+        mTempPlaneU = std::unique_ptr<uint8_t[]>(
+                new uint8_t[visibleSize.width() * visibleSize.height() / 4]);
+        mTempPlaneV = std::unique_ptr<uint8_t[]>(
+                new uint8_t[visibleSize.width() * visibleSize.height() / 4]);
+    }
+    mVisibleSize = visibleSize;
+    return true;
+}
+
 c2_status_t FormatConverter::returnBlock(uint64_t frameIndex) {
     ALOGV("returnBlock(frame_index=%" PRIu64 ")", frameIndex);
 
@@ -12,6 +12,7 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
 #include <memory>
 #include <string>
 
@@ -39,45 +40,118 @@ constexpr int convertMap(media::VideoPixelFormat src, media::VideoPixelFormat ds
                    (static_cast<int>(media::VideoPixelFormat::PIXEL_FORMAT_MAX) + 1) +
            static_cast<int>(dst);
 }
+
+// Get the libyuv constants converting YUV to RGB with |matrix| and |range|. With |swapUV|, the
+// constants of the swapped U and V planes are returned, which turns the ARGB kernels into ABGR
+// ones. The unspecified aspects default to the limited range, and to BT.601 for 8-bit or BT.2020
+// for 10-bit content.
+const libyuv::YuvConstants* getYuvConstants(C2Color::matrix_t matrix, C2Color::range_t range,
+                                            bool is10Bit, bool swapUV) {
+    const bool fullRange = (range == C2Color::RANGE_FULL);
+    if (matrix == C2Color::MATRIX_UNSPECIFIED) {
+        matrix = is10Bit ? C2Color::MATRIX_BT2020 : C2Color::MATRIX_BT601;
+    }
+
+    switch (matrix) {
+    case C2Color::MATRIX_BT709:
+        if (fullRange) return swapUV ? &libyuv::kYvuF709Constants : &libyuv::kYuvF709Constants;
+        return swapUV ? &libyuv::kYvuH709Constants : &libyuv::kYuvH709Constants;
+    case C2Color::MATRIX_BT2020:
+    case C2Color::MATRIX_BT2020_CONSTANT:
+        if (fullRange) return swapUV ? &libyuv::kYvuV2020Constants : &libyuv::kYuvV2020Constants;
+        return swapUV ? &libyuv::kYvu2020Constants : &libyuv::kYuv2020Constants;
+    default:
+        if (fullRange) return swapUV ? &libyuv::kYvuJPEGConstants : &libyuv::kYuvJPEGConstants;
+        return swapUV ? &libyuv::kYvuI601Constants : &libyuv::kYuvI601Constants;
+    }
+}
 }  // namespace
 
 // static
 std::unique_ptr<OutputFormatConverter> OutputFormatConverter::Create(
         media::VideoPixelFormat inFormat, const media::Size& visibleSize, uint32_t inputCount,
-        const media::Size& codedSize) {
+        const media::Size& codedSize, std::shared_ptr<C2BlockPool> pool) {
 #ifndef RGBA_TO_RGBA_WA
-    if (inFormat != media::VideoPixelFormat::PIXEL_FORMAT_NV12) {
+    if (inFormat != media::VideoPixelFormat::PIXEL_FORMAT_NV12 &&
+        inFormat != media::VideoPixelFormat::PIXEL_FORMAT_P016LE) {
         ALOGE("Unsupported output format: %d", static_cast<int32_t>(inFormat));
         return nullptr;
     }
 #endif
     std::unique_ptr<OutputFormatConverter> converter(new OutputFormatConverter);
-    if (converter->initialize(inFormat, visibleSize, inputCount, codedSize) != C2_OK) {
+    if (converter->initialize(inFormat, visibleSize, inputCount, codedSize, std::move(pool)) !=
+        C2_OK) {
         ALOGE("Failed to initialize OutputFormatConverter");
         return nullptr;
     }
     return converter;
 }
 
+// static
+std::unique_ptr<OutputFormatConverter> OutputFormatConverter::CreateScaler(
+        HalPixelFormat pixelFormat, const media::Size& codedSize, const media::Size& scaledSize,
+        uint32_t inputCount, std::shared_ptr<C2BlockPool> pool) {
+    media::VideoPixelFormat format;
+    switch (pixelFormat) {
+    case HalPixelFormat::YCBCR_420_888:
+        format = media::VideoPixelFormat::PIXEL_FORMAT_NV12;
+        break;
+    case HalPixelFormat::RGBA_8888:
+        format = media::VideoPixelFormat::PIXEL_FORMAT_ABGR;
+        break;
+    case HalPixelFormat::BGRA_8888:
+        format = media::VideoPixelFormat::PIXEL_FORMAT_ARGB;
+        break;
+    default:
+        ALOGE("Unsupported scaling format: %s", HalPixelFormatToString(pixelFormat));
+        return nullptr;
+    }
+
+    std::unique_ptr<OutputFormatConverter> converter(new OutputFormatConverter);
+    if (converter->initialize(format, scaledSize, inputCount, codedSize, std::move(pool)) !=
+        C2_OK) {
+        ALOGE("Failed to initialize scaling OutputFormatConverter");
+        return nullptr;
+    }
+    converter->mOutFormat = format;
+    converter->mScaledFormat = pixelFormat;
+
+    if (format == media::VideoPixelFormat::PIXEL_FORMAT_NV12) {
+        const size_t srcUVSize = static_cast<size_t>((codedSize.width() + 1) / 2) *
+                                 ((codedSize.height() + 1) / 2);
+        const size_t dstUVSize = static_cast<size_t>((scaledSize.width() + 1) / 2) *
+                                 ((scaledSize.height() + 1) / 2);
+        converter->mTempPlaneU = std::make_unique<uint8_t[]>(srcUVSize);
+        converter->mTempPlaneV = std::make_unique<uint8_t[]>(srcUVSize);
+        converter->mScaledPlaneU = std::make_unique<uint8_t[]>(dstUVSize);
+        converter->mScaledPlaneV = std::make_unique<uint8_t[]>(dstUVSize);
+    }
+    return converter;
+}
+
 OutputFormatConverter::~OutputFormatConverter() {
     ALOGV("%s", __func__);
 }
 
 c2_status_t OutputFormatConverter::initialize(media::VideoPixelFormat inFormat,
                                               const media::Size& visibleSize, uint32_t inputCount,
-                                              const media::Size& codedSize) {
+                                              const media::Size& codedSize,
+                                              std::shared_ptr<C2BlockPool> pool) {
     ALOGV("initialize(out_format=%s, visible_size=%dx%d, input_count=%u, coded_size=%dx%d)",
           media::VideoPixelFormatToString(inFormat).c_str(), visibleSize.width(),
           visibleSize.height(), inputCount, codedSize.width(), codedSize.height());
 
     mInFormat = inFormat;
 
-    std::shared_ptr<C2BlockPool> pool;
-    c2_status_t status = GetCodec2BlockPool(C2BlockPool::BASIC_GRAPHIC, nullptr, &pool);
-    if (status != C2_OK) {
-        ALOGE("Failed to get basic graphic block pool (err=%d)", status);
-        return status;
+    c2_status_t status = C2_OK;
+    if (!pool) {
+        status = GetCodec2BlockPool(C2BlockPool::BASIC_GRAPHIC, nullptr, &pool);
+        if (status != C2_OK) {
+            ALOGE("Failed to get basic graphic block pool (err=%d)", status);
+            return status;
+        }
     }
+    mBlockPool = pool;
 
     HalPixelFormat halFormat;
     media::VideoPixelFormat outFormat = media::VideoPixelFormat::PIXEL_FORMAT_ABGR;
@@ -89,6 +163,10 @@ c2_status_t OutputFormatConverter::initialize(media::VideoPixelFormat inFormat,
         halFormat = HalPixelFormat::RGBA_8888;
     } else if (mInFormat == media::VideoPixelFormat::PIXEL_FORMAT_ARGB) {
         halFormat = HalPixelFormat::BGRA_8888;
+    } else if (mInFormat == media::VideoPixelFormat::PIXEL_FORMAT_P016LE) {
+        // 10-bit frames are converted to RGBA_1010102 to keep their depth.
+        halFormat = HalPixelFormat::YCBCR_P010;
+        outFormat = media::VideoPixelFormat::PIXEL_FORMAT_XB30;
     } else {
         halFormat = HalPixelFormat::YCBCR_420_888;  // will allocate NV12 by minigbm.
     }
@@ -157,15 +235,18 @@ std::optional<uint32_t> OutputFormatConverter::getBufferIdFromGraphicBlock(const
 //#define DUMP_SURFACE
 std::shared_ptr<C2GraphicBlock> OutputFormatConverter::convertBlock(
         std::shared_ptr<C2GraphicBlock> inputBlock, c2_status_t* status) {
-    std::shared_ptr<C2BlockPool> pool;
-    GetCodec2BlockPool(C2BlockPool::BASIC_GRAPHIC, nullptr, &pool);
+    const std::shared_ptr<C2BlockPool>& pool = mBlockPool;
 
     std::shared_ptr<C2GraphicBlock> outputBlock;
-    ALOGV("%s, allocate RGBA8888 of wxh=%dx%d", __func__, mVisibleSize.width(),
-          mVisibleSize.height());
+    const HalPixelFormat outputHalFormat =
+            (mOutFormat == media::VideoPixelFormat::PIXEL_FORMAT_XB30)
+                    ? HalPixelFormat::RGBA_1010102
+                    : HalPixelFormat::RGBA_8888;
+    ALOGV("%s, allocate %s of wxh=%dx%d", __func__, HalPixelFormatToString(outputHalFormat),
+          mVisibleSize.width(), mVisibleSize.height());
 #if 1
     *status = pool->fetchGraphicBlock(mVisibleSize.width(), mVisibleSize.height(),
-                                      static_cast<uint32_t>(HalPixelFormat::RGBA_8888),
+                                      static_cast<uint32_t>(outputHalFormat),
                                       {C2MemoryUsage::CPU_READ, C2MemoryUsage::CPU_WRITE},
                                       &outputBlock);
 #else
@@ -196,6 +277,9 @@ std::shared_ptr<C2GraphicBlock> OutputFormatConverter::convertBlock(
         const int srcStrideU = inputLayout.planes[C2PlanarLayout::PLANE_U].rowInc;
         if (inputLayout.rootPlanes == 3) {
             inputFormat = media::VideoPixelFormat::PIXEL_FORMAT_YV12;
+        } else if (inputLayout.rootPlanes == 2 &&
+                   inputLayout.planes[C2PlanarLayout::PLANE_Y].allocatedDepth == 16) {
+            inputFormat = media::VideoPixelFormat::PIXEL_FORMAT_P016LE;
         } else if (inputLayout.rootPlanes == 2) {
             inputFormat = (srcV > srcU) ? media::VideoPixelFormat::PIXEL_FORMAT_NV12
                                         : media::VideoPixelFormat::PIXEL_FORMAT_NV21;
@@ -204,7 +288,7 @@ std::shared_ptr<C2GraphicBlock> OutputFormatConverter::convertBlock(
 
         switch (convertMap(inputFormat, mOutFormat)) {
         case convertMap(media::VideoPixelFormat::PIXEL_FORMAT_NV12,
-                        media::VideoPixelFormat::PIXEL_FORMAT_ABGR):
+                        media::VideoPixelFormat::PIXEL_FORMAT_ABGR): {
             ALOGV("%s, convert NV12 to RGBA", __func__);
             uint8_t* dstRGB = outputView.data()[C2PlanarLayout::PLANE_R];
             const int dstStrideRGB = outputLayout.planes[C2PlanarLayout::PLANE_R].rowInc;
@@ -212,8 +296,10 @@ std::shared_ptr<C2GraphicBlock> OutputFormatConverter::convertBlock(
                   "wxh:%dx%d ",
                   srcY, srcStrideY, srcU, srcStrideU, dstRGB, dstStrideRGB, mVisibleSize.width(),
                   mVisibleSize.height());
-            libyuv::NV12ToABGR(srcY, srcStrideY, srcU, srcStrideU, dstRGB, dstStrideRGB,
-                               mVisibleSize.width(), mVisibleSize.height());
+            // libyuv converts NV12 to ABGR as NV21 to ARGB with the swapped constants.
+            libyuv::NV21ToARGBMatrix(srcY, srcStrideY, srcU, srcStrideU, dstRGB, dstStrideRGB,
+                                     getYuvConstants(mColorMatrix, mColorRange, false, true),
+                                     mVisibleSize.width(), mVisibleSize.height());
 #ifdef DUMP_SURFACE
             static FILE* m_f;
             static int count = 0;
@@ -234,15 +320,32 @@ std::shared_ptr<C2GraphicBlock> OutputFormatConverter::convertBlock(
             }
 #endif
             break;
-#if 0
-        //compiler said it cannot jump to this default, I don't know why
+        }
+        case convertMap(media::VideoPixelFormat::PIXEL_FORMAT_P016LE,
+                        media::VideoPixelFormat::PIXEL_FORMAT_XB30): {
+            ALOGV("%s, convert P010 to RGBA_1010102", __func__);
+            // The strides of 16-bit planes are counted in samples by libyuv.
+            uint8_t* dstRGB = std::min({outputView.data()[C2PlanarLayout::PLANE_R],
+                                        outputView.data()[C2PlanarLayout::PLANE_G],
+                                        outputView.data()[C2PlanarLayout::PLANE_B]});
+            const int dstStrideRGB = outputLayout.planes[C2PlanarLayout::PLANE_R].rowInc;
+            libyuv::P010ToAR30Matrix(reinterpret_cast<const uint16_t*>(srcY), srcStrideY / 2,
+                                     reinterpret_cast<const uint16_t*>(srcU), srcStrideU / 2,
+                                     dstRGB, dstStrideRGB,
+                                     getYuvConstants(mColorMatrix, mColorRange, true, false),
+                                     mVisibleSize.width(), mVisibleSize.height());
+            // libyuv only outputs AR30, i.e. B in the lowest bits, while Android's RGBA_1010102
+            // has R in the lowest bits. Both are vectorized, and the swap is done in place.
+            libyuv::AR30ToAB30(dstRGB, dstStrideRGB, dstRGB, dstStrideRGB, mVisibleSize.width(),
+                               mVisibleSize.height());
+            break;
+        }
         default:
             ALOGE("Unsupported pixel format conversion from %s to %s",
                   media::VideoPixelFormatToString(inputFormat).c_str(),
                   media::VideoPixelFormatToString(mOutFormat).c_str());
             *status = C2_CORRUPTED;
-            return NULL;//inputBlock;  // This is actually redundant and should not be used.
-#endif
+            return NULL;  //inputBlock;  // This is actually redundant and should not be used.
         }
     } else if (inputLayout.type == C2PlanarLayout::TYPE_RGB) {
         // There is only RGBA_8888 specified in C2AllocationGralloc::map(), no BGRA_8888. Maybe
@@ -250,15 +353,19 @@ std::shared_ptr<C2GraphicBlock> OutputFormatConverter::convertBlock(
         inputFormat = media::VideoPixelFormat::PIXEL_FORMAT_ABGR;
 
         const uint8_t* srcRGB = inputView.data()[C2PlanarLayout::PLANE_R];
-        //const int srcStrideRGB = inputLayout.planes[C2PlanarLayout::PLANE_R].rowInc;
+        const int srcStrideRGB = inputLayout.planes[C2PlanarLayout::PLANE_R].rowInc;
 
         uint8_t* dstRGB = outputView.data()[C2PlanarLayout::PLANE_R];
+        const int dstStrideRGB = outputLayout.planes[C2PlanarLayout::PLANE_R].rowInc;
 
         switch (convertMap(inputFormat, mOutFormat)) {
         case convertMap(media::VideoPixelFormat::PIXEL_FORMAT_ABGR,
                         media::VideoPixelFormat::PIXEL_FORMAT_ABGR):
+            // Not used by VideoFramePool, which decodes the RGBA frames straight into the output
+            // blocks instead.
             ALOGV("%s, copy RGBA to RGBA\n", __func__);
-            memcpy(dstRGB, srcRGB, 4 * mVisibleSize.width() * mVisibleSize.height());
+            libyuv::ARGBCopy(srcRGB, srcStrideRGB, dstRGB, dstStrideRGB, mVisibleSize.width(),
+                             mVisibleSize.height());
             break;
         default:
             ALOGE("Unsupported pixel format conversion from %s to %s",
@@ -281,6 +388,108 @@ std::shared_ptr<C2GraphicBlock> OutputFormatConverter::convertBlock(
     //return outputBlock->share(C2Rect(mVisibleSize.width(), mVisibleSize.height()), C2Fence());
 }
 
+std::shared_ptr<C2GraphicBlock> OutputFormatConverter::scaleBlock(
+        std::shared_ptr<C2GraphicBlock> inputBlock, const media::Rect& srcRect,
+        c2_status_t* status) {
+    ATRACE_CALL();
+    ALOG_ASSERT(mScaledFormat != HalPixelFormat::UNKNOWN);
+
+    std::shared_ptr<C2GraphicBlock> outputBlock;
+    *status = mBlockPool->fetchGraphicBlock(mVisibleSize.width(), mVisibleSize.height(),
+                                            static_cast<uint32_t>(mScaledFormat),
+                                            {C2MemoryUsage::CPU_READ, C2MemoryUsage::CPU_WRITE},
+                                            &outputBlock);
+    if (*status != C2_OK) {
+        ALOGE("Failed to fetch graphic block (err=%d)", *status);
+        return nullptr;
+    }
+
+    {
+        const C2GraphicView& inputView = inputBlock->map().get();
+        C2GraphicView outputView = outputBlock->map().get();
+        if (inputView.error() != C2_OK || outputView.error() != C2_OK) {
+            ALOGE("Failed to map the blocks (err=%d, %d)", inputView.error(), outputView.error());
+            *status = C2_CORRUPTED;
+            return nullptr;
+        }
+        const C2PlanarLayout& inputLayout = inputView.layout();
+        const C2PlanarLayout& outputLayout = outputView.layout();
+        if (inputLayout.type != outputLayout.type) {
+            ALOGE("Mismatched layout types: %d, %d", inputLayout.type, outputLayout.type);
+            *status = C2_CORRUPTED;
+            return nullptr;
+        }
+
+        const int srcX = srcRect.x() & ~1;
+        const int srcY = srcRect.y() & ~1;
+        if (inputLayout.type == C2PlanarLayout::TYPE_YUV && inputLayout.rootPlanes == 2 &&
+            outputLayout.rootPlanes == 2) {
+            const int srcStrideY = inputLayout.planes[C2PlanarLayout::PLANE_Y].rowInc;
+            const int srcStrideUV = inputLayout.planes[C2PlanarLayout::PLANE_U].rowInc;
+            const uint8_t* srcPlaneY =
+                    inputView.data()[C2PlanarLayout::PLANE_Y] + srcY * srcStrideY + srcX;
+            const uint8_t* srcPlaneUV =
+                    inputView.data()[C2PlanarLayout::PLANE_U] + srcY / 2 * srcStrideUV + srcX;
+            uint8_t* dstPlaneY = outputView.data()[C2PlanarLayout::PLANE_Y];
+            uint8_t* dstPlaneUV = outputView.data()[C2PlanarLayout::PLANE_U];
+            const int dstStrideY = outputLayout.planes[C2PlanarLayout::PLANE_Y].rowInc;
+            const int dstStrideUV = outputLayout.planes[C2PlanarLayout::PLANE_U].rowInc;
+
+            const int srcUVWidth = (srcRect.width() + 1) / 2;
+            const int srcUVHeight = (srcRect.height() + 1) / 2;
+            const int dstUVWidth = (mVisibleSize.width() + 1) / 2;
+            const int dstUVHeight = (mVisibleSize.height() + 1) / 2;
+
+            // libyuv has no NV12 scaler in all versions, so the interleaved U/V plane is split,
+            // scaled plane by plane and merged back.
+            libyuv::ScalePlane(srcPlaneY, srcStrideY, srcRect.width(), srcRect.height(),
+                               dstPlaneY, dstStrideY, mVisibleSize.width(),
+                               mVisibleSize.height(), libyuv::kFilterBox);
+            libyuv::SplitUVPlane(srcPlaneUV, srcStrideUV, mTempPlaneU.get(), srcUVWidth,
+                                 mTempPlaneV.get(), srcUVWidth, srcUVWidth, srcUVHeight);
+            libyuv::ScalePlane(mTempPlaneU.get(), srcUVWidth, srcUVWidth, srcUVHeight,
+                               mScaledPlaneU.get(), dstUVWidth, dstUVWidth, dstUVHeight,
+                               libyuv::kFilterBox);
+            libyuv::ScalePlane(mTempPlaneV.get(), srcUVWidth, srcUVWidth, srcUVHeight,
+                               mScaledPlaneV.get(), dstUVWidth, dstUVWidth, dstUVHeight,
+                               libyuv::kFilterBox);
+            libyuv::MergeUVPlane(mScaledPlaneU.get(), dstUVWidth, mScaledPlaneV.get(), dstUVWidth,
+                                 dstPlaneUV, dstStrideUV, dstUVWidth, dstUVHeight);
+        } else if (inputLayout.type == C2PlanarLayout::TYPE_RGB ||
+                   inputLayout.type == C2PlanarLayout::TYPE_RGBA) {
+            // The channel order doesn't matter to the scaler, only the start of the pixels does.
+            const uint8_t* srcPixels = std::min({inputView.data()[C2PlanarLayout::PLANE_R],
+                                                 inputView.data()[C2PlanarLayout::PLANE_G],
+                                                 inputView.data()[C2PlanarLayout::PLANE_B]});
+            uint8_t* dstPixels = std::min({outputView.data()[C2PlanarLayout::PLANE_R],
+                                           outputView.data()[C2PlanarLayout::PLANE_G],
+                                           outputView.data()[C2PlanarLayout::PLANE_B]});
+            const int srcStride = inputLayout.planes[C2PlanarLayout::PLANE_R].rowInc;
+            const int dstStride = outputLayout.planes[C2PlanarLayout::PLANE_R].rowInc;
+            libyuv::ARGBScale(srcPixels + srcY * srcStride + srcX * 4, srcStride,
+                              srcRect.width(), srcRect.height(), dstPixels, dstStride,
+                              mVisibleSize.width(), mVisibleSize.height(), libyuv::kFilterBox);
+        } else {
+            ALOGE("Unsupported layout for scaling: type=%d, rootPlanes=%u", inputLayout.type,
+                  inputLayout.rootPlanes);
+            *status = C2_CORRUPTED;
+            return nullptr;
+        }
+    }
+
+    ALOGV("scaleBlock(frame=%p, %s -> %s)", inputBlock.get(), srcRect.ToString().c_str(),
+          mVisibleSize.ToString().c_str());
+    returnBlock(inputBlock);
+    *status = C2_OK;
+    return outputBlock;
+}
+
+void OutputFormatConverter::setColorAspects(C2Color::range_t range, C2Color::matrix_t matrix) {
+    ALOGV("%s(range=%d, matrix=%d)", __func__, range, matrix);
+    mColorRange = range;
+    mColorMatrix = matrix;
+}
+
 c2_status_t OutputFormatConverter::returnBlock(std::shared_ptr<C2GraphicBlock> block) {
     ALOGV("returnBlock(%p)", block.get());
 
@@ -0,0 +1,79 @@
+// Copyright 2020 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// #define LOG_NDEBUG 0
+#define LOG_TAG "TiledFormats"
+
+#include <v4l2_codec2/common/TiledFormats.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <log/log.h>
+
+#include <v4l2_device.h>
+#include <video_pixel_format.h>
+
+#ifndef V4L2_PIX_FMT_P010
+#define V4L2_PIX_FMT_P010 v4l2_fourcc('P', '0', '1', '0')
+#endif
+#ifndef V4L2_PIX_FMT_NV12_32L32
+#define V4L2_PIX_FMT_NV12_32L32 v4l2_fourcc('S', 'T', '1', '2')
+#endif
+#ifndef V4L2_PIX_FMT_QC08C
+#define V4L2_PIX_FMT_QC08C v4l2_fourcc('Q', '0', '8', 'C')
+#endif
+#ifndef V4L2_PIX_FMT_QC10C
+#define V4L2_PIX_FMT_QC10C v4l2_fourcc('Q', '1', '0', 'C')
+#endif
+
+namespace android {
+namespace {
+
+constexpr uint64_t kQcomCompressedModifier = (0x05ULL << 56) | 1;  // DRM_FORMAT_MOD_QCOM_COMPRESSED
+constexpr uint64_t kAllwinnerTiledModifier = (0x09ULL << 56) | 1;  // DRM_FORMAT_MOD_ALLWINNER_TILED
+
+// GRALLOC_USAGE_PRIVATE_ALLOC_UBWC of the Qualcomm gralloc.
+constexpr uint64_t kQcomCompressedUsage = 1ULL << 28;
+
+constexpr TiledFormat kTiledFormats[] = {
+        {V4L2_PIX_FMT_QC08C, V4L2_PIX_FMT_NV12, kQcomCompressedModifier, kQcomCompressedUsage},
+        {V4L2_PIX_FMT_QC10C, V4L2_PIX_FMT_P010, kQcomCompressedModifier, kQcomCompressedUsage},
+        {V4L2_PIX_FMT_NV12_32L32, V4L2_PIX_FMT_NV12, kAllwinnerTiledModifier, 0},
+};
+
+}  // namespace
+
+const TiledFormat* findTiledFormat(uint32_t v4l2PixFmt) {
+    for (const TiledFormat& tiledFormat : kTiledFormats) {
+        if (tiledFormat.v4l2PixFmt == v4l2PixFmt) return &tiledFormat;
+    }
+    return nullptr;
+}
+
+const TiledFormat* setTiledFormat(media::V4L2Device* device, const struct v4l2_format& format) {
+    ALOGV("%s()", __func__);
+
+    const std::vector<uint32_t> pixelFormats =
+            device->EnumerateSupportedPixelformats(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+    for (const TiledFormat& tiledFormat : kTiledFormats) {
+        if (tiledFormat.linearV4L2PixFmt != format.fmt.pix_mp.pixelformat ||
+            std::find(pixelFormats.begin(), pixelFormats.end(), tiledFormat.v4l2PixFmt) ==
+                    pixelFormats.end()) {
+            continue;
+        }
+
+        struct v4l2_format tiledV4L2Format = format;
+        tiledV4L2Format.fmt.pix_mp.pixelformat = tiledFormat.v4l2PixFmt;
+        if (device->Ioctl(VIDIOC_S_FMT, &tiledV4L2Format) == 0 &&
+            tiledV4L2Format.fmt.pix_mp.pixelformat == tiledFormat.v4l2PixFmt) {
+            return &tiledFormat;
+        }
+        ALOGW("Failed to set the output format to %s",
+              media::FourccToString(tiledFormat.v4l2PixFmt).c_str());
+    }
+    return nullptr;
+}
+
+}  // namespace android
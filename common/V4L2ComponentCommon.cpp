@@ -14,6 +14,9 @@
 namespace android {
 
 const std::string V4L2ComponentName::kH264Encoder = "c2.v4l2.avc.encoder";
+const std::string V4L2ComponentName::kH265Encoder = "c2.v4l2.hevc.encoder";
+const std::string V4L2ComponentName::kVP8Encoder = "c2.v4l2.vp8.encoder";
+const std::string V4L2ComponentName::kVP9Encoder = "c2.v4l2.vp9.encoder";
 
 const std::string V4L2ComponentName::kH264Decoder = "c2.v4l2.avc.decoder";
 const std::string V4L2ComponentName::kH265Decoder = "c2.v4l2.hevc.decoder";
@@ -26,7 +29,8 @@ const std::string V4L2ComponentName::kVP9Decoder = "c2.v4l2.vp9.decoder";
 
 // static
 bool V4L2ComponentName::isValid(const char* name) {
-    return name == kH264Encoder || name == kH264Decoder || name == kVP8Decoder ||
+    return name == kH264Encoder || name == kH265Encoder || name == kVP8Encoder ||
+           name == kVP9Encoder || name == kH264Decoder || name == kVP8Decoder ||
            name == kVP9Decoder || name == kH265Decoder;
 }
 
@@ -34,7 +38,8 @@ bool V4L2ComponentName::isValid(const char* name) {
 bool V4L2ComponentName::isEncoder(const char* name) {
     ALOG_ASSERT(isValid(name));
 
-    return name == kH264Encoder;
+    return name == kH264Encoder || name == kH265Encoder || name == kVP8Encoder ||
+           name == kVP9Encoder;
 }
 
 }  // namespace android
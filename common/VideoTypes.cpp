@@ -7,6 +7,8 @@
 
 #include <v4l2_codec2/common/VideoTypes.h>
 
+#include <linux/videodev2.h>
+
 #include <log/log.h>
 
 namespace android {
@@ -24,6 +26,19 @@ const char* VideoCodecToString(VideoCodec codec) {
     }
 }
 
+uint32_t VideoCodecToV4L2PixFmt(VideoCodec codec) {
+    switch (codec) {
+    case VideoCodec::H264:
+        return V4L2_PIX_FMT_H264;
+    case VideoCodec::VP8:
+        return V4L2_PIX_FMT_VP8;
+    case VideoCodec::VP9:
+        return V4L2_PIX_FMT_VP9;
+    case VideoCodec::H265:
+        return V4L2_PIX_FMT_HEVC;
+    }
+}
+
 const char* HalPixelFormatToString(HalPixelFormat format) {
     switch (format) {
     case HalPixelFormat::UNKNOWN:
@@ -36,10 +51,14 @@ const char* HalPixelFormatToString(HalPixelFormat format) {
         return "RGBA_8888";
     case HalPixelFormat::RGB_888:
         return "RGB_888";
+    case HalPixelFormat::RGBA_1010102:
+        return "RGBA_1010102";
     case HalPixelFormat::YV12:
         return "YV12";
     case HalPixelFormat::NV12:
         return "NV12";
+    case HalPixelFormat::YCBCR_P010:
+        return "YCBCR_P010";
     }
 }
 
@@ -41,19 +41,22 @@ struct VideoEncoderAcceleratorConfig {
 // Convert the specified C2Config profile to a media::VideoCodecProfile.
 media::VideoCodecProfile c2ProfileToVideoCodecProfile(C2Config::profile_t profile);
 
+// Get the codec of the specified |profile|, kUnknownVideoCodec if the codec is not supported.
+media::VideoCodec videoCodecProfileToVideoCodec(media::VideoCodecProfile profile);
+
 // Convert the specified C2Config level to an integer value.
 uint8_t c2LevelToLevelIDC(C2Config::level_t level);
 
 // Get the specified graphics block in YCbCr format.
 android_ycbcr getGraphicBlockInfo(const C2ConstGraphicBlock& block);
 
-// When encoding a video the codec-specific data (CSD; e.g. SPS and PPS for H264 encoding) will be
-// concatenated to the first encoded slice. This function extracts the CSD out of the bitstream and
-// stores it into |csd|.
+// When encoding a video the codec-specific data (CSD; e.g. SPS and PPS for H264 encoding, or VPS,
+// SPS and PPS for HEVC encoding) will be concatenated to the first encoded slice. This function
+// extracts the CSD of the H264 or HEVC bitstream of the specified |codec| and stores it into |csd|.
 void extractCSDInfo(std::unique_ptr<C2StreamInitDataInfo::output>* const csd, const uint8_t* data,
-                    size_t length);
+                    size_t length, media::VideoCodec codec);
 
-// Helper class to parse H264 NAL units from data.
+// Helper class to parse H264 and HEVC NAL units from data.
 class NalParser {
 public:
     NalParser(const uint8_t* data, size_t length);
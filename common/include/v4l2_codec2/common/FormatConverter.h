@@ -49,11 +49,11 @@ public:
     FormatConverter& operator=(const FormatConverter&) = delete;
 
     // Create FormatConverter instance and initialize it, nullptr will be returned on
-    // initialization error.
-    static std::unique_ptr<FormatConverter> Create(media::VideoPixelFormat outFormat,
-                                                        const media::Size& visibleSize,
-                                                        uint32_t inputCount,
-                                                        const media::Size& codedSize);
+    // initialization error. The graphic blocks are fetched from |pool|, or from the basic graphic
+    // block pool if null.
+    static std::unique_ptr<FormatConverter> Create(
+            media::VideoPixelFormat outFormat, const media::Size& visibleSize, uint32_t inputCount,
+            const media::Size& codedSize, std::shared_ptr<C2BlockPool> pool = nullptr);
 
     // Convert the input block into the alternative block with required pixel format and return it,
     // or return the original block if zero-copy is applied.
@@ -63,6 +63,11 @@ public:
     c2_status_t returnBlock(uint64_t frameIndex);
     // Check if there is available block for conversion.
     bool isReady() const { return !mAvailableQueue.empty(); }
+    // Convert the following blocks to |visibleSize|, keeping the allocated graphic blocks. Return
+    // false if |visibleSize| doesn't fit in the blocks, the converter should be recreated then.
+    bool setVisibleSize(const media::Size& visibleSize);
+    // The size the graphic blocks are allocated with.
+    const media::Size& codedSize() const { return mCodedSize; }
 
 private:
     // The minimal number requirement of allocated buffers for conversion. This value is the same as
@@ -94,7 +99,8 @@ private:
     // Initialize foramt converter. It will pre-allocate a set of graphic blocks as |codedSize| and
     // |outFormat|. This function should be called prior to other functions.
     c2_status_t initialize(media::VideoPixelFormat outFormat, const media::Size& visibleSize,
-                           uint32_t inputCount, const media::Size& codedSize);
+                           uint32_t inputCount, const media::Size& codedSize,
+                           std::shared_ptr<C2BlockPool> pool);
 
     // The array of block entries.
     std::vector<std::unique_ptr<BlockEntry>> mGraphicBlocks;
@@ -108,6 +114,7 @@ private:
 
     media::VideoPixelFormat mOutFormat = media::VideoPixelFormat::PIXEL_FORMAT_UNKNOWN;
     media::Size mVisibleSize;
+    media::Size mCodedSize;
 };
 
 }  // namespace android
@@ -11,10 +11,14 @@
 #include <vector>
 
 #include <C2Buffer.h>
+#include <C2Config.h>
+#include <rect.h>
 #include <size.h>
 #include <utils/StrongPointer.h>
 #include <video_pixel_format.h>
 
+#include <v4l2_codec2/common/VideoTypes.h>
+
 namespace android {
 
 class GraphicBuffer;
@@ -28,16 +32,31 @@ public:
     OutputFormatConverter& operator=(const OutputFormatConverter&) = delete;
 
     // Create OutputFormatConverter instance and initialize it, nullptr will be returned on
-    // initialization error.
-    static std::unique_ptr<OutputFormatConverter> Create(media::VideoPixelFormat outFormat,
-                                                         const media::Size& visibleSize,
-                                                         uint32_t inputCount,
-                                                         const media::Size& codedSize);
+    // initialization error. The graphic blocks are fetched from |pool|, or from the basic graphic
+    // block pool if null. NV12 frames are converted to RGBA_8888, P010 (PIXEL_FORMAT_P016LE)
+    // frames to RGBA_1010102.
+    static std::unique_ptr<OutputFormatConverter> Create(
+            media::VideoPixelFormat outFormat, const media::Size& visibleSize, uint32_t inputCount,
+            const media::Size& codedSize, std::shared_ptr<C2BlockPool> pool = nullptr);
+    // Create an OutputFormatConverter scaling the blocks of |codedSize| down to |scaledSize| in
+    // scaleBlock(), keeping |pixelFormat|. Only NV12 (YCBCR_420_888) and 32-bit RGB formats are
+    // supported.
+    static std::unique_ptr<OutputFormatConverter> CreateScaler(
+            HalPixelFormat pixelFormat, const media::Size& codedSize, const media::Size& scaledSize,
+            uint32_t inputCount, std::shared_ptr<C2BlockPool> pool = nullptr);
 
     // Convert the input block into the alternative block with required pixel format and return it,
     // or return the original block if zero-copy is applied.
     std::shared_ptr<C2GraphicBlock> convertBlock(std::shared_ptr<C2GraphicBlock> inputBlock,
                                                  c2_status_t* status /* non-null */);
+    // Scale the |srcRect| area of the input block down into a new block of the scaled size, and
+    // return the input block to the available queue. Only used if created by CreateScaler().
+    std::shared_ptr<C2GraphicBlock> scaleBlock(std::shared_ptr<C2GraphicBlock> inputBlock,
+                                               const media::Rect& srcRect,
+                                               c2_status_t* status /* non-null */);
+    // Set the color aspects of the YUV blocks, selecting the matrix and the range of their
+    // conversion to RGB in convertBlock().
+    void setColorAspects(C2Color::range_t range, C2Color::matrix_t matrix);
     // Return the block ownership when VEA no longer needs it, or erase the zero-copy BlockEntry.
     c2_status_t returnBlock(std::shared_ptr<C2GraphicBlock> block);
     // Check if there is available block for conversion.
@@ -78,8 +97,11 @@ private:
     // Initialize foramt converter. It will pre-allocate a set of graphic blocks as |codedSize| and
     // |outFormat|. This function should be called prior to other functions.
     c2_status_t initialize(media::VideoPixelFormat outFormat, const media::Size& visibleSize,
-                           uint32_t inputCount, const media::Size& codedSize);
+                           uint32_t inputCount, const media::Size& codedSize,
+                           std::shared_ptr<C2BlockPool> pool);
 
+    // The pool the graphic blocks are fetched from.
+    std::shared_ptr<C2BlockPool> mBlockPool;
     // The array of block entries.
     std::vector<std::unique_ptr<BlockEntry>> mGraphicBlocks;
     // The queue of recording the raw pointers of available graphic blocks. The consumed block will
@@ -89,9 +111,19 @@ private:
     // allocated on initialize().
     std::unique_ptr<uint8_t[]> mTempPlaneU;
     std::unique_ptr<uint8_t[]> mTempPlaneV;
+    // The temporary U/V plane memory allocation of the scaled blocks for NV12 scaling. The source
+    // U/V planes are split to |mTempPlaneU| and |mTempPlaneV|, which are then sized for
+    // |codedSize|. Allocated on CreateScaler().
+    std::unique_ptr<uint8_t[]> mScaledPlaneU;
+    std::unique_ptr<uint8_t[]> mScaledPlaneV;
+    // The pixel format of the input and scaled blocks if created by CreateScaler().
+    HalPixelFormat mScaledFormat = HalPixelFormat::UNKNOWN;
 
     media::VideoPixelFormat mOutFormat = media::VideoPixelFormat::PIXEL_FORMAT_UNKNOWN;
     media::VideoPixelFormat mInFormat = media::VideoPixelFormat::PIXEL_FORMAT_UNKNOWN;
+    // The color aspects of the YUV blocks, see setColorAspects().
+    C2Color::range_t mColorRange = C2Color::RANGE_UNSPECIFIED;
+    C2Color::matrix_t mColorMatrix = C2Color::MATRIX_UNSPECIFIED;
     media::Size mVisibleSize;
 };
 
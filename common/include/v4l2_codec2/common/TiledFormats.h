@@ -0,0 +1,43 @@
+// Copyright 2020 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ANDROID_V4L2_CODEC2_COMMON_TILED_FORMATS_H
+#define ANDROID_V4L2_CODEC2_COMMON_TILED_FORMATS_H
+
+#include <stdint.h>
+
+#include <linux/videodev2.h>
+
+namespace media {
+class V4L2Device;
+}  // namespace media
+
+namespace android {
+
+// The DRM format modifier of the linear layout, see drm_fourcc.h.
+constexpr uint64_t kLinearModifier = 0;
+
+// A tiled or compressed CAPTURE format of a V4L2 decoder, which is a layout of a linear format.
+struct TiledFormat {
+    uint32_t v4l2PixFmt;
+    // The buffers of the layout are allocated with the pixel format of the linear format.
+    uint32_t linearV4L2PixFmt;
+    // The DRM format modifier of the layout, see drm_fourcc.h.
+    uint64_t modifier;
+    // The gralloc usage flags requesting the layout when allocating the buffers, 0 if gralloc
+    // chooses the layout by itself.
+    uint64_t usage;
+};
+
+// Return the tiled or compressed layout of |v4l2PixFmt|, or nullptr if it's a linear format.
+const TiledFormat* findTiledFormat(uint32_t v4l2PixFmt);
+
+// Set the CAPTURE format of |device| to a tiled or compressed layout of the linear |format| if the
+// device supports one. Return the layout, or nullptr if none is supported, in which case the format
+// is left as is.
+const TiledFormat* setTiledFormat(media::V4L2Device* device, const struct v4l2_format& format);
+
+}  // namespace android
+
+#endif  // ANDROID_V4L2_CODEC2_COMMON_TILED_FORMATS_H
@@ -0,0 +1,238 @@
+// Copyright 2020 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ANDROID_V4L2_CODEC2_COMMON_V4L2_COMPONENT_PARAMS_H
+#define ANDROID_V4L2_CODEC2_COMMON_V4L2_COMPONENT_PARAMS_H
+
+#include <C2Config.h>
+#include <C2ParamDef.h>
+
+namespace android {
+
+// Vendor parameters supported by the V4L2 components, in addition to the standard parameters
+// defined at C2Config.h.
+enum V4L2ParamIndexKind : C2Param::type_index_t {
+    kParamIndexV4L2DecodeMode = C2Param::TYPE_INDEX_VENDOR_START,
+    kParamIndexV4L2QpRange,
+    kParamIndexV4L2PeakBitrate,
+    kParamIndexV4L2VbvSize,
+    kParamIndexV4L2BFrames,
+    kParamIndexV4L2NumRefFrames,
+    kParamIndexV4L2TemporalLayerId,
+    kParamIndexV4L2SliceCount,
+    kParamIndexV4L2EncodeFrameStats,
+    kParamIndexV4L2EncodeSessionStats,
+    kParamIndexV4L2RoiRects,
+    kParamIndexV4L2QpMap,
+    kParamIndexV4L2ScaledOutputSize,
+    kParamIndexV4L2OutputModifier,
+};
+
+// The frames a decoder component should decode. Skipped frames are never sent to the device, and
+// their works are returned with empty output.
+enum V4L2DecodeMode : uint32_t {
+    // Decode all the frames.
+    V4L2_DECODE_MODE_ALL = 0,
+    // Skip the frames which are not used as reference by any other frame, e.g. to catch up when
+    // the playback is behind schedule.
+    V4L2_DECODE_MODE_REFERENCE_ONLY = 1,
+    // Only decode the key frames, e.g. for thumbnail extraction.
+    V4L2_DECODE_MODE_KEY_FRAME_ONLY = 2,
+};
+
+typedef C2StreamParam<C2Tuning, C2Uint32Value, kParamIndexV4L2DecodeMode>
+        C2StreamV4L2DecodeModeTuning;
+constexpr char C2_PARAMKEY_V4L2_DECODE_MODE[] = "vendor.v4l2-decode-mode";
+
+// The quantization parameters of an encoder component. The encoder picks the quantization parameter
+// of each frame within [minQp, maxQp] when a bitrate control mode is used. The fixed iFrameQp and
+// pFrameQp are used for I and P frames in the constant quality mode (C2Config::BITRATE_IGNORE).
+struct C2V4L2QpRangeStruct {
+    C2V4L2QpRangeStruct() : minQp(0), maxQp(0), iFrameQp(0), pFrameQp(0) {}
+    C2V4L2QpRangeStruct(int32_t minQp_, int32_t maxQp_, int32_t iFrameQp_, int32_t pFrameQp_)
+          : minQp(minQp_), maxQp(maxQp_), iFrameQp(iFrameQp_), pFrameQp(pFrameQp_) {}
+
+    int32_t minQp;
+    int32_t maxQp;
+    int32_t iFrameQp;
+    int32_t pFrameQp;
+
+    DEFINE_AND_DESCRIBE_C2STRUCT(V4L2QpRange)
+    C2FIELD(minQp, "min")
+    C2FIELD(maxQp, "max")
+    C2FIELD(iFrameQp, "i-frame")
+    C2FIELD(pFrameQp, "p-frame")
+};
+
+typedef C2StreamParam<C2Tuning, C2V4L2QpRangeStruct, kParamIndexV4L2QpRange>
+        C2StreamV4L2QpRangeTuning;
+constexpr char C2_PARAMKEY_V4L2_QP_RANGE[] = "vendor.v4l2-qp-range";
+
+// The peak bitrate of an encoder component in bits per second, only used in the variable bitrate
+// mode. 0 lets the device choose.
+typedef C2StreamParam<C2Tuning, C2Uint32Value, kParamIndexV4L2PeakBitrate>
+        C2StreamV4L2PeakBitrateTuning;
+constexpr char C2_PARAMKEY_V4L2_PEAK_BITRATE[] = "vendor.v4l2-peak-bitrate";
+
+// The size of the video buffering verifier (coded picture buffer for H.264) of an encoder component
+// in bytes. 0 lets the device choose.
+typedef C2StreamParam<C2Tuning, C2Uint32Value, kParamIndexV4L2VbvSize> C2StreamV4L2VbvSizeTuning;
+constexpr char C2_PARAMKEY_V4L2_VBV_SIZE[] = "vendor.v4l2-vbv-size";
+
+// The number of consecutive B-frames an encoder component may insert between reference frames.
+// B-frames improve the compression at the cost of encoding latency, as the encoded output is
+// reordered.
+typedef C2StreamParam<C2Tuning, C2Uint32Value, kParamIndexV4L2BFrames> C2StreamV4L2BFramesTuning;
+constexpr char C2_PARAMKEY_V4L2_B_FRAMES[] = "vendor.v4l2-b-frames";
+
+// The number of reference frames an encoder component may use for P-frames. 0 lets the device
+// choose.
+typedef C2StreamParam<C2Tuning, C2Uint32Value, kParamIndexV4L2NumRefFrames>
+        C2StreamV4L2NumRefFramesTuning;
+constexpr char C2_PARAMKEY_V4L2_NUM_REF_FRAMES[] = "vendor.v4l2-num-ref-frames";
+
+// The temporal layer of an encoded output buffer when temporal layering is configured through
+// C2_PARAMKEY_TEMPORAL_LAYERING, 0 being the base layer. Attached to each output buffer, so that
+// the buffers of the upper layers can be dropped without breaking the decoding of the lower ones.
+typedef C2StreamParam<C2Info, C2Uint32Value, kParamIndexV4L2TemporalLayerId>
+        C2StreamV4L2TemporalLayerIdInfo;
+constexpr char C2_PARAMKEY_V4L2_TEMPORAL_LAYER_ID[] = "vendor.v4l2-temporal-layer-id";
+
+// The number of slices an encoder component splits each frame into, at a small cost in
+// compression. Each frame is still output as a whole access unit once all its slices are encoded,
+// so multiple slices don't lower the latency. 0 or 1 encodes each frame as a single slice.
+typedef C2StreamParam<C2Tuning, C2Uint32Value, kParamIndexV4L2SliceCount>
+        C2StreamV4L2SliceCountTuning;
+constexpr char C2_PARAMKEY_V4L2_SLICE_COUNT[] = "vendor.v4l2-slice-count";
+
+// The type of an encoded frame, as reported by the device.
+enum V4L2EncodeFrameType : uint32_t {
+    V4L2_ENCODE_FRAME_TYPE_UNKNOWN = 0,
+    V4L2_ENCODE_FRAME_TYPE_I = 1,
+    V4L2_ENCODE_FRAME_TYPE_P = 2,
+    V4L2_ENCODE_FRAME_TYPE_B = 3,
+};
+
+// The statistics of an encoded frame. |averageQp| is -1 if the device doesn't report it.
+// |encodeTimeUs| is the time between queuing the frame to the device and dequeuing its encoded
+// output, |inputWaitTimeUs| the time the frame waited in the component before being queued.
+struct C2V4L2EncodeFrameStatsStruct {
+    C2V4L2EncodeFrameStatsStruct()
+          : frameType(V4L2_ENCODE_FRAME_TYPE_UNKNOWN),
+            averageQp(-1),
+            bits(0),
+            encodeTimeUs(0),
+            inputWaitTimeUs(0) {}
+
+    uint32_t frameType;
+    int32_t averageQp;
+    uint32_t bits;
+    uint32_t encodeTimeUs;
+    uint32_t inputWaitTimeUs;
+
+    DEFINE_AND_DESCRIBE_C2STRUCT(V4L2EncodeFrameStats)
+    C2FIELD(frameType, "frame-type")
+    C2FIELD(averageQp, "average-qp")
+    C2FIELD(bits, "bits")
+    C2FIELD(encodeTimeUs, "encode-time-us")
+    C2FIELD(inputWaitTimeUs, "input-wait-time-us")
+};
+
+// Attached to each encoded output buffer of an encoder component.
+typedef C2StreamParam<C2Info, C2V4L2EncodeFrameStatsStruct, kParamIndexV4L2EncodeFrameStats>
+        C2StreamV4L2EncodeFrameStatsInfo;
+constexpr char C2_PARAMKEY_V4L2_ENCODE_FRAME_STATS[] = "vendor.v4l2-encode-frame-stats";
+
+// The statistics of an encoder session. |frameCount| and |keyFrameCount| count all frames encoded
+// since the component was started, the averages and maximum are taken over the recent frames.
+// |averageQp| is -1 if the device doesn't report the quantization parameter.
+struct C2V4L2EncodeSessionStatsStruct {
+    C2V4L2EncodeSessionStatsStruct()
+          : frameCount(0),
+            keyFrameCount(0),
+            averageQp(-1),
+            averageBits(0),
+            averageEncodeTimeUs(0),
+            maxEncodeTimeUs(0),
+            averageInputWaitTimeUs(0) {}
+
+    uint32_t frameCount;
+    uint32_t keyFrameCount;
+    int32_t averageQp;
+    uint32_t averageBits;
+    uint32_t averageEncodeTimeUs;
+    uint32_t maxEncodeTimeUs;
+    uint32_t averageInputWaitTimeUs;
+
+    DEFINE_AND_DESCRIBE_C2STRUCT(V4L2EncodeSessionStats)
+    C2FIELD(frameCount, "frame-count")
+    C2FIELD(keyFrameCount, "key-frame-count")
+    C2FIELD(averageQp, "average-qp")
+    C2FIELD(averageBits, "average-bits")
+    C2FIELD(averageEncodeTimeUs, "average-encode-time-us")
+    C2FIELD(maxEncodeTimeUs, "max-encode-time-us")
+    C2FIELD(averageInputWaitTimeUs, "average-input-wait-time-us")
+};
+
+// Updated by an encoder component after each encoded frame.
+typedef C2StreamParam<C2Info, C2V4L2EncodeSessionStatsStruct, kParamIndexV4L2EncodeSessionStats>
+        C2StreamV4L2EncodeSessionStatsInfo;
+constexpr char C2_PARAMKEY_V4L2_ENCODE_SESSION_STATS[] = "vendor.v4l2-encode-session-stats";
+
+// A region of interest of an input frame, in pixels. The encoder adds |qpDelta| to the
+// quantization parameter of the macroblocks covering the region, a negative delta spending more
+// bits on the region.
+struct C2V4L2RoiRectStruct {
+    C2V4L2RoiRectStruct() : left(0), top(0), width(0), height(0), qpDelta(0) {}
+    C2V4L2RoiRectStruct(uint32_t left_, uint32_t top_, uint32_t width_, uint32_t height_,
+                        int32_t qpDelta_)
+          : left(left_), top(top_), width(width_), height(height_), qpDelta(qpDelta_) {}
+
+    uint32_t left;
+    uint32_t top;
+    uint32_t width;
+    uint32_t height;
+    int32_t qpDelta;
+
+    DEFINE_AND_DESCRIBE_C2STRUCT(V4L2RoiRect)
+    C2FIELD(left, "left")
+    C2FIELD(top, "top")
+    C2FIELD(width, "width")
+    C2FIELD(height, "height")
+    C2FIELD(qpDelta, "qp-delta")
+};
+
+// The regions of interest of an input frame of an encoder component. Attached to the input of a
+// work item, the regions only apply to the frame of that work item. Later regions take precedence
+// where regions overlap.
+typedef C2StreamParam<C2Tuning, C2SimpleArrayStruct<C2V4L2RoiRectStruct>, kParamIndexV4L2RoiRects>
+        C2StreamV4L2RoiRectsTuning;
+constexpr char C2_PARAMKEY_V4L2_ROI_RECTS[] = "vendor.v4l2-roi-rects";
+
+// The QP delta of each 16x16 macroblock of an input frame of an encoder component, in raster order.
+// Each byte is a signed 8-bit delta. Attached to the input of a work item, the map only applies to
+// the frame of that work item. Regions of interest attached to the same frame are applied on top
+// of the map.
+typedef C2StreamParam<C2Tuning, C2BlobValue, kParamIndexV4L2QpMap> C2StreamV4L2QpMapTuning;
+constexpr char C2_PARAMKEY_V4L2_QP_MAP[] = "vendor.v4l2-qp-map";
+
+// The size a decoder component scales its output frames down to, e.g. to show many streams as
+// small previews without allocating full-size output buffers. The frames are scaled by the device
+// when it accepts the size as the compose rectangle of its CAPTURE queue, by the CPU otherwise.
+// 0x0 disables the scaling, as does a size larger than the decoded frames. The aspect ratio is not
+// preserved. Only applied when the component is started.
+typedef C2StreamParam<C2Tuning, C2PictureSizeStruct, kParamIndexV4L2ScaledOutputSize>
+        C2StreamV4L2ScaledOutputSizeTuning;
+constexpr char C2_PARAMKEY_V4L2_SCALED_OUTPUT_SIZE[] = "vendor.v4l2-scaled-output-size";
+
+// The DRM format modifier of the tiled or compressed layout an output buffer of a decoder
+// component is decoded into, see drm_fourcc.h. Attached to each output buffer which isn't in the
+// linear layout, so that the consumer doesn't have to query gralloc for it.
+typedef C2StreamParam<C2Info, C2Uint64Value, kParamIndexV4L2OutputModifier>
+        C2StreamV4L2OutputModifierInfo;
+constexpr char C2_PARAMKEY_V4L2_OUTPUT_MODIFIER[] = "vendor.v4l2-output-modifier";
+
+}  // namespace android
+
+#endif  // ANDROID_V4L2_CODEC2_COMMON_V4L2_COMPONENT_PARAMS_H
@@ -5,6 +5,8 @@
 #ifndef ANDROID_V4L2_CODEC2_COMPONENTS_VIDEO_TYPES_H
 #define ANDROID_V4L2_CODEC2_COMPONENTS_VIDEO_TYPES_H
 
+#include <stdint.h>
+
 #include <optional>
 #include <string>
 
@@ -20,6 +22,8 @@ enum class VideoCodec {
     VP9,
 };
 const char* VideoCodecToString(VideoCodec codec);
+// The V4L2 pixel format of the bitstream of |codec|.
+uint32_t VideoCodecToV4L2PixFmt(VideoCodec codec);
 
 // Enumeration of supported pixel format. The value should be the same as
 // ::android::hardware::graphics::common::V1_0::PixelFormat.
@@ -30,9 +34,13 @@ enum class HalPixelFormat : int32_t {
     BGRA_8888 = static_cast<int32_t>(HPixelFormat::BGRA_8888),
     RGB_888 = static_cast<int32_t>(HPixelFormat::RGB_888),
     RGBA_8888 = static_cast<int32_t>(HPixelFormat::RGBA_8888),  //DRM_FORMAT_ABGR8888
+    RGBA_1010102 = static_cast<int32_t>(HPixelFormat::RGBA_1010102),
     YV12 = static_cast<int32_t>(HPixelFormat::YV12),
     // NV12 is not defined at PixelFormat, follow the convention to use fourcc value.
     NV12 = 0x3231564e,
+    // P010 is only defined at PixelFormat since version 1.1, the value is the same as
+    // HAL_PIXEL_FORMAT_YCBCR_P010.
+    YCBCR_P010 = 0x36,
 };
 const char* HalPixelFormatToString(HalPixelFormat format);
 
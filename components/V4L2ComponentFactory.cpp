@@ -83,10 +83,17 @@ c2_status_t V4L2ComponentFactory::createInterface(
     }
 
     if (mIsEncoder) {
+        // Fail if the device doesn't support the codec of the component, so the component isn't
+        // listed by the store.
+        auto encodeInterface = std::make_shared<V4L2EncodeInterface>(mComponentName, mReflector);
+        if (encodeInterface->status() != C2_OK) {
+            ALOGE("Encoder interface initialization failed (error code %d)",
+                  encodeInterface->status());
+            return encodeInterface->status();
+        }
         *interface = std::shared_ptr<C2ComponentInterface>(
-                new SimpleInterface<V4L2EncodeInterface>(
-                        mComponentName.c_str(), id,
-                        std::make_shared<V4L2EncodeInterface>(mComponentName, mReflector)),
+                new SimpleInterface<V4L2EncodeInterface>(mComponentName.c_str(), id,
+                                                         std::move(encodeInterface)),
                 deleter);
         return C2_OK;
     } else {
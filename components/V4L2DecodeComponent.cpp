@@ -13,7 +13,9 @@
 #include <linux/videodev2.h>
 #include <stdint.h>
 
+#include <algorithm>
 #include <memory>
+#include <optional>
 #include <utils/Trace.h>
 
 #include <C2.h>
@@ -30,22 +32,36 @@
 
 #include <h264_parser.h>
 #include <v4l2_codec2/common/OutputFormatConverter.h>
+#include <v4l2_codec2/common/TiledFormats.h>
+#include <v4l2_codec2/common/V4L2ComponentParams.h>
 #include <v4l2_codec2/common/VideoTypes.h>
 #include <v4l2_codec2/components/BitstreamBuffer.h>
 #include <v4l2_codec2/components/V4L2Decoder.h>
+#include <v4l2_codec2/components/V4L2PrewarmPool.h>
 #include <v4l2_codec2/components/VideoFramePool.h>
 #include <v4l2_codec2/plugin_store/C2VdaBqBlockPool.h>
+#include <v4l2_codec2/store/V4L2SessionScheduler.h>
+#include <vp8_parser.h>
+#include <vp9_parser.h>
 
 namespace android {
 namespace {
 // TODO(b/151128291): figure out why we cannot open V4L2Device in 0.5 second?
 const ::base::TimeDelta kBlockingMethodTimeout = ::base::TimeDelta::FromMilliseconds(5000);
+const char* kDecoderThreadName = "V4L2DecodeComponentDecoderThread";
 
 // Mask against 30 bits to avoid (undefined) wraparound on signed integer.
 int32_t frameIndexToBitstreamId(c2_cntr64_t frameIndex) {
     return static_cast<int32_t>(frameIndex.peeku() & 0x3FFFFFFF);
 }
 
+// The properties of a compressed frame, used to decide whether to skip it under the decode mode.
+struct FrameProperties {
+    bool isKeyFrame;
+    // Whether any following frame might depend on the frame.
+    bool isReference;
+};
+
 bool parseCodedColorAspects(const C2ConstLinearBlock& input,
                             C2StreamColorAspectsInfo::input* codedAspects) {
     C2ReadView view = input.map().get();
@@ -107,6 +123,136 @@ bool parseCodedColorAspects(const C2ConstLinearBlock& input,
     return true;
 }
 
+// Parse the first slice NALU of the H264 frame. Return std::nullopt if no slice is found. Besides
+// the IDR frames, the frames preceded by a recovery point SEI with no recovery frame are key
+// frames, as the frames following them in output order can be decoded correctly from them.
+std::optional<FrameProperties> parseH264FrameProperties(const uint8_t* data, size_t size) {
+    media::H264Parser parser;
+    parser.SetStream(data, static_cast<off_t>(size));
+    media::H264NALU nalu;
+    bool isRecoveryPoint = false;
+    while (parser.AdvanceToNextNALU(&nalu) == media::H264Parser::kOk) {
+        if (nalu.nal_unit_type == media::H264NALU::kSEIMessage) {
+            media::H264SEIMessage seiMessage;
+            if (parser.ParseSEI(&seiMessage) == media::H264Parser::kOk &&
+                seiMessage.type == media::H264SEIMessage::kSEIRecoveryPoint &&
+                seiMessage.recovery_point.recovery_frame_cnt == 0) {
+                isRecoveryPoint = true;
+            }
+        } else if (nalu.nal_unit_type == media::H264NALU::kIDRSlice ||
+                   nalu.nal_unit_type == media::H264NALU::kNonIDRSlice) {
+            return FrameProperties{
+                    .isKeyFrame =
+                            nalu.nal_unit_type == media::H264NALU::kIDRSlice || isRecoveryPoint,
+                    .isReference = nalu.nal_ref_idc != 0,
+            };
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<FrameProperties> parseVp8FrameProperties(media::Vp8Parser* parser,
+                                                       const uint8_t* data, size_t size) {
+    media::Vp8FrameHeader header;
+    if (!parser->ParseFrame(data, size, &header)) return std::nullopt;
+    if (header.IsKeyframe()) return FrameProperties{.isKeyFrame = true, .isReference = true};
+
+    // Besides the reference buffers, the probabilities, segmentation and loop filter deltas might
+    // persist to the following frames.
+    const bool isReference =
+            header.refresh_last || header.refresh_golden_frame || header.copy_buffer_to_golden ||
+            header.refresh_alternate_frame || header.copy_buffer_to_alternate ||
+            header.refresh_entropy_probs || header.segmentation_hdr.update_mb_segmentation_map ||
+            header.segmentation_hdr.update_segment_feature_data ||
+            header.loopfilter_hdr.mode_ref_lf_delta_update;
+    return FrameProperties{.isKeyFrame = false, .isReference = isReference};
+}
+
+// Parse all the frames of the VP9 frame or superframe. The superframe is a key frame or a
+// reference frame if any of its frames is.
+std::optional<FrameProperties> parseVp9FrameProperties(media::Vp9Parser* parser,
+                                                       const uint8_t* data, size_t size) {
+    parser->SetStream(data, static_cast<off_t>(size));
+
+    FrameProperties properties{.isKeyFrame = false, .isReference = false};
+    bool parsed = false;
+    media::Vp9FrameHeader header;
+    media::Vp9Parser::Result result;
+    while ((result = parser->ParseNextFrame(&header)) == media::Vp9Parser::kOk) {
+        parsed = true;
+        if (header.show_existing_frame) continue;
+        properties.isKeyFrame |= header.IsKeyframe();
+        properties.isReference |= header.IsKeyframe() || header.refresh_frame_flags != 0 ||
+                                  header.refresh_frame_context;
+    }
+    if (result != media::Vp9Parser::kEOStream || !parsed) return std::nullopt;
+    return properties;
+}
+
+// The number of reference buffers of VP8: last, golden and altref frames.
+constexpr size_t kVp8NumRefFrames = 3;
+
+// The output format parsed from the bitstream before the decoder reports it.
+struct OutputFormatHint {
+    media::Size codedSize;
+    // The reference frames plus the frame being decoded.
+    size_t minNumBuffers;
+};
+
+media::Size alignCodedSize(uint32_t width, uint32_t height) {
+    constexpr uint32_t kMacroblockSize = 16;
+    return media::Size((width + kMacroblockSize - 1) & ~(kMacroblockSize - 1),
+                       (height + kMacroblockSize - 1) & ~(kMacroblockSize - 1));
+}
+
+// Parse the H264 SPS, or the VP8/VP9 key frame header in |data|.
+std::optional<OutputFormatHint> parseOutputFormatHint(VideoCodec codec, const uint8_t* data,
+                                                      size_t size) {
+    switch (codec) {
+    case VideoCodec::H264: {
+        media::H264Parser parser;
+        parser.SetStream(data, static_cast<off_t>(size));
+        media::H264NALU nalu;
+        while (parser.AdvanceToNextNALU(&nalu) == media::H264Parser::kOk) {
+            if (nalu.nal_unit_type != media::H264NALU::kSPS) continue;
+
+            int spsId;
+            if (parser.ParseSPS(&spsId) != media::H264Parser::kOk) return std::nullopt;
+            const media::H264SPS* sps = parser.GetSPS(spsId);
+            ::base::Optional<media::Size> codedSize = sps->GetCodedSize();
+            if (!codedSize) return std::nullopt;
+
+            const int numRefFrames =
+                    std::max(sps->max_num_ref_frames, sps->max_dec_frame_buffering);
+            return OutputFormatHint{*codedSize, static_cast<size_t>(numRefFrames) + 1};
+        }
+        return std::nullopt;
+    }
+
+    case VideoCodec::VP8: {
+        media::Vp8Parser parser;
+        media::Vp8FrameHeader header;
+        if (!parser.ParseFrame(data, size, &header) || !header.IsKeyframe()) return std::nullopt;
+        return OutputFormatHint{alignCodedSize(header.width, header.height), kVp8NumRefFrames + 1};
+    }
+
+    case VideoCodec::VP9: {
+        media::Vp9Parser parser(false);
+        parser.SetStream(data, static_cast<off_t>(size));
+        media::Vp9FrameHeader header;
+        if (parser.ParseNextFrame(&header) != media::Vp9Parser::kOk || !header.IsKeyframe()) {
+            return std::nullopt;
+        }
+        return OutputFormatHint{alignCodedSize(header.frame_width, header.frame_height),
+                                media::kVp9NumRefFrames + 1};
+    }
+
+    case VideoCodec::H265:
+        // There is no HEVC parser.
+        return std::nullopt;
+    }
+}
+
 bool isWorkDone(const C2Work& work) {
     ATRACE_CALL();
     const int32_t bitstreamId = frameIndexToBitstreamId(work.input.ordinal.frameIndex);
@@ -163,20 +309,30 @@ V4L2DecodeComponent::V4L2DecodeComponent(const std::string& name, c2_node_id_t i
                                          const std::shared_ptr<C2ReflectorHelper>& helper,
                                          const std::shared_ptr<V4L2DecodeInterface>& intfImpl)
       : mIntfImpl(intfImpl),
-        mIntf(std::make_shared<SimpleInterface<V4L2DecodeInterface>>(name.c_str(), id, mIntfImpl)) {
+        mIntf(std::make_shared<SimpleInterface<V4L2DecodeInterface>>(name.c_str(), id, mIntfImpl)),
+        mSchedulerSessionId(V4L2SessionScheduler::getInstance().registerSession()),
+        mDecoderThread(std::make_unique<::base::Thread>(kDecoderThreadName)) {
     ALOGV("%s(%s)", __func__, name.c_str());
 
     mIsSecure = name.find(".secure") != std::string::npos;
+
+    // Prepare the device and the threads of the codec while the client configures the component.
+    const auto codec = mIntfImpl->getVideoCodec();
+    if (codec) {
+        V4L2PrewarmPool::getInstance().prewarm(media::V4L2Device::Type::kDecoder,
+                                               VideoCodecToV4L2PixFmt(*codec), kDecoderThreadName);
+    }
 }
 
 V4L2DecodeComponent::~V4L2DecodeComponent() {
     ALOGV("%s()", __func__);
 
-    if (mDecoderThread.IsRunning()) {
+    if (mDecoderThread->IsRunning()) {
         mDecoderTaskRunner->PostTask(
                 FROM_HERE, ::base::BindOnce(&V4L2DecodeComponent::destroyTask, mWeakThis));
-        mDecoderThread.Stop();
+        mDecoderThread->Stop();
     }
+    V4L2SessionScheduler::getInstance().unregisterSession(mSchedulerSessionId);
     ALOGV("%s() done", __func__);
 }
 
@@ -198,18 +354,26 @@ c2_status_t V4L2DecodeComponent::start() {
         return C2_BAD_STATE;
     }
 
-    if (!mDecoderThread.Start()) {
+    // Adopt the device and the threads prepared in the background, if they are ready.
+    scoped_refptr<media::V4L2Device> device;
+    std::unique_ptr<::base::Thread> thread;
+    const auto codec = mIntfImpl->getVideoCodec();
+    if (codec && V4L2PrewarmPool::getInstance().take(media::V4L2Device::Type::kDecoder,
+                                                      VideoCodecToV4L2PixFmt(*codec), &device,
+                                                      &thread)) {
+        mDecoderThread = std::move(thread);
+    } else if (!mDecoderThread->Start()) {
         ALOGE("Decoder thread failed to start.");
         return C2_CORRUPTED;
     }
-    mDecoderTaskRunner = mDecoderThread.task_runner();
+    mDecoderTaskRunner = mDecoderThread->task_runner();
     mWeakThis = mWeakThisFactory.GetWeakPtr();
 
     c2_status_t status = C2_CORRUPTED;
     mStartStopDone.Reset();
     mDecoderTaskRunner->PostTask(FROM_HERE,
                                  ::base::BindOnce(&V4L2DecodeComponent::startTask, mWeakThis,
-                                                  ::base::Unretained(&status)));
+                                                  std::move(device), ::base::Unretained(&status)));
     if (!mStartStopDone.TimedWait(kBlockingMethodTimeout)) {
         ALOGE("startTask() timeout...");
         return C2_TIMED_OUT;
@@ -219,7 +383,8 @@ c2_status_t V4L2DecodeComponent::start() {
     return status;
 }
 
-void V4L2DecodeComponent::startTask(c2_status_t* status) {
+void V4L2DecodeComponent::startTask(scoped_refptr<media::V4L2Device> device,
+                                    c2_status_t* status) {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mDecoderTaskRunner->RunsTasksInCurrentSequence());
     ATRACE_CALL();
@@ -234,8 +399,14 @@ void V4L2DecodeComponent::startTask(c2_status_t* status) {
         return;
     }
     const size_t inputBufferSize = mIntfImpl->getInputBufferSize();
+    // The secure frames can't be scaled by the CPU when the device has no scaler.
+    const media::Size scaledOutputSize =
+            mIsSecure ? media::Size() : mIntfImpl->getScaledOutputSize();
+    mOutputFormatHintParsed = false;
+    // A new decoder starts from a key frame.
+    mReferenceFrameSkipped = false;
     mDecoder = V4L2Decoder::Create(
-            *codec, inputBufferSize,
+            *codec, inputBufferSize, scaledOutputSize, std::move(device),
             ::base::BindRepeating(&V4L2DecodeComponent::getVideoFramePool, mWeakThis),
             ::base::BindRepeating(&V4L2DecodeComponent::onOutputFrameReady, mWeakThis),
             ::base::BindRepeating(&V4L2DecodeComponent::reportError, mWeakThis, C2_CORRUPTED),
@@ -249,14 +420,17 @@ void V4L2DecodeComponent::startTask(c2_status_t* status) {
     if (!mIsSecure && *codec == VideoCodec::H264) {
         if (mIntfImpl->queryColorAspects(&mCurrentColorAspects) != C2_OK) return;
         mPendingColorAspectsChange = false;
+        mDecoder->setColorAspects(mCurrentColorAspects, 0);
     }
 
     *status = C2_OK;
 }
 
 void V4L2DecodeComponent::getVideoFramePool(std::unique_ptr<VideoFramePool>* pool,
-                                            const media::Size& size, HalPixelFormat pixelFormat,
-                                            size_t numBuffers) {
+                                            const media::Size& size,
+                                            const media::Size& scaledSize,
+                                            HalPixelFormat pixelFormat, uint64_t usage,
+                                            size_t numBuffers, size_t maxNumBuffers) {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mDecoderTaskRunner->RunsTasksInCurrentSequence());
     ATRACE_CALL();
@@ -286,9 +460,10 @@ void V4L2DecodeComponent::getVideoFramePool(std::unique_ptr<VideoFramePool>* poo
         return;
     }
 
-    *pool = VideoFramePool::Create(std::move(blockPool), numBuffers, size, pixelFormat, mIsSecure,
+    // The decoder sets the color aspects used to convert the frames on the pool.
+    *pool = VideoFramePool::Create(std::move(blockPool), numBuffers, maxNumBuffers, size,
+                                   scaledSize, pixelFormat, usage, mIsSecure,
                                    mDecoderTaskRunner);
-    // VirtIO GPU didn't support YUV, convert YUV to RGBA
 }
 
 c2_status_t V4L2DecodeComponent::stop() {
@@ -302,7 +477,7 @@ c2_status_t V4L2DecodeComponent::stop() {
     }
 
     // Return immediately if the component is already stopped.
-    if (!mDecoderThread.IsRunning()) return C2_OK;
+    if (!mDecoderThread->IsRunning()) return C2_OK;
 
     mStartStopDone.Reset();
     mDecoderTaskRunner->PostTask(FROM_HERE,
@@ -312,7 +487,7 @@ c2_status_t V4L2DecodeComponent::stop() {
         return C2_TIMED_OUT;
     }
 
-    mDecoderThread.Stop();
+    mDecoderThread->Stop();
     mDecoderTaskRunner = nullptr;
     mComponentState.store(ComponentState::STOPPED);
     return C2_OK;
@@ -324,6 +499,7 @@ void V4L2DecodeComponent::stopTask() {
 
     reportAbandonedWorks();
     mIsDraining = false;
+    mIsWaitingForQueueSlot = false;
     mDecoder = nullptr;
     mWeakThisFactory.InvalidateWeakPtrs();
 
@@ -347,7 +523,7 @@ c2_status_t V4L2DecodeComponent::setListener_vb(
     }
 
     // If the decoder thread is not running it's safe to update the listener directly.
-    if (!mDecoderThread.IsRunning()) {
+    if (!mDecoderThread->IsRunning()) {
         mListener = listener;
         return C2_OK;
     }
@@ -419,10 +595,91 @@ void V4L2DecodeComponent::queueTask(std::unique_ptr<C2Work> work) {
         work->input.buffers.emplace_back(nullptr);
     }
 
+    // Mark the work whose frame should be skipped under the current decode mode. The parsers keep
+    // states across frames, so this is done once per work in decoding order.
+    if (shouldSkipWork(*work)) {
+        work->worklets.front()->output.flags = C2FrameData::FLAG_DROP_FRAME;
+    }
+
     mPendingWorks.push(std::move(work));
     pumpPendingWorks();
 }
 
+bool V4L2DecodeComponent::shouldSkipWork(const C2Work& work) {
+    ALOG_ASSERT(mDecoderTaskRunner->RunsTasksInCurrentSequence());
+
+    // The bitstream of secure playback is not accessible.
+    if (mIsSecure || work.input.buffers.front() == nullptr) return false;
+    if (work.input.flags & (C2FrameData::FLAG_END_OF_STREAM | C2FrameData::FLAG_CODEC_CONFIG)) {
+        return false;
+    }
+
+    if (mIntfImpl->takeDecodeModeChanged()) {
+        C2StreamV4L2DecodeModeTuning::input decodeMode;
+        if (mIntfImpl->query({&decodeMode}, {}, C2_DONT_BLOCK, nullptr) == C2_OK &&
+            decodeMode.value != mDecodeMode) {
+            ALOGV("Decode mode changed from %u to %u", mDecodeMode, decodeMode.value);
+            // The parsers missed the frames decoded in the ALL mode, restart them.
+            if (mDecodeMode == V4L2_DECODE_MODE_ALL && !mReferenceFrameSkipped) {
+                mVp8Parser.reset();
+                mVp9Parser.reset();
+            }
+            mDecodeMode = decodeMode.value;
+        }
+    }
+    if (mDecodeMode == V4L2_DECODE_MODE_ALL && !mReferenceFrameSkipped) return false;
+
+    C2ConstLinearBlock linearBlock = work.input.buffers.front()->data().linearBlocks().front();
+    C2ReadView view = linearBlock.map().get();
+    if (view.error() != C2_OK) {
+        ALOGW("Failed to map the input buffer: %d", view.error());
+        return false;
+    }
+
+    std::optional<FrameProperties> properties;
+    switch (*mIntfImpl->getVideoCodec()) {
+    case VideoCodec::H264:
+        properties = parseH264FrameProperties(view.data(), view.capacity());
+        break;
+    case VideoCodec::VP8:
+        if (!mVp8Parser) mVp8Parser = std::make_unique<media::Vp8Parser>();
+        properties = parseVp8FrameProperties(mVp8Parser.get(), view.data(), view.capacity());
+        break;
+    case VideoCodec::VP9:
+        if (!mVp9Parser) mVp9Parser = std::make_unique<media::Vp9Parser>(false);
+        properties = parseVp9FrameProperties(mVp9Parser.get(), view.data(), view.capacity());
+        break;
+    case VideoCodec::H265:
+        // There is no HEVC parser, always decode the frames.
+        break;
+    }
+
+    // Decode the frame if we are not sure about it.
+    if (!properties) return false;
+
+    if (properties->isKeyFrame) {
+        mReferenceFrameSkipped = false;
+        return false;
+    }
+
+    // Once a frame which might be referred to is skipped, e.g. in the KEY_FRAME_ONLY mode, the
+    // following frames can't be decoded correctly until the next key frame, even if the mode is
+    // changed in the meantime.
+    bool skip = mReferenceFrameSkipped;
+    switch (mDecodeMode) {
+    case V4L2_DECODE_MODE_REFERENCE_ONLY:
+        skip |= !properties->isReference;
+        break;
+    case V4L2_DECODE_MODE_KEY_FRAME_ONLY:
+        skip = true;
+        break;
+    default:
+        break;
+    }
+    if (skip && properties->isReference) mReferenceFrameSkipped = true;
+    return skip;
+}
+
 void V4L2DecodeComponent::pumpPendingWorks() {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mDecoderTaskRunner->RunsTasksInCurrentSequence());
@@ -434,7 +691,29 @@ void V4L2DecodeComponent::pumpPendingWorks() {
         return;
     }
 
+    // A delayed pump is already scheduled, the works will be processed then.
+    if (mIsWaitingForQueueSlot) return;
+
     while (!mPendingWorks.empty() && !mIsDraining) {
+        // The work is marked at queueTask() to be skipped under the decode mode.
+        const C2Work* frontWork = mPendingWorks.front().get();
+        const bool isSkippedWork =
+                frontWork->worklets.front()->output.flags & C2FrameData::FLAG_DROP_FRAME;
+
+        // Check whether the session scheduler allows us to queue another input buffer. If not, try
+        // again after the requested delay and let other sessions use the device meanwhile.
+        if (frontWork->input.buffers.front() != nullptr && !isSkippedWork) {
+            std::chrono::microseconds delay = acquireQueueSlot();
+            if (delay.count() > 0) {
+                mIsWaitingForQueueSlot = true;
+                mDecoderTaskRunner->PostDelayedTask(
+                        FROM_HERE,
+                        ::base::BindOnce(&V4L2DecodeComponent::onQueueSlotAvailable, mWeakThis),
+                        ::base::TimeDelta::FromMicroseconds(delay.count()));
+                return;
+            }
+        }
+
         std::unique_ptr<C2Work> work(std::move(mPendingWorks.front()));
         mPendingWorks.pop();
 
@@ -444,7 +723,12 @@ void V4L2DecodeComponent::pumpPendingWorks() {
         ALOGV("Process C2Work bitstreamId=%d isCSDWork=%d, isEmptyWork=%d", bitstreamId, isCSDWork,
               isEmptyWork);
 
-        if (work->input.buffers.front() != nullptr) {
+        if (isSkippedWork) {
+            // Release the input buffer without sending it to |mDecoder|, the work is reported
+            // with empty output below.
+            ALOGV("Skip work(bitstreamId=%d) under the current decode mode", bitstreamId);
+            work->input.buffers.front().reset();
+        } else if (work->input.buffers.front() != nullptr) {
             // If input.buffers is not empty, the buffer should have meaningful content inside.
             C2ConstLinearBlock linearBlock =
                     work->input.buffers.front()->data().linearBlocks().front();
@@ -467,7 +751,32 @@ void V4L2DecodeComponent::pumpPendingWorks() {
                     // buffers whose frame indices are not less than this one.
                     mPendingColorAspectsChange = true;
                     mPendingColorAspectsChangeFrameIndex = work->input.ordinal.frameIndex.peeku();
+
+                    // The frames of this work and the following ones are converted with the new
+                    // color aspects, the frames in flight keep the previous ones.
+                    std::shared_ptr<C2StreamColorAspectsInfo::output> colorAspects;
+                    if (mIntfImpl->queryColorAspects(&colorAspects) == C2_OK) {
+                        mDecoder->setColorAspects(std::move(colorAspects), bitstreamId);
+                    }
+                }
+            }
+
+            // Parse the output format from the header of the first frame, so the output buffers
+            // are allocated in parallel with the device parsing the same header.
+            if (!mOutputFormatHintParsed && !mIsSecure) {
+                std::optional<OutputFormatHint> hint;
+                C2ReadView view = linearBlock.map().get();
+                if (view.error() == C2_OK) {
+                    hint = parseOutputFormatHint(*mIntfImpl->getVideoCodec(), view.data(),
+                                                 view.capacity());
                 }
+                if (hint) {
+                    ALOGV("Parsed output format: coded size %s, %zu buffers",
+                          hint->codedSize.ToString().c_str(), hint->minNumBuffers);
+                    mDecoder->preallocateOutputBuffers(hint->codedSize, hint->minNumBuffers);
+                }
+                // The header is carried by the CSD or the first frame.
+                mOutputFormatHintParsed = hint || !isCSDWork;
             }
 
             std::unique_ptr<BitstreamBuffer> buffer =
@@ -489,9 +798,36 @@ void V4L2DecodeComponent::pumpPendingWorks() {
         auto res = mWorksAtDecoder.insert(std::make_pair(bitstreamId, std::move(work)));
         ALOGW_IF(!res.second, "We already inserted bitstreamId %d to decoder?", bitstreamId);
 
-        // Directly report the empty CSD work as finished.
-        if (isCSDWork && isEmptyWork) reportWorkIfFinished(bitstreamId);
+        // Directly report the empty CSD work and the skipped work as finished.
+        if ((isCSDWork && isEmptyWork) || isSkippedWork) reportWorkIfFinished(bitstreamId);
+    }
+}
+
+std::chrono::microseconds V4L2DecodeComponent::acquireQueueSlot() {
+    ALOG_ASSERT(mDecoderTaskRunner->RunsTasksInCurrentSequence());
+
+    // The session parameters of the scheduler are only refreshed when the client configures them.
+    if (mIntfImpl->takeSchedulingParamsChanged()) {
+        C2ComponentPriorityTuning priority;
+        C2ComponentOperatingRateTuning operatingRate;
+        c2_status_t status =
+                mIntfImpl->query({&priority, &operatingRate}, {}, C2_DONT_BLOCK, nullptr);
+        if (status != C2_OK) {
+            ALOGW("Failed to query interface for scheduling parameters: %d", status);
+        } else {
+            V4L2SessionScheduler::getInstance().updateSession(mSchedulerSessionId, priority.value,
+                                                              operatingRate.value);
+        }
     }
+    return V4L2SessionScheduler::getInstance().acquireQueueSlot(mSchedulerSessionId);
+}
+
+void V4L2DecodeComponent::onQueueSlotAvailable() {
+    ALOGV("%s()", __func__);
+    ALOG_ASSERT(mDecoderTaskRunner->RunsTasksInCurrentSequence());
+
+    mIsWaitingForQueueSlot = false;
+    pumpPendingWorks();
 }
 
 void V4L2DecodeComponent::onDecodeDone(int32_t bitstreamId, VideoDecoder::DecodeStatus status) {
@@ -551,7 +887,9 @@ void V4L2DecodeComponent::onOutputFrameReady(std::unique_ptr<VideoFrame> frame)
     }
     C2Work* work = it->second.get();
 
-    C2ConstGraphicBlock constBlock = std::move(frame)->getGraphicBlock();
+    const uint64_t modifier = frame->getModifier();
+    C2ConstGraphicBlock constBlock = frame->getGraphicBlock();
+    mDecoder->recycleFrame(std::move(frame));
     // TODO(b/160307705): Consider to remove the dependency of C2VdaBqBlockPool.
     MarkBlockPoolDataAsShared(constBlock); //use buffer pool, remove it.
     std::shared_ptr<C2Buffer> buffer = C2Buffer::CreateGraphicBuffer(std::move(constBlock));
@@ -563,6 +901,9 @@ void V4L2DecodeComponent::onOutputFrameReady(std::unique_ptr<VideoFrame> frame)
     if (mCurrentColorAspects) {
         buffer->setInfo(mCurrentColorAspects);
     }
+    if (modifier != kLinearModifier) {
+        buffer->setInfo(std::make_shared<C2StreamV4L2OutputModifierInfo::output>(0u, modifier));
+    }
     work->worklets.front()->output.buffers.emplace_back(std::move(buffer));
 
     // Check no-show frame by timestamps for VP8/VP9 cases before reporting the current work.
@@ -715,11 +1056,17 @@ void V4L2DecodeComponent::flushTask() {
     ALOG_ASSERT(mDecoderTaskRunner->RunsTasksInCurrentSequence());
     ATRACE_CALL();
 
+    const ::base::TimeTicks startTime = ::base::TimeTicks::Now();
     mDecoder->flush();
     reportAbandonedWorks();
 
     // Pending EOS work will be abandoned here due to component flush if any.
     mIsDraining = false;
+
+    // Flush latency dominates seeking, so make it visible both in logs and traces.
+    const int64_t flushLatencyUs = (::base::TimeTicks::Now() - startTime).InMicroseconds();
+    ALOGI("Flush done in %" PRId64 " us", flushLatencyUs);
+    ATRACE_INT64("FlushLatencyUs", flushLatencyUs);
 }
 
 void V4L2DecodeComponent::reportAbandonedWorks() {
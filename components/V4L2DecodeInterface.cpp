@@ -183,7 +183,8 @@ V4L2DecodeInterface::V4L2DecodeInterface(const std::string& name,
                                 0u, C2Config::PROFILE_HEVC_MAIN, C2Config::LEVEL_HEVC_MAIN_5_1))
                         .withFields({C2F(mProfileLevel, profile)
                                              .oneOf({C2Config::PROFILE_HEVC_MAIN,
-                                                     C2Config::PROFILE_HEVC_MAIN_STILL}),
+                                                     C2Config::PROFILE_HEVC_MAIN_STILL,
+                                                     C2Config::PROFILE_HEVC_MAIN_10}),
                                      C2F(mProfileLevel, level)
                                              .oneOf({C2Config::LEVEL_HEVC_MAIN_1,
                                                      C2Config::LEVEL_HEVC_MAIN_2,
@@ -218,7 +219,9 @@ V4L2DecodeInterface::V4L2DecodeInterface(const std::string& name,
                 DefineParam(mProfileLevel, C2_PARAMKEY_PROFILE_LEVEL)
                         .withDefault(new C2StreamProfileLevelInfo::input(
                                 0u, C2Config::PROFILE_VP9_0, C2Config::LEVEL_VP9_5))
-                        .withFields({C2F(mProfileLevel, profile).oneOf({C2Config::PROFILE_VP9_0}),
+                        .withFields({C2F(mProfileLevel, profile)
+                                             .oneOf({C2Config::PROFILE_VP9_0,
+                                                     C2Config::PROFILE_VP9_2}),
                                      C2F(mProfileLevel, level)
                                              .oneOf({C2Config::LEVEL_VP9_1, C2Config::LEVEL_VP9_1_1,
                                                      C2Config::LEVEL_VP9_2, C2Config::LEVEL_VP9_2_1,
@@ -368,12 +371,64 @@ V4L2DecodeInterface::V4L2DecodeInterface(const std::string& name,
                                      .inRange(C2Color::MATRIX_UNSPECIFIED, C2Color::MATRIX_OTHER)})
                     .withSetter(MergedColorAspectsSetter, mDefaultColorAspects, mCodedColorAspects)
                     .build());
+
+    addParameter(DefineParam(mDecodeMode, C2_PARAMKEY_V4L2_DECODE_MODE)
+                         .withDefault(new C2StreamV4L2DecodeModeTuning::input(
+                                 0u, V4L2_DECODE_MODE_ALL))
+                         .withFields({C2F(mDecodeMode, value)
+                                              .oneOf({V4L2_DECODE_MODE_ALL,
+                                                      V4L2_DECODE_MODE_REFERENCE_ONLY,
+                                                      V4L2_DECODE_MODE_KEY_FRAME_ONLY})})
+                         .withSetter(Setter<decltype(*mDecodeMode)>::StrictValueWithNoDeps)
+                         .build());
+
+    addParameter(
+            DefineParam(mScaledOutputSize, C2_PARAMKEY_V4L2_SCALED_OUTPUT_SIZE)
+                    .withDefault(new C2StreamV4L2ScaledOutputSizeTuning::output(0u, 0, 0))
+                    .withFields({
+                            C2F(mScaledOutputSize, width).inRange(0, 4096, 2),
+                            C2F(mScaledOutputSize, height).inRange(0, 4096, 2),
+                    })
+                    .withSetter(Setter<decltype(*mScaledOutputSize)>::StrictValueWithNoDeps)
+                    .build());
+
+    addParameter(DefineParam(mPriority, C2_PARAMKEY_PRIORITY)
+                         .withDefault(new C2ComponentPriorityTuning(0))
+                         .withFields({C2F(mPriority, value).any()})
+                         .withSetter(Setter<decltype(*mPriority)>::NonStrictValueWithNoDeps)
+                         .build());
+
+    addParameter(DefineParam(mOperatingRate, C2_PARAMKEY_OPERATING_RATE)
+                         .withDefault(new C2ComponentOperatingRateTuning(0.))
+                         .withFields({C2F(mOperatingRate, value).any()})
+                         .withSetter(Setter<decltype(*mOperatingRate)>::NonStrictValueWithNoDeps)
+                         .build());
 }
 
 size_t V4L2DecodeInterface::getInputBufferSize() const {
     return calculateInputBufferSize(getMaxSize().GetArea());
 }
 
+c2_status_t V4L2DecodeInterface::config(
+        const std::vector<C2Param*>& params, c2_blocking_t mayBlock,
+        std::vector<std::unique_ptr<C2SettingResult>>* const failures, bool updateParams,
+        std::vector<std::shared_ptr<C2Param>>* changes) {
+    c2_status_t status =
+            C2InterfaceHelper::config(params, mayBlock, failures, updateParams, changes);
+
+    for (const C2Param* param : params) {
+        if (param == nullptr) continue;
+        const uint32_t coreIndex = param->coreIndex().coreIndex();
+        if (coreIndex == C2ComponentPriorityTuning::CORE_INDEX ||
+            coreIndex == C2ComponentOperatingRateTuning::CORE_INDEX) {
+            mSchedulingParamsChanged = true;
+        } else if (coreIndex == C2StreamV4L2DecodeModeTuning::CORE_INDEX) {
+            mDecodeModeChanged = true;
+        }
+    }
+    return status;
+}
+
 c2_status_t V4L2DecodeInterface::queryColorAspects(
         std::shared_ptr<C2StreamColorAspectsInfo::output>* targetColorAspects) {
     std::unique_ptr<C2StreamColorAspectsInfo::output> colorAspects =
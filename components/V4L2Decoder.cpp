@@ -7,38 +7,63 @@
 #define ATRACE_TAG ATRACE_TAG_VIDEO
 
 #include <v4l2_codec2/components/V4L2Decoder.h>
+#include <v4l2_codec2/common/TiledFormats.h>
 #include <v4l2_codec2/plugin_store/C2VdaBqBlockPool.h>
 
+#include <inttypes.h>
 #include <stdint.h>
 
+#include <algorithm>
 #include <vector>
 
 #include <base/bind.h>
 #include <base/files/scoped_file.h>
 #include <base/memory/ptr_util.h>
+#include <cutils/properties.h>
 #include <log/log.h>
+#include <video_pixel_format.h>
 
 #include <utils/Trace.h>
 
 #define OUTPUT_BGRA_8888
 
+#ifndef V4L2_PIX_FMT_P010
+#define V4L2_PIX_FMT_P010 v4l2_fourcc('P', '0', '1', '0')
+#endif
+
 namespace android {
 namespace {
 
+#ifdef OUTPUT_BGRA_8888
+constexpr HalPixelFormat kOutputPixelFormat = HalPixelFormat::BGRA_8888;
+#else
+constexpr HalPixelFormat kOutputPixelFormat = HalPixelFormat::YCBCR_420_888;
+#endif
+
 constexpr size_t kNumInputBuffers = 16;
 // Extra buffers for transmitting in the whole video pipeline.
 constexpr size_t kNumExtraOutputBuffers = 7;
+// The system property enabling the incremental allocation of the output buffers. Only the minimal
+// number of buffers required by the driver is allocated first, and the extra buffers are allocated
+// one by one when the decoder is starved of output buffers.
+const char* kIncrementalOutputBuffersPropertyName = "vendor.v4l2_codec2.incremental_output_buffers";
+// The flush generation is carried at the microseconds field of the V4L2 buffer timestamp, which
+// should be less than one second.
+constexpr uint32_t kMaxFlushGeneration = 1000000;
+
+// Get the pixel format of the output buffers from the format of the CAPTURE queue reported by the
+// driver. 10-bit streams, e.g. VP9 profile 2 or HEVC Main10, are decoded at full depth to P010.
+HalPixelFormat V4L2PixFmtToOutputPixelFormat(uint32_t pixelFormat) {
+    // The buffers of a tiled layout are allocated with the pixel format of the linear layout.
+    if (const TiledFormat* tiledFormat = findTiledFormat(pixelFormat)) {
+        pixelFormat = tiledFormat->linearV4L2PixFmt;
+    }
 
-uint32_t VideoCodecToV4L2PixFmt(VideoCodec codec) {
-    switch (codec) {
-    case VideoCodec::H264:
-        return V4L2_PIX_FMT_H264;
-    case VideoCodec::VP8:
-        return V4L2_PIX_FMT_VP8;
-    case VideoCodec::VP9:
-        return V4L2_PIX_FMT_VP9;
-    case VideoCodec::H265:
-        return V4L2_PIX_FMT_HEVC;
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_P010:
+        return HalPixelFormat::YCBCR_P010;
+    default:
+        return kOutputPixelFormat;
     }
 }
 
@@ -46,12 +71,13 @@ uint32_t VideoCodecToV4L2PixFmt(VideoCodec codec) {
 
 // static
 std::unique_ptr<VideoDecoder> V4L2Decoder::Create(
-        const VideoCodec& codec, const size_t inputBufferSize, GetPoolCB getPoolCb,
-        OutputCB outputCb, ErrorCB errorCb, scoped_refptr<::base::SequencedTaskRunner> taskRunner) {
+        const VideoCodec& codec, const size_t inputBufferSize, const media::Size& scaledOutputSize,
+        scoped_refptr<media::V4L2Device> device, GetPoolCB getPoolCb, OutputCB outputCb,
+        ErrorCB errorCb, scoped_refptr<::base::SequencedTaskRunner> taskRunner) {
     std::unique_ptr<V4L2Decoder> decoder =
             ::base::WrapUnique<V4L2Decoder>(new V4L2Decoder(taskRunner));
-    if (!decoder->start(codec, inputBufferSize, std::move(getPoolCb), std::move(outputCb),
-                        std::move(errorCb))) {
+    if (!decoder->start(codec, inputBufferSize, scaledOutputSize, std::move(device),
+                        std::move(getPoolCb), std::move(outputCb), std::move(errorCb))) {
         return nullptr;
     }
     return decoder;
@@ -87,27 +113,33 @@ V4L2Decoder::~V4L2Decoder() {
     }
 }
 
-bool V4L2Decoder::start(const VideoCodec& codec, const size_t inputBufferSize, GetPoolCB getPoolCb,
+bool V4L2Decoder::start(const VideoCodec& codec, const size_t inputBufferSize,
+                        const media::Size& scaledOutputSize,
+                        scoped_refptr<media::V4L2Device> device, GetPoolCB getPoolCb,
                         OutputCB outputCb, ErrorCB errorCb) {
-    ALOGV("%s(codec=%s, inputBufferSize=%zu)", __func__, VideoCodecToString(codec),
-          inputBufferSize);
+    ALOGV("%s(codec=%s, inputBufferSize=%zu, scaledOutputSize=%s)", __func__,
+          VideoCodecToString(codec), inputBufferSize, scaledOutputSize.ToString().c_str());
     ALOG_ASSERT(mTaskRunner->RunsTasksInCurrentSequence());
 
+    mScaledOutputSize = scaledOutputSize;
     mGetPoolCb = std::move(getPoolCb);
     mOutputCb = std::move(outputCb);
     mErrorCb = std::move(errorCb);
+    mIncrementalOutputBuffers = property_get_bool(kIncrementalOutputBuffersPropertyName, false);
 
     if (mState == State::Error) {
         ALOGE("Ignore due to error state.");
         return false;
     }
 
-    mDevice = media::V4L2Device::Create();
-
     const uint32_t inputPixelFormat = VideoCodecToV4L2PixFmt(codec);
-    if (!mDevice->Open(media::V4L2Device::Type::kDecoder, inputPixelFormat)) {
-        ALOGE("Failed to open device for %s", VideoCodecToString(codec));
-        return false;
+    mDevice = std::move(device);
+    if (!mDevice) {
+        mDevice = media::V4L2Device::Create();
+        if (!mDevice->Open(media::V4L2Device::Type::kDecoder, inputPixelFormat)) {
+            ALOGE("Failed to open device for %s", VideoCodecToString(codec));
+            return false;
+        }
     }
 
     if (!mDevice->HasCapabilities(V4L2_CAP_VIDEO_M2M_MPLANE | V4L2_CAP_STREAMING)) {
@@ -204,6 +236,7 @@ void V4L2Decoder::decode(std::unique_ptr<BitstreamBuffer> buffer, DecodeCB decod
 
     mDecodeRequests.push(DecodeRequest(std::move(buffer), std::move(decodeCb)));
     pumpDecodeRequest();
+    updateOutputStarved();
 }
 
 void V4L2Decoder::drain(DecodeCB drainCb) {
@@ -273,8 +306,11 @@ void V4L2Decoder::pumpDecodeRequest() {
             return;
         }
 
-        // Pause if no free input buffer. We resume decoding after dequeueing input buffers.
-        auto inputBuffer = mInputQueue->GetFreeBuffer();
+        // Pause if no free input buffer. We resume decoding after dequeueing input buffers. The
+        // buffer last queued with the same DMABUF is preferred, to avoid importing it again. The
+        // DMABUF is matched by identity, as each work passes it through a different fd.
+        const std::vector<int> fds = {mDecodeRequests.front().buffer->dmabuf_fd};
+        auto inputBuffer = mInputQueue->GetFreeBufferForDmabufs(fds);
         ATRACE_NAME("got inputBuffer ");
         if (!inputBuffer) {
             ALOGV("There is no free input buffer.");
@@ -286,7 +322,8 @@ void V4L2Decoder::pumpDecodeRequest() {
 
         const int32_t bitstreamId = request.buffer->id;
         ALOGV("QBUF to input queue, bitstreadId=%d", bitstreamId);
-        inputBuffer->SetTimeStamp({.tv_sec = bitstreamId});
+        inputBuffer->SetTimeStamp(
+                {.tv_sec = bitstreamId, .tv_usec = static_cast<suseconds_t>(mFlushGeneration)});
         if (ATRACE_ENABLED())
             ATRACE_INT("QBUF, input", bitstreamId);
         size_t planeSize = inputBuffer->GetPlaneSize(0);
@@ -301,8 +338,6 @@ void V4L2Decoder::pumpDecodeRequest() {
               request.buffer->offset);
         inputBuffer->SetPlaneDataOffset(0, request.buffer->offset);
         inputBuffer->SetPlaneBytesUsed(0, request.buffer->offset + request.buffer->size);
-        std::vector<int> fds;
-        fds.push_back(std::move(request.buffer->dmabuf_fd));
         ATRACE_BEGIN("before QueueDMABuf ");
         if (!std::move(*inputBuffer).QueueDMABuf(fds)) {
             ALOGE("%s(): Failed to QBUF to input queue, bitstreamId=%d", __func__, bitstreamId);
@@ -331,20 +366,44 @@ void V4L2Decoder::flush() {
         return;
     }
 
+    // Cancel the decode requests which are not queued to the device yet.
+    while (!mDecodeRequests.empty()) {
+        std::move(mDecodeRequests.front().decodeCb).Run(VideoDecoder::DecodeStatus::kAborted);
+        mDecodeRequests.pop();
+    }
+
     // Call all pending callbacks.
     for (auto& item : mPendingDecodeCbs) {
         std::move(item.second).Run(VideoDecoder::DecodeStatus::kAborted);
     }
     mPendingDecodeCbs.clear();
+    const bool wasDraining = (mState == State::Draining);
     if (mDrainCb) {
         std::move(mDrainCb).Run(VideoDecoder::DecodeStatus::kAborted);
     }
 
+    // Frames decoded from the input buffers queued before the flush might still be dequeued from
+    // the output queue. Bump the generation so serviceDeviceTask() can recognize and recycle them.
+    mFlushGeneration = (mFlushGeneration + 1) % kMaxFlushGeneration;
+
+    // A seek only needs to restart the input queue. The output buffers stay allocated and queued
+    // at the device with their block ID mapping, so decoding resumes without refilling the output
+    // queue. The drain sequence can only be aborted by restarting the output queue though.
+    if (!wasDraining) {
+        ALOGV("%s(): restart input queue only, %zu output buffers kept at device", __func__,
+              mOutputQueue->QueuedBuffersCount());
+        if (!mInputQueue->Streamoff() || !mInputQueue->Streamon()) {
+            ALOGE("Failed to restart input queue.");
+            onError();
+            return;
+        }
+        setState(State::Idle);
+        return;
+    }
+
     // Streamoff both V4L2 queues to drop input and output buffers.
     mDevice->StopPolling();
     mOutputQueue->Streamoff();
-    ALOGV("%s mFrameAtDevice size:%d", __func__, (int)mFrameAtDevice.size());
-    //mFrameAtDevice.clear();
     returnVideoFrame();
     mInputQueue->Streamoff();
 
@@ -433,25 +492,42 @@ void V4L2Decoder::serviceDeviceTask(bool event) {
               bufferId, bitstreamId, bytesUsed);
 
         // Get the corresponding VideoFrame of the dequeued buffer.
-        auto it = mFrameAtDevice.find(bufferId);
-        ALOG_ASSERT(it != mFrameAtDevice.end(), "buffer %zu is not found at mFrameAtDevice",
-                    bufferId);
-        auto frame = std::move(it->second);
-        mFrameAtDevice.erase(it);
+        if (bufferId >= mFrameAtDevice.size() || !mFrameAtDevice[bufferId]) {
+            ALOGE("%s(): buffer %zu is not found at mFrameAtDevice", __func__, bufferId);
+            onError();
+            return;
+        }
+        std::unique_ptr<VideoFrame> frame = std::move(mFrameAtDevice[bufferId]);
 
-        if (bytesUsed > 0) {
+        // The frame is decoded from an input buffer queued before the last flush.
+        const bool isStale =
+                static_cast<uint32_t>(dequeuedBuffer->GetTimeStamp().tv_usec) != mFlushGeneration;
+        ALOGV_IF(isStale && bytesUsed > 0, "Drop stale output frame(bitstreamId=%d)", bitstreamId);
+
+        if (bytesUsed > 0 && !isStale) {
             ALOGV("Send output frame(bitstreamId=%d) to client", bitstreamId);
             std::shared_ptr<C2GraphicBlock> frameConverted;
 
-            mVideoFramePool->convertFrame(frame->getRawGraphicBlock(), &frameConverted);
+            applyColorAspects(bitstreamId);
+            mVideoFramePool->convertFrame(frame->getRawGraphicBlock(), mVisibleRect,
+                                          &frameConverted);
+            if (!frameConverted) {
+                ALOGE("Failed to convert output frame(bitstreamId=%d)", bitstreamId);
+                onError();
+                return;
+            }
             C2VdaBqBlockPool::flush(frameConverted);
+            // The converted frames are written in the linear layout.
+            if (frameConverted != frame->getRawGraphicBlock()) frame->setModifier(kLinearModifier);
             frame->setRawGraphicBlock(frameConverted);
             frame->setBitstreamId(bitstreamId);
-            frame->setVisibleRect(mVisibleRect);
+            frame->setVisibleRect(mPoolScaledSize.IsEmpty() ? mVisibleRect
+                                                            : media::Rect(mPoolScaledSize));
             mOutputCb.Run(std::move(frame));
         } else {
             // Workaround(b/168750131): If the buffer is not enqueued before the next drain is done,
-            // then the driver will fail to notify EOS. So we recycle the buffer immediately.
+            // then the driver will fail to notify EOS. So we recycle the buffer immediately. Stale
+            // frames are recycled in the same way.
             ALOGV("Recycle empty buffer %zu back to V4L2 output queue.", bufferId);
             dequeuedBuffer.reset();
             auto outputBuffer = mOutputQueue->GetFreeBuffer(bufferId);
@@ -462,7 +538,7 @@ void V4L2Decoder::serviceDeviceTask(bool event) {
                 onError();
                 return;
             }
-            mFrameAtDevice.insert(std::make_pair(bufferId, std::move(frame)));
+            mFrameAtDevice[bufferId] = std::move(frame);
         }
 
         if (mDrainCb && isLast) {
@@ -481,6 +557,8 @@ void V4L2Decoder::serviceDeviceTask(bool event) {
         }
     }
 
+    updateOutputStarved();
+
     // We freed some input buffers, continue handling decode requests.
     if (inputDequeued) {
         mTaskRunner->PostTask(FROM_HERE,
@@ -515,50 +593,214 @@ bool V4L2Decoder::changeResolution() {
     ATRACE_CALL();
 
     std::optional<struct v4l2_format> format = getFormatInfo();
-    std::optional<size_t> numOutputBuffers = getNumOutputBuffers();
-    if (!format || !numOutputBuffers) {
+    std::optional<size_t> minNumOutputBuffers = getMinNumOutputBuffers();
+    if (!format || !minNumOutputBuffers) {
         return false;
     }
+    size_t numOutputBuffers;
+    size_t maxNumOutputBuffers;
+    std::tie(numOutputBuffers, maxNumOutputBuffers) = getNumOutputBuffers(*minNumOutputBuffers);
 
     mCodedSize.SetSize(format->fmt.pix_mp.width, format->fmt.pix_mp.height);
     mVisibleRect = getVisibleRect(mCodedSize);
+    mOutputPixelFormat = V4L2PixFmtToOutputPixelFormat(format->fmt.pix_mp.pixelformat);
 
-    ALOGI("Need %zu output buffers. coded size: %s, visible rect: %s", *numOutputBuffers,
-          mCodedSize.ToString().c_str(), mVisibleRect.ToString().c_str());
+    ALOGI("Need %zu (up to %zu) output buffers. coded size: %s, visible rect: %s, format: %s",
+          numOutputBuffers, maxNumOutputBuffers, mCodedSize.ToString().c_str(),
+          mVisibleRect.ToString().c_str(), HalPixelFormatToString(mOutputPixelFormat));
     if (mCodedSize.IsEmpty()) {
         ALOGE("Failed to get resolution from V4L2 driver.");
         return false;
     }
 
+    // Scale the output frames down by the device if it supports it, so only small output buffers
+    // are allocated. Otherwise |mVideoFramePool| decodes into full-size buffers of its own and
+    // scales each frame into a small one.
+    mPoolScaledSize = media::Size();
+    if (!mScaledOutputSize.IsEmpty() && mScaledOutputSize != mVisibleRect.size()) {
+        if (mScaledOutputSize.width() > mVisibleRect.width() ||
+            mScaledOutputSize.height() > mVisibleRect.height()) {
+            ALOGW("Ignore the scaled output size %s larger than the visible size %s",
+                  mScaledOutputSize.ToString().c_str(), mVisibleRect.size().ToString().c_str());
+        } else if (setScaledOutputFormat(*format)) {
+            format = getFormatInfo();
+            if (!format) return false;
+            mCodedSize.SetSize(format->fmt.pix_mp.width, format->fmt.pix_mp.height);
+            mVisibleRect = media::Rect(mScaledOutputSize);
+            ALOGI("Output frames are scaled by the device, coded size: %s",
+                  mCodedSize.ToString().c_str());
+        } else if (mOutputPixelFormat == HalPixelFormat::YCBCR_P010) {
+            ALOGW("Scaling 10-bit output frames is only supported by the device");
+        } else {
+            mPoolScaledSize = mScaledOutputSize;
+            ALOGI("Output frames are scaled to %s by the CPU", mPoolScaledSize.ToString().c_str());
+        }
+    }
+
+    // Decode into a tiled or compressed layout if the driver supports one, unless the frames are
+    // scaled by the CPU. The layout is checked against the first buffer allocated by gralloc.
+    if (mPoolScaledSize.IsEmpty() && !mTiledOutputDisabled &&
+        setTiledFormat(mDevice.get(), *format)) {
+        format = getFormatInfo();
+        if (!format) return false;
+        mCodedSize.SetSize(format->fmt.pix_mp.width, format->fmt.pix_mp.height);
+    }
+    const TiledFormat* tiledFormat = findTiledFormat(format->fmt.pix_mp.pixelformat);
+    mOutputModifier = tiledFormat ? tiledFormat->modifier : kLinearModifier;
+    mOutputLayoutUsage = tiledFormat ? tiledFormat->usage : 0;
+    mCheckOutputModifier = (tiledFormat != nullptr);
+    if (tiledFormat) {
+        ALOGI("Output frames are decoded in %s layout (modifier=0x%" PRIx64 "), coded size: %s",
+              media::FourccToString(tiledFormat->v4l2PixFmt).c_str(), mOutputModifier,
+              mCodedSize.ToString().c_str());
+    }
+
+    // Adopt the output buffers allocated by preallocateOutputBuffers() if they fit the format
+    // reported by the driver.
+    const bool adoptPreallocatedBuffers = mIsPrefetching && mPreallocatedCodedSize == mCodedSize &&
+                                          mOutputPixelFormat == kOutputPixelFormat &&
+                                          !mCheckOutputModifier &&
+                                          numOutputBuffers <= mPreallocatedNumBuffers &&
+                                          maxNumOutputBuffers <= mPreallocatedMaxNumBuffers;
+    const size_t numBuffers =
+            adoptPreallocatedBuffers ? mPreallocatedNumBuffers : numOutputBuffers;
+    const size_t maxNumBuffers =
+            adoptPreallocatedBuffers ? mPreallocatedMaxNumBuffers : maxNumOutputBuffers;
+    mIsPrefetching = false;
+    std::vector<VideoFramePool::FrameWithBlockId> prefetchedFrames = std::move(mPrefetchedFrames);
+    mPrefetchedFrames.clear();
+
     mOutputQueue->Streamoff();
     mOutputQueue->DeallocateBuffers();
     mFrameAtDevice.clear();
     mBlockIdToV4L2Id.clear();
 
-    if (mOutputQueue->AllocateBuffers(*numOutputBuffers, V4L2_MEMORY_DMABUF) == 0) {
+    // The DMABUF buffers don't hold any memory until a frame is queued, so allocate the V4L2
+    // buffers for all the frames the pool may grow to.
+    if (mOutputQueue->AllocateBuffers(maxNumBuffers, V4L2_MEMORY_DMABUF) == 0) {
         ALOGE("Failed to allocate output buffer.");
         return false;
     }
+    mFrameAtDevice.resize(mOutputQueue->AllocatedBuffersCount());
     if (!mOutputQueue->Streamon()) {
         ALOGE("Failed to streamon output queue.");
         return false;
     }
 
-#ifdef OUTPUT_BGRA_8888
-    mGetPoolCb.Run(&mVideoFramePool, mCodedSize, HalPixelFormat::BGRA_8888, *numOutputBuffers);
-#else
-    mGetPoolCb.Run(&mVideoFramePool, mCodedSize, HalPixelFormat::YCBCR_420_888, *numOutputBuffers);
-#endif
+    if (adoptPreallocatedBuffers) {
+        ALOGI("Adopt %zu pre-allocated output buffers, %zu of them are fetched", numBuffers,
+              prefetchedFrames.size());
+        for (auto& frameWithBlockId : prefetchedFrames) {
+            onVideoFrameReady(std::move(frameWithBlockId));
+            if (mState == State::Error) return true;
+        }
+        tryFetchVideoFrame();
+        return true;
+    }
+
+    // Return the pre-fetched frames to the previous pool before replacing it.
+    if (!prefetchedFrames.empty()) {
+        ALOGI("Drop %zu pre-allocated output buffers of size %s", prefetchedFrames.size(),
+              mPreallocatedCodedSize.ToString().c_str());
+        prefetchedFrames.clear();
+    }
+    mGetPoolCb.Run(&mVideoFramePool, mCodedSize, mPoolScaledSize, mOutputPixelFormat,
+                   mOutputLayoutUsage, numBuffers, maxNumBuffers);
 
     if (!mVideoFramePool) {
         ALOGE("Failed to get block pool with size: %s", mCodedSize.ToString().c_str());
         return false;
     }
+    if (mColorAspects) mVideoFramePool->setColorAspects(*mColorAspects);
 
     tryFetchVideoFrame();
     return true;
 }
 
+void V4L2Decoder::preallocateOutputBuffers(const media::Size& codedSize, size_t minNumBuffers) {
+    ALOGV("%s(codedSize=%s, minNumBuffers=%zu)", __func__, codedSize.ToString().c_str(),
+          minNumBuffers);
+    ALOG_ASSERT(mTaskRunner->RunsTasksInCurrentSequence());
+    ATRACE_CALL();
+
+    // Ignore the hint if the output format is already reported by the driver. When the output is
+    // scaled, the size of the output buffers is only known once the driver reports the format.
+    if (mState == State::Error || mVideoFramePool || !mScaledOutputSize.IsEmpty()) return;
+
+    size_t numBuffers;
+    size_t maxNumBuffers;
+    std::tie(numBuffers, maxNumBuffers) = getNumOutputBuffers(minNumBuffers);
+    mGetPoolCb.Run(&mVideoFramePool, codedSize, media::Size(), kOutputPixelFormat, 0, numBuffers,
+                   maxNumBuffers);
+    if (!mVideoFramePool) {
+        // Not fatal, the buffers will be allocated when the driver reports the output format.
+        ALOGW("Failed to pre-allocate output buffers with size: %s",
+              codedSize.ToString().c_str());
+        return;
+    }
+    if (mColorAspects) mVideoFramePool->setColorAspects(*mColorAspects);
+
+    mIsPrefetching = true;
+    mPreallocatedCodedSize = codedSize;
+    mPreallocatedNumBuffers = numBuffers;
+    mPreallocatedMaxNumBuffers = maxNumBuffers;
+    prefetchVideoFrame();
+}
+
+void V4L2Decoder::setColorAspects(
+        std::shared_ptr<const C2StreamColorAspectsInfo::output> colorAspects, int32_t bitstreamId) {
+    ALOGV("%s(bitstreamId=%d, range=%d, primaries=%d, transfer=%d, matrix=%d)", __func__,
+          bitstreamId, colorAspects->range, colorAspects->primaries, colorAspects->transfer,
+          colorAspects->matrix);
+    ALOG_ASSERT(mTaskRunner->RunsTasksInCurrentSequence());
+
+    // The frames already decoded, or being decoded, keep the previous color aspects.
+    mPendingColorAspects.emplace_back(bitstreamId, std::move(colorAspects));
+}
+
+void V4L2Decoder::applyColorAspects(int32_t bitstreamId) {
+    ALOG_ASSERT(mTaskRunner->RunsTasksInCurrentSequence());
+
+    bool changed = false;
+    while (!mPendingColorAspects.empty() && mPendingColorAspects.front().first <= bitstreamId) {
+        mColorAspects = std::move(mPendingColorAspects.front().second);
+        mPendingColorAspects.pop_front();
+        changed = true;
+    }
+    if (changed && mVideoFramePool) mVideoFramePool->setColorAspects(*mColorAspects);
+}
+
+void V4L2Decoder::prefetchVideoFrame() {
+    ALOGV("%s()", __func__);
+    ALOG_ASSERT(mTaskRunner->RunsTasksInCurrentSequence());
+
+    if (mPrefetchedFrames.size() >= mPreallocatedNumBuffers) return;
+
+    if (!mVideoFramePool->getVideoFrame(
+                ::base::BindOnce(&V4L2Decoder::onVideoFramePrefetched, mWeakThis))) {
+        ALOGV("%s(): Previous callback is running, ignore.", __func__);
+    }
+}
+
+void V4L2Decoder::onVideoFramePrefetched(
+        std::optional<VideoFramePool::FrameWithBlockId> frameWithBlockId) {
+    ALOGV("%s()", __func__);
+    ALOG_ASSERT(mTaskRunner->RunsTasksInCurrentSequence());
+
+    // The pre-allocated buffers have been adopted while the frame was being fetched.
+    if (!mIsPrefetching) {
+        onVideoFrameReady(std::move(frameWithBlockId));
+        return;
+    }
+
+    if (!frameWithBlockId) {
+        ALOGW("Failed to pre-fetch VideoFrame.");
+        return;
+    }
+    mPrefetchedFrames.push_back(std::move(*frameWithBlockId));
+    prefetchVideoFrame();
+}
+
 void V4L2Decoder::tryFetchVideoFrame() {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mTaskRunner->RunsTasksInCurrentSequence());
@@ -574,20 +816,27 @@ void V4L2Decoder::tryFetchVideoFrame() {
                 ::base::BindOnce(&V4L2Decoder::onVideoFrameReady, mWeakThis))) {
         ALOGV("%s(): Previous callback is running, ignore.", __func__);
     }
+    updateOutputStarved();
+}
+
+void V4L2Decoder::recycleFrame(std::unique_ptr<VideoFrame> frame) {
+    ALOGV("%s()", __func__);
+    ALOG_ASSERT(mTaskRunner->RunsTasksInCurrentSequence());
+
+    // A frame output before the pool was replaced is dropped by the new pool, unless its block is
+    // part of the new buffer set too, its file descriptors being checked when it's reused.
+    if (mVideoFramePool) mVideoFramePool->recycleFrame(std::move(frame));
 }
 
 void V4L2Decoder::returnVideoFrame() {
     ALOGV("%s()", __func__);
 
-    std::map<size_t, std::unique_ptr<VideoFrame>>::iterator iter;
-    iter = mFrameAtDevice.begin();
-    while (iter != mFrameAtDevice.end()) {
-        auto frame = std::move(iter->second);
+    // The slots are kept, as the output buffers stay allocated.
+    for (std::unique_ptr<VideoFrame>& frame : mFrameAtDevice) {
+        if (!frame) continue;
         mVideoFramePool->retrunFrame(frame->getRawGraphicBlock());
-        iter++;
+        frame.reset();
     }
-
-    mFrameAtDevice.clear();
 }
 
 void V4L2Decoder::onVideoFrameReady(
@@ -607,6 +856,21 @@ void V4L2Decoder::onVideoFrameReady(
     uint32_t blockId;
     std::tie(frame, blockId) = std::move(*frameWithBlockId);
 
+    // The driver writes the negotiated layout, which gralloc and the display must expect too.
+    if (mCheckOutputModifier) {
+        mCheckOutputModifier = false;
+        const std::optional<uint64_t> modifier = frame->queryModifier();
+        if (modifier != mOutputModifier) {
+            ALOGW("The output buffers are allocated with modifier 0x%" PRIx64
+                  " instead of 0x%" PRIx64 ", fall back to the linear layout",
+                  modifier.value_or(kLinearModifier), mOutputModifier);
+            frame.reset();
+            if (!fallBackToLinearOutputFormat()) onError();
+            return;
+        }
+    }
+    frame->setModifier(mOutputModifier);
+
     ::base::Optional<media::V4L2WritableBufferRef> outputBuffer;
     // Find the V4L2 buffer that is associated with this block.
     auto iter = mBlockIdToV4L2Id.find(blockId);
@@ -640,17 +904,35 @@ void V4L2Decoder::onVideoFrameReady(
         onError();
         return;
     }
-    if (mFrameAtDevice.find(v4l2Id) != mFrameAtDevice.end()) {
+    if (mFrameAtDevice[v4l2Id]) {
         ALOGE("%s(): V4L2 buffer %d already enqueued.", __func__, v4l2Id);
         onError();
         return;
     }
-    mFrameAtDevice.insert(std::make_pair(v4l2Id, std::move(frame)));
+    mFrameAtDevice[v4l2Id] = std::move(frame);
 
     tryFetchVideoFrame();
 }
 
-std::optional<size_t> V4L2Decoder::getNumOutputBuffers() {
+void V4L2Decoder::updateOutputStarved() {
+    ALOG_ASSERT(mTaskRunner->RunsTasksInCurrentSequence());
+
+    if (!mVideoFramePool || mIsPrefetching) return;
+
+    // The decoding is starved if fetching an output buffer is blocked on the block pool while
+    // input is pending. The device might still have output buffers queued, e.g. when the frames
+    // it holds are used as references, so their number isn't taken into account.
+    const bool hasPendingInput =
+            !mDecodeRequests.empty() || mInputQueue->QueuedBuffersCount() > 0;
+    mVideoFramePool->setOutputStarved(hasPendingInput && mVideoFramePool->isFetching());
+}
+
+std::pair<size_t, size_t> V4L2Decoder::getNumOutputBuffers(size_t minNumBuffers) const {
+    const size_t maxNumBuffers = minNumBuffers + kNumExtraOutputBuffers;
+    return {mIncrementalOutputBuffers ? minNumBuffers : maxNumBuffers, maxNumBuffers};
+}
+
+std::optional<size_t> V4L2Decoder::getMinNumOutputBuffers() {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mTaskRunner->RunsTasksInCurrentSequence());
 
@@ -663,7 +945,7 @@ std::optional<size_t> V4L2Decoder::getNumOutputBuffers() {
     }
     ALOGV("%s() V4L2_CID_MIN_BUFFERS_FOR_CAPTURE returns %u", __func__, ctrl.value);
 
-    return ctrl.value + kNumExtraOutputBuffers;
+    return ctrl.value;
 }
 
 std::optional<struct v4l2_format> V4L2Decoder::getFormatInfo() {
@@ -682,6 +964,84 @@ std::optional<struct v4l2_format> V4L2Decoder::getFormatInfo() {
     return format;
 }
 
+bool V4L2Decoder::setScaledOutputFormat(const struct v4l2_format& format) {
+    ALOGV("%s()", __func__);
+    ALOG_ASSERT(mTaskRunner->RunsTasksInCurrentSequence());
+
+    // A decoder scales the decoded frames if its compose rectangle on the capture queue is
+    // writable, as described by the V4L2 stateful decoder interface. The driver adjusts the
+    // rectangle to what it supports, and keeps the visible size if it can't scale.
+    struct v4l2_selection selection_arg;
+    memset(&selection_arg, 0, sizeof(selection_arg));
+    selection_arg.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    selection_arg.target = V4L2_SEL_TGT_COMPOSE;
+    selection_arg.r.width = mScaledOutputSize.width();
+    selection_arg.r.height = mScaledOutputSize.height();
+    if (mDevice->Ioctl(VIDIOC_S_SELECTION, &selection_arg) != 0) {
+        ALOGV("Setting the compose rectangle is not supported, the device can't scale");
+        return false;
+    }
+    if (selection_arg.r.left != 0 || selection_arg.r.top != 0 ||
+        selection_arg.r.width != static_cast<uint32_t>(mScaledOutputSize.width()) ||
+        selection_arg.r.height != static_cast<uint32_t>(mScaledOutputSize.height())) {
+        ALOGV("The device can't scale to %s", mScaledOutputSize.ToString().c_str());
+        selection_arg.r.left = mVisibleRect.x();
+        selection_arg.r.top = mVisibleRect.y();
+        selection_arg.r.width = mVisibleRect.width();
+        selection_arg.r.height = mVisibleRect.height();
+        if (mDevice->Ioctl(VIDIOC_S_SELECTION, &selection_arg) != 0) {
+            ALOGW("Failed to restore the compose rectangle");
+        }
+        return false;
+    }
+
+    // Shrink the output buffers to the scaled size. The size may be aligned up by the driver, the
+    // frames are then cropped to |mScaledOutputSize|. If the driver keeps the full size, the
+    // scaled frames are composed into full-size buffers.
+    struct v4l2_format scaledFormat = format;
+    scaledFormat.fmt.pix_mp.width = mScaledOutputSize.width();
+    scaledFormat.fmt.pix_mp.height = mScaledOutputSize.height();
+    if (mDevice->Ioctl(VIDIOC_S_FMT, &scaledFormat) != 0) {
+        ALOGV("VIDIOC_S_FMT with the scaled output size is not supported");
+        return true;
+    }
+    const uint32_t width = scaledFormat.fmt.pix_mp.width;
+    const uint32_t height = scaledFormat.fmt.pix_mp.height;
+    if (width < static_cast<uint32_t>(mScaledOutputSize.width()) ||
+        height < static_cast<uint32_t>(mScaledOutputSize.height())) {
+        struct v4l2_format originalFormat = format;
+        if (mDevice->Ioctl(VIDIOC_S_FMT, &originalFormat) != 0) {
+            ALOGW("Failed to restore the output format");
+        }
+    }
+    return true;
+}
+
+bool V4L2Decoder::fallBackToLinearOutputFormat() {
+    ALOGV("%s()", __func__);
+    ALOG_ASSERT(mTaskRunner->RunsTasksInCurrentSequence());
+
+    mTiledOutputDisabled = true;
+    mOutputQueue->Streamoff();
+    mOutputQueue->DeallocateBuffers();
+    mFrameAtDevice.clear();
+    mBlockIdToV4L2Id.clear();
+
+    std::optional<struct v4l2_format> format = getFormatInfo();
+    if (!format) return false;
+    const TiledFormat* tiledFormat = findTiledFormat(format->fmt.pix_mp.pixelformat);
+    if (tiledFormat) {
+        format->fmt.pix_mp.pixelformat = tiledFormat->linearV4L2PixFmt;
+        if (mDevice->Ioctl(VIDIOC_S_FMT, &*format) != 0 ||
+            format->fmt.pix_mp.pixelformat != tiledFormat->linearV4L2PixFmt) {
+            ALOGE("Failed to set the output format to %s",
+                  media::FourccToString(tiledFormat->linearV4L2PixFmt).c_str());
+            return false;
+        }
+    }
+    return changeResolution();
+}
+
 media::Rect V4L2Decoder::getVisibleRect(const media::Size& codedSize) {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mTaskRunner->RunsTasksInCurrentSequence());
@@ -9,8 +9,10 @@
 #include <v4l2_codec2/components/V4L2EncodeComponent.h>
 
 #include <inttypes.h>
+#include <sys/stat.h>
 
 #include <algorithm>
+#include <cmath>
 #include <utility>
 
 #include <C2AllocatorGralloc.h>
@@ -19,6 +21,7 @@
 #include <android/hardware/graphics/common/1.0/types.h>
 #include <base/bind.h>
 #include <base/bind_helpers.h>
+#include <base/time/time.h>
 #include <log/log.h>
 #include <media/stagefright/MediaDefs.h>
 #include <ui/GraphicBuffer.h>
@@ -31,6 +34,9 @@
 #include <v4l2_codec2/common/Common.h>
 #include <v4l2_codec2/common/EncodeHelpers.h>
 #include <v4l2_codec2/common/VideoTypes.h>  // for HalPixelFormat
+#include <v4l2_codec2/components/V4L2PrewarmPool.h>
+#include <v4l2_codec2/plugin_store/C2RecyclingGraphicAllocator.h>
+#include <v4l2_codec2/store/V4L2SessionScheduler.h>
 #include <v4l2_device.h>
 #include <video_pixel_format.h>
 
@@ -197,6 +203,130 @@ size_t GetMaxOutputBufferSize(const media::Size& size) {
 constexpr size_t kInputBufferCount = 4;
 constexpr size_t kOutputBufferCount = 4;
 
+// The maximum number of input buffer layouts we cache. The cache is cleared when it's full, which
+// only happens if the producer keeps allocating new buffers.
+constexpr size_t kMaxInputLayoutCacheSize = 32;
+
+// The size of the macroblocks a QP map applies to, and the maximal QP delta of a macroblock.
+constexpr uint32_t kQpMapBlockSize = 16;
+constexpr int32_t kMaxQpDelta = 51;
+
+// The number of recently encoded frames the session statistics are averaged over.
+constexpr size_t kSessionStatsWindow = 30;
+
+const char* kEncoderThreadName = "V4L2EncodeComponentThread";
+
+// Get the V4L2 pixel format of the output profile configured on |interface|, 0 if not supported.
+uint32_t getOutputPixelFormat(const V4L2EncodeInterface& interface) {
+    return media::V4L2Device::VideoCodecProfileToV4L2PixFmt(
+            c2ProfileToVideoCodecProfile(interface.getOutputProfile()), false);
+}
+
+// Get the time elapsed between |start| and |end| in microseconds, clamped to the uint32_t range.
+uint32_t elapsedMicroseconds(std::chrono::steady_clock::time_point start,
+                             std::chrono::steady_clock::time_point end) {
+    const int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    return static_cast<uint32_t>(std::clamp<int64_t>(us, 0, UINT32_MAX));
+}
+
+// Check whether the device supports the menu item |index| of the menu control |ctrlId|.
+bool isCtrlMenuItemSupported(media::V4L2Device* device, uint32_t ctrlId, uint32_t index) {
+    struct v4l2_querymenu queryMenu;
+    memset(&queryMenu, 0, sizeof(queryMenu));
+    queryMenu.id = ctrlId;
+    queryMenu.index = index;
+    return device->Ioctl(VIDIOC_QUERYMENU, &queryMenu) == 0;
+}
+
+// Set the |ctrls| on the |device| in a single call. Setting a batch of controls fails as a whole if
+// any control is not supported by the device, fall back to setting the controls one by one then,
+// so the supported ones are still applied. Return false if any control failed to be set.
+bool setExtCtrlsOrEach(media::V4L2Device* device, const std::vector<media::V4L2ExtCtrl>& ctrls) {
+    if (ctrls.empty() || device->SetExtCtrls(V4L2_CTRL_CLASS_MPEG, ctrls)) return true;
+
+    bool success = true;
+    for (const media::V4L2ExtCtrl& ctrl : ctrls) {
+        if (ctrls.size() > 1 && device->SetExtCtrls(V4L2_CTRL_CLASS_MPEG, {ctrl})) continue;
+        ALOGW("Failed to set control %#x", ctrl.ctrl.id);
+        success = false;
+    }
+    return success;
+}
+
+// Convert the HEVC |profile| to the matching V4L2 menu item.
+std::optional<uint32_t> videoCodecProfileToV4L2HevcProfile(media::VideoCodecProfile profile) {
+    switch (profile) {
+    case media::HEVCPROFILE_MAIN:
+        return V4L2_MPEG_VIDEO_HEVC_PROFILE_MAIN;
+    case media::HEVCPROFILE_MAIN10:
+        return V4L2_MPEG_VIDEO_HEVC_PROFILE_MAIN_10;
+    case media::HEVCPROFILE_MAIN_STILL_PICTURE:
+        return V4L2_MPEG_VIDEO_HEVC_PROFILE_MAIN_STILL_PICTURE;
+    default:
+        return std::nullopt;
+    }
+}
+
+// Convert the VP9 |profile| to the matching V4L2 menu item.
+std::optional<uint32_t> videoCodecProfileToV4L2Vp9Profile(media::VideoCodecProfile profile) {
+    switch (profile) {
+    case media::VP9PROFILE_PROFILE0:
+        return V4L2_MPEG_VIDEO_VP9_PROFILE_0;
+    case media::VP9PROFILE_PROFILE1:
+        return V4L2_MPEG_VIDEO_VP9_PROFILE_1;
+    case media::VP9PROFILE_PROFILE2:
+        return V4L2_MPEG_VIDEO_VP9_PROFILE_2;
+    case media::VP9PROFILE_PROFILE3:
+        return V4L2_MPEG_VIDEO_VP9_PROFILE_3;
+    default:
+        return std::nullopt;
+    }
+}
+
+// Convert the HEVC |level| to the matching V4L2 menu item. The tier is set separately.
+std::optional<uint32_t> c2LevelToV4L2HevcLevel(C2Config::level_t level) {
+    switch (level) {
+    case C2Config::LEVEL_HEVC_MAIN_1:
+        return V4L2_MPEG_VIDEO_HEVC_LEVEL_1;
+    case C2Config::LEVEL_HEVC_MAIN_2:
+        return V4L2_MPEG_VIDEO_HEVC_LEVEL_2;
+    case C2Config::LEVEL_HEVC_MAIN_2_1:
+        return V4L2_MPEG_VIDEO_HEVC_LEVEL_2_1;
+    case C2Config::LEVEL_HEVC_MAIN_3:
+        return V4L2_MPEG_VIDEO_HEVC_LEVEL_3;
+    case C2Config::LEVEL_HEVC_MAIN_3_1:
+        return V4L2_MPEG_VIDEO_HEVC_LEVEL_3_1;
+    case C2Config::LEVEL_HEVC_MAIN_4:
+    case C2Config::LEVEL_HEVC_HIGH_4:
+        return V4L2_MPEG_VIDEO_HEVC_LEVEL_4;
+    case C2Config::LEVEL_HEVC_MAIN_4_1:
+    case C2Config::LEVEL_HEVC_HIGH_4_1:
+        return V4L2_MPEG_VIDEO_HEVC_LEVEL_4_1;
+    case C2Config::LEVEL_HEVC_MAIN_5:
+    case C2Config::LEVEL_HEVC_HIGH_5:
+        return V4L2_MPEG_VIDEO_HEVC_LEVEL_5;
+    case C2Config::LEVEL_HEVC_MAIN_5_1:
+    case C2Config::LEVEL_HEVC_HIGH_5_1:
+        return V4L2_MPEG_VIDEO_HEVC_LEVEL_5_1;
+    default:
+        return std::nullopt;
+    }
+}
+
+bool isC2HevcHighTierLevel(C2Config::level_t level) {
+    return level == C2Config::LEVEL_HEVC_HIGH_4 || level == C2Config::LEVEL_HEVC_HIGH_4_1 ||
+           level == C2Config::LEVEL_HEVC_HIGH_5 || level == C2Config::LEVEL_HEVC_HIGH_5_1;
+}
+
+// Get the temporal layer of the frame at |index| frames after the last key frame, for the dyadic
+// hierarchical-P prediction structure with |numLayers| layers. E.g. the frames are assigned the
+// layers 0,1,0,1,... for two layers, and 0,2,1,2,... for three layers.
+uint32_t getTemporalLayerId(uint32_t numLayers, uint32_t index) {
+    const uint32_t position = index % (1u << (numLayers - 1));
+    if (position == 0) return 0;
+    return numLayers - 1 - __builtin_ctz(position);
+}
+
 // Define V4L2_CID_MPEG_VIDEO_H264_SPS_PPS_BEFORE_IDR control code if not present in header files.
 #ifndef V4L2_CID_MPEG_VIDEO_H264_SPS_PPS_BEFORE_IDR
 #define V4L2_CID_MPEG_VIDEO_H264_SPS_PPS_BEFORE_IDR (V4L2_CID_MPEG_BASE + 388)
@@ -237,23 +367,33 @@ V4L2EncodeComponent::V4L2EncodeComponent(C2String name, c2_node_id_t id,
       : mName(name),
         mId(id),
         mInterface(std::move(interface)),
-        mComponentState(ComponentState::LOADED) {
+        mComponentState(ComponentState::LOADED),
+        mSchedulerSessionId(V4L2SessionScheduler::getInstance().registerSession()),
+        mEncoderThread(std::make_unique<::base::Thread>(kEncoderThreadName)) {
     ALOGV("%s(%s)", __func__, name.c_str());
+
+    // Prepare the device and the threads of the codec while the client configures the component.
+    const uint32_t outputPixelFormat = getOutputPixelFormat(*mInterface);
+    if (outputPixelFormat) {
+        V4L2PrewarmPool::getInstance().prewarm(media::V4L2Device::Type::kEncoder,
+                                               outputPixelFormat, kEncoderThreadName);
+    }
 }
 
 V4L2EncodeComponent::~V4L2EncodeComponent() {
     ALOGV("%s()", __func__);
 
     // Stop encoder thread and invalidate pointers if component wasn't stopped before destroying.
-    if (mEncoderThread.IsRunning()) {
+    if (mEncoderThread->IsRunning()) {
         mEncoderTaskRunner->PostTask(
                 FROM_HERE, ::base::BindOnce(
                                    [](::base::WeakPtrFactory<V4L2EncodeComponent>* weakPtrFactory) {
                                        weakPtrFactory->InvalidateWeakPtrs();
                                    },
                                    &mWeakThisFactory));
-        mEncoderThread.Stop();
+        mEncoderThread->Stop();
     }
+    V4L2SessionScheduler::getInstance().unregisterSession(mSchedulerSessionId);
     ALOGV("%s(): done", __func__);
 }
 
@@ -268,18 +408,27 @@ c2_status_t V4L2EncodeComponent::start() {
         return C2_BAD_STATE;
     }
 
-    if (!mEncoderThread.Start()) {
+    // Adopt the device and the threads prepared in the background, if they are ready.
+    scoped_refptr<media::V4L2Device> device;
+    std::unique_ptr<::base::Thread> thread;
+    const uint32_t outputPixelFormat = getOutputPixelFormat(*mInterface);
+    if (outputPixelFormat &&
+        V4L2PrewarmPool::getInstance().take(media::V4L2Device::Type::kEncoder, outputPixelFormat,
+                                            &device, &thread)) {
+        mEncoderThread = std::move(thread);
+    } else if (!mEncoderThread->Start()) {
         ALOGE("Failed to start encoder thread");
         return C2_CORRUPTED;
     }
-    mEncoderTaskRunner = mEncoderThread.task_runner();
+    mEncoderTaskRunner = mEncoderThread->task_runner();
     mWeakThis = mWeakThisFactory.GetWeakPtr();
 
     // Initialize the encoder on the encoder thread.
     ::base::WaitableEvent done;
     bool success = false;
-    mEncoderTaskRunner->PostTask(
-            FROM_HERE, ::base::Bind(&V4L2EncodeComponent::startTask, mWeakThis, &success, &done));
+    mEncoderTaskRunner->PostTask(FROM_HERE,
+                                 ::base::BindOnce(&V4L2EncodeComponent::startTask, mWeakThis,
+                                                  std::move(device), &success, &done));
     done.Wait();
 
     if (!success) {
@@ -302,7 +451,7 @@ c2_status_t V4L2EncodeComponent::stop() {
     }
 
     // Return immediately if the component is already stopped.
-    if (!mEncoderThread.IsRunning()) {
+    if (!mEncoderThread->IsRunning()) {
         return C2_OK;
     }
 
@@ -311,7 +460,7 @@ c2_status_t V4L2EncodeComponent::stop() {
     mEncoderTaskRunner->PostTask(
             FROM_HERE, ::base::BindOnce(&V4L2EncodeComponent::stopTask, mWeakThis, &done));
     done.Wait();
-    mEncoderThread.Stop();
+    mEncoderThread->Stop();
 
     setComponentState(ComponentState::LOADED);
 
@@ -415,7 +564,7 @@ c2_status_t V4L2EncodeComponent::setListener_vb(const std::shared_ptr<Listener>&
     std::lock_guard<std::mutex> lock(mComponentLock);
 
     // If the encoder thread is not running it's safe to update the listener directly.
-    if (!mEncoderThread.IsRunning()) {
+    if (!mEncoderThread->IsRunning()) {
         mListener = listener;
         return C2_OK;
     }
@@ -437,12 +586,13 @@ std::shared_ptr<C2ComponentInterface> V4L2EncodeComponent::intf() {
     return std::make_shared<SimpleInterface<V4L2EncodeInterface>>(mName.c_str(), mId, mInterface);
 }
 
-void V4L2EncodeComponent::startTask(bool* success, ::base::WaitableEvent* done) {
+void V4L2EncodeComponent::startTask(scoped_refptr<media::V4L2Device> device, bool* success,
+                                    ::base::WaitableEvent* done) {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
     ALOG_ASSERT(mEncoderState == EncoderState::UNINITIALIZED);
 
-    *success = initializeEncoder();
+    *success = initializeEncoder(std::move(device));
     done->Signal();
 }
 
@@ -457,6 +607,7 @@ void V4L2EncodeComponent::stopTask(::base::WaitableEvent* done) {
     // Deallocate all V4L2 device input and output buffers.
     destroyInputBuffers();
     destroyOutputBuffers();
+    mInputLayoutCache.clear();
 
     // Invalidate all weak pointers so no more functions will be executed on the encoder thread.
     mWeakThisFactory.InvalidateWeakPtrs();
@@ -479,6 +630,7 @@ void V4L2EncodeComponent::queueTask(std::unique_ptr<C2Work> work) {
           work->input.ordinal.frameIndex.peekull(), work->input.ordinal.timestamp.peekull(),
           work->input.flags & C2FrameData::FLAG_END_OF_STREAM);
 
+    mFrameTimes[work->input.ordinal.frameIndex.peeku()].mQueued = std::chrono::steady_clock::now();
     mInputWorkQueue.push(std::move(work));
 
     // If we were waiting for work, start encoding again.
@@ -548,20 +700,37 @@ void V4L2EncodeComponent::onDrainDone(bool done) {
         return;
     }
 
-    // Mark the last item in the output work queue as EOS done.
+    // Mark the last item in the output work queue as EOS done. All encoded output has been
+    // returned now. When B-frames are used the EOS work item might not be the last one with
+    // encoded output in decoding order, in which case we move the EOS flag to the work item that
+    // will be reported last. An empty EOS work item is always reported last.
     C2Work* eosWork = mOutputWorkQueue.back().get();
+    if (!eosWork->input.buffers.empty() && !mOutputOrder.empty() &&
+        mOutputOrder.back() != eosWork->input.ordinal.frameIndex.peeku()) {
+        C2Work* lastWork = getWorkByIndex(mOutputOrder.back());
+        if (!lastWork) {
+            reportError(C2_CORRUPTED);
+            return;
+        }
+        ALOGV("Moving EOS from work item %" PRIu64 " to %" PRIu64 " in decoding order",
+              eosWork->input.ordinal.frameIndex.peeku(), mOutputOrder.back());
+        eosWork->input.flags = static_cast<C2FrameData::flags_t>(
+                eosWork->input.flags & ~C2FrameData::FLAG_END_OF_STREAM);
+        lastWork->input.flags = static_cast<C2FrameData::flags_t>(
+                lastWork->input.flags | C2FrameData::FLAG_END_OF_STREAM);
+        eosWork = lastWork;
+    }
     eosWork->worklets.back()->output.flags = C2FrameData::FLAG_END_OF_STREAM;
 
     // Draining is done which means all buffers on the device output queue have been returned, but
     // not all buffers on the device input queue might have been returned yet.
-    if ((mOutputWorkQueue.size() > 1) || !isWorkDone(*eosWork)) {
+    reportFinishedWorks();
+    if (!mOutputWorkQueue.empty()) {
         ALOGV("Draining done, waiting for input buffers to be returned");
         return;
     }
 
     ALOGV("Draining done");
-    reportWork(std::move(mOutputWorkQueue.front()));
-    mOutputWorkQueue.pop_front();
 
     // Draining the encoder is now done, we can start encoding again.
     if (!mInputWorkQueue.empty()) {
@@ -602,16 +771,25 @@ void V4L2EncodeComponent::setListenerTask(const std::shared_ptr<Listener>& liste
     done->Signal();
 }
 
-bool V4L2EncodeComponent::initializeEncoder() {
+bool V4L2EncodeComponent::initializeEncoder(scoped_refptr<media::V4L2Device> device) {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
     ALOG_ASSERT(mEncoderState == EncoderState::UNINITIALIZED);
 
     mVisibleSize = mInterface->getInputVisibleSize();
+    mPictureSize = mVisibleSize;
+    mPendingPictureSize.reset();
+    mInterface->takePictureSizeChanged();
+    mConfiguredPictureSize = mPictureSize;
     mKeyFramePeriod = mInterface->getKeyFramePeriod();
     mKeyFrameCounter = 0;
     mCSDSubmitted = false;
 
+    // Apply the dynamic encoding parameters to the newly opened device at the first frame.
+    mBitrate = 0;
+    mFramerate = 0;
+    mInterface->markDynamicParamsChanged();
+
     // Open the V4L2 device for encoding to the requested output format.
     // TODO(dstaessens): Do we need to close the device first if already opened?
     // TODO(dstaessens): Avoid conversion to VideoCodecProfile and use C2Config::profile_t directly.
@@ -623,6 +801,27 @@ bool V4L2EncodeComponent::initializeEncoder() {
         ALOGE("Invalid output profile %s", media::GetProfileName(outputProfile).c_str());
         return false;
     }
+    mOutputProfile = outputProfile;
+    mOutputCodec = videoCodecProfileToVideoCodec(outputProfile);
+    // VP8 and VP9 streams don't have any codec-specific data.
+    mCSDSubmitted = mOutputCodec == media::kCodecVP8 || mOutputCodec == media::kCodecVP9;
+
+    // B-frames are not allowed in the H.264 Baseline profile, nor in VP8 and VP9. The device holds
+    // on to the input buffers of the B-frames until the next reference frame is encoded, so we
+    // need extra input buffers to keep the device busy.
+    mNumBFrames = mInterface->getNumBFrames();
+    if (mNumBFrames > 0 && (outputProfile == media::H264PROFILE_BASELINE ||
+                            mOutputCodec == media::kCodecVP8 || mOutputCodec == media::kCodecVP9)) {
+        ALOGW("B-frames are not supported by profile %s, disabling B-frames",
+              media::GetProfileName(outputProfile).c_str());
+        mNumBFrames = 0;
+    }
+    mInputBufferCount = kInputBufferCount + mNumBFrames;
+    mNumTemporalLayers = 0;
+    mTemporalLayerFrameCounter = 0;
+    mEncodedFrameCount = 0;
+    mEncodedKeyFrameCount = 0;
+    mRecentFrameStats.clear();
 
     std::optional<uint32_t> stride =
             getVideoFrameStride(kInputPixelFormat, mVisibleSize);
@@ -631,17 +830,20 @@ bool V4L2EncodeComponent::initializeEncoder() {
         return false;
     }
 
-    mDevice = media::V4L2Device::Create();
+    mDevice = std::move(device);
     if (!mDevice) {
-        ALOGE("Failed to create V4L2 device");
-        return false;
-    }
+        mDevice = media::V4L2Device::Create();
+        if (!mDevice) {
+            ALOGE("Failed to create V4L2 device");
+            return false;
+        }
 
-    if (!mDevice->Open(media::V4L2Device::Type::kEncoder, outputPixelFormat)) {
-        ALOGE("Failed to open device for profile %s (%s)",
-              media::GetProfileName(outputProfile).c_str(),
-              media::FourccToString(outputPixelFormat).c_str());
-        return false;
+        if (!mDevice->Open(media::V4L2Device::Type::kEncoder, outputPixelFormat)) {
+            ALOGE("Failed to open device for profile %s (%s)",
+                  media::GetProfileName(outputProfile).c_str(),
+                  media::FourccToString(outputPixelFormat).c_str());
+            return false;
+        }
     }
 
     // Make sure the device has all required capabilities (multi-planar Memory-To-Memory and
@@ -668,7 +870,9 @@ bool V4L2EncodeComponent::initializeEncoder() {
     if (!configureOutputFormat(outputProfile)) return false;
 
     // Configure the input format. If the device doesn't support the specified format we'll use one
-    // of the device's preferred formats in combination with an input format convertor.
+    // of the device's preferred formats in combination with an input format convertor. The
+    // convertor of a previous session is never kept, the device is opened again.
+    mInputFormatConverter.reset();
     if (!configureInputFormat(kInputPixelFormat, *stride)) return false;
 
     // Create input and output buffers.
@@ -676,8 +880,11 @@ bool V4L2EncodeComponent::initializeEncoder() {
     if (!createInputBuffers() || !createOutputBuffers()) return false;
 
     // Configure the device, setting all required controls.
-    uint8_t level = c2LevelToLevelIDC(mInterface->getOutputLevel());
-    if (!configureDevice(outputProfile, level)) return false;
+    std::optional<uint8_t> h264Level;
+    if (mOutputCodec == media::kCodecH264) {
+        h264Level = c2LevelToLevelIDC(mInterface->getOutputLevel());
+    }
+    if (!configureDevice(outputProfile, h264Level)) return false;
 
     // We're ready to start encoding now.
     setEncoderState(EncoderState::WAITING_FOR_INPUT);
@@ -694,16 +901,22 @@ bool V4L2EncodeComponent::initializeEncoder() {
 bool V4L2EncodeComponent::configureInputFormat(media::VideoPixelFormat inputFormat, uint32_t stride) {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
-    ALOG_ASSERT(mEncoderState == EncoderState::UNINITIALIZED);
+    ALOG_ASSERT(mEncoderState == EncoderState::UNINITIALIZED ||
+                mEncoderState == EncoderState::CHANGING_RESOLUTION);
     ALOG_ASSERT(!mInputQueue->IsStreaming());
     ALOG_ASSERT(!mVisibleSize.IsEmpty());
-    ALOG_ASSERT(!mInputFormatConverter);
+
+    // If the input format convertor is kept across a resolution change, the device reads the
+    // frames from its blocks. The format then keeps the size of these blocks, and only the visible
+    // rectangle is changed.
+    const media::Size formatSize =
+            mInputFormatConverter ? mInputFormatConverter->codedSize() : mVisibleSize;
 
     // First try to use the requested pixel format directly.
     ::base::Optional<struct v4l2_format> format;
     auto fourcc = media::Fourcc::FromVideoPixelFormat(inputFormat, false);
     if (fourcc) {
-        format = mInputQueue->SetFormat(fourcc->ToV4L2PixFmt(), mVisibleSize, 0, stride);
+        format = mInputQueue->SetFormat(fourcc->ToV4L2PixFmt(), formatSize, 0, stride);
     }
 
     // If the device doesn't support the requested input format we'll try the device's preferred
@@ -713,7 +926,7 @@ bool V4L2EncodeComponent::configureInputFormat(media::VideoPixelFormat inputForm
         std::vector<uint32_t> preferredFormats =
                 mDevice->PreferredInputFormat(media::V4L2Device::Type::kEncoder);
         for (uint32_t i = 0; !format && i < preferredFormats.size(); ++i) {
-            format = mInputQueue->SetFormat(preferredFormats[i], mVisibleSize, 0, stride);
+            format = mInputQueue->SetFormat(preferredFormats[i], formatSize, 0, stride);
         }
     }
 
@@ -742,6 +955,13 @@ bool V4L2EncodeComponent::configureInputFormat(media::VideoPixelFormat inputForm
     // TODO(dstaessens): How is this different from mInputLayout->coded_size()?
     mInputCodedSize = media::V4L2Device::AllocatedSizeFromV4L2Format(*format);
 
+    // The blocks of a kept convertor can only be used if the device didn't adjust their size.
+    if (mInputFormatConverter && mInputFormatConverter->codedSize() != mInputCodedSize) {
+        ALOGV("Input coded size changed to %s, reallocating the input format convertor",
+              mInputCodedSize.ToString().c_str());
+        mInputFormatConverter.reset();
+    }
+
     // Add an input format convertor if the device doesn't support the requested input format.
     // Note: The amount of input buffers in the convertor should match the amount of buffers on the
     // device input queue, to simplify logic.
@@ -749,13 +969,18 @@ bool V4L2EncodeComponent::configureInputFormat(media::VideoPixelFormat inputForm
     // buffer always seems to fail unless we copy it into a new a buffer first. As a temporary
     // workaround the line below is commented, but this should be undone once the issue is fixed.
     //if (mInputLayout->format() != inputFormat) {
-    ALOGV("Creating input format convertor (%s)",
-          media::VideoPixelFormatToString(mInputLayout->format()).c_str());
-    mInputFormatConverter =
-            FormatConverter::Create(inputFormat, mVisibleSize, kInputBufferCount, mInputCodedSize);
     if (!mInputFormatConverter) {
-        ALOGE("Failed to created input format convertor");
-        return false;
+        ALOGV("Creating input format convertor (%s)",
+              media::VideoPixelFormatToString(mInputLayout->format()).c_str());
+        // The converted blocks are allocated through the recycling allocator, so a session started
+        // right after another one with the same size reuses its buffers.
+        mInputFormatConverter = FormatConverter::Create(
+                inputFormat, mVisibleSize, mInputBufferCount, mInputCodedSize,
+                C2RecyclingGraphicAllocator::getBasicGraphicBlockPool());
+        if (!mInputFormatConverter) {
+            ALOGE("Failed to created input format convertor");
+            return false;
+        }
     }
     //}
 
@@ -808,7 +1033,8 @@ bool V4L2EncodeComponent::configureInputFormat(media::VideoPixelFormat inputForm
 bool V4L2EncodeComponent::configureOutputFormat(media::VideoCodecProfile outputProfile) {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
-    ALOG_ASSERT(mEncoderState == EncoderState::UNINITIALIZED);
+    ALOG_ASSERT(mEncoderState == EncoderState::UNINITIALIZED ||
+                mEncoderState == EncoderState::CHANGING_RESOLUTION);
     ALOG_ASSERT(!mOutputQueue->IsStreaming());
     ALOG_ASSERT(!mVisibleSize.IsEmpty());
 
@@ -833,26 +1059,62 @@ bool V4L2EncodeComponent::configureDevice(media::VideoCodecProfile outputProfile
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
 
-    // Enable frame-level bitrate control. This is the only mandatory general control.
-    if (!mDevice->SetExtCtrls(V4L2_CTRL_CLASS_MPEG,
-                              {media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_FRAME_RC_ENABLE, 1)})) {
-        ALOGW("Failed enabling bitrate control");
-        // TODO(b/161508368): V4L2_CID_MPEG_VIDEO_FRAME_RC_ENABLE is currently not supported yet,
-        // assume the operation was successful for now.
-    }
+    // Configure the bitrate control mode, the constant quality mode disables the bitrate control.
+    configureRateControl();
 
-    // Additional optional controls:
-    // - Enable macroblock-level bitrate control.
-    // - Set GOP length to 0 to disable periodic key frames.
+    // Set GOP length to 0 to disable periodic key frames, this is an optional control.
     mDevice->SetExtCtrls(V4L2_CTRL_CLASS_MPEG,
-                         {media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_MB_RC_ENABLE, 1),
-                          media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_GOP_SIZE, 0)});
+                         {media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_GOP_SIZE, 0)});
+
+    // Split each frame into slices of an equal number of macroblocks if requested. The device
+    // still returns each frame as a whole access unit.
+    const uint32_t sliceCount = mInterface->getSliceCount();
+    if (sliceCount > 1) {
+        const uint32_t numMacroblocks =
+                ((mVisibleSize.width() + 15) / 16) * ((mVisibleSize.height() + 15) / 16);
+        const uint32_t macroblocksPerSlice = (numMacroblocks + sliceCount - 1) / sliceCount;
+        ALOGV("Encoding %u slices of %u macroblocks", sliceCount, macroblocksPerSlice);
+        if (!mDevice->IsCtrlExposed(V4L2_CID_MPEG_VIDEO_MULTI_SLICE_MODE) ||
+            !mDevice->SetExtCtrls(
+                    V4L2_CTRL_CLASS_MPEG,
+                    {media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_MULTI_SLICE_MODE,
+                                        V4L2_MPEG_VIDEO_MULTI_SLICE_MODE_MAX_MB),
+                     media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_MULTI_SLICE_MAX_MB,
+                                        macroblocksPerSlice)})) {
+            ALOGW("Device doesn't support multi-slice encoding, encoding a single slice");
+        }
+    }
 
-    // All controls below are H.264-specific, so we can return here if the profile is not H.264.
-    if (outputProfile < media::H264PROFILE_MIN || outputProfile > media::H264PROFILE_MAX) {
-        return true;
+    // The average QP of the last encoded frame is reported through a read-only control by some
+    // devices, which is optional.
+    mAverageQpSupported = false;
+#ifdef V4L2_CID_MPEG_VIDEO_AVERAGE_QP
+    mAverageQpSupported = mDevice->IsCtrlExposed(V4L2_CID_MPEG_VIDEO_AVERAGE_QP);
+#endif
+
+    // Region of interest encoding isn't standardized by V4L2 yet. Kernels exposing a per-frame QP
+    // map control take one signed QP delta byte per macroblock.
+    mQpMapSupported = false;
+    mQpMapActive = false;
+#ifdef V4L2_CID_MPEG_VIDEO_QP_MAP
+    mQpMapSupported = mDevice->IsCtrlExposed(V4L2_CID_MPEG_VIDEO_QP_MAP);
+#endif
+
+    switch (mOutputCodec) {
+    case media::kCodecH264:
+        break;
+    case media::kCodecHEVC:
+        return configureHevcControls(outputProfile);
+    case media::kCodecVP8:
+    case media::kCodecVP9:
+        return configureVpxControls(outputProfile);
+    default:
+        ALOGE("Unsupported output profile %s", media::GetProfileName(outputProfile).c_str());
+        return false;
     }
 
+    // All controls below are H.264-specific.
+
     // When encoding H.264 we want to prepend SPS and PPS to each IDR for resilience. Some
     // devices support this through the V4L2_CID_MPEG_VIDEO_H264_SPS_PPS_BEFORE_IDR control.
     // TODO(b/161495502): V4L2_CID_MPEG_VIDEO_H264_SPS_PPS_BEFORE_IDR is currently not supported
@@ -871,10 +1133,12 @@ bool V4L2EncodeComponent::configureDevice(media::VideoCodecProfile outputProfile
 
     std::vector<media::V4L2ExtCtrl> h264Ctrls;
 
-    // No B-frames, for lowest decoding latency.
-    h264Ctrls.emplace_back(V4L2_CID_MPEG_VIDEO_B_FRAMES, 0);
-    // Quantization parameter maximum value (for variable bitrate control).
-    h264Ctrls.emplace_back(V4L2_CID_MPEG_VIDEO_H264_MAX_QP, 51);
+    // B-frames are disabled by default, for lowest encoding and decoding latency.
+    h264Ctrls.emplace_back(V4L2_CID_MPEG_VIDEO_B_FRAMES, mNumBFrames);
+    // Quantization parameter bounds (for bitrate control).
+    const C2V4L2QpRangeStruct& qpRange = mInterface->getQpRange();
+    h264Ctrls.emplace_back(V4L2_CID_MPEG_VIDEO_H264_MIN_QP, qpRange.minQp);
+    h264Ctrls.emplace_back(V4L2_CID_MPEG_VIDEO_H264_MAX_QP, qpRange.maxQp);
 
     // Set H.264 profile.
     int32_t profile = media::V4L2Device::VideoCodecProfileToV4L2H264Profile(outputProfile);
@@ -894,96 +1158,326 @@ bool V4L2EncodeComponent::configureDevice(media::VideoCodecProfile outputProfile
     h264Ctrls.emplace_back(V4L2_CID_MPEG_VIDEO_HEADER_MODE,
                            V4L2_MPEG_VIDEO_HEADER_MODE_JOINED_WITH_1ST_FRAME);
 
-    // Ignore return value as these controls are optional.
-    mDevice->SetExtCtrls(V4L2_CTRL_CLASS_MPEG, std::move(h264Ctrls));
+    // Ignore return value as these controls are optional, but set the ones supported by the device
+    // even if some others are not.
+    setExtCtrlsOrEach(mDevice.get(), h264Ctrls);
+
+    // Set the number of reference frames if requested and supported.
+    const uint32_t numRefFrames = mInterface->getNumRefFrames();
+    if (numRefFrames > 0) {
+#ifdef V4L2_CID_MPEG_VIDEO_REF_NUMBER_FOR_PFRAMES
+        if (!mDevice->IsCtrlExposed(V4L2_CID_MPEG_VIDEO_REF_NUMBER_FOR_PFRAMES) ||
+            !mDevice->SetExtCtrls(
+                    V4L2_CTRL_CLASS_MPEG,
+                    {media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_REF_NUMBER_FOR_PFRAMES,
+                                        numRefFrames)})) {
+            ALOGW("Failed to set the number of reference frames to %u", numRefFrames);
+        }
+#else
+        ALOGW("Setting the number of reference frames is not supported");
+#endif
+    }
+
+    configureTemporalLayers();
 
     return true;
 }
 
-bool V4L2EncodeComponent::updateEncodingParameters() {
+bool V4L2EncodeComponent::configureHevcControls(media::VideoCodecProfile outputProfile) {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
 
-    // Query the interface for the encoding parameters requested by the codec 2.0 framework.
-    C2StreamBitrateInfo::output bitrateInfo;
-    C2StreamFrameRateInfo::output framerateInfo;
-    c2_status_t status =
-            mInterface->query({&bitrateInfo, &framerateInfo}, {}, C2_DONT_BLOCK, nullptr);
-    if (status != C2_OK) {
-        ALOGE("Failed to query interface for encoding parameters (error code: %d)", status);
-        reportError(status);
+#ifdef V4L2_CID_MPEG_VIDEO_PREPEND_SPSPPS_TO_IDR
+    // Prepend VPS, SPS and PPS to each IDR for resilience, if supported by the device.
+    if (!mDevice->IsCtrlExposed(V4L2_CID_MPEG_VIDEO_PREPEND_SPSPPS_TO_IDR) ||
+        !mDevice->SetExtCtrls(
+                V4L2_CTRL_CLASS_MPEG,
+                {media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_PREPEND_SPSPPS_TO_IDR, 1)})) {
+        ALOGW("Device doesn't support prepending VPS, SPS and PPS to IDR");
+    }
+#endif
+
+    std::vector<media::V4L2ExtCtrl> hevcCtrls;
+
+    hevcCtrls.emplace_back(V4L2_CID_MPEG_VIDEO_B_FRAMES, mNumBFrames);
+    const C2V4L2QpRangeStruct& qpRange = mInterface->getQpRange();
+    hevcCtrls.emplace_back(V4L2_CID_MPEG_VIDEO_HEVC_MIN_QP, qpRange.minQp);
+    hevcCtrls.emplace_back(V4L2_CID_MPEG_VIDEO_HEVC_MAX_QP, qpRange.maxQp);
+
+    std::optional<uint32_t> profile = videoCodecProfileToV4L2HevcProfile(outputProfile);
+    if (!profile) {
+        ALOGE("Trying to set invalid HEVC profile");
+        return false;
+    }
+    hevcCtrls.emplace_back(V4L2_CID_MPEG_VIDEO_HEVC_PROFILE, *profile);
+
+    // Set the level and tier, keep the device's default if the level is unknown.
+    const C2Config::level_t level = mInterface->getOutputLevel();
+    std::optional<uint32_t> v4l2Level = c2LevelToV4L2HevcLevel(level);
+    if (v4l2Level) {
+        hevcCtrls.emplace_back(V4L2_CID_MPEG_VIDEO_HEVC_LEVEL, *v4l2Level);
+        hevcCtrls.emplace_back(V4L2_CID_MPEG_VIDEO_HEVC_TIER,
+                               isC2HevcHighTierLevel(level) ? V4L2_MPEG_VIDEO_HEVC_TIER_HIGH
+                                                            : V4L2_MPEG_VIDEO_HEVC_TIER_MAIN);
+    }
+
+    // Ask not to put VPS, SPS and PPS into separate bitstream buffers.
+    hevcCtrls.emplace_back(V4L2_CID_MPEG_VIDEO_HEADER_MODE,
+                           V4L2_MPEG_VIDEO_HEADER_MODE_JOINED_WITH_1ST_FRAME);
+
+    // Ignore return value as these controls are optional, but set the ones supported by the device
+    // even if some others are not.
+    setExtCtrlsOrEach(mDevice.get(), hevcCtrls);
+    return true;
+}
+
+bool V4L2EncodeComponent::configureVpxControls(media::VideoCodecProfile outputProfile) {
+    ALOGV("%s()", __func__);
+    ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
+
+    // Set the profile, this is an optional control.
+    if (mOutputCodec == media::kCodecVP8) {
+        mDevice->SetExtCtrls(V4L2_CTRL_CLASS_MPEG,
+                             {media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_VP8_PROFILE,
+                                                 V4L2_MPEG_VIDEO_VP8_PROFILE_0)});
+        return true;
+    }
+
+    std::optional<uint32_t> profile = videoCodecProfileToV4L2Vp9Profile(outputProfile);
+    if (!profile) {
+        ALOGE("Trying to set invalid VP9 profile");
         return false;
     }
+    mDevice->SetExtCtrls(V4L2_CTRL_CLASS_MPEG,
+                         {media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_VP9_PROFILE, *profile)});
+    return true;
+}
+
+void V4L2EncodeComponent::configureTemporalLayers() {
+    ALOGV("%s()", __func__);
+    ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
+
+    const uint32_t numLayers = mInterface->getNumTemporalLayers();
+    if (numLayers <= 1) return;
+
+    // The temporal layers are produced by the device's hierarchical-P coding, the stateful V4L2
+    // API doesn't allow us to mark the reference frames ourselves.
+    if (mNumBFrames > 0) {
+        ALOGW("Temporal layering is not supported together with B-frames, encoding a single layer");
+        return;
+    }
+    if (!mDevice->IsCtrlExposed(V4L2_CID_MPEG_VIDEO_H264_HIERARCHICAL_CODING) ||
+        !mDevice->SetExtCtrls(
+                V4L2_CTRL_CLASS_MPEG,
+                {media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_H264_HIERARCHICAL_CODING, 1),
+                 media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_H264_HIERARCHICAL_CODING_TYPE,
+                                    V4L2_MPEG_VIDEO_H264_HIERARCHICAL_CODING_P),
+                 media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_H264_HIERARCHICAL_CODING_LAYER,
+                                    numLayers)})) {
+        ALOGW("Device doesn't support hierarchical coding, encoding a single layer");
+        return;
+    }
+
+    ALOGV("Encoding %u temporal layers", numLayers);
+    mNumTemporalLayers = numLayers;
+    mTemporalLayerBitrateRatios = mInterface->getTemporalLayerBitrateRatios();
+    // The per-layer bitrates are set together with the total bitrate, see
+    // updateEncodingParameters().
+}
 
-    // Ask device to change bitrate if it's different from the currently configured bitrate.
-    ALOGV("v4l2 device bitrate: %u, wanted bitrate: %u", mBitrate, bitrateInfo.value);
-    uint32_t bitrate = bitrateInfo.value;
-    if (mBitrate != bitrate) {
-        ALOG_ASSERT(bitrate > 0u);
-        ALOGV("Setting bitrate to %u", bitrate);
-        if (!mDevice->SetExtCtrls(V4L2_CTRL_CLASS_MPEG,
-                                  {media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_BITRATE, bitrate)})) {
-            // TODO(b/161495749): V4L2_CID_MPEG_VIDEO_BITRATE is currently not supported yet, assume
-            // the operation was successful for now.
-            ALOGW("Requesting bitrate change failed");
+void V4L2EncodeComponent::appendTemporalLayerBitrateCtrls(uint32_t bitrate,
+                                                          std::vector<media::V4L2ExtCtrl>* ctrls) {
+    if (mNumTemporalLayers <= 1) return;
+
+#ifdef V4L2_CID_MPEG_VIDEO_H264_HIER_CODING_L0_BR
+    // The device expects the bitrate of each layer on its own, while the ratios are cumulative.
+    float lowerRatio = 0.0f;
+    for (uint32_t layer = 0; layer < mTemporalLayerBitrateRatios.size(); ++layer) {
+        const float ratio = mTemporalLayerBitrateRatios[layer];
+        ctrls->emplace_back(V4L2_CID_MPEG_VIDEO_H264_HIER_CODING_L0_BR + layer,
+                            static_cast<uint32_t>(std::round(bitrate * (ratio - lowerRatio))));
+        lowerRatio = ratio;
+    }
+#else
+    (void)bitrate;
+    (void)ctrls;
+    ALOGW("Setting the bitrate of each temporal layer is not supported");
+#endif
+}
+
+void V4L2EncodeComponent::configureRateControl() {
+    ALOGV("%s()", __func__);
+    ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
+
+    const C2Config::bitrate_mode_t bitrateMode = mInterface->getBitrateMode();
+    if (bitrateMode == C2Config::BITRATE_IGNORE) {
+        // Constant quality: disable the frame-level and macroblock-level bitrate control, the
+        // device uses the fixed quantization parameter of each frame type instead.
+        ALOGV("Using constant quality mode");
+        std::vector<media::V4L2ExtCtrl> ctrls;
+        ctrls.emplace_back(V4L2_CID_MPEG_VIDEO_FRAME_RC_ENABLE, 0);
+        if (mDevice->IsCtrlExposed(V4L2_CID_MPEG_VIDEO_MB_RC_ENABLE)) {
+            ctrls.emplace_back(V4L2_CID_MPEG_VIDEO_MB_RC_ENABLE, 0);
         }
-        mBitrate = bitrate;
-    }
-
-    // Ask device to change framerate if it's different from the currently configured framerate.
-    // TODO(dstaessens): Move IOCTL to device and use helper function.
-    // uint32_t framerate = static_cast<uint32_t>(std::round(framerateInfo.value));
-    uint32_t framerate = 60;  // temp hardcode
-    ALOGV("v4l2 device framerate: %u, wanted framerate: %u", mFramerate, framerate);
-    if (mFramerate != framerate) {
-        ALOG_ASSERT(framerate > 0u);
-        ALOGV("Setting framerate to %u", framerate);
-        struct v4l2_streamparm parms;
-        memset(&parms, 0, sizeof(v4l2_streamparm));
-        parms.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-        parms.parm.output.timeperframe.numerator = 1;
-        parms.parm.output.timeperframe.denominator = framerate;
-        if (mDevice->Ioctl(VIDIOC_S_PARM, &parms) != 0) {
-            // TODO(b/161499573): VIDIOC_S_PARM is currently not supported yet, assume the operation
-            // was successful for now.
-            ALOGW("Requesting framerate change failed");
+        if (!setExtCtrlsOrEach(mDevice.get(), ctrls)) {
+            ALOGW("Failed disabling bitrate control");
         }
-        mFramerate = framerate;
+        // The quantization parameters follow the H.264 scale, which HEVC shares. VP8 and VP9 use
+        // a different scale, so the device's defaults are kept.
+        const bool isHevc = mOutputCodec == media::kCodecHEVC;
+        if (mOutputCodec == media::kCodecH264 || isHevc) {
+            const C2V4L2QpRangeStruct& qpRange = mInterface->getQpRange();
+            if (!setExtCtrlsOrEach(
+                        mDevice.get(),
+                        {media::V4L2ExtCtrl(isHevc ? V4L2_CID_MPEG_VIDEO_HEVC_I_FRAME_QP
+                                                   : V4L2_CID_MPEG_VIDEO_H264_I_FRAME_QP,
+                                            qpRange.iFrameQp),
+                         media::V4L2ExtCtrl(isHevc ? V4L2_CID_MPEG_VIDEO_HEVC_P_FRAME_QP
+                                                   : V4L2_CID_MPEG_VIDEO_H264_P_FRAME_QP,
+                                            qpRange.pFrameQp)})) {
+                ALOGW("Failed setting the quantization parameters");
+            }
+        }
+        return;
     }
 
-    // Check whether an explicit key frame was requested, if so reset the key frame counter to
-    // immediately request a key frame.
-    C2StreamRequestSyncFrameTuning::output requestKeyFrame;
-    status = mInterface->query({&requestKeyFrame}, {}, C2_DONT_BLOCK, nullptr);
-    if (status != C2_OK) {
-        ALOGE("Failed to query interface for key frame request (error code: %d)", status);
-        reportError(status);
-        return false;
+    // Enable frame-level bitrate control. This is the only mandatory general control.
+    if (!mDevice->SetExtCtrls(V4L2_CTRL_CLASS_MPEG,
+                              {media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_FRAME_RC_ENABLE, 1)})) {
+        ALOGW("Failed enabling bitrate control");
+        // TODO(b/161508368): V4L2_CID_MPEG_VIDEO_FRAME_RC_ENABLE is currently not supported yet,
+        // assume the operation was successful for now.
+    }
+
+    // The controls below are optional, only set the ones supported by the device. Enable
+    // macroblock-level bitrate control first.
+    std::vector<media::V4L2ExtCtrl> ctrls;
+    if (mDevice->IsCtrlExposed(V4L2_CID_MPEG_VIDEO_MB_RC_ENABLE)) {
+        ctrls.emplace_back(V4L2_CID_MPEG_VIDEO_MB_RC_ENABLE, 1);
+    } else {
+        ALOGW("Device doesn't support macroblock-level bitrate control");
+    }
+
+    const uint32_t v4l2BitrateMode = (bitrateMode == C2Config::BITRATE_VARIABLE)
+                                             ? V4L2_MPEG_VIDEO_BITRATE_MODE_VBR
+                                             : V4L2_MPEG_VIDEO_BITRATE_MODE_CBR;
+    if (isCtrlMenuItemSupported(mDevice.get(), V4L2_CID_MPEG_VIDEO_BITRATE_MODE, v4l2BitrateMode)) {
+        ctrls.emplace_back(V4L2_CID_MPEG_VIDEO_BITRATE_MODE, v4l2BitrateMode);
+    } else {
+        ALOGW("Device doesn't support bitrate mode %u, using the device's default",
+              static_cast<uint32_t>(bitrateMode));
+    }
+
+    const uint32_t peakBitrate = mInterface->getPeakBitrate();
+    if (bitrateMode == C2Config::BITRATE_VARIABLE && peakBitrate > 0) {
+        if (mDevice->IsCtrlExposed(V4L2_CID_MPEG_VIDEO_BITRATE_PEAK)) {
+            ctrls.emplace_back(V4L2_CID_MPEG_VIDEO_BITRATE_PEAK, peakBitrate);
+        } else {
+            ALOGW("Device doesn't support setting the peak bitrate");
+        }
+    }
+
+    // The video buffering verifier size is set in kilobytes.
+    const uint32_t vbvSizeKb = (mInterface->getVbvSize() + 1023) / 1024;
+    if (vbvSizeKb > 0) {
+        const uint32_t vbvCtrlId = (mOutputCodec == media::kCodecH264)
+                                           ? V4L2_CID_MPEG_VIDEO_H264_CPB_SIZE
+                                           : V4L2_CID_MPEG_VIDEO_VBV_SIZE;
+        if (mDevice->IsCtrlExposed(vbvCtrlId)) {
+            ctrls.emplace_back(vbvCtrlId, vbvSizeKb);
+        } else {
+            ALOGW("Device doesn't support setting the VBV size");
+        }
+    }
+
+    // A control rejected by the device doesn't prevent the others from being applied.
+    if (!setExtCtrlsOrEach(mDevice.get(), ctrls)) {
+        ALOGW("Failed configuring the bitrate control");
     }
+}
+
+bool V4L2EncodeComponent::updateEncodingParameters() {
+    ALOGV("%s()", __func__);
+    ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
 
-    ALOGV("Whether request KeyFrame: %s", (requestKeyFrame.value == C2_TRUE) ? "true" : "false");
-    if (requestKeyFrame.value == C2_TRUE) {
-        mKeyFrameCounter = 0;
-        requestKeyFrame.value = C2_FALSE;
-        std::vector<std::unique_ptr<C2SettingResult>> failures;
-        status = mInterface->config({&requestKeyFrame}, C2_MAY_BLOCK, &failures);
+    // All control changes for the next frame are batched into a single call.
+    std::vector<media::V4L2ExtCtrl> ctrls;
+
+    // Only query the interface if the codec 2.0 framework changed any of the dynamic parameters
+    // since the last frame, to avoid taking the interface lock for each frame.
+    if (mInterface->takeDynamicParamsChanged()) {
+        C2StreamBitrateInfo::output bitrateInfo;
+        C2StreamFrameRateInfo::output framerateInfo;
+        C2StreamRequestSyncFrameTuning::output requestKeyFrame;
+        c2_status_t status = mInterface->query({&bitrateInfo, &framerateInfo, &requestKeyFrame}, {},
+                                               C2_DONT_BLOCK, nullptr);
         if (status != C2_OK) {
-            ALOGE("Failed to reset key frame request on interface (error code: %d)", status);
+            ALOGE("Failed to query interface for encoding parameters (error code: %d)", status);
             reportError(status);
             return false;
         }
+
+        // Ask device to change bitrate if it's different from the currently configured bitrate.
+        ALOGV("v4l2 device bitrate: %u, wanted bitrate: %u", mBitrate, bitrateInfo.value);
+        uint32_t bitrate = bitrateInfo.value;
+        if (mBitrate != bitrate) {
+            ALOG_ASSERT(bitrate > 0u);
+            ALOGV("Setting bitrate to %u", bitrate);
+            ctrls.emplace_back(V4L2_CID_MPEG_VIDEO_BITRATE, bitrate);
+            appendTemporalLayerBitrateCtrls(bitrate, &ctrls);
+            mBitrate = bitrate;
+        }
+
+        // Ask device to change framerate if it's different from the currently configured
+        // framerate.
+        uint32_t framerate =
+                std::max(static_cast<uint32_t>(std::round(framerateInfo.value)), 1u);
+        ALOGV("v4l2 device framerate: %u, wanted framerate: %u", mFramerate, framerate);
+        if (mFramerate != framerate) {
+            ALOGV("Setting framerate to %u", framerate);
+            // TODO(dstaessens): Move IOCTL to device and use helper function.
+            struct v4l2_streamparm parms;
+            memset(&parms, 0, sizeof(v4l2_streamparm));
+            parms.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+            parms.parm.output.timeperframe.numerator = 1;
+            parms.parm.output.timeperframe.denominator = framerate;
+            if (mDevice->Ioctl(VIDIOC_S_PARM, &parms) != 0) {
+                // TODO(b/161499573): VIDIOC_S_PARM is currently not supported yet, assume the
+                // operation was successful for now.
+                ALOGW("Requesting framerate change failed");
+            }
+            mFramerate = framerate;
+        }
+
+        // Check whether an explicit key frame was requested, if so reset the key frame counter to
+        // immediately request a key frame.
+        ALOGV("Whether request KeyFrame: %s",
+              (requestKeyFrame.value == C2_TRUE) ? "true" : "false");
+        if (requestKeyFrame.value == C2_TRUE) {
+            mKeyFrameCounter = 0;
+            requestKeyFrame.value = C2_FALSE;
+            // Reset the request through the base class, so the reset itself isn't tracked as a
+            // change of the dynamic parameters.
+            std::vector<std::unique_ptr<C2SettingResult>> failures;
+            status = mInterface->C2InterfaceHelper::config({&requestKeyFrame}, C2_MAY_BLOCK,
+                                                           &failures);
+            if (status != C2_OK) {
+                ALOGE("Failed to reset key frame request on interface (error code: %d)", status);
+                reportError(status);
+                return false;
+            }
+        }
     }
 
     // Request the next frame to be a key frame each time the counter reaches 0.
     if (mKeyFrameCounter == 0) {
-        if (!mDevice->SetExtCtrls(V4L2_CTRL_CLASS_MPEG,
-                                  {media::V4L2ExtCtrl(V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME)})) {
-            // TODO(b/161498590): V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME is currently not supported
-            // yet, assume the operation was successful for now.
-            ALOGW("Failed requesting key frame");
-        }
+        ctrls.emplace_back(V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME);
     }
 
+    // TODO(b/161495749, b/161498590): V4L2_CID_MPEG_VIDEO_BITRATE and
+    // V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME are currently not supported yet, assume the operation
+    // was successful for now.
+    setExtCtrlsOrEach(mDevice.get(), ctrls);
     return true;
 }
 
@@ -997,6 +1491,13 @@ void V4L2EncodeComponent::scheduleNextEncodeTask() {
         return;
     }
 
+    // A delayed task posted while waiting for the session scheduler might run after the input
+    // work queue has been flushed.
+    if (mInputWorkQueue.empty()) {
+        setEncoderState(EncoderState::WAITING_FOR_INPUT);
+        return;
+    }
+
     // Get the next work item. Currently only a single worklet per work item is supported. An input
     // buffer should always be supplied unless this is a drain or CSD request.
     ALOG_ASSERT(!mInputWorkQueue.empty());
@@ -1015,6 +1516,15 @@ void V4L2EncodeComponent::scheduleNextEncodeTask() {
           timestamp, endOfStream);
 
     if (!work->input.buffers.empty()) {
+        // If this work item has a new input picture size, the device needs to be reconfigured
+        // before it can be encoded. Encoding resumes once done.
+        std::optional<media::Size> newPictureSize;
+        if (!getNewPictureSize(*work, &newPictureSize)) return;
+        if (newPictureSize) {
+            startResolutionChange(*newPictureSize);
+            return;
+        }
+
         // Check if the device has free input buffers available. If not we'll switch to the
         // WAITING_FOR_INPUT_BUFFERS state, and resume encoding once we're notified buffers are
         // available in the onInputBufferDone() task. Note: The input buffers are not copied into
@@ -1026,9 +1536,23 @@ void V4L2EncodeComponent::scheduleNextEncodeTask() {
             return;
         }
 
+        // Check whether the session scheduler allows us to queue another input buffer. If not
+        // we'll try again after the requested delay, other sessions can use the device meanwhile.
+        std::chrono::microseconds delay = acquireQueueSlot();
+        if (delay.count() > 0) {
+            mEncoderTaskRunner->PostDelayedTask(
+                    FROM_HERE,
+                    ::base::BindOnce(&V4L2EncodeComponent::scheduleNextEncodeTask, mWeakThis),
+                    ::base::TimeDelta::FromMicroseconds(delay.count()));
+            return;
+        }
+
         C2ConstGraphicBlock inputBlock =
                 work->input.buffers.front()->data().graphicBlocks().front();
 
+        // Apply the region of interest hints attached to the work item to this frame.
+        applyQpHints(work->input.configUpdate);
+
         // If encoding fails, we'll wait for an event (e.g. input buffers available) to start
         // encoding again.
         if (!encode(inputBlock, index, timestamp)) {
@@ -1064,6 +1588,124 @@ void V4L2EncodeComponent::scheduleNextEncodeTask() {
             FROM_HERE, ::base::BindOnce(&V4L2EncodeComponent::scheduleNextEncodeTask, mWeakThis));
 }
 
+std::chrono::microseconds V4L2EncodeComponent::acquireQueueSlot() {
+    ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
+
+    // The session parameters of the scheduler are only refreshed when the client configures them.
+    if (mInterface->takeSchedulingParamsChanged()) {
+        C2ComponentPriorityTuning priority;
+        C2ComponentOperatingRateTuning operatingRate;
+        c2_status_t status =
+                mInterface->query({&priority, &operatingRate}, {}, C2_DONT_BLOCK, nullptr);
+        if (status != C2_OK) {
+            ALOGW("Failed to query interface for scheduling parameters (error code: %d)", status);
+        } else {
+            V4L2SessionScheduler::getInstance().updateSession(mSchedulerSessionId, priority.value,
+                                                              operatingRate.value);
+        }
+    }
+    return V4L2SessionScheduler::getInstance().acquireQueueSlot(mSchedulerSessionId);
+}
+
+void V4L2EncodeComponent::applyQpHints(const std::vector<std::unique_ptr<C2Param>>& configUpdate) {
+    ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
+
+    const C2StreamV4L2RoiRectsTuning::input* roiRects = nullptr;
+    const C2StreamV4L2QpMapTuning::input* qpMap = nullptr;
+    for (const std::unique_ptr<C2Param>& param : configUpdate) {
+        if (auto* rects = C2StreamV4L2RoiRectsTuning::input::From(param.get())) roiRects = rects;
+        if (auto* map = C2StreamV4L2QpMapTuning::input::From(param.get())) qpMap = map;
+    }
+    const bool hasHints =
+            (roiRects && roiRects->flexCount() > 0) || (qpMap && qpMap->flexCount() > 0);
+
+    // The QP map configured on the device applies to all following frames, so it needs to be
+    // cleared after a frame with hints.
+    if (!hasHints && !mQpMapActive) return;
+
+    // Without device support the hints are dropped, and the frames are encoded as usual.
+    if (!mQpMapSupported) {
+        if (!mQpHintsIgnored) {
+            ALOGW("Device doesn't support QP maps, ignoring region of interest hints");
+            mQpHintsIgnored = true;
+        }
+        return;
+    }
+
+    const uint32_t widthInBlocks = (mVisibleSize.width() + kQpMapBlockSize - 1) / kQpMapBlockSize;
+    const uint32_t heightInBlocks =
+            (mVisibleSize.height() + kQpMapBlockSize - 1) / kQpMapBlockSize;
+    std::vector<int8_t> map(widthInBlocks * heightInBlocks, 0);
+    if (qpMap && qpMap->flexCount() > 0) {
+        if (qpMap->flexCount() == map.size()) {
+            memcpy(map.data(), qpMap->m.value, map.size());
+        } else {
+            ALOGW("Ignoring QP map of %zu macroblocks, expected %zu", qpMap->flexCount(),
+                  map.size());
+        }
+    }
+    for (size_t i = 0; roiRects && i < roiRects->flexCount(); ++i) {
+        const C2V4L2RoiRectStruct& rect = roiRects->m.values[i];
+        const uint64_t right = std::min<uint64_t>(static_cast<uint64_t>(rect.left) + rect.width,
+                                                  mVisibleSize.width());
+        const uint64_t bottom = std::min<uint64_t>(static_cast<uint64_t>(rect.top) + rect.height,
+                                                   mVisibleSize.height());
+        const int8_t qpDelta =
+                static_cast<int8_t>(std::clamp(rect.qpDelta, -kMaxQpDelta, kMaxQpDelta));
+        for (uint64_t y = rect.top / kQpMapBlockSize; y * kQpMapBlockSize < bottom; ++y) {
+            for (uint64_t x = rect.left / kQpMapBlockSize; x * kQpMapBlockSize < right; ++x) {
+                map[y * widthInBlocks + x] = qpDelta;
+            }
+        }
+    }
+
+#ifdef V4L2_CID_MPEG_VIDEO_QP_MAP
+    media::V4L2ExtCtrl ctrl(V4L2_CID_MPEG_VIDEO_QP_MAP);
+    ctrl.ctrl.size = map.size();
+    ctrl.ctrl.ptr = map.data();
+    if (!mDevice->SetExtCtrls(V4L2_CTRL_CLASS_MPEG, {ctrl})) {
+        ALOGW("Failed to set QP map");
+        return;
+    }
+#endif
+    mQpMapActive = hasHints;
+}
+
+std::optional<V4L2EncodeComponent::InputLayout> V4L2EncodeComponent::getInputLayout(
+        const C2ConstGraphicBlock& block) {
+    ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
+
+    std::optional<InputLayoutKey> key;
+    const C2Handle* const handle = block.handle();
+    struct stat st;
+    if (handle->numFds > 0 && fstat(handle->data[0], &st) == 0) {
+        uint32_t width, height, format, stride, igbpSlot, generation;
+        uint64_t usage, igbpId;
+        _UnwrapNativeCodec2GrallocMetadata(handle, &width, &height, &format, &usage, &stride,
+                                           &generation, &igbpId, &igbpSlot);
+        key = InputLayoutKey(st.st_dev, st.st_ino, block.width(), block.height(), format, usage);
+        auto it = mInputLayoutCache.find(*key);
+        if (it != mInputLayoutCache.end()) return it->second;
+    }
+
+    InputLayout layout;
+    std::optional<std::vector<VideoFramePlane>> planes =
+            getVideoFrameLayout(block, &layout.mFormat);
+    if (!planes) return std::nullopt;
+    layout.mPlanes = std::move(*planes);
+
+    if (key) {
+        if (mInputLayoutCache.size() >= kMaxInputLayoutCacheSize) {
+            ALOGV("Input layout cache is full, clearing");
+            mInputLayoutCache.clear();
+        }
+        mInputLayoutCache.emplace(*key, layout);
+        ALOGV("Cached layout of input buffer (inode: %" PRIu64 "), %zu buffers cached",
+              static_cast<uint64_t>(st.st_ino), mInputLayoutCache.size());
+    }
+    return layout;
+}
+
 bool V4L2EncodeComponent::encode(C2ConstGraphicBlock block, uint64_t index, int64_t timestamp) {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
@@ -1111,16 +1753,15 @@ bool V4L2EncodeComponent::encode(C2ConstGraphicBlock block, uint64_t index, int6
     }
 
     // Get the video frame layout and pixel format from the graphic block.
-    // TODO(dstaessens) Integrate getVideoFrameLayout() into InputFrame::Create()
-    media::VideoPixelFormat format;
-    std::optional<std::vector<VideoFramePlane>> planes = getVideoFrameLayout(block, &format);
-    if (!planes) {
+    std::optional<InputLayout> layout = getInputLayout(block);
+    if (!layout) {
         ALOGE("Failed to get input block's layout");
         reportError(C2_CORRUPTED);
         return false;
     }
 
-    if (!enqueueInputBuffer(std::move(frame), format, *planes, index, timestamp)) {
+    mFrameTimes[index].mEncodeStarted = std::chrono::steady_clock::now();
+    if (!enqueueInputBuffer(std::move(frame), layout->mFormat, layout->mPlanes, index, timestamp)) {
         ALOGE("Failed to enqueue video frame (index: %" PRIu64 ", timestamp: %" PRId64 ")", index,
               timestamp);
         reportError(C2_CORRUPTED);
@@ -1174,6 +1815,184 @@ void V4L2EncodeComponent::drain() {
     setEncoderState(EncoderState::DRAINING);
 }
 
+bool V4L2EncodeComponent::getNewPictureSize(const C2Work& work,
+                                            std::optional<media::Size>* pictureSize) {
+    ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
+    ALOG_ASSERT(!work.input.buffers.empty());
+
+    // A picture size attached to the work item applies from this work item.
+    for (const std::unique_ptr<C2Param>& param : work.input.configUpdate) {
+        if (auto* size = C2StreamPictureSizeInfo::input::From(param.get())) {
+            media::Size workSize(size->width, size->height);
+            if (workSize != mPictureSize) *pictureSize = workSize;
+            return true;
+        }
+    }
+
+    // Otherwise the picture size configured on the interface applies from the first work item
+    // whose input block has the new size. The work items queued before the size was configured
+    // are still encoded with the previous size.
+    if (mInterface->takePictureSizeChanged()) {
+        C2StreamPictureSizeInfo::input size;
+        c2_status_t status = mInterface->query({&size}, {}, C2_DONT_BLOCK, nullptr);
+        if (status != C2_OK) {
+            ALOGE("Failed to query interface for picture size (error code: %d)", status);
+            reportError(status);
+            return false;
+        }
+        mConfiguredPictureSize = media::Size(size.width, size.height);
+    }
+    if (mConfiguredPictureSize == mPictureSize) return true;
+
+    const C2ConstGraphicBlock& block = work.input.buffers.front()->data().graphicBlocks().front();
+    if (media::Size(block.width(), block.height()) == mConfiguredPictureSize) {
+        *pictureSize = mConfiguredPictureSize;
+    }
+    return true;
+}
+
+void V4L2EncodeComponent::startResolutionChange(const media::Size& pictureSize) {
+    ALOGV("%s(): %s -> %s", __func__, mPictureSize.ToString().c_str(),
+          pictureSize.ToString().c_str());
+    ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
+    ALOG_ASSERT(mEncoderState == EncoderState::ENCODING);
+
+    mPendingPictureSize = pictureSize;
+    setEncoderState(EncoderState::CHANGING_RESOLUTION);
+
+    // If no frames are pending on the device we can change the resolution right away.
+    if (!mInputQueue->IsStreaming() || mOutputWorkQueue.empty()) {
+        changeResolution();
+        return;
+    }
+
+    // Drain the device, the resolution is changed once the last buffer is dequeued.
+    struct v4l2_encoder_cmd cmd;
+    memset(&cmd, 0, sizeof(v4l2_encoder_cmd));
+    cmd.cmd = V4L2_ENC_CMD_STOP;
+    if (mDevice->Ioctl(VIDIOC_ENCODER_CMD, &cmd) != 0) {
+        ALOGE("Failed to stop encoder");
+        reportError(C2_CORRUPTED);
+    }
+}
+
+void V4L2EncodeComponent::changeResolution() {
+    ALOGV("%s()", __func__);
+    ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
+
+    // The resolution might already have been changed when flushing.
+    if (mEncoderState != EncoderState::CHANGING_RESOLUTION) {
+        return;
+    }
+    ALOG_ASSERT(mPendingPictureSize);
+
+    // The device returned all input buffers of the previous resolution, dequeue the ones we didn't
+    // process yet so their work items are reported.
+    while (mInputQueue->IsStreaming() && mInputQueue->QueuedBuffersCount() > 0) {
+        if (!dequeueInputBuffer()) break;
+    }
+    if (mEncoderState == EncoderState::ERROR) return;
+    if (!mOutputWorkQueue.empty()) {
+        ALOGE("Work items still pending after draining the encoder");
+        reportError(C2_CORRUPTED);
+        return;
+    }
+
+    // Stop streaming, the device is restarted by encode() when the next frame is queued.
+    stopDevicePoll();
+    for (auto& queue : {mInputQueue, mOutputQueue}) {
+        if (queue->IsStreaming() && !queue->Streamoff()) {
+            ALOGE("Failed to stop streaming on the device queue");
+            reportError(C2_CORRUPTED);
+            return;
+        }
+    }
+
+    // The input format depends on the resolution, so the input buffers are always reallocated.
+    // They don't hold any memory as the frames are queued as DMABUFs. The blocks of the input
+    // format convertor are kept if the new frames fit in them, as allocating them is costly. The
+    // cached input layouts are invalidated as the client will allocate new graphic buffers.
+    for (auto& it : mInputBuffersMap) {
+        if (mInputFormatConverter && it.second) {
+            mInputFormatConverter->returnBlock(it.first);
+        }
+        it.second = nullptr;
+    }
+    destroyInputBuffers();
+    mInputLayoutCache.clear();
+
+    mVisibleSize = *mPendingPictureSize;
+    mPictureSize = *mPendingPictureSize;
+    mPendingPictureSize.reset();
+
+    // The device keeps reading the kept blocks with their stride.
+    std::optional<uint32_t> stride;
+    if (mInputFormatConverter && mInputFormatConverter->setVisibleSize(mVisibleSize)) {
+        ALOGV("Keeping the input format convertor blocks of size %s",
+              mInputFormatConverter->codedSize().ToString().c_str());
+        stride = static_cast<uint32_t>(mInputLayout->planes()[0].stride);
+    } else {
+        mInputFormatConverter.reset();
+        stride = getVideoFrameStride(kInputPixelFormat, mVisibleSize);
+    }
+    if (!stride) {
+        ALOGE("Failed to get video frame stride");
+        reportError(C2_CORRUPTED);
+        return;
+    }
+
+    // The output format depends on the resolution too, and can't be set while the output buffers
+    // are allocated. The output buffers don't hold any memory as the bitstream blocks are fetched
+    // from the block pool when the buffers are queued, so reallocating them is cheap.
+    for (auto& block : mOutputBuffersMap) {
+        block.reset();
+    }
+    destroyOutputBuffers();
+    if (!configureOutputFormat(mOutputProfile) || !createOutputBuffers()) {
+        reportError(C2_CORRUPTED);
+        return;
+    }
+
+    if (!configureInputFormat(kInputPixelFormat, *stride) || !createInputBuffers()) {
+        reportError(C2_CORRUPTED);
+        return;
+    }
+
+    // The level might have been adjusted by the interface for the new resolution.
+    std::optional<uint8_t> h264Level;
+    if (mOutputCodec == media::kCodecH264) {
+        C2StreamProfileLevelInfo::output profileLevel;
+        c2_status_t status = mInterface->query({&profileLevel}, {}, C2_DONT_BLOCK, nullptr);
+        if (status != C2_OK) {
+            ALOGE("Failed to query interface for profile and level (error code: %d)", status);
+            reportError(status);
+            return;
+        }
+        h264Level = c2LevelToLevelIDC(profileLevel.level);
+    }
+    if (!configureDevice(mOutputProfile, h264Level)) {
+        reportError(C2_CORRUPTED);
+        return;
+    }
+
+    // Apply the dynamic encoding parameters again, and start the new resolution with a key frame
+    // preceded by new codec-specific data.
+    mBitrate = 0;
+    mFramerate = 0;
+    mInterface->markDynamicParamsChanged();
+    mKeyFrameCounter = 0;
+    mTemporalLayerFrameCounter = 0;
+    mCSDSubmitted = mOutputCodec == media::kCodecVP8 || mOutputCodec == media::kCodecVP9;
+
+    if (mInputWorkQueue.empty()) {
+        setEncoderState(EncoderState::WAITING_FOR_INPUT);
+        return;
+    }
+    setEncoderState(EncoderState::ENCODING);
+    mEncoderTaskRunner->PostTask(
+            FROM_HERE, ::base::BindOnce(&V4L2EncodeComponent::scheduleNextEncodeTask, mWeakThis));
+}
+
 void V4L2EncodeComponent::flush() {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
@@ -1217,9 +2036,18 @@ void V4L2EncodeComponent::flush() {
         abortedWorkItems.push_back(std::move(work));
         mOutputWorkQueue.pop_front();
     }
+    mOutputOrder.clear();
+    mFrameTimes.clear();
     if (!abortedWorkItems.empty())
         mListener->onWorkDone_nb(shared_from_this(), std::move(abortedWorkItems));
 
+    // There is nothing left to drain if we were waiting to change the resolution, so we can
+    // change it right away.
+    if (mEncoderState == EncoderState::CHANGING_RESOLUTION) {
+        changeResolution();
+        return;
+    }
+
     // Streaming and polling on the V4L2 device input and output queues will be resumed once new
     // encode work is queued.
 }
@@ -1271,10 +2099,7 @@ void V4L2EncodeComponent::onInputBufferDone(uint64_t index) {
     // Return all completed work items. The work item might have been waiting for it's input buffer
     // to be returned, in which case we can report it as completed now. As input buffers are not
     // necessarily returned in order we might be able to return multiple ready work items now.
-    while (!mOutputWorkQueue.empty() && isWorkDone(*mOutputWorkQueue.front())) {
-        reportWork(std::move(mOutputWorkQueue.front()));
-        mOutputWorkQueue.pop_front();
-    }
+    reportFinishedWorks();
 
     // We might have been waiting for input buffers to be returned after draining finished.
     if (mEncoderState == EncoderState::DRAINING && mOutputWorkQueue.empty()) {
@@ -1292,7 +2117,8 @@ void V4L2EncodeComponent::onInputBufferDone(uint64_t index) {
 }
 
 void V4L2EncodeComponent::onOutputBufferDone(uint32_t payloadSize, bool keyFrame, int64_t timestamp,
-                                             std::shared_ptr<C2LinearBlock> outputBlock) {
+                                             std::shared_ptr<C2LinearBlock> outputBlock,
+                                             C2V4L2EncodeFrameStatsStruct stats) {
     ALOGV("%s(): output buffer done (timestamp: %" PRId64 ", size: %u, key frame: %d)", __func__,
           timestamp, payloadSize, keyFrame);
     ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
@@ -1311,7 +2137,7 @@ void V4L2EncodeComponent::onOutputBufferDone(uint32_t payloadSize, bool keyFrame
         ALOGV("No CSD submitted yet, extracting CSD");
         std::unique_ptr<C2StreamInitDataInfo::output> csd;
         C2ReadView view = constBlock.map().get();
-        extractCSDInfo(&csd, view.data(), view.capacity());
+        extractCSDInfo(&csd, view.data(), view.capacity(), mOutputCodec);
         if (!csd) {
             ALOGE("Failed to extract CSD");
             reportError(C2_CORRUPTED);
@@ -1342,15 +2168,85 @@ void V4L2EncodeComponent::onOutputBufferDone(uint32_t payloadSize, bool keyFrame
         buffer->setInfo(
                 std::make_shared<C2StreamPictureTypeMaskInfo::output>(0u, C2Config::SYNC_FRAME));
     }
+    // Tag the output with its temporal layer, so the upper layers can be dropped downstream. The
+    // device restarts the prediction structure at each key frame.
+    if (mNumTemporalLayers > 1) {
+        if (keyFrame) mTemporalLayerFrameCounter = 0;
+        const uint32_t layerId =
+                getTemporalLayerId(mNumTemporalLayers, mTemporalLayerFrameCounter++);
+        buffer->setInfo(std::make_shared<C2StreamV4L2TemporalLayerIdInfo::output>(0u, layerId));
+    }
+    // Complete the statistics of the frame with the time it spent in the component and on the
+    // device, and attach them to the output.
+    auto times = mFrameTimes.find(work->input.ordinal.frameIndex.peeku());
+    if (times != mFrameTimes.end()) {
+        stats.inputWaitTimeUs =
+                elapsedMicroseconds(times->second.mQueued, times->second.mEncodeStarted);
+        stats.encodeTimeUs = elapsedMicroseconds(times->second.mEncodeStarted,
+                                                 std::chrono::steady_clock::now());
+    }
+    buffer->setInfo(std::make_shared<C2StreamV4L2EncodeFrameStatsInfo::output>(0u, stats));
+    updateSessionStats(stats, keyFrame);
+    // The device returns the encoded output in decoding order, which differs from the input order
+    // when B-frames are used. Keep track of the order, so the work items are reported in the same
+    // order. The output keeps the presentation timestamp of its input frame.
+    if (work->worklets.front()->output.buffers.empty()) {
+        mOutputOrder.push_back(work->input.ordinal.frameIndex.peeku());
+    }
     work->worklets.front()->output.buffers.emplace_back(buffer);
 
     // We can report the work item as completed if its associated input buffer has also been
     // released. As output buffers are not necessarily returned in order we might be able to return
     // multiple ready work items now.
-    while (!mOutputWorkQueue.empty() && isWorkDone(*mOutputWorkQueue.front())) {
-        reportWork(std::move(mOutputWorkQueue.front()));
-        mOutputWorkQueue.pop_front();
+    reportFinishedWorks();
+}
+
+int32_t V4L2EncodeComponent::getAverageQp() {
+    ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
+
+#ifdef V4L2_CID_MPEG_VIDEO_AVERAGE_QP
+    // The control holds the average QP of the last frame encoded by the device. We read it as soon
+    // as the output buffer is dequeued, which might be late by a frame if the device is already
+    // done encoding the next one.
+    if (mAverageQpSupported) {
+        auto ctrl = mDevice->GetCtrl(V4L2_CID_MPEG_VIDEO_AVERAGE_QP);
+        if (ctrl) return ctrl->value;
     }
+#endif
+    return -1;
+}
+
+void V4L2EncodeComponent::updateSessionStats(const C2V4L2EncodeFrameStatsStruct& stats,
+                                             bool keyFrame) {
+    ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
+
+    mEncodedFrameCount++;
+    if (keyFrame) mEncodedKeyFrameCount++;
+    mRecentFrameStats.push_back(stats);
+    if (mRecentFrameStats.size() > kSessionStatsWindow) mRecentFrameStats.pop_front();
+
+    C2StreamV4L2EncodeSessionStatsInfo::output sessionStats(0u);
+    sessionStats.frameCount = mEncodedFrameCount;
+    sessionStats.keyFrameCount = mEncodedKeyFrameCount;
+    uint64_t qpSum = 0, qpCount = 0, bitsSum = 0, encodeTimeSum = 0, inputWaitTimeSum = 0;
+    for (const C2V4L2EncodeFrameStatsStruct& frame : mRecentFrameStats) {
+        if (frame.averageQp >= 0) {
+            qpSum += frame.averageQp;
+            qpCount++;
+        }
+        bitsSum += frame.bits;
+        encodeTimeSum += frame.encodeTimeUs;
+        inputWaitTimeSum += frame.inputWaitTimeUs;
+        sessionStats.maxEncodeTimeUs = std::max(sessionStats.maxEncodeTimeUs, frame.encodeTimeUs);
+    }
+    const uint64_t count = mRecentFrameStats.size();
+    sessionStats.averageQp = qpCount > 0 ? static_cast<int32_t>(qpSum / qpCount) : -1;
+    sessionStats.averageBits = static_cast<uint32_t>(bitsSum / count);
+    sessionStats.averageEncodeTimeUs = static_cast<uint32_t>(encodeTimeSum / count);
+    sessionStats.averageInputWaitTimeUs = static_cast<uint32_t>(inputWaitTimeSum / count);
+
+    // The statistics are only copied to the interface, which reports them when queried.
+    mInterface->setSessionStats(sessionStats);
 }
 
 C2Work* V4L2EncodeComponent::getWorkByIndex(uint64_t index) {
@@ -1416,6 +2312,36 @@ bool V4L2EncodeComponent::isWorkDone(const C2Work& work) const {
     return true;
 }
 
+void V4L2EncodeComponent::reportFinishedWorks() {
+    ALOGV("%s()", __func__);
+    ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
+
+    while (!mOutputWorkQueue.empty()) {
+        // Work items with encoded output are reported in decoding order. Work items without encoded
+        // output (e.g. an empty EOS work item) are reported once all work items queued before them
+        // have been reported.
+        auto it = mOutputWorkQueue.begin();
+        if (!mOutputOrder.empty()) {
+            const uint64_t index = mOutputOrder.front();
+            it = std::find_if(mOutputWorkQueue.begin(), mOutputWorkQueue.end(),
+                              [index](const std::unique_ptr<C2Work>& w) {
+                                  return w->input.ordinal.frameIndex.peeku() == index;
+                              });
+            if (it == mOutputWorkQueue.end()) {
+                ALOGE("Failed to find work (index: %" PRIu64 ")", index);
+                reportError(C2_CORRUPTED);
+                return;
+            }
+        }
+        if (!isWorkDone(**it)) return;
+
+        if (!mOutputOrder.empty()) mOutputOrder.pop_front();
+        std::unique_ptr<C2Work> work = std::move(*it);
+        mOutputWorkQueue.erase(it);
+        reportWork(std::move(work));
+    }
+}
+
 void V4L2EncodeComponent::reportWork(std::unique_ptr<C2Work> work) {
     ALOG_ASSERT(work);
     ALOGV("%s(): Reporting work item as finished (index: %llu, timestamp: %llu)", __func__,
@@ -1424,6 +2350,7 @@ void V4L2EncodeComponent::reportWork(std::unique_ptr<C2Work> work) {
 
     work->result = C2_OK;
     work->workletsProcessed = static_cast<uint32_t>(work->worklets.size());
+    mFrameTimes.erase(work->input.ordinal.frameIndex.peeku());
 
     std::list<std::unique_ptr<C2Work>> finishedWorkList;
     finishedWorkList.emplace_back(std::move(work));
@@ -1502,7 +2429,9 @@ bool V4L2EncodeComponent::enqueueInputBuffer(std::unique_ptr<InputFrame> frame,
     ALOG_ASSERT(mInputLayout->format() == format);
     ALOG_ASSERT(mInputLayout->planes().size() == planes.size());
 
-    auto buffer = mInputQueue->GetFreeBuffer();
+    // Prefer the buffer last queued with the same DMABUFs, so the driver doesn't import them again.
+    // The queue matches the DMABUFs by identity, whichever fds the input block refers to them by.
+    auto buffer = mInputQueue->GetFreeBufferForDmabufs(frame->getFDs());
     if (!buffer) {
         ALOGE("Failed to get free buffer from device input queue");
         return false;
@@ -1553,24 +2482,25 @@ bool V4L2EncodeComponent::enqueueOutputBuffer() {
     ALOG_ASSERT(mEncoderTaskRunner->RunsTasksInCurrentSequence());
     ALOG_ASSERT(mOutputQueue->FreeBuffersCount() > 0);
 
-    auto buffer = mOutputQueue->GetFreeBuffer();
-    if (!buffer) {
-        ALOGE("Failed to get free buffer from device output queue");
+    std::shared_ptr<C2LinearBlock> outputBlock = fetchOutputBlock();
+    if (!outputBlock) {
+        ALOGE("Failed to fetch output block");
         reportError(C2_CORRUPTED);
         return false;
     }
 
-    std::shared_ptr<C2LinearBlock> outputBlock = fetchOutputBlock();
-    if (!outputBlock) {
-        ALOGE("Failed to fetch output block");
+    // Prefer the buffer last queued with the same DMABUF, so the driver doesn't import it again.
+    // The queue matches the DMABUF by identity, whichever fd the output block refers to it by.
+    const std::vector<int> fds = {outputBlock->handle()->data[0]};
+    auto buffer = mOutputQueue->GetFreeBufferForDmabufs(fds);
+    if (!buffer) {
+        ALOGE("Failed to get free buffer from device output queue");
         reportError(C2_CORRUPTED);
         return false;
     }
 
     size_t bufferId = buffer->BufferId();
 
-    std::vector<int> fds;
-    fds.push_back(outputBlock->handle()->data[0]);
     if (!std::move(*buffer).QueueDMABuf(fds)) {
         ALOGE("Failed to queue output buffer using QueueDMABuf");
         reportError(C2_CORRUPTED);
@@ -1649,11 +2579,30 @@ bool V4L2EncodeComponent::dequeueOutputBuffer() {
 
     std::shared_ptr<C2LinearBlock> block = std::move(mOutputBuffersMap[buffer->BufferId()]);
     if (encodedDataSize > 0) {
+        C2V4L2EncodeFrameStatsStruct stats;
+        if (buffer->IsKeyframe()) {
+            stats.frameType = V4L2_ENCODE_FRAME_TYPE_I;
+        } else if (buffer->IsPFrame()) {
+            stats.frameType = V4L2_ENCODE_FRAME_TYPE_P;
+        } else if (buffer->IsBFrame()) {
+            stats.frameType = V4L2_ENCODE_FRAME_TYPE_B;
+        }
+        stats.averageQp = getAverageQp();
+        stats.bits = static_cast<uint32_t>(encodedDataSize * 8);
         onOutputBufferDone(encodedDataSize, buffer->IsKeyframe(), timestamp.InMicroseconds(),
-                           std::move(block));
+                           std::move(block), stats);
     }
 
     // If the buffer is marked as last and we were flushing the encoder, flushing is now done.
+    // If the buffer is marked as last and we were changing the resolution, all frames of the
+    // previous resolution are encoded now. The buffer isn't queued again as the device's queues
+    // will be reconfigured.
+    if ((mEncoderState == EncoderState::CHANGING_RESOLUTION) && buffer->IsLast()) {
+        mEncoderTaskRunner->PostTask(
+                FROM_HERE, ::base::BindOnce(&V4L2EncodeComponent::changeResolution, mWeakThis));
+        return false;
+    }
+
     if ((mEncoderState == EncoderState::DRAINING) && buffer->IsLast()) {
         onDrainDone(true);
 
@@ -1683,7 +2632,7 @@ bool V4L2EncodeComponent::createInputBuffers() {
 
     // No memory is allocated here, we just generate a list of buffers on the input queue, which
     // will hold memory handles to the real buffers.
-    if (mInputQueue->AllocateBuffers(kInputBufferCount, V4L2_MEMORY_DMABUF) < kInputBufferCount) {
+    if (mInputQueue->AllocateBuffers(mInputBufferCount, V4L2_MEMORY_DMABUF) < mInputBufferCount) {
         ALOGE("Failed to create V4L2 input buffers.");
         return false;
     }
@@ -1789,7 +2738,8 @@ void V4L2EncodeComponent::setEncoderState(EncoderState state) {
     case EncoderState::WAITING_FOR_INPUT:
         ALOG_ASSERT(mEncoderState == EncoderState::UNINITIALIZED ||
                     mEncoderState == EncoderState::ENCODING ||
-                    mEncoderState == EncoderState::DRAINING);
+                    mEncoderState == EncoderState::DRAINING ||
+                    mEncoderState == EncoderState::CHANGING_RESOLUTION);
         break;
     case EncoderState::WAITING_FOR_INPUT_BUFFERS:
         ALOG_ASSERT(mEncoderState == EncoderState::ENCODING);
@@ -1797,9 +2747,11 @@ void V4L2EncodeComponent::setEncoderState(EncoderState state) {
     case EncoderState::ENCODING:
         ALOG_ASSERT(mEncoderState == EncoderState::WAITING_FOR_INPUT ||
                     mEncoderState == EncoderState::WAITING_FOR_INPUT_BUFFERS ||
-                    mEncoderState == EncoderState::DRAINING);
+                    mEncoderState == EncoderState::DRAINING ||
+                    mEncoderState == EncoderState::CHANGING_RESOLUTION);
         break;
     case EncoderState::DRAINING:
+    case EncoderState::CHANGING_RESOLUTION:
         ALOG_ASSERT(mEncoderState == EncoderState::ENCODING);
         break;
     case EncoderState::ERROR:
@@ -1836,6 +2788,8 @@ const char* V4L2EncodeComponent::encoderStateToString(V4L2EncodeComponent::Encod
         return "ENCODING";
     case EncoderState::DRAINING:
         return "Draining";
+    case EncoderState::CHANGING_RESOLUTION:
+        return "CHANGING_RESOLUTION";
     case EncoderState::ERROR:
         return "ERROR";
     }
@@ -46,6 +46,24 @@ constexpr uint32_t kMaxBitrate = 50000000;
 // The frame size of 1080p video.
 constexpr uint32_t kFrameSize1080P = 1920 * 1080;
 
+// The range of the H.264 quantization parameter.
+constexpr int32_t kMinH264Qp = 0;
+constexpr int32_t kMaxH264Qp = 51;
+// The default quantization parameters of I and P frames in the constant quality mode.
+constexpr int32_t kDefaultIFrameQp = 26;
+constexpr int32_t kDefaultPFrameQp = 28;
+
+// The maximal number of consecutive B-frames.
+constexpr uint32_t kMaxBFrames = 3;
+// The maximal number of reference frames, the maximal H.264 DPB size in frames.
+constexpr uint32_t kMaxNumRefFrames = 16;
+// The maximal number of temporal layers.
+constexpr uint32_t kMaxTemporalLayers = 3;
+// The maximal number of slices per frame.
+constexpr uint32_t kMaxSliceCount = 32;
+// The maximal QP delta of a region of interest.
+constexpr int32_t kMaxQpDelta = 51;
+
 C2Config::profile_t videoCodecProfileToC2Profile(media::VideoCodecProfile profile) {
     switch (profile) {
     case media::VideoCodecProfile::H264PROFILE_BASELINE:
@@ -70,6 +88,22 @@ C2Config::profile_t videoCodecProfileToC2Profile(media::VideoCodecProfile profil
         return C2Config::PROFILE_AVC_STEREO_HIGH;
     case media::VideoCodecProfile::H264PROFILE_MULTIVIEWHIGH:
         return C2Config::PROFILE_AVC_MULTIVIEW_HIGH;
+    case media::VideoCodecProfile::HEVCPROFILE_MAIN:
+        return C2Config::PROFILE_HEVC_MAIN;
+    case media::VideoCodecProfile::HEVCPROFILE_MAIN10:
+        return C2Config::PROFILE_HEVC_MAIN_10;
+    case media::VideoCodecProfile::HEVCPROFILE_MAIN_STILL_PICTURE:
+        return C2Config::PROFILE_HEVC_MAIN_STILL;
+    case media::VideoCodecProfile::VP8PROFILE_ANY:
+        return C2Config::PROFILE_VP8_0;
+    case media::VideoCodecProfile::VP9PROFILE_PROFILE0:
+        return C2Config::PROFILE_VP9_0;
+    case media::VideoCodecProfile::VP9PROFILE_PROFILE1:
+        return C2Config::PROFILE_VP9_1;
+    case media::VideoCodecProfile::VP9PROFILE_PROFILE2:
+        return C2Config::PROFILE_VP9_2;
+    case media::VideoCodecProfile::VP9PROFILE_PROFILE3:
+        return C2Config::PROFILE_VP9_3;
     default:
         ALOGE("Unrecognizable profile (value = %d)...", profile);
         return C2Config::PROFILE_UNUSED;
@@ -79,6 +113,12 @@ C2Config::profile_t videoCodecProfileToC2Profile(media::VideoCodecProfile profil
 std::optional<media::VideoCodec> getCodecFromComponentName(const std::string& name) {
     if (name == V4L2ComponentName::kH264Encoder)
         return media::VideoCodec::kCodecH264;
+    if (name == V4L2ComponentName::kH265Encoder)
+        return media::VideoCodec::kCodecHEVC;
+    if (name == V4L2ComponentName::kVP8Encoder)
+        return media::VideoCodec::kCodecVP8;
+    if (name == V4L2ComponentName::kVP9Encoder)
+        return media::VideoCodec::kCodecVP9;
 
     ALOGE("Unknown name: %s", name.c_str());
     return std::nullopt;
@@ -235,6 +275,39 @@ C2R V4L2EncodeInterface::IntraRefreshPeriodSetter(bool mayBlock,
     return C2R::Ok();
 }
 
+// static
+C2R V4L2EncodeInterface::QpRangeSetter(bool mayBlock,
+                                       C2P<C2StreamV4L2QpRangeTuning::output>& qpRange) {
+    (void)mayBlock;
+    if (qpRange.v.minQp > qpRange.v.maxQp) {
+        ALOGE("Invalid QP range [%d, %d]", qpRange.v.minQp, qpRange.v.maxQp);
+        return C2R(C2SettingResultBuilder::BadValue(qpRange.F(qpRange.v.minQp)));
+    }
+    return qpRange.F(qpRange.v.minQp)
+            .validatePossible(qpRange.v.minQp)
+            .plus(qpRange.F(qpRange.v.maxQp).validatePossible(qpRange.v.maxQp))
+            .plus(qpRange.F(qpRange.v.iFrameQp).validatePossible(qpRange.v.iFrameQp))
+            .plus(qpRange.F(qpRange.v.pFrameQp).validatePossible(qpRange.v.pFrameQp));
+}
+
+// static
+C2R V4L2EncodeInterface::LayeringSetter(bool mayBlock,
+                                        C2P<C2StreamTemporalLayeringTuning::output>& layering) {
+    (void)mayBlock;
+    if (layering.v.m.layerCount > kMaxTemporalLayers) {
+        layering.set().m.layerCount = kMaxTemporalLayers;
+    }
+    // B-layers are not supported.
+    layering.set().m.bLayerCount = 0;
+    // Make sure the cumulative bitrate ratios are increasing and within [0, 1].
+    for (size_t i = 0; i < layering.v.flexCount(); ++i) {
+        layering.set().m.bitrateRatios[i] =
+                c2_clamp(i > 0 ? layering.v.m.bitrateRatios[i - 1] : 0.0f,
+                         layering.v.m.bitrateRatios[i], 1.0f);
+    }
+    return C2R::Ok();
+}
+
 V4L2EncodeInterface::V4L2EncodeInterface(
         const C2String& name, std::shared_ptr<C2ReflectorHelper> helper)
       : C2InterfaceHelper(std::move(helper)) {
@@ -256,9 +329,18 @@ void V4L2EncodeInterface::Initialize(const C2String& name) {
     // Use type=unsigned int here, otherwise it will cause compile error in
     // C2F(mProfileLevel, profile).oneOf(profiles) since std::vector<C2Config::profile_t> cannot
     // convert to std::vector<unsigned int>.
+    std::optional<media::VideoCodec> codec = getCodecFromComponentName(name);
+    if (!codec) {
+        mInitStatus = C2_BAD_VALUE;
+        return;
+    }
+
     std::vector<unsigned int> profiles;
     media::Size maxSize;
     for (const auto& supportedProfile : device->GetSupportedEncodeProfiles()) {
+        if (videoCodecProfileToVideoCodec(supportedProfile.profile) != *codec) {
+            continue;  // neglect the profiles of other codecs
+        }
         C2Config::profile_t profile = videoCodecProfileToC2Profile(supportedProfile.profile);
         if (profile == C2Config::PROFILE_UNUSED) {
             continue;  // neglect unrecognizable profile
@@ -306,7 +388,8 @@ void V4L2EncodeInterface::Initialize(const C2String& name) {
                          .build());
 
     std::string outputMime;
-    if (getCodecFromComponentName(name) == media::VideoCodec::kCodecH264) {
+    switch (*codec) {
+    case media::VideoCodec::kCodecH264:
         outputMime = MEDIA_MIMETYPE_VIDEO_AVC;
         addParameter(
                 DefineParam(mProfileLevel, C2_PARAMKEY_PROFILE_LEVEL)
@@ -326,8 +409,63 @@ void V4L2EncodeInterface::Initialize(const C2String& name) {
                                                  C2Config::LEVEL_AVC_5_1})})
                         .withSetter(ProfileLevelSetter, mInputVisibleSize, mFrameRate, mBitrate)
                         .build());
-    } else {
-        // TODO(johnylin): implement VP8/VP9 encoder in the future.
+        break;
+
+    case media::VideoCodec::kCodecHEVC:
+        outputMime = MEDIA_MIMETYPE_VIDEO_HEVC;
+        addParameter(
+                DefineParam(mProfileLevel, C2_PARAMKEY_PROFILE_LEVEL)
+                        .withDefault(new C2StreamProfileLevelInfo::output(
+                                0u, minProfile, C2Config::LEVEL_HEVC_MAIN_4_1))
+                        .withFields({C2F(mProfileLevel, profile).oneOf(profiles),
+                                     C2F(mProfileLevel, level)
+                                             .oneOf({C2Config::LEVEL_HEVC_MAIN_1,
+                                                     C2Config::LEVEL_HEVC_MAIN_2,
+                                                     C2Config::LEVEL_HEVC_MAIN_2_1,
+                                                     C2Config::LEVEL_HEVC_MAIN_3,
+                                                     C2Config::LEVEL_HEVC_MAIN_3_1,
+                                                     C2Config::LEVEL_HEVC_MAIN_4,
+                                                     C2Config::LEVEL_HEVC_MAIN_4_1,
+                                                     C2Config::LEVEL_HEVC_MAIN_5,
+                                                     C2Config::LEVEL_HEVC_MAIN_5_1,
+                                                     C2Config::LEVEL_HEVC_HIGH_4,
+                                                     C2Config::LEVEL_HEVC_HIGH_4_1,
+                                                     C2Config::LEVEL_HEVC_HIGH_5,
+                                                     C2Config::LEVEL_HEVC_HIGH_5_1})})
+                        .withSetter(Setter<decltype(*mProfileLevel)>::StrictValueWithNoDeps)
+                        .build());
+        break;
+
+    case media::VideoCodec::kCodecVP8:
+        outputMime = MEDIA_MIMETYPE_VIDEO_VP8;
+        addParameter(DefineParam(mProfileLevel, C2_PARAMKEY_PROFILE_LEVEL)
+                             .withDefault(new C2StreamProfileLevelInfo::output(
+                                     0u, minProfile, C2Config::LEVEL_UNUSED))
+                             .withFields({C2F(mProfileLevel, profile).oneOf(profiles),
+                                          C2F(mProfileLevel, level).oneOf(
+                                                  {C2Config::LEVEL_UNUSED})})
+                             .withSetter(Setter<decltype(*mProfileLevel)>::StrictValueWithNoDeps)
+                             .build());
+        break;
+
+    case media::VideoCodec::kCodecVP9:
+        outputMime = MEDIA_MIMETYPE_VIDEO_VP9;
+        addParameter(
+                DefineParam(mProfileLevel, C2_PARAMKEY_PROFILE_LEVEL)
+                        .withDefault(new C2StreamProfileLevelInfo::output(0u, minProfile,
+                                                                          C2Config::LEVEL_VP9_4_1))
+                        .withFields({C2F(mProfileLevel, profile).oneOf(profiles),
+                                     C2F(mProfileLevel, level)
+                                             .oneOf({C2Config::LEVEL_VP9_1, C2Config::LEVEL_VP9_1_1,
+                                                     C2Config::LEVEL_VP9_2, C2Config::LEVEL_VP9_2_1,
+                                                     C2Config::LEVEL_VP9_3, C2Config::LEVEL_VP9_3_1,
+                                                     C2Config::LEVEL_VP9_4, C2Config::LEVEL_VP9_4_1,
+                                                     C2Config::LEVEL_VP9_5})})
+                        .withSetter(Setter<decltype(*mProfileLevel)>::StrictValueWithNoDeps)
+                        .build());
+        break;
+
+    default:
         ALOGE("Unsupported component name: %s", name.c_str());
         mInitStatus = C2_BAD_VALUE;
         return;
@@ -387,6 +525,103 @@ void V4L2EncodeInterface::Initialize(const C2String& name) {
                          .withSetter(Setter<decltype(*mKeyFramePeriodUs)>::StrictValueWithNoDeps)
                          .build());
 
+    addParameter(DefineParam(mBitrateMode, C2_PARAMKEY_BITRATE_MODE)
+                         .withDefault(new C2StreamBitrateModeTuning::output(
+                                 0u, C2Config::BITRATE_CONST))
+                         .withFields({C2F(mBitrateMode, value)
+                                              .oneOf({C2Config::BITRATE_IGNORE,
+                                                      C2Config::BITRATE_CONST,
+                                                      C2Config::BITRATE_VARIABLE})})
+                         .withSetter(Setter<decltype(*mBitrateMode)>::StrictValueWithNoDeps)
+                         .build());
+
+    addParameter(DefineParam(mQpRange, C2_PARAMKEY_V4L2_QP_RANGE)
+                         .withDefault(new C2StreamV4L2QpRangeTuning::output(
+                                 0u, kMinH264Qp, kMaxH264Qp, kDefaultIFrameQp, kDefaultPFrameQp))
+                         .withFields({C2F(mQpRange, minQp).inRange(kMinH264Qp, kMaxH264Qp),
+                                      C2F(mQpRange, maxQp).inRange(kMinH264Qp, kMaxH264Qp),
+                                      C2F(mQpRange, iFrameQp).inRange(kMinH264Qp, kMaxH264Qp),
+                                      C2F(mQpRange, pFrameQp).inRange(kMinH264Qp, kMaxH264Qp)})
+                         .withSetter(QpRangeSetter)
+                         .build());
+
+    addParameter(DefineParam(mPeakBitrate, C2_PARAMKEY_V4L2_PEAK_BITRATE)
+                         .withDefault(new C2StreamV4L2PeakBitrateTuning::output(0u, 0))
+                         .withFields({C2F(mPeakBitrate, value).inRange(0, kMaxBitrate)})
+                         .withSetter(Setter<decltype(*mPeakBitrate)>::StrictValueWithNoDeps)
+                         .build());
+
+    addParameter(DefineParam(mVbvSize, C2_PARAMKEY_V4L2_VBV_SIZE)
+                         .withDefault(new C2StreamV4L2VbvSizeTuning::output(0u, 0))
+                         .withFields({C2F(mVbvSize, value).any()})
+                         .withSetter(Setter<decltype(*mVbvSize)>::StrictValueWithNoDeps)
+                         .build());
+
+    addParameter(DefineParam(mBFrames, C2_PARAMKEY_V4L2_B_FRAMES)
+                         .withDefault(new C2StreamV4L2BFramesTuning::output(0u, 0))
+                         .withFields({C2F(mBFrames, value).inRange(0, kMaxBFrames)})
+                         .withSetter(Setter<decltype(*mBFrames)>::StrictValueWithNoDeps)
+                         .build());
+
+    addParameter(DefineParam(mNumRefFrames, C2_PARAMKEY_V4L2_NUM_REF_FRAMES)
+                         .withDefault(new C2StreamV4L2NumRefFramesTuning::output(0u, 0))
+                         .withFields({C2F(mNumRefFrames, value).inRange(0, kMaxNumRefFrames)})
+                         .withSetter(Setter<decltype(*mNumRefFrames)>::StrictValueWithNoDeps)
+                         .build());
+
+    addParameter(
+            DefineParam(mLayering, C2_PARAMKEY_TEMPORAL_LAYERING)
+                    .withDefault(C2StreamTemporalLayeringTuning::output::AllocShared(0u, 0, 0, 0))
+                    .withFields({C2F(mLayering, m.layerCount).inRange(0, kMaxTemporalLayers),
+                                 C2F(mLayering, m.bLayerCount).inRange(0, 0),
+                                 C2F(mLayering, m.bitrateRatios).inRange(0., 1.)})
+                    .withSetter(LayeringSetter)
+                    .build());
+
+    addParameter(DefineParam(mSliceCount, C2_PARAMKEY_V4L2_SLICE_COUNT)
+                         .withDefault(new C2StreamV4L2SliceCountTuning::output(0u, 0))
+                         .withFields({C2F(mSliceCount, value).inRange(0, kMaxSliceCount)})
+                         .withSetter(Setter<decltype(*mSliceCount)>::StrictValueWithNoDeps)
+                         .build());
+
+    // The per-frame encoding hints are attached to the input of the work items, these parameters
+    // are only declared so the hints are recognized by the framework.
+    addParameter(
+            DefineParam(mRoiRects, C2_PARAMKEY_V4L2_ROI_RECTS)
+                    .withDefault(C2StreamV4L2RoiRectsTuning::input::AllocShared(0u, 0u))
+                    .withFields({C2F(mRoiRects, m.values[0].left).any(),
+                                 C2F(mRoiRects, m.values[0].top).any(),
+                                 C2F(mRoiRects, m.values[0].width).any(),
+                                 C2F(mRoiRects, m.values[0].height).any(),
+                                 C2F(mRoiRects, m.values[0].qpDelta)
+                                         .inRange(-kMaxQpDelta, kMaxQpDelta)})
+                    .withSetter(Setter<decltype(*mRoiRects)>::NonStrictValuesWithNoDeps)
+                    .build());
+
+    addParameter(DefineParam(mQpMap, C2_PARAMKEY_V4L2_QP_MAP)
+                         .withDefault(C2StreamV4L2QpMapTuning::input::AllocShared(0u, 0u))
+                         .withFields({C2F(mQpMap, m.value).any()})
+                         .withSetter(Setter<decltype(*mQpMap)>::NonStrictValuesWithNoDeps)
+                         .build());
+
+    // The session statistics can't be configured, the value reported on query is set by the
+    // component after each encoded frame.
+    addParameter(DefineParam(mSessionStats, C2_PARAMKEY_V4L2_ENCODE_SESSION_STATS)
+                         .withConstValue(new C2StreamV4L2EncodeSessionStatsInfo::output(0u))
+                         .build());
+
+    addParameter(DefineParam(mPriority, C2_PARAMKEY_PRIORITY)
+                         .withDefault(new C2ComponentPriorityTuning(0))
+                         .withFields({C2F(mPriority, value).any()})
+                         .withSetter(Setter<decltype(*mPriority)>::NonStrictValueWithNoDeps)
+                         .build());
+
+    addParameter(DefineParam(mOperatingRate, C2_PARAMKEY_OPERATING_RATE)
+                         .withDefault(new C2ComponentOperatingRateTuning(0.))
+                         .withFields({C2F(mOperatingRate, value).any()})
+                         .withSetter(Setter<decltype(*mOperatingRate)>::NonStrictValueWithNoDeps)
+                         .build());
+
     C2Allocator::id_t inputAllocators[] = {kDefaultInputAllocator};
 
     C2Allocator::id_t outputAllocators[] = {kDefaultOutputAllocator};
@@ -414,6 +649,60 @@ void V4L2EncodeInterface::Initialize(const C2String& name) {
     mInitStatus = C2_OK;
 }
 
+c2_status_t V4L2EncodeInterface::config(
+        const std::vector<C2Param*>& params, c2_blocking_t mayBlock,
+        std::vector<std::unique_ptr<C2SettingResult>>* const failures, bool updateParams,
+        std::vector<std::shared_ptr<C2Param>>* changes) {
+    c2_status_t status =
+            C2InterfaceHelper::config(params, mayBlock, failures, updateParams, changes);
+
+    for (const C2Param* param : params) {
+        if (param == nullptr) continue;
+        const uint32_t coreIndex = param->coreIndex().coreIndex();
+        if (coreIndex == C2StreamBitrateInfo::CORE_INDEX ||
+            coreIndex == C2StreamFrameRateInfo::CORE_INDEX ||
+            coreIndex == C2StreamRequestSyncFrameTuning::CORE_INDEX) {
+            mDynamicParamsChanged = true;
+        } else if (coreIndex == C2ComponentPriorityTuning::CORE_INDEX ||
+                   coreIndex == C2ComponentOperatingRateTuning::CORE_INDEX) {
+            mSchedulingParamsChanged = true;
+        } else if (coreIndex == C2StreamPictureSizeInfo::CORE_INDEX) {
+            mPictureSizeChanged = true;
+        }
+    }
+    return status;
+}
+
+c2_status_t V4L2EncodeInterface::query(
+        const std::vector<C2Param*>& stackParams,
+        const std::vector<C2Param::Index>& heapParamIndices, c2_blocking_t mayBlock,
+        std::vector<std::unique_ptr<C2Param>>* const heapParams) const {
+    const size_t heapParamsOffset = heapParams ? heapParams->size() : 0;
+    c2_status_t status =
+            C2InterfaceHelper::query(stackParams, heapParamIndices, mayBlock, heapParams);
+
+    std::lock_guard<std::mutex> lock(mSessionStatsLock);
+    for (C2Param* param : stackParams) {
+        if (param && *param && C2StreamV4L2EncodeSessionStatsInfo::output::From(param)) {
+            param->updateFrom(mLatestSessionStats);
+        }
+    }
+    if (heapParams) {
+        for (size_t i = heapParamsOffset; i < heapParams->size(); ++i) {
+            C2Param* param = (*heapParams)[i].get();
+            if (param && C2StreamV4L2EncodeSessionStatsInfo::output::From(param)) {
+                param->updateFrom(mLatestSessionStats);
+            }
+        }
+    }
+    return status;
+}
+
+void V4L2EncodeInterface::setSessionStats(const C2StreamV4L2EncodeSessionStatsInfo::output& stats) {
+    std::lock_guard<std::mutex> lock(mSessionStatsLock);
+    mLatestSessionStats.updateFrom(stats);
+}
+
 uint32_t V4L2EncodeInterface::getKeyFramePeriod() const {
     if (mKeyFramePeriodUs->value < 0 || mKeyFramePeriodUs->value == INT64_MAX) {
         return 0;
@@ -422,4 +711,17 @@ uint32_t V4L2EncodeInterface::getKeyFramePeriod() const {
     return static_cast<uint32_t>(std::max(std::min(std::round(period), double(UINT32_MAX)), 1.));
 }
 
+std::vector<float> V4L2EncodeInterface::getTemporalLayerBitrateRatios() const {
+    const uint32_t layerCount = mLayering->m.layerCount;
+    std::vector<float> ratios;
+    for (uint32_t i = 0; i + 1 < layerCount; ++i) {
+        // Split the bitrate evenly between the layers if the client doesn't specify the ratios.
+        float ratio = (i < mLayering->flexCount()) ? mLayering->m.bitrateRatios[i]
+                                                   : static_cast<float>(i + 1) / layerCount;
+        ratios.push_back(ratios.empty() ? ratio : std::max(ratio, ratios.back()));
+    }
+    if (layerCount > 0) ratios.push_back(1.0f);
+    return ratios;
+}
+
 }  // namespace android
@@ -0,0 +1,135 @@
+// Copyright 2020 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// #define LOG_NDEBUG 0
+#define ATRACE_TAG ATRACE_TAG_VIDEO
+#define LOG_TAG "V4L2PrewarmPool"
+
+#include <v4l2_codec2/components/V4L2PrewarmPool.h>
+
+#include <algorithm>
+
+#include <base/bind.h>
+#include <cutils/properties.h>
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include <video_pixel_format.h>
+
+namespace android {
+namespace {
+
+// The system property of the number of instances kept for each codec.
+const char* kPrewarmPropertyName = "vendor.v4l2_codec2.prewarm_instances";
+constexpr int32_t kDefaultNumInstances = 1;
+
+bool prepareInstance(media::V4L2Device::Type type, uint32_t pixelFormat,
+                     const std::string& threadName, scoped_refptr<media::V4L2Device>* device,
+                     std::unique_ptr<::base::Thread>* thread) {
+    *device = media::V4L2Device::Create();
+    if (!*device || !(*device)->Open(type, pixelFormat)) {
+        ALOGW("Failed to open device for %s", media::FourccToString(pixelFormat).c_str());
+        return false;
+    }
+    if (!(*device)->StartPollThread()) {
+        ALOGW("Failed to start the poller thread");
+        return false;
+    }
+
+    *thread = std::make_unique<::base::Thread>(threadName);
+    if (!(*thread)->Start()) {
+        ALOGW("Failed to start thread %s", threadName.c_str());
+        return false;
+    }
+    // The thread is used and stopped by the component adopting it.
+    (*thread)->DetachFromSequence();
+    return true;
+}
+
+}  // namespace
+
+// static
+V4L2PrewarmPool& V4L2PrewarmPool::getInstance() {
+    static V4L2PrewarmPool sPool;
+    return sPool;
+}
+
+V4L2PrewarmPool::V4L2PrewarmPool()
+      : mNumInstances(static_cast<size_t>(
+                std::max(property_get_int32(kPrewarmPropertyName, kDefaultNumInstances), 0))) {
+    ALOGV("%s(): %zu instances per codec", __func__, mNumInstances);
+    if (mNumInstances == 0) return;
+
+    if (!mPrewarmThread.Start()) {
+        ALOGE("Failed to start the pre-warm thread");
+        return;
+    }
+    mPrewarmTaskRunner = mPrewarmThread.task_runner();
+}
+
+V4L2PrewarmPool::~V4L2PrewarmPool() {
+    ALOGV("%s()", __func__);
+
+    // Wait for the pending tasks before destroying the instances.
+    mPrewarmThread.Stop();
+    mEntries.clear();
+}
+
+void V4L2PrewarmPool::prewarm(media::V4L2Device::Type type, uint32_t pixelFormat,
+                              const std::string& threadName) {
+    if (!mPrewarmTaskRunner) return;
+
+    std::lock_guard<std::mutex> lock(mLock);
+    const Key key(type, pixelFormat);
+    Entry& entry = mEntries[key];
+    entry.mThreadName = threadName;
+    fillLocked(key, &entry);
+}
+
+bool V4L2PrewarmPool::take(media::V4L2Device::Type type, uint32_t pixelFormat,
+                           scoped_refptr<media::V4L2Device>* device,
+                           std::unique_ptr<::base::Thread>* thread) {
+    std::lock_guard<std::mutex> lock(mLock);
+    const Key key(type, pixelFormat);
+    auto it = mEntries.find(key);
+    if (it == mEntries.end() || it->second.mInstances.empty()) {
+        ALOGV("%s(%s): no instance ready", __func__, media::FourccToString(pixelFormat).c_str());
+        return false;
+    }
+
+    Entry& entry = it->second;
+    *device = std::move(entry.mInstances.front().mDevice);
+    *thread = std::move(entry.mInstances.front().mThread);
+    entry.mInstances.pop_front();
+    ALOGV("%s(%s): %zu instances left", __func__, media::FourccToString(pixelFormat).c_str(),
+          entry.mInstances.size());
+
+    fillLocked(key, &entry);
+    return true;
+}
+
+void V4L2PrewarmPool::fillLocked(const Key& key, Entry* entry) {
+    while (entry->mInstances.size() + entry->mNumPending < mNumInstances) {
+        ++entry->mNumPending;
+        mPrewarmTaskRunner->PostTask(
+                FROM_HERE, ::base::BindOnce(&V4L2PrewarmPool::prewarmTask,
+                                            ::base::Unretained(this), key, entry->mThreadName));
+    }
+}
+
+void V4L2PrewarmPool::prewarmTask(Key key, std::string threadName) {
+    ALOGV("%s(%s)", __func__, media::FourccToString(key.second).c_str());
+    ATRACE_CALL();
+
+    Instance instance;
+    const bool prewarmed = prepareInstance(key.first, key.second, threadName, &instance.mDevice,
+                                           &instance.mThread);
+
+    std::lock_guard<std::mutex> lock(mLock);
+    Entry& entry = mEntries[key];
+    --entry.mNumPending;
+    if (prewarmed) entry.mInstances.push_back(std::move(instance));
+}
+
+}  // namespace android
@@ -8,8 +8,12 @@
 
 #include <v4l2_codec2/components/VideoFrame.h>
 
+#include <algorithm>
+
 #include <C2AllocatorGralloc.h>
 #include <log/log.h>
+#include <ui/GraphicBuffer.h>
+#include <ui/GraphicBufferMapper.h>
 #include <utils/Trace.h>
 
 namespace android {
@@ -18,17 +22,29 @@ namespace android {
 std::unique_ptr<VideoFrame> VideoFrame::Create(std::shared_ptr<C2GraphicBlock> block) {
     if (!block) return nullptr;
 
-    std::vector<int> fds;
     const C2Handle* const handle = block->handle();
-    for (int i = 0; i < handle->numFds; i++) {
-        fds.emplace_back(handle->data[i]);
-    }
-
+    std::vector<int> fds(handle->data, handle->data + handle->numFds);
     return std::unique_ptr<VideoFrame>(new VideoFrame(std::move(block), std::move(fds)));
 }
 
 VideoFrame::VideoFrame(std::shared_ptr<C2GraphicBlock> block, std::vector<int> fds)
-      : mGraphicBlock(std::move(block)), mFds(fds) {}
+      : mGraphicBlock(std::move(block)), mFds(std::move(fds)) {}
+
+void VideoFrame::rebind(std::shared_ptr<C2GraphicBlock> block) {
+    ALOG_ASSERT(block != nullptr);
+
+    // The buffer of a block might be replaced, e.g. when the output surface is switched, so the
+    // file descriptors are checked against the handle.
+    const C2Handle* const handle = block->handle();
+    if (mFds.size() != static_cast<size_t>(handle->numFds) ||
+        !std::equal(mFds.begin(), mFds.end(), handle->data)) {
+        mFds.assign(handle->data, handle->data + handle->numFds);
+    }
+    mGraphicBlock = std::move(block);
+    mVisibleRect = media::Rect();
+    mBitstreamId = -1;
+    mModifier = 0;
+}
 
 VideoFrame::~VideoFrame() /* default;*/ {
     ALOGV("%s", __func__);
@@ -54,6 +70,22 @@ int32_t VideoFrame::getBitstreamId() const {
     return mBitstreamId;
 }
 
+void VideoFrame::setBlockId(uint32_t blockId) {
+    mBlockId = blockId;
+}
+
+uint32_t VideoFrame::getBlockId() const {
+    return mBlockId;
+}
+
+void VideoFrame::setModifier(uint64_t modifier) {
+    mModifier = modifier;
+}
+
+uint64_t VideoFrame::getModifier() const {
+    return mModifier;
+}
+
 C2ConstGraphicBlock VideoFrame::getGraphicBlock() {
     ALOGV("%s,mVisibleRect:%dx%d ", __func__, mVisibleRect.width(), mVisibleRect.height());
     return mGraphicBlock->share(C2Rect(mVisibleRect.width(), mVisibleRect.height()), ::C2Fence());
@@ -67,4 +99,33 @@ std::shared_ptr<C2GraphicBlock> VideoFrame::setRawGraphicBlock(
         std::shared_ptr<C2GraphicBlock> block) {
     return mGraphicBlock = block;
 }
+
+std::optional<uint64_t> VideoFrame::queryModifier() const {
+    const C2Handle* const handle = mGraphicBlock->handle();
+    uint32_t width, height, format, stride, igbpSlot, generation;
+    uint64_t usage, igbpId;
+    _UnwrapNativeCodec2GrallocMetadata(handle, &width, &height, &format, &usage, &stride,
+                                       &generation, &igbpId, &igbpSlot);
+    native_handle_t* grallocHandle = UnwrapNativeCodec2GrallocHandle(handle);
+    if (!grallocHandle) {
+        ALOGE("Failed to unwrap the gralloc handle");
+        return std::nullopt;
+    }
+
+    // The gralloc metadata can only be queried from an imported buffer.
+    sp<GraphicBuffer> buffer = new GraphicBuffer(grallocHandle, GraphicBuffer::CLONE_HANDLE, width,
+                                                 height, format, 1, usage, stride);
+    native_handle_delete(grallocHandle);
+    if (buffer->initCheck() != NO_ERROR) {
+        ALOGE("Failed to import the buffer: %d", buffer->initCheck());
+        return std::nullopt;
+    }
+
+    uint64_t modifier;
+    if (GraphicBufferMapper::get().getPixelFormatModifier(buffer->handle, &modifier) != NO_ERROR) {
+        ALOGV("The modifier is not reported by gralloc");
+        return std::nullopt;
+    }
+    return modifier;
+}
 }  // namespace android
@@ -8,6 +8,7 @@
 
 #include <v4l2_codec2/components/VideoFramePool.h>
 
+#include <inttypes.h>
 #include <stdint.h>
 #include <memory>
 
@@ -20,6 +21,7 @@
 #include <utils/Trace.h>
 
 #include <v4l2_codec2/common/VideoTypes.h>
+#include <v4l2_codec2/plugin_store/C2RecyclingGraphicAllocator.h>
 #include <v4l2_codec2/plugin_store/C2VdaBqBlockPool.h>
 #include <v4l2_codec2/plugin_store/C2VdaPooledBlockPool.h>
 #include <v4l2_codec2/plugin_store/V4L2AllocatorId.h>
@@ -33,6 +35,11 @@ using android::hardware::graphics::common::V1_0::BufferUsage;
 #endif
 
 namespace android {
+namespace {
+// Grow the buffer set when fetching a buffer waited that long while the client is starved of
+// output buffers, about two frames at 60fps.
+constexpr int64_t kStarvationThresholdMs = 32;
+}  // namespace
 
 // static
 std::optional<uint32_t> VideoFramePool::getBufferIdFromGraphicBlock(const C2BlockPool& blockPool,
@@ -69,6 +76,22 @@ c2_status_t VideoFramePool::requestNewBufferSet(C2BlockPool& blockPool, int32_t
     return C2_BAD_VALUE;
 }
 
+// static
+c2_status_t VideoFramePool::growBufferSet(C2BlockPool& blockPool, int32_t bufferCount) {
+    ALOGV("%s() blockPool.getAllocatorId() = %u", __func__, blockPool.getAllocatorId());
+
+    if (blockPool.getAllocatorId() == android::V4L2AllocatorId::V4L2_BUFFERPOOL) {
+        C2VdaPooledBlockPool* bpPool = static_cast<C2VdaPooledBlockPool*>(&blockPool);
+        return bpPool->growBufferSet(bufferCount);
+    } else if (blockPool.getAllocatorId() == C2PlatformAllocatorStore::BUFFERQUEUE) {
+        C2VdaBqBlockPool* bqPool = static_cast<C2VdaBqBlockPool*>(&blockPool);
+        return bqPool->growBufferSet(bufferCount);
+    }
+
+    ALOGE("%s(): unknown allocator ID: %u", __func__, blockPool.getAllocatorId());
+    return C2_BAD_VALUE;
+}
+
 // static
 bool VideoFramePool::setNotifyBlockAvailableCb(C2BlockPool& blockPool, ::base::OnceClosure cb) {
     ALOGV("%s() blockPool.getAllocatorId() = %u", __func__, blockPool.getAllocatorId());
@@ -82,43 +105,75 @@ bool VideoFramePool::setNotifyBlockAvailableCb(C2BlockPool& blockPool, ::base::O
 
 // static
 std::unique_ptr<VideoFramePool> VideoFramePool::Create(
-        std::shared_ptr<C2BlockPool> blockPool, const size_t numBuffers, const media::Size& size,
-        HalPixelFormat pixelFormat, bool isSecure,
-        scoped_refptr<::base::SequencedTaskRunner> taskRunner) {
+        std::shared_ptr<C2BlockPool> blockPool, const size_t numBuffers, const size_t maxNumBuffers,
+        const media::Size& size, const media::Size& scaledSize, HalPixelFormat pixelFormat,
+        uint64_t usage, bool isSecure, scoped_refptr<::base::SequencedTaskRunner> taskRunner) {
     ALOG_ASSERT(blockPool != nullptr);
+    ALOG_ASSERT(numBuffers <= maxNumBuffers);
 
-#if !defined OUT_NV12_TO_RGBA && !defined OUT_RGBA_TO_RGBA
-    if (requestNewBufferSet(*blockPool, numBuffers) != C2_OK) {
-        return nullptr;
+#ifdef OUT_RGBA_TO_RGBA
+    // The 32-bit RGB frames already have the output format, so they are decoded straight into the
+    // RGBA_8888 blocks of |blockPool| instead of being copied from the blocks of a converter.
+    if (pixelFormat == HalPixelFormat::BGRA_8888 || pixelFormat == HalPixelFormat::RGBA_8888) {
+        pixelFormat = HalPixelFormat::RGBA_8888;
     }
 #endif
     std::unique_ptr<VideoFramePool> pool = ::base::WrapUnique(new VideoFramePool(
-            std::move(blockPool), size, pixelFormat, isSecure, numBuffers, std::move(taskRunner)));
+            blockPool, size, scaledSize, pixelFormat, usage, isSecure, numBuffers, maxNumBuffers,
+            std::move(taskRunner)));
+    if (!scaledSize.IsEmpty() && !pool->mOutputFormatConverter) return nullptr;
+    // The frames are decoded into the blocks of the converter if any, not fetched from |blockPool|.
+    if (!pool->mOutputFormatConverter && requestNewBufferSet(*blockPool, numBuffers) != C2_OK) {
+        return nullptr;
+    }
     if (!pool->initialize()) return nullptr;
 
     return pool;
 }
 
 VideoFramePool::VideoFramePool(std::shared_ptr<C2BlockPool> blockPool, const media::Size& size,
-                               HalPixelFormat pixelFormat, bool isSecure, const size_t numBuffers,
+                               const media::Size& scaledSize, HalPixelFormat pixelFormat,
+                               uint64_t usage, bool isSecure, const size_t numBuffers,
+                               const size_t maxNumBuffers,
                                scoped_refptr<::base::SequencedTaskRunner> taskRunner)
       : mBlockPool(std::move(blockPool)),
         mSize(size),
+        mScaledSize(scaledSize),
         mPixelFormat(pixelFormat),
-        mMemoryUsage(C2MemoryUsage::CPU_READ, C2MemoryUsage::CPU_WRITE),
+        mMemoryUsage(C2MemoryUsage::CPU_READ | usage, C2MemoryUsage::CPU_WRITE),
+        mNumBuffers(numBuffers),
+        mMaxNumBuffers(maxNumBuffers),
+        mCachedFrames(numBuffers),
         mClientTaskRunner(std::move(taskRunner)) {
-    ALOGV("%s(size=%dx%d)", __func__, size.width(), size.height());
+    ALOGV("%s(size=%dx%d, scaledSize=%s, usage=0x%" PRIx64 ", numBuffers=%zu, maxNumBuffers=%zu)",
+          __func__, size.width(), size.height(), scaledSize.ToString().c_str(), usage, numBuffers,
+          maxNumBuffers);
     ALOG_ASSERT(mClientTaskRunner->RunsTasksInCurrentSequence());
     DCHECK(mBlockPool);
     DCHECK(mClientTaskRunner);
-#ifdef OUT_NV12_TO_RGBA
-    mOutputFormatConverter = OutputFormatConverter::Create(
-            media::VideoPixelFormat::PIXEL_FORMAT_NV12, size, numBuffers, size);
-    if (!mOutputFormatConverter) ALOGV("%s create OutputFormatConverter failed", __func__);
+    if (!mScaledSize.IsEmpty()) {
+        // Only the small scaled buffers are output to the client. The full-size buffers the frames
+        // are decoded into stay in the pool.
+        mOutputFormatConverter = OutputFormatConverter::CreateScaler(
+                pixelFormat, size, scaledSize, numBuffers,
+                C2RecyclingGraphicAllocator::getBasicGraphicBlockPool());
+        if (!mOutputFormatConverter) ALOGE("%s create scaling converter failed", __func__);
+        return;
+    }
+#if defined OUT_NV12_TO_RGBA || defined OUT_RGBA_TO_RGBA
+    // 10-bit frames are converted to RGBA_1010102, so their depth is kept.
+    if (pixelFormat == HalPixelFormat::YCBCR_P010) {
+        mOutputFormatConverter = OutputFormatConverter::Create(
+                media::VideoPixelFormat::PIXEL_FORMAT_P016LE, size, numBuffers, size,
+                C2RecyclingGraphicAllocator::getBasicGraphicBlockPool());
+        if (!mOutputFormatConverter) ALOGV("%s create OutputFormatConverter failed", __func__);
+        return;
+    }
 #endif
-#ifdef OUT_RGBA_TO_RGBA
+#ifdef OUT_NV12_TO_RGBA
     mOutputFormatConverter = OutputFormatConverter::Create(
-            media::VideoPixelFormat::PIXEL_FORMAT_ABGR/* PIXEL_FORMAT_ARGB*/, size, numBuffers, size);
+            media::VideoPixelFormat::PIXEL_FORMAT_NV12, size, numBuffers, size,
+            C2RecyclingGraphicAllocator::getBasicGraphicBlockPool());
     if (!mOutputFormatConverter) ALOGV("%s create OutputFormatConverter failed", __func__);
 #endif
 }
@@ -153,6 +208,8 @@ void VideoFramePool::destroyTask() {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mFetchTaskRunner->RunsTasksInCurrentSequence());
 
+    ALOGI("Fetching buffers waited %zu times for %" PRId64 " ms in total, %zu/%zu buffers used",
+          mNumFetchWaits, mTotalFetchWaitTime.InMilliseconds(), mNumBuffers, mMaxNumBuffers);
     mFetchWeakThisFactory.InvalidateWeakPtrs();
 }
 
@@ -171,6 +228,18 @@ bool VideoFramePool::getVideoFrame(GetVideoFrameCB cb) {
     return true;
 }
 
+bool VideoFramePool::isFetching() const {
+    ALOG_ASSERT(mClientTaskRunner->RunsTasksInCurrentSequence());
+
+    return static_cast<bool>(mOutputCb);
+}
+
+void VideoFramePool::setOutputStarved(bool starved) {
+    ALOG_ASSERT(mClientTaskRunner->RunsTasksInCurrentSequence());
+
+    mOutputStarved = starved;
+}
+
 // static
 void VideoFramePool::getVideoFrameTaskThunk(
         scoped_refptr<::base::SequencedTaskRunner> taskRunner,
@@ -185,9 +254,13 @@ void VideoFramePool::getVideoFrameTaskThunk(
 void VideoFramePool::getVideoFrameTaskFromConverterPool() {}
 
 void VideoFramePool::convertFrame(std::shared_ptr<C2GraphicBlock> from,
+                                  const media::Rect& visibleRect,
                                   std::shared_ptr<C2GraphicBlock>* to) {
     c2_status_t status;
-    if (mOutputFormatConverter) {
+    if (mOutputFormatConverter && !mScaledSize.IsEmpty()) {
+        *to = mOutputFormatConverter->scaleBlock(std::move(from), visibleRect, &status);
+        if (status != C2_OK) ALOGE("%s(), scaleBlock failed:%d", __func__, status);
+    } else if (mOutputFormatConverter) {
         *to = mOutputFormatConverter->convertBlock(from, &status);
         if (status != C2_OK) ALOGE("%s(), convertBlock failed:%d", __func__, status);
     } else {
@@ -195,6 +268,14 @@ void VideoFramePool::convertFrame(std::shared_ptr<C2GraphicBlock> from,
     }
 }
 
+void VideoFramePool::setColorAspects(const C2StreamColorAspectsInfo::output& colorAspects) {
+    ALOG_ASSERT(mClientTaskRunner->RunsTasksInCurrentSequence());
+
+    if (mOutputFormatConverter) {
+        mOutputFormatConverter->setColorAspects(colorAspects.range, colorAspects.matrix);
+    }
+}
+
 void VideoFramePool::retrunFrame(std::shared_ptr<C2GraphicBlock> block) {
     c2_status_t status;
     if (mOutputFormatConverter) {
@@ -224,7 +305,20 @@ void VideoFramePool::getVideoFrameTask() {
                                             &block);
     }
     if (err == C2_TIMED_OUT || err == C2_BLOCKING) {
-        if (!mOutputFormatConverter &&
+        if (!mFetchWaitStart) {
+            mFetchWaitStart = ::base::TimeTicks::Now();
+            mNumFetchWaits++;
+        }
+        if (maybeGrowBufferSet()) {
+            mFetchTaskRunner->PostTask(
+                    FROM_HERE,
+                    ::base::BindOnce(&VideoFramePool::getVideoFrameTask, mFetchWeakThis));
+            return;
+        }
+
+        // Keep polling while the buffer set can still grow, so the starvation is noticed even if
+        // no buffer is released.
+        if (!mOutputFormatConverter && mNumBuffers >= mMaxNumBuffers &&
             setNotifyBlockAvailableCb(*mBlockPool,
                                       ::base::BindOnce(&VideoFramePool::getVideoFrameTaskThunk,
                                                        mFetchTaskRunner, mFetchWeakThis))) {
@@ -246,15 +340,27 @@ void VideoFramePool::getVideoFrameTask() {
     // Reset to the default value.
     sNumRetries = 0;
     sDelay = kFetchRetryDelayInit;
+    if (mFetchWaitStart) {
+        mTotalFetchWaitTime += ::base::TimeTicks::Now() - *mFetchWaitStart;
+        mFetchWaitStart.reset();
+    }
 
     std::optional<FrameWithBlockId> frameWithBlockId;
     if (err == C2_OK) {
         ALOG_ASSERT(block != nullptr);
         std::optional<uint32_t> bufferId = getBufferIdFromGraphicBlock(*mBlockPool, *block);
-        std::unique_ptr<VideoFrame> frame = VideoFrame::Create(std::move(block));
+        std::unique_ptr<VideoFrame> frame;
+        CachedFrame* cachedFrame = bufferId ? getCachedFrameSlot(*bufferId, true) : nullptr;
+        if (cachedFrame && cachedFrame->frame) {
+            frame = std::move(cachedFrame->frame);
+            frame->rebind(std::move(block));
+        } else {
+            frame = VideoFrame::Create(std::move(block));
+        }
+        if (frame && bufferId) frame->setBlockId(*bufferId);
         // Only pass the frame + id pair if both have successfully been obtained.
         // Otherwise exit the loop so a nullopt is passed to the client.
-        if (ATRACE_ENABLED())
+        if (ATRACE_ENABLED() && bufferId)
             ATRACE_INT("bufferId", *bufferId);
         if (bufferId && frame) {
             frameWithBlockId = std::make_pair(std::move(frame), *bufferId);
@@ -270,6 +376,64 @@ void VideoFramePool::getVideoFrameTask() {
                                         std::move(frameWithBlockId)));
 }
 
+bool VideoFramePool::maybeGrowBufferSet() {
+    ALOG_ASSERT(mFetchTaskRunner->RunsTasksInCurrentSequence());
+    ALOG_ASSERT(mFetchWaitStart);
+
+    if (mOutputFormatConverter || mNumBuffers >= mMaxNumBuffers || !mOutputStarved) return false;
+
+    const ::base::TimeTicks now = ::base::TimeTicks::Now();
+    const ::base::TimeDelta waitTime = now - *mFetchWaitStart;
+    if (waitTime < ::base::TimeDelta::FromMilliseconds(kStarvationThresholdMs)) return false;
+
+    c2_status_t err = growBufferSet(*mBlockPool, mNumBuffers + 1);
+    if (err != C2_OK) {
+        ALOGW("%s(): Failed to grow the buffer set to %zu buffers, err=%d", __func__,
+              mNumBuffers + 1, err);
+        return false;
+    }
+    mNumBuffers++;
+    mCachedFrames.resize(mNumBuffers);
+    ALOGI("Starved for %" PRId64 " ms, grow the buffer set to %zu/%zu buffers",
+          waitTime.InMilliseconds(), mNumBuffers, mMaxNumBuffers);
+
+    // The next buffer should be allocated right away. Wait again before growing further.
+    mTotalFetchWaitTime += waitTime;
+    mFetchWaitStart = now;
+    return true;
+}
+
+void VideoFramePool::recycleFrame(std::unique_ptr<VideoFrame> frame) {
+    ALOGV("%s(blockId=%u)", __func__, frame->getBlockId());
+    ALOG_ASSERT(mClientTaskRunner->RunsTasksInCurrentSequence());
+
+    // Release the block right away, the cached frame must not keep it from the block pool.
+    frame->setRawGraphicBlock(nullptr);
+    mFetchTaskRunner->PostTask(FROM_HERE, ::base::BindOnce(&VideoFramePool::recycleFrameTask,
+                                                           mFetchWeakThis, std::move(frame)));
+}
+
+void VideoFramePool::recycleFrameTask(std::unique_ptr<VideoFrame> frame) {
+    ALOG_ASSERT(mFetchTaskRunner->RunsTasksInCurrentSequence());
+
+    // A frame of a block which was never fetched from this buffer set is dropped.
+    CachedFrame* cachedFrame = getCachedFrameSlot(frame->getBlockId(), false);
+    if (cachedFrame) cachedFrame->frame = std::move(frame);
+}
+
+VideoFramePool::CachedFrame* VideoFramePool::getCachedFrameSlot(uint32_t blockId, bool assign) {
+    ALOG_ASSERT(mFetchTaskRunner->RunsTasksInCurrentSequence());
+
+    CachedFrame* freeSlot = nullptr;
+    for (CachedFrame& cachedFrame : mCachedFrames) {
+        if (cachedFrame.blockId == blockId) return &cachedFrame;
+        if (!cachedFrame.blockId && !freeSlot) freeSlot = &cachedFrame;
+    }
+    if (!assign || !freeSlot) return nullptr;
+    freeSlot->blockId = blockId;
+    return freeSlot;
+}
+
 void VideoFramePool::onVideoFrameReady(std::optional<FrameWithBlockId> frameWithBlockId) {
     ALOGV("%s()", __func__);
     ALOG_ASSERT(mClientTaskRunner->RunsTasksInCurrentSequence());
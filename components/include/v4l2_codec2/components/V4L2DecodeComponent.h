@@ -5,6 +5,7 @@
 #ifndef ANDROID_V4L2_CODEC2_COMPONENTS_V4L2_DECODE_COMPONENT_H
 #define ANDROID_V4L2_CODEC2_COMPONENTS_V4L2_DECODE_COMPONENT_H
 
+#include <chrono>
 #include <memory>
 
 #include <C2Component.h>
@@ -19,7 +20,10 @@
 #include <v4l2_codec2/components/V4L2DecodeInterface.h>
 #include <v4l2_codec2/components/VideoDecoder.h>
 #include <v4l2_codec2/components/VideoFramePool.h>
+#include <v4l2_codec2/store/V4L2SessionScheduler.h>
 #include <v4l2_device.h>
+#include <vp8_parser.h>
+#include <vp9_parser.h>
 
 namespace android {
 
@@ -60,18 +64,26 @@ private:
 
     // Handle C2Component's public methods on |mDecoderTaskRunner|.
     void destroyTask();
-    void startTask(c2_status_t* status);
+    void startTask(scoped_refptr<media::V4L2Device> device, c2_status_t* status);
     void stopTask();
     void queueTask(std::unique_ptr<C2Work> work);
     void flushTask();
     void drainTask();
     void setListenerTask(const std::shared_ptr<Listener>& listener, ::base::WaitableEvent* done);
 
-    // Try to process pending works at |mPendingWorks|. Paused when |mIsDraining| is set.
+    // Return true if the frame of |work| should be skipped under the current decode mode.
+    bool shouldSkipWork(const C2Work& work);
+    // Try to process pending works at |mPendingWorks|. Paused when |mIsDraining| is set, or when
+    // the session scheduler asks us to wait before queuing the next input buffer.
     void pumpPendingWorks();
+    // Update the session scheduler with the priority and operating rate requested by the client,
+    // and ask whether we can queue an input buffer now. Returns the delay to wait otherwise.
+    std::chrono::microseconds acquireQueueSlot();
+    void onQueueSlotAvailable();
     // Get the buffer pool.
     void getVideoFramePool(std::unique_ptr<VideoFramePool>* pool, const media::Size& size,
-                           HalPixelFormat pixelFormat, size_t numBuffers);
+                           const media::Size& scaledSize, HalPixelFormat pixelFormat,
+                           uint64_t usage, size_t numBuffers, size_t maxNumBuffers);
     // Detect and report works with no-show frame, only used at VP8 and VP9.
     void detectNoShowFrameWorksAndReportIfFinished(const C2WorkOrdinalStruct& currOrdinal);
 
@@ -97,6 +109,8 @@ private:
     const std::shared_ptr<C2ComponentInterface> mIntf;
     // The pointer of component listener.
     std::shared_ptr<Listener> mListener;
+    // The ID of this component's session at the process-wide session scheduler.
+    const V4L2SessionScheduler::SessionId mSchedulerSessionId;
 
     std::unique_ptr<VideoDecoder> mDecoder;
     // The queue of works that haven't processed and sent to |mDecoder|.
@@ -116,6 +130,9 @@ private:
     // the drain request, and unset either after reportEOSWork() (EOS is outputted), or
     // reportAbandonedWorks() (drain is cancelled and works are abandoned).
     bool mIsDraining = false;
+    // Whether a delayed pumpPendingWorks() is scheduled because the session scheduler asked us to
+    // wait before queuing the next input buffer.
+    bool mIsWaitingForQueueSlot = false;
 
     // The mutex lock to synchronize start/stop/reset/release calls.
     std::mutex mStartStopLock;
@@ -133,9 +150,25 @@ private:
     // The record of frame index to update color aspects. Details as above.
     uint64_t mPendingColorAspectsChangeFrameIndex;
 
+    // Whether we have tried to parse the output format from the bitstream to pre-allocate the
+    // output buffers.
+    bool mOutputFormatHintParsed = false;
+
+    // The decode mode requested by the client, see V4L2DecodeMode. Only queried from |mIntfImpl|
+    // when the client configures it.
+    uint32_t mDecodeMode = V4L2_DECODE_MODE_ALL;
+    // Set when a skipped frame might be referred to by the following frames. All the frames are
+    // then skipped until the next key frame, whatever the decode mode.
+    bool mReferenceFrameSkipped = false;
+    // The parsers used to decide whether to skip the frames under the decode mode. They keep
+    // states across frames, and are created at the first use.
+    std::unique_ptr<media::Vp8Parser> mVp8Parser;
+    std::unique_ptr<media::Vp9Parser> mVp9Parser;
+
     // The device task runner and its sequence checker. We should interact with
     // |mDevice| on this.
-    ::base::Thread mDecoderThread{"V4L2DecodeComponentDecoderThread"};
+    // The thread might be replaced by one taken from V4L2PrewarmPool on start().
+    std::unique_ptr<::base::Thread> mDecoderThread;
     scoped_refptr<::base::SequencedTaskRunner> mDecoderTaskRunner;
 
     ::base::WeakPtrFactory<V4L2DecodeComponent> mWeakThisFactory{this};
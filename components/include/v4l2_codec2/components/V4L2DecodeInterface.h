@@ -5,6 +5,7 @@
 #ifndef ANDROID_V4L2_CODEC2_COMPONENTS_V4L2_DECODE_INTERFACE_H
 #define ANDROID_V4L2_CODEC2_COMPONENTS_V4L2_DECODE_INTERFACE_H
 
+#include <atomic>
 #include <memory>
 #include <string>
 
@@ -12,6 +13,7 @@
 #include <util/C2InterfaceHelper.h>
 
 #include <size.h>
+#include <v4l2_codec2/common/V4L2ComponentParams.h>
 #include <v4l2_codec2/common/VideoTypes.h>
 
 namespace android {
@@ -29,11 +31,26 @@ public:
     std::optional<VideoCodec> getVideoCodec() const { return mVideoCodec; }
     media::Size getMaxSize() const { return mMaxSize; }
     media::Size getMinSize() const { return mMinSize; }
+    media::Size getScaledOutputSize() const {
+        return media::Size(mScaledOutputSize->width, mScaledOutputSize->height);
+    }
 
     size_t getInputBufferSize() const;
     c2_status_t queryColorAspects(
             std::shared_ptr<C2StreamColorAspectsInfo::output>* targetColorAspects);
 
+    // Hides C2InterfaceHelper::config() to track changes of the scheduling parameters and of the
+    // decode mode.
+    c2_status_t config(const std::vector<C2Param*>& params, c2_blocking_t mayBlock,
+                       std::vector<std::unique_ptr<C2SettingResult>>* const failures,
+                       bool updateParams = true,
+                       std::vector<std::shared_ptr<C2Param>>* changes = nullptr);
+    // Returns whether the priority or operating rate were configured since the last call, and
+    // clears the flag. The component only needs to query these parameters if so.
+    bool takeSchedulingParamsChanged() { return mSchedulingParamsChanged.exchange(false); }
+    // Returns whether the decode mode was configured since the last call, and clears the flag.
+    bool takeDecodeModeChanged() { return mDecodeModeChanged.exchange(false); }
+
 private:
     // Configurable parameter setters.
     static C2R ProfileLevelSetter(bool mayBlock, C2P<C2StreamProfileLevelInfo::input>& info);
@@ -91,8 +108,22 @@ private:
     // former has higher priority. This parameter is used for component to provide color aspects
     // as C2Info in decoded output buffers.
     std::shared_ptr<C2StreamColorAspectsInfo::output> mColorAspects;
+    // The frames to decode, see V4L2DecodeMode. Could be changed while decoding, e.g. when the
+    // playback falls behind schedule.
+    std::shared_ptr<C2StreamV4L2DecodeModeTuning::input> mDecodeMode;
+    // The size the output frames are scaled down to, 0x0 if they are not scaled.
+    std::shared_ptr<C2StreamV4L2ScaledOutputSizeTuning::output> mScaledOutputSize;
+    // The scheduling priority of the component, 0 means realtime. Used by the session scheduler
+    // to meter the input buffers queued to the device.
+    std::shared_ptr<C2ComponentPriorityTuning> mPriority;
+    // The expected decoding rate in frames per second, 0 if unspecified.
+    std::shared_ptr<C2ComponentOperatingRateTuning> mOperatingRate;
 
     c2_status_t mInitStatus;
+    // Set when the priority or operating rate is configured, can be accessed from any thread.
+    std::atomic<bool> mSchedulingParamsChanged{true};
+    // Set when the decode mode is configured, can be accessed from any thread.
+    std::atomic<bool> mDecodeModeChanged{true};
     std::optional<VideoCodec> mVideoCodec;
     media::Size mMinSize;
     media::Size mMaxSize;
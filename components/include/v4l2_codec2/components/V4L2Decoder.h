@@ -7,8 +7,12 @@
 
 #include <stdint.h>
 
+#include <deque>
+#include <map>
 #include <memory>
 #include <optional>
+#include <utility>
+#include <vector>
 
 #include <base/callback.h>
 #include <base/memory/weak_ptr.h>
@@ -25,15 +29,23 @@ namespace android {
 
 class V4L2Decoder : public VideoDecoder {
 public:
+    // The output frames are scaled down to |scaledOutputSize| if it's not empty, see
+    // C2_PARAMKEY_V4L2_SCALED_OUTPUT_SIZE. |device| is a device already opened for |codec|, e.g. by
+    // V4L2PrewarmPool, or null to open a new one.
     static std::unique_ptr<VideoDecoder> Create(
-            const VideoCodec& codec, const size_t inputBufferSize, GetPoolCB getPoolCB,
-            OutputCB outputCb, ErrorCB errorCb,
+            const VideoCodec& codec, const size_t inputBufferSize,
+            const media::Size& scaledOutputSize, scoped_refptr<media::V4L2Device> device,
+            GetPoolCB getPoolCB, OutputCB outputCb, ErrorCB errorCb,
             scoped_refptr<::base::SequencedTaskRunner> taskRunner);
     ~V4L2Decoder() override;
 
     void decode(std::unique_ptr<BitstreamBuffer> buffer, DecodeCB decodeCb) override;
     void drain(DecodeCB drainCb) override;
     void flush() override;
+    void preallocateOutputBuffers(const media::Size& codedSize, size_t minNumBuffers) override;
+    void setColorAspects(std::shared_ptr<const C2StreamColorAspectsInfo::output> colorAspects,
+                         int32_t bitstreamId) override;
+    void recycleFrame(std::unique_ptr<VideoFrame> frame) override;
 
 private:
     enum class State {
@@ -56,8 +68,9 @@ private:
     };
 
     V4L2Decoder(scoped_refptr<::base::SequencedTaskRunner> taskRunner);
-    bool start(const VideoCodec& codec, const size_t inputBufferSize, GetPoolCB getPoolCb,
-               OutputCB outputCb, ErrorCB errorCb);
+    bool start(const VideoCodec& codec, const size_t inputBufferSize,
+               const media::Size& scaledOutputSize, scoped_refptr<media::V4L2Device> device,
+               GetPoolCB getPoolCb, OutputCB outputCb, ErrorCB errorCb);
     bool setupInputFormat(const uint32_t inputPixelFormat, const size_t inputBufferSize);
     void pumpDecodeRequest();
 
@@ -68,9 +81,28 @@ private:
     void tryFetchVideoFrame();
     void returnVideoFrame();
     void onVideoFrameReady(std::optional<VideoFramePool::FrameWithBlockId> frameWithBlockId);
+    void prefetchVideoFrame();
+    void onVideoFramePrefetched(std::optional<VideoFramePool::FrameWithBlockId> frameWithBlockId);
 
-    std::optional<size_t> getNumOutputBuffers();
+    // Apply the color aspects set for the bitstream buffers up to |bitstreamId| to
+    // |mVideoFramePool|, before the frame decoded from |bitstreamId| is converted.
+    void applyColorAspects(int32_t bitstreamId);
+
+    // Notify |mVideoFramePool| whether fetching an output buffer blocks the pending input.
+    void updateOutputStarved();
+
+    // Return the number of output buffers to allocate first and the maximal number of output
+    // buffers, given the minimal number of buffers required by the driver.
+    std::pair<size_t, size_t> getNumOutputBuffers(size_t minNumBuffers) const;
+    std::optional<size_t> getMinNumOutputBuffers();
     std::optional<struct v4l2_format> getFormatInfo();
+    // Try to let the device scale the output frames down to |mScaledOutputSize| through the compose
+    // rectangle of the capture queue, given the output |format| reported by the driver. Return
+    // false if the device doesn't support it, the frames are then scaled by the CPU.
+    bool setScaledOutputFormat(const struct v4l2_format& format);
+    // Reallocate the output buffers in the linear layout, as gralloc doesn't allocate buffers of
+    // the negotiated tiled or compressed layout.
+    bool fallBackToLinearOutputFormat();
     media::Rect getVisibleRect(const media::Size& codedSize);
     bool sendV4L2DecoderCmd(bool start);
 
@@ -93,13 +125,57 @@ private:
 
     media::Size mCodedSize;
     media::Rect mVisibleRect;
-
-    std::map<size_t, std::unique_ptr<VideoFrame>> mFrameAtDevice;
+    // The pixel format of the output buffers, set when the driver reports the output format.
+    HalPixelFormat mOutputPixelFormat = HalPixelFormat::UNKNOWN;
+    // The DRM format modifier of the layout the frames are decoded into.
+    uint64_t mOutputModifier = 0;
+    // The gralloc usage flags requesting the layout when allocating the output buffers.
+    uint64_t mOutputLayoutUsage = 0;
+    // Set when a tiled or compressed layout is negotiated, until the modifier of the first output
+    // buffer is checked.
+    bool mCheckOutputModifier = false;
+    // Set once gralloc didn't allocate the buffers of the negotiated layout. The frames are then
+    // always decoded in the linear layout.
+    bool mTiledOutputDisabled = false;
+
+    // The size requested for the output frames, empty if they are not scaled.
+    media::Size mScaledOutputSize;
+    // The size |mVideoFramePool| scales the decoded frames down to, empty if they are output as
+    // decoded, i.e. when the scaling is disabled or done by the device.
+    media::Size mPoolScaledSize;
+
+    // The frames queued at the device indexed by V4L2 buffer ID, nullptr for the free buffers.
+    // Sized to the number of allocated output buffers.
+    std::vector<std::unique_ptr<VideoFrame>> mFrameAtDevice;
 
     // Block IDs can be arbitrarily large, but we only have a limited number of
     // buffers. This maintains an association between a block ID and a specific
-    // V4L2 buffer index.
-    std::map<size_t, size_t> mBlockIdToV4L2Id;
+    // V4L2 buffer index, the V4L2 buffers being assigned in order.
+    std::map<uint32_t, size_t> mBlockIdToV4L2Id;
+
+    // Set when |mVideoFramePool| is created by preallocateOutputBuffers() and the frames are
+    // fetched into |mPrefetchedFrames| before the output queue is allocated. Unset when the
+    // output format is reported by the driver, either adopting or dropping the frames.
+    bool mIsPrefetching = false;
+    media::Size mPreallocatedCodedSize;
+    size_t mPreallocatedNumBuffers = 0;
+    size_t mPreallocatedMaxNumBuffers = 0;
+    std::vector<VideoFramePool::FrameWithBlockId> mPrefetchedFrames;
+
+    // The color aspects set by setColorAspects() for the frames not converted yet, with the
+    // bitstream id they apply from, and the ones applied to |mVideoFramePool|.
+    std::deque<std::pair<int32_t, std::shared_ptr<const C2StreamColorAspectsInfo::output>>>
+            mPendingColorAspects;
+    std::shared_ptr<const C2StreamColorAspectsInfo::output> mColorAspects;
+
+    // Incremented at each flush() and attached to the timestamp of each queued input buffer, so
+    // that output frames decoded from the input buffers queued before the flush are dropped.
+    uint32_t mFlushGeneration = 0;
+
+    // Set by the "vendor.v4l2_codec2.incremental_output_buffers" system property. Only the minimal
+    // number of output buffers required by the driver is allocated first, and the pool grows when
+    // the device is starved of output buffers.
+    bool mIncrementalOutputBuffers = false;
 
     State mState = State::Idle;
 
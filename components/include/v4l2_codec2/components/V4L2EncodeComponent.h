@@ -5,9 +5,14 @@
 #ifndef ANDROID_V4L2_CODEC2_COMPONENTS_V4L2_ENCODE_COMPONENT_H
 #define ANDROID_V4L2_CODEC2_COMPONENTS_V4L2_ENCODE_COMPONENT_H
 
+#include <sys/types.h>
+
 #include <atomic>
+#include <chrono>
+#include <map>
 #include <memory>
 #include <optional>
+#include <tuple>
 
 #include <C2Component.h>
 #include <C2ComponentFactory.h>
@@ -23,8 +28,11 @@
 #include <util/C2InterfaceHelper.h>
 
 #include <size.h>
+#include <v4l2_codec2/common/Common.h>
 #include <v4l2_codec2/common/FormatConverter.h>
 #include <v4l2_codec2/components/V4L2EncodeInterface.h>
+#include <v4l2_codec2/store/V4L2SessionScheduler.h>
+#include <video_codecs.h>
 #include <video_frame_layout.h>
 
 namespace media {
@@ -35,8 +43,6 @@ class V4L2Queue;
 
 namespace android {
 
-struct VideoFramePlane;
-
 class V4L2EncodeComponent : public C2Component,
                             public std::enable_shared_from_this<V4L2EncodeComponent> {
 public:
@@ -75,6 +81,23 @@ private:
         const std::vector<int> mFds;
     };
 
+    // The layout and pixel format of an input buffer.
+    struct InputLayout {
+        media::VideoPixelFormat mFormat;
+        std::vector<VideoFramePlane> mPlanes;
+    };
+    // Identifies the buffer backing an input block: the device and inode of the buffer's first
+    // dmabuf, which stay the same while the fds are duplicated for each frame, and the block's
+    // size, the buffer's pixel format and usage.
+    using InputLayoutKey = std::tuple<dev_t, ino_t, uint32_t, uint32_t, uint32_t, uint64_t>;
+
+    // The times at which a work item was queued to the component and its input buffer was queued
+    // to the device, used to report the statistics of each encoded frame.
+    struct FrameTimes {
+        std::chrono::steady_clock::time_point mQueued;
+        std::chrono::steady_clock::time_point mEncodeStarted;
+    };
+
     // Possible component states.
     enum class ComponentState {
         UNLOADED,  // Initial state of component.
@@ -90,6 +113,7 @@ private:
         WAITING_FOR_INPUT_BUFFERS,  // Waiting for V4L2 input queue buffers.
         ENCODING,                   // Queuing input buffers.
         DRAINING,                   // Flushing encoder.
+        CHANGING_RESOLUTION,        // Flushing encoder before changing the input resolution.
         ERROR,                      // encoder encountered an error.
     };
 
@@ -99,8 +123,9 @@ private:
     V4L2EncodeComponent(const V4L2EncodeComponent&) = delete;
     V4L2EncodeComponent& operator=(const V4L2EncodeComponent&) = delete;
 
-    // Initialize the encoder on the encoder thread.
-    void startTask(bool* success, ::base::WaitableEvent* done);
+    // Initialize the encoder on the encoder thread, with |device| if it was already opened.
+    void startTask(scoped_refptr<media::V4L2Device> device, bool* success,
+                   ::base::WaitableEvent* done);
     // Destroy the encoder on the encoder thread.
     void stopTask(::base::WaitableEvent* done);
     // Queue a new encode work item on the encoder thread.
@@ -117,8 +142,10 @@ private:
     // Set the component listener on the encoder thread.
     void setListenerTask(const std::shared_ptr<Listener>& listener, ::base::WaitableEvent* done);
 
-    // Initialize the V4L2 device for encoding with the requested configuration.
-    bool initializeEncoder();
+    // Initialize the V4L2 device for encoding with the requested configuration. |device| is a
+    // device already opened for the output profile, e.g. by V4L2PrewarmPool, or null to open a new
+    // one.
+    bool initializeEncoder(scoped_refptr<media::V4L2Device> device);
     // Configure input format on the V4L2 device.
     bool configureInputFormat(media::VideoPixelFormat inputFormat, uint32_t stride);
     // Configure output format on the V4L2 device.
@@ -126,16 +153,49 @@ private:
     // Configure required and optional controls on the V4L2 device.
     bool configureDevice(media::VideoCodecProfile outputProfile,
                          std::optional<const uint8_t> outputH264Level);
+    // Configure the HEVC-specific controls on the V4L2 device.
+    bool configureHevcControls(media::VideoCodecProfile outputProfile);
+    // Configure the VP8 or VP9-specific controls on the V4L2 device.
+    bool configureVpxControls(media::VideoCodecProfile outputProfile);
+    // Configure the bitrate control mode, quantization parameters, peak bitrate and VBV size
+    // requested by the codec 2.0 framework, as far as supported by the V4L2 device.
+    void configureRateControl();
+    // Configure the H.264 hierarchical-P temporal layering requested by the codec 2.0 framework,
+    // if supported by the V4L2 device. Sets |mNumTemporalLayers|.
+    void configureTemporalLayers();
+    // Append the controls setting the bitrate of each temporal layer for the total |bitrate|.
+    void appendTemporalLayerBitrateCtrls(uint32_t bitrate, std::vector<media::V4L2ExtCtrl>* ctrls);
     // Update the |mBitrate| and |mFramerate| currently configured on the V4L2 device, to match the
     // values requested by the codec 2.0 framework.
     bool updateEncodingParameters();
 
     // Schedule the next encode operation on the V4L2 device.
     void scheduleNextEncodeTask();
+    // Update the session scheduler with the priority and operating rate requested by the codec 2.0
+    // framework, and ask whether we can queue an input buffer now. Returns the delay to wait
+    // otherwise.
+    std::chrono::microseconds acquireQueueSlot();
+    // Configure the QP map of the next frame on the device, from the regions of interest and QP
+    // map in the |configUpdate| of its work item. Hints are ignored if the device doesn't support
+    // QP maps.
+    void applyQpHints(const std::vector<std::unique_ptr<C2Param>>& configUpdate);
+    // Get the layout and pixel format of the specified |block|. The layout is only resolved from
+    // the graphic buffer the first time a buffer is seen, and taken from |mInputLayoutCache| after.
+    std::optional<InputLayout> getInputLayout(const C2ConstGraphicBlock& block);
     // Encode the specified |block| with corresponding |index| and |timestamp|.
     bool encode(C2ConstGraphicBlock block, uint64_t index, int64_t timestamp);
     // Drain the encoder.
     void drain();
+    // Start changing the input resolution to |pictureSize|. The frames already queued on the device
+    // are encoded with the previous resolution first, after which changeResolution() is called.
+    void startResolutionChange(const media::Size& pictureSize);
+    // Get the input picture size of the |work| item, if it differs from the size the device is
+    // configured for. Returns false if the interface can't be queried.
+    bool getNewPictureSize(const C2Work& work, std::optional<media::Size>* pictureSize);
+    // Reconfigure the V4L2 device for |mPendingPictureSize| without closing it. The V4L2 input and
+    // output buffers, which don't hold any memory, are reallocated. The blocks of the input format
+    // convertor are only reallocated if the new frames don't fit in them.
+    void changeResolution();
     // Flush the encoder.
     void flush();
 
@@ -144,9 +204,16 @@ private:
 
     // Called on the encoder thread when the encoder is done using an input buffer.
     void onInputBufferDone(uint64_t index);
-    // Called on the encoder thread when an output buffer is ready.
+    // Called on the encoder thread when an output buffer is ready. The frame type, average QP and
+    // size of the frame are set in |stats|, the timings are filled in here.
     void onOutputBufferDone(uint32_t payloadSize, bool keyFrame, int64_t timestamp,
-                            std::shared_ptr<C2LinearBlock> outputBlock);
+                            std::shared_ptr<C2LinearBlock> outputBlock,
+                            C2V4L2EncodeFrameStatsStruct stats);
+    // Get the average QP of the last encoded frame, or -1 if not reported by the device.
+    int32_t getAverageQp();
+    // Add the |stats| of an encoded frame to the session statistics, and update these on the
+    // interface.
+    void updateSessionStats(const C2V4L2EncodeFrameStatsStruct& stats, bool keyFrame);
 
     // Helper function to find a work item in the output work queue by index.
     C2Work* getWorkByIndex(uint64_t index);
@@ -154,6 +221,9 @@ private:
     C2Work* getWorkByTimestamp(int64_t timestamp);
     // Helper function to determine if the specified |work| item is finished.
     bool isWorkDone(const C2Work& work) const;
+    // Report all finished work items in |mOutputWorkQueue|, in the order their encoded output was
+    // returned by the device.
+    void reportFinishedWorks();
     // Notify the listener the specified |work| item is finished.
     void reportWork(std::unique_ptr<C2Work> work);
 
@@ -224,14 +294,41 @@ private:
 
     // The video stream's visible size.
     media::Size mVisibleSize;
+    // The input picture size requested by the codec 2.0 framework the device is configured for.
+    // Might differ from |mVisibleSize|, as the device can adjust the visible rectangle.
+    media::Size mPictureSize;
+    // The new input picture size while changing the resolution.
+    std::optional<media::Size> mPendingPictureSize;
+    // The input picture size last configured on the interface by the codec 2.0 framework. The
+    // resolution is changed from the first work item whose input block has this size.
+    media::Size mConfiguredPictureSize;
     // The video stream's coded size.
     media::Size mInputCodedSize;
     // The input layout configured on the V4L2 device.
     std::optional<media::VideoFrameLayout> mInputLayout;
+    // The layouts of the input buffers seen so far. Producers like the camera or screen recording
+    // cycle through a small set of buffers, so resolving the layout (which requires locking the
+    // graphic buffer) is only needed once per buffer.
+    std::map<InputLayoutKey, InputLayout> mInputLayoutCache;
     // An input format convertor will be used if the device doesn't support the video's format.
     std::unique_ptr<FormatConverter> mInputFormatConverter;
+    // The profile and codec of the encoded output stream.
+    media::VideoCodecProfile mOutputProfile = media::VIDEO_CODEC_PROFILE_UNKNOWN;
+    media::VideoCodec mOutputCodec = media::kUnknownVideoCodec;
     // Required output buffer byte size.
     uint32_t mOutputBufferSize = 0;
+    // The number of consecutive B-frames configured on the device.
+    uint32_t mNumBFrames = 0;
+    // The number of buffers allocated on the device input queue.
+    size_t mInputBufferCount = 0;
+    // The number of temporal layers configured on the device, 0 if temporal layering is disabled.
+    uint32_t mNumTemporalLayers = 0;
+    // The cumulative bitrate ratios of the temporal layers, see
+    // V4L2EncodeInterface::getTemporalLayerBitrateRatios().
+    std::vector<float> mTemporalLayerBitrateRatios;
+    // The number of encoded output frames since the last key frame, used to determine the
+    // temporal layer of each output frame.
+    uint32_t mTemporalLayerFrameCounter = 0;
 
     // The bitrate currently configured on the v4l2 device.
     uint32_t mBitrate = 0;
@@ -243,6 +340,21 @@ private:
     // Key frame counter, a key frame will be requested each time it reaches zero.
     uint32_t mKeyFrameCounter = 0;
 
+    // Whether the device supports per-frame QP maps, and whether a QP map is currently configured.
+    bool mQpMapSupported = false;
+    bool mQpMapActive = false;
+    // Whether we warned the region of interest hints are ignored by the device.
+    bool mQpHintsIgnored = false;
+    // Whether the device reports the average QP of each encoded frame.
+    bool mAverageQpSupported = false;
+    // The times of the work items which haven't been reported yet, by work item index.
+    std::map<uint64_t, FrameTimes> mFrameTimes;
+    // The number of frames and key frames encoded since the encoder was initialized.
+    uint32_t mEncodedFrameCount = 0;
+    uint32_t mEncodedKeyFrameCount = 0;
+    // The statistics of the last encoded frames, see kSessionStatsWindow.
+    std::deque<C2V4L2EncodeFrameStatsStruct> mRecentFrameStats;
+
     // Whether we extracted and submitted CSD (codec-specific data, e.g. H.264 SPS) to the framework.
     bool mCSDSubmitted = false;
 
@@ -250,6 +362,9 @@ private:
     std::queue<std::unique_ptr<C2Work>> mInputWorkQueue;
     // The queue of encode work items currently being processed.
     std::deque<std::unique_ptr<C2Work>> mOutputWorkQueue;
+    // The indices of the work items in |mOutputWorkQueue| which received their encoded output, in
+    // the order the output was returned by the device (decoding order).
+    std::deque<uint64_t> mOutputOrder;
 
     // List of work item indices and frames associated with each buffer in the device input queue.
     std::vector<std::pair<int64_t, std::unique_ptr<InputFrame>>> mInputBuffersMap;
@@ -264,9 +379,12 @@ private:
     std::atomic<ComponentState> mComponentState;
     // The current state of the encoder, only accessed on the encoder thread.
     EncoderState mEncoderState = EncoderState::UNINITIALIZED;
+    // The ID of this component's session at the process-wide session scheduler.
+    const V4L2SessionScheduler::SessionId mSchedulerSessionId;
 
-    // The encoder thread on which all interaction with the V4L2 device is performed.
-    ::base::Thread mEncoderThread{"V4L2EncodeComponentThread"};
+    // The encoder thread on which all interaction with the V4L2 device is performed. The thread
+    // might be replaced by one taken from V4L2PrewarmPool on start().
+    std::unique_ptr<::base::Thread> mEncoderThread;
     // The task runner on the encoder thread.
     scoped_refptr<::base::SequencedTaskRunner> mEncoderTaskRunner;
 
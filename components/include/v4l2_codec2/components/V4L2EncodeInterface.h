@@ -5,6 +5,8 @@
 #ifndef ANDROID_V4L2_CODEC2_COMPONENTS_V4L2_ENCODE_INTERFACE_H
 #define ANDROID_V4L2_CODEC2_COMPONENTS_V4L2_ENCODE_INTERFACE_H
 
+#include <atomic>
+#include <mutex>
 #include <optional>
 #include <vector>
 
@@ -15,6 +17,7 @@
 
 #include <size.h>
 #include <v4l2_codec2/common/EncodeHelpers.h>
+#include <v4l2_codec2/common/V4L2ComponentParams.h>
 #include <video_codecs.h>
 
 namespace media {
@@ -41,6 +44,45 @@ public:
     C2BlockPool::local_id_t getBlockPoolId() const { return mOutputBlockPoolIds->m.values[0]; }
     // Get sync key-frame period in frames.
     uint32_t getKeyFramePeriod() const;
+    C2Config::bitrate_mode_t getBitrateMode() const { return mBitrateMode->value; }
+    const C2V4L2QpRangeStruct& getQpRange() const { return *mQpRange; }
+    uint32_t getPeakBitrate() const { return mPeakBitrate->value; }
+    uint32_t getVbvSize() const { return mVbvSize->value; }
+    uint32_t getNumBFrames() const { return mBFrames->value; }
+    uint32_t getNumRefFrames() const { return mNumRefFrames->value; }
+    // Get the number of temporal layers, 0 or 1 if temporal layering is disabled.
+    uint32_t getNumTemporalLayers() const { return mLayering->m.layerCount; }
+    // Get the cumulative bitrate ratio of each temporal layer, i.e. the ratio of the total bitrate
+    // used by the layer and all the layers below it. The ratio of the top layer is always 1.
+    std::vector<float> getTemporalLayerBitrateRatios() const;
+    uint32_t getSliceCount() const { return mSliceCount->value; }
+
+    // Hides C2InterfaceHelper::config() to track changes of the dynamic encoding parameters, of
+    // the scheduling parameters and of the input picture size.
+    c2_status_t config(const std::vector<C2Param*>& params, c2_blocking_t mayBlock,
+                       std::vector<std::unique_ptr<C2SettingResult>>* const failures,
+                       bool updateParams = true,
+                       std::vector<std::shared_ptr<C2Param>>* changes = nullptr);
+    // Returns whether the bitrate, framerate or key frame request were configured since the last
+    // call, and clears the flag. The component only needs to query these parameters if so.
+    bool takeDynamicParamsChanged() { return mDynamicParamsChanged.exchange(false); }
+    // Force the next takeDynamicParamsChanged() call to return true.
+    void markDynamicParamsChanged() { mDynamicParamsChanged = true; }
+    // Returns whether the priority or operating rate were configured since the last call, and
+    // clears the flag. The component only needs to query these parameters if so.
+    bool takeSchedulingParamsChanged() { return mSchedulingParamsChanged.exchange(false); }
+    // Returns whether the input picture size was configured since the last call, and clears the
+    // flag. The component only needs to check for a resolution change if so.
+    bool takePictureSizeChanged() { return mPictureSizeChanged.exchange(false); }
+
+    // Hides C2InterfaceHelper::query() to report the latest session statistics.
+    c2_status_t query(const std::vector<C2Param*>& stackParams,
+                      const std::vector<C2Param::Index>& heapParamIndices, c2_blocking_t mayBlock,
+                      std::vector<std::unique_ptr<C2Param>>* const heapParams) const;
+    // Set the statistics of the recently encoded frames, reported when the read-only session
+    // statistics parameter is queried. This doesn't go through config() as it's called for each
+    // encoded frame.
+    void setSessionStats(const C2StreamV4L2EncodeSessionStatsInfo::output& stats);
 
 protected:
     void Initialize(const C2String& name);
@@ -56,6 +98,11 @@ protected:
     static C2R IntraRefreshPeriodSetter(bool mayBlock,
                                         C2P<C2StreamIntraRefreshTuning::output>& period);
 
+    static C2R QpRangeSetter(bool mayBlock, C2P<C2StreamV4L2QpRangeTuning::output>& qpRange);
+
+    static C2R LayeringSetter(bool mayBlock,
+                              C2P<C2StreamTemporalLayeringTuning::output>& layering);
+
     // Constant parameters
 
     // The input format kind; should be C2FormatVideo.
@@ -84,6 +131,29 @@ protected:
     std::shared_ptr<C2StreamSyncFrameIntervalTuning::output> mKeyFramePeriodUs;
     // Component uses this ID to fetch corresponding output block pool from platform.
     std::shared_ptr<C2PortBlockPoolsTuning::output> mOutputBlockPoolIds;
+    // The bitrate control mode: constant bitrate, variable bitrate or constant quality.
+    std::shared_ptr<C2StreamBitrateModeTuning::output> mBitrateMode;
+    // The quantization parameter bounds, and the fixed quantization parameters used in the
+    // constant quality mode.
+    std::shared_ptr<C2StreamV4L2QpRangeTuning::output> mQpRange;
+    // The peak bitrate in the variable bitrate mode, in bits per second.
+    std::shared_ptr<C2StreamV4L2PeakBitrateTuning::output> mPeakBitrate;
+    // The size of the video buffering verifier, in bytes.
+    std::shared_ptr<C2StreamV4L2VbvSizeTuning::output> mVbvSize;
+    // The number of consecutive B-frames.
+    std::shared_ptr<C2StreamV4L2BFramesTuning::output> mBFrames;
+    // The number of reference frames for P-frames, 0 to let the device choose.
+    std::shared_ptr<C2StreamV4L2NumRefFramesTuning::output> mNumRefFrames;
+    // The number of temporal layers and the bitrate ratios of the layers.
+    std::shared_ptr<C2StreamTemporalLayeringTuning::output> mLayering;
+    // The number of slices per frame, 0 or 1 to encode each frame as a single slice.
+    std::shared_ptr<C2StreamV4L2SliceCountTuning::output> mSliceCount;
+    // The regions of interest and QP map of an input frame, only used as per-frame parameters.
+    std::shared_ptr<C2StreamV4L2RoiRectsTuning::input> mRoiRects;
+    std::shared_ptr<C2StreamV4L2QpMapTuning::input> mQpMap;
+    // The statistics of the recently encoded frames. The parameter is read-only, its value is
+    // taken from |mLatestSessionStats| when queried.
+    std::shared_ptr<C2StreamV4L2EncodeSessionStatsInfo::output> mSessionStats;
 
     // Dynamic parameters
 
@@ -97,8 +167,22 @@ protected:
     // The intra-frame refresh period. This is unused for the component now.
     // TODO: adapt intra refresh period to encoder.
     std::shared_ptr<C2StreamIntraRefreshTuning::output> mIntraRefreshPeriod;
+    // The scheduling priority of the component, 0 means realtime.
+    std::shared_ptr<C2ComponentPriorityTuning> mPriority;
+    // The expected encoding rate in frames per second, 0 if unspecified.
+    std::shared_ptr<C2ComponentOperatingRateTuning> mOperatingRate;
 
     c2_status_t mInitStatus = C2_NO_INIT;
+    // Set when any of the dynamic parameters is configured, can be accessed from any thread.
+    std::atomic<bool> mDynamicParamsChanged{true};
+    // Set when the priority or operating rate is configured, can be accessed from any thread.
+    std::atomic<bool> mSchedulingParamsChanged{true};
+    // Set when the input picture size is configured, can be accessed from any thread.
+    std::atomic<bool> mPictureSizeChanged{false};
+
+    // The session statistics set by the component, reported by query().
+    mutable std::mutex mSessionStatsLock;
+    C2StreamV4L2EncodeSessionStatsInfo::output mLatestSessionStats{0u};
 };
 
 }  // namespace android
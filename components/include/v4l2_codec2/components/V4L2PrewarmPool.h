@@ -0,0 +1,84 @@
+// Copyright 2020 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ANDROID_V4L2_CODEC2_COMPONENTS_V4L2_PREWARM_POOL_H
+#define ANDROID_V4L2_CODEC2_COMPONENTS_V4L2_PREWARM_POOL_H
+
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include <base/memory/scoped_refptr.h>
+#include <base/single_thread_task_runner.h>
+#include <base/threading/thread.h>
+
+#include <v4l2_device.h>
+
+namespace android {
+
+// Process-wide pool of V4L2 devices and worker threads prepared ahead of the components starting.
+// Opening the device and starting the worker and poller threads only depend on the codec of the
+// component, not on its configuration, so they are done in the background once a component of
+// the codec is created. Starting the component then adopts them instead of doing it while its
+// client is blocked. The number of instances kept for each codec is read from the
+// "vendor.v4l2_codec2.prewarm_instances" property (default 1, 0 disables the pool).
+class V4L2PrewarmPool {
+public:
+    static V4L2PrewarmPool& getInstance();
+
+    V4L2PrewarmPool(const V4L2PrewarmPool&) = delete;
+    V4L2PrewarmPool& operator=(const V4L2PrewarmPool&) = delete;
+
+    // Fill the pool of |type| devices opened for |pixelFormat| in the background. The worker
+    // threads are named |threadName|.
+    void prewarm(media::V4L2Device::Type type, uint32_t pixelFormat,
+                 const std::string& threadName);
+
+    // Take a device opened for |pixelFormat|, whose poller thread is running, and a running worker
+    // thread out of the pool, and schedule the pool to be filled again. Returns false if none is
+    // ready yet, in which case the caller opens the device and starts the threads itself.
+    bool take(media::V4L2Device::Type type, uint32_t pixelFormat,
+              scoped_refptr<media::V4L2Device>* device, std::unique_ptr<::base::Thread>* thread);
+
+private:
+    using Key = std::pair<media::V4L2Device::Type, uint32_t>;
+
+    struct Instance {
+        scoped_refptr<media::V4L2Device> mDevice;
+        std::unique_ptr<::base::Thread> mThread;
+    };
+
+    struct Entry {
+        std::string mThreadName;
+        std::deque<Instance> mInstances;
+        // The number of instances being prepared on |mPrewarmThread|.
+        size_t mNumPending = 0;
+    };
+
+    V4L2PrewarmPool();
+    ~V4L2PrewarmPool();
+
+    // Schedule the instances missing from |entry|. |mLock| must be held.
+    void fillLocked(const Key& key, Entry* entry);
+    // Prepare one instance for |key|, called on |mPrewarmThread|.
+    void prewarmTask(Key key, std::string threadName);
+
+    const size_t mNumInstances;
+
+    std::mutex mLock;
+    // The thread opening the devices and starting the threads, not started if the pool is
+    // disabled.
+    ::base::Thread mPrewarmThread{"V4L2PrewarmThread"};
+    scoped_refptr<::base::SingleThreadTaskRunner> mPrewarmTaskRunner;
+    std::map<Key, Entry> mEntries;
+};
+
+}  // namespace android
+
+#endif  // ANDROID_V4L2_CODEC2_COMPONENTS_V4L2_PREWARM_POOL_H
@@ -26,9 +26,16 @@ public:
     };
     static const char* DecodeStatusToString(DecodeStatus status);
 
-    using GetPoolCB =
-            base::RepeatingCallback<void(std::unique_ptr<VideoFramePool>*, const media::Size& size,
-                                         HalPixelFormat pixelFormat, size_t numOutputBuffers)>;
+    // Create a VideoFramePool allocating |numOutputBuffers| buffers first, and up to
+    // |maxNumOutputBuffers| buffers when the decoder is starved of output buffers. If |scaledSize|
+    // is not empty, the frames decoded into the |size| buffers are scaled down to |scaledSize| by
+    // the pool, see VideoFramePool::convertFrame().
+    // |usage| holds the extra gralloc usage flags requesting the layout the frames are decoded
+    // into, 0 for the linear layout.
+    using GetPoolCB = base::RepeatingCallback<void(
+            std::unique_ptr<VideoFramePool>*, const media::Size& size,
+            const media::Size& scaledSize, HalPixelFormat pixelFormat, uint64_t usage,
+            size_t numOutputBuffers, size_t maxNumOutputBuffers)>;
     using DecodeCB = base::OnceCallback<void(DecodeStatus)>;
     using OutputCB = base::RepeatingCallback<void(std::unique_ptr<VideoFrame>)>;
     using ErrorCB = base::RepeatingCallback<void()>;
@@ -38,6 +45,19 @@ public:
     virtual void decode(std::unique_ptr<BitstreamBuffer> buffer, DecodeCB decodeCb) = 0;
     virtual void drain(DecodeCB drainCb) = 0;
     virtual void flush() = 0;
+    // Hint the coded size and the minimal number of output buffers, parsed from the bitstream
+    // before the decoder reports the output format. The decoder could start allocating the output
+    // buffers in advance, and adopt them if the reported output format matches.
+    virtual void preallocateOutputBuffers(const media::Size& codedSize, size_t minNumBuffers) = 0;
+    // Set the color aspects of the output frames decoded from the bitstream buffer |bitstreamId|
+    // and the following ones, used when they are converted to RGB. Should be called before the
+    // bitstream buffer is passed to decode().
+    virtual void setColorAspects(
+            std::shared_ptr<const C2StreamColorAspectsInfo::output> colorAspects,
+            int32_t bitstreamId) = 0;
+    // Give back an output frame once its block is passed on, so it's reused for the next output
+    // of the same block.
+    virtual void recycleFrame(std::unique_ptr<VideoFrame> frame) = 0;
 };
 
 }  // namespace android
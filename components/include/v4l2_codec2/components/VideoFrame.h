@@ -6,6 +6,7 @@
 #define ANDROID_V4L2_CODEC2_COMPONENTS_VIDEO_FRAME_H
 
 #include <memory>
+#include <optional>
 #include <vector>
 
 #include <C2Buffer.h>
@@ -21,6 +22,11 @@ public:
     static std::unique_ptr<VideoFrame> Create(std::shared_ptr<C2GraphicBlock> block);
     ~VideoFrame();
 
+    // Reuse the instance for |block|, another fetch of the block it was created for. The file
+    // descriptors are only extracted again if the buffer of the block was replaced, and the
+    // per-frame information is reset.
+    void rebind(std::shared_ptr<C2GraphicBlock> block);
+
     // Return the file descriptors of the corresponding buffer.
     const std::vector<int>& getFDs() const;
 
@@ -32,11 +38,23 @@ public:
     void setBitstreamId(int32_t bitstreamId);
     int32_t getBitstreamId() const;
 
+    // Getter and setter of the ID of the block in the buffer set of the VideoFramePool.
+    void setBlockId(uint32_t blockId);
+    uint32_t getBlockId() const;
+
     // Get the read-only C2GraphicBlock, should be called after calling setVisibleRect().
     C2ConstGraphicBlock getGraphicBlock();
     std::shared_ptr<C2GraphicBlock> getRawGraphicBlock();
     std::shared_ptr<C2GraphicBlock> setRawGraphicBlock(std::shared_ptr<C2GraphicBlock> block);
 
+    // Query the DRM format modifier of the buffer from gralloc, i.e. its tiling or compression
+    // layout. Return std::nullopt if gralloc doesn't report it.
+    std::optional<uint64_t> queryModifier() const;
+
+    // Getter and setter of the DRM format modifier of the layout the frame is decoded into.
+    void setModifier(uint64_t modifier);
+    uint64_t getModifier() const;
+
 private:
     VideoFrame(std::shared_ptr<C2GraphicBlock> block, std::vector<int> fds);
 
@@ -44,6 +62,8 @@ private:
     std::vector<int> mFds;
     media::Rect mVisibleRect;
     int32_t mBitstreamId = -1;
+    uint32_t mBlockId = 0;
+    uint64_t mModifier = 0;
 };
 
 }  // namespace android
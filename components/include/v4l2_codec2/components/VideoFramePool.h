@@ -9,13 +9,17 @@
 #include <memory>
 #include <optional>
 #include <queue>
+#include <vector>
 
 #include <C2Buffer.h>
+#include <C2Config.h>
 #include <base/callback.h>
 #include <base/memory/weak_ptr.h>
 #include <base/sequenced_task_runner.h>
 #include <base/threading/thread.h>
+#include <base/time/time.h>
 
+#include <rect.h>
 #include <size.h>
 #include <v4l2_codec2/common/OutputFormatConverter.h>
 #include <v4l2_codec2/common/VideoTypes.h>
@@ -31,9 +35,16 @@ public:
     using FrameWithBlockId = std::pair<std::unique_ptr<VideoFrame>, uint32_t>;
     using GetVideoFrameCB = ::base::OnceCallback<void(std::optional<FrameWithBlockId>)>;
 
+    // |numBuffers| buffers are allocated first. If |maxNumBuffers| is larger, one more buffer is
+    // allocated each time fetching a buffer waits too long while the client is starved of output
+    // buffers, up to |maxNumBuffers| buffers.
+    // If |scaledSize| is not empty, the frames are decoded into |size| buffers owned by the pool,
+    // and scaled down into |scaledSize| buffers by convertFrame().
+    // |usage| is added to the usage of the fetched blocks to request the layout of the buffers.
     static std::unique_ptr<VideoFramePool> Create(
             std::shared_ptr<C2BlockPool> blockPool, const size_t numBuffers,
-            const media::Size& size, HalPixelFormat pixelFormat, bool isSecure,
+            const size_t maxNumBuffers, const media::Size& size, const media::Size& scaledSize,
+            HalPixelFormat pixelFormat, uint64_t usage, bool isSecure,
             scoped_refptr<::base::SequencedTaskRunner> taskRunner);
     ~VideoFramePool();
 
@@ -42,8 +53,23 @@ public:
     // Return false if the previous callback has not been called, and |cb| will
     // be dropped directly.
     bool getVideoFrame(GetVideoFrameCB cb);
-    void convertFrame(std::shared_ptr<C2GraphicBlock> from, std::shared_ptr<C2GraphicBlock>* to);
+    // Return whether a VideoFrame requested by getVideoFrame() wasn't passed to the client yet.
+    bool isFetching() const;
+    // Notify whether the client is starved, i.e. its request of a VideoFrame blocks pending work.
+    // The buffer set only grows while the fetch is blocked and the client is starved.
+    void setOutputStarved(bool starved);
+    // Convert the decoded block |from| into the block output to the client, scaling its
+    // |visibleRect| down if the pool is created with a scaled size. |to| is set to |from| if no
+    // conversion is needed, or to nullptr on error.
+    void convertFrame(std::shared_ptr<C2GraphicBlock> from, const media::Rect& visibleRect,
+                      std::shared_ptr<C2GraphicBlock>* to);
+    // Set the color aspects of the decoded frames, used when they are converted to RGB by
+    // convertFrame().
+    void setColorAspects(const C2StreamColorAspectsInfo::output& colorAspects);
     void retrunFrame(std::shared_ptr<C2GraphicBlock> block);
+    // Give back a frame fetched from the pool once its block is output, so the instance is reused
+    // the next time its block is fetched instead of wrapping the block again.
+    void recycleFrame(std::unique_ptr<VideoFrame> frame);
 
 private:
     // |blockPool| is the C2BlockPool that we fetch graphic blocks from.
@@ -52,7 +78,8 @@ private:
     // |isSecure| indicates the video stream is encrypted or not.
     // All public methods and the callbacks should be run on |taskRunner|.
     VideoFramePool(std::shared_ptr<C2BlockPool> blockPool, const media::Size& size,
-                   HalPixelFormat pixelFormat, bool isSecure, const size_t numBuffers,
+                   const media::Size& scaledSize, HalPixelFormat pixelFormat, uint64_t usage,
+                   bool isSecure, const size_t numBuffers, const size_t maxNumBuffers,
                    scoped_refptr<::base::SequencedTaskRunner> taskRunner);
     bool initialize();
     void destroyTask();
@@ -61,8 +88,16 @@ private:
                                        std::optional<::base::WeakPtr<VideoFramePool>> weakPool);
     void getVideoFrameTask();
     void getVideoFrameTaskFromConverterPool();
+    void recycleFrameTask(std::unique_ptr<VideoFrame> frame);
+    // Return the slot of |mCachedFrames| of the block |blockId|. If |assign| is true, the block is
+    // assigned a free slot the first time it's fetched. Return nullptr if the block has no slot.
+    CachedFrame* getCachedFrameSlot(uint32_t blockId, bool assign);
     void onVideoFrameReady(std::optional<FrameWithBlockId> frameWithBlockId);
 
+    // Called when fetching a buffer timed out. Grow the buffer set by one buffer if the client has
+    // been starved for long enough, return true if the buffer set is grown.
+    bool maybeGrowBufferSet();
+
     // Extracts buffer ID from graphic block.
     // |block| is the graphic block allocated by |blockPool|.
     std::optional<uint32_t> getBufferIdFromGraphicBlock(const C2BlockPool& blockPool,
@@ -72,17 +107,44 @@ private:
     // |bufferCount| is the number of requested buffers.
     static c2_status_t requestNewBufferSet(C2BlockPool& blockPool, int32_t bufferCount);
 
+    // Ask |blockPool| to allocate more buffers, keeping the allocated ones.
+    // |bufferCount| is the new total number of buffers.
+    static c2_status_t growBufferSet(C2BlockPool& blockPool, int32_t bufferCount);
+
     // Ask |blockPool| to notify when a block is available via |cb|.
     // Return true if |blockPool| supports notifying buffer available.
     static bool setNotifyBlockAvailableCb(C2BlockPool& blockPool, ::base::OnceClosure cb);
 
     std::shared_ptr<C2BlockPool> mBlockPool;
     const media::Size mSize;
+    // The size the frames are scaled down to by |mOutputFormatConverter|, empty if not scaled.
+    const media::Size mScaledSize;
     const HalPixelFormat mPixelFormat;
     const C2MemoryUsage mMemoryUsage;
 
     GetVideoFrameCB mOutputCb;
 
+    // The number of buffers the block pool is allowed to allocate, only accessed on the fetch
+    // thread, and its upper bound.
+    size_t mNumBuffers;
+    const size_t mMaxNumBuffers;
+    std::atomic<bool> mOutputStarved{false};
+    // The pool-wait metrics, only accessed on the fetch thread. |mFetchWaitStart| is set when
+    // fetching a buffer times out, until a buffer is fetched or the buffer set is grown.
+    std::optional<::base::TimeTicks> mFetchWaitStart;
+    size_t mNumFetchWaits = 0;
+    ::base::TimeDelta mTotalFetchWaitTime;
+    // The recycled frames, one slot per buffer of the set, only accessed on the fetch thread.
+    // Each block of the buffer set is wrapped into a VideoFrame once, which is then moved out of
+    // its slot when the block is fetched and back in when the frame is recycled. The slots are
+    // sized when the buffer set is requested or grown, so reusing a frame doesn't allocate. The
+    // block IDs are gralloc backing store IDs, which can't index the slots directly.
+    struct CachedFrame {
+        std::optional<uint32_t> blockId;
+        std::unique_ptr<VideoFrame> frame;
+    };
+    std::vector<CachedFrame> mCachedFrames;
+
     scoped_refptr<::base::SequencedTaskRunner> mClientTaskRunner;
     ::base::Thread mFetchThread{"VideoFramePoolFetchThread"};
     scoped_refptr<::base::SequencedTaskRunner> mFetchTaskRunner;
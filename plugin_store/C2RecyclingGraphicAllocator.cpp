@@ -0,0 +1,308 @@
+// Copyright 2020 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// #define LOG_NDEBUG 0
+#define LOG_TAG "C2RecyclingGraphicAllocator"
+
+#include <v4l2_codec2/plugin_store/C2RecyclingGraphicAllocator.h>
+
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <C2AllocatorGralloc.h>
+#include <C2BufferPriv.h>
+#include <C2PlatformSupport.h>
+#include <android-base/thread_annotations.h>
+#include <hardware/gralloc.h>
+#include <log/log.h>
+#include <system/graphics.h>
+
+namespace android {
+namespace {
+
+// A released allocation is kept in the cache for at most this long.
+constexpr std::chrono::seconds kMaxIdleTime(5);
+// The maximal total size of the cached allocations in bytes, enough for a set of 4K buffers.
+constexpr size_t kMaxCachedBytes = 256 * 1024 * 1024;
+
+// The width, height, format and usage of a graphic allocation.
+using AllocationKey = std::tuple<uint32_t, uint32_t, uint32_t, uint64_t>;
+
+// Whether allocations with |usage| can be recycled. The content of a recycled allocation is cleared
+// by the CPU before it's handed to a new user, as the allocation might be reused by a session of
+// another client. Protected allocations are never recycled.
+bool isRecyclable(C2MemoryUsage usage) {
+    if (usage.expected & (C2MemoryUsage::READ_PROTECTED | C2MemoryUsage::WRITE_PROTECTED |
+                          GRALLOC_USAGE_PROTECTED)) {
+        return false;
+    }
+    return (usage.expected & C2MemoryUsage::CPU_WRITE) == C2MemoryUsage::CPU_WRITE;
+}
+
+// Zero the content of the |allocation|, so no data of its previous user is leaked to the next one.
+bool clearAllocation(C2GraphicAllocation* allocation) {
+    const C2Rect rect(allocation->width(), allocation->height());
+    C2PlanarLayout layout;
+    uint8_t* addr[C2PlanarLayout::MAX_NUM_PLANES] = {};
+    c2_status_t status = allocation->map(rect, C2MemoryUsage(0, C2MemoryUsage::CPU_WRITE), nullptr,
+                                         &layout, addr);
+    if (status != C2_OK) {
+        ALOGW("Failed to map cached allocation (err=%d)", status);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < layout.numPlanes; ++i) {
+        const C2PlaneInfo& plane = layout.planes[i];
+        const uint32_t rows = allocation->height() / plane.rowSampling;
+        const uint32_t columns = allocation->width() / plane.colSampling;
+        if (!addr[i] || rows == 0 || columns == 0) continue;
+
+        // Only clear the bytes of the plane, the planes of semi-planar formats are interleaved.
+        const size_t rowBytes = (columns - 1) * plane.colInc + (plane.allocatedDepth + 7) / 8;
+        for (uint32_t row = 0; row < rows; ++row) {
+            memset(addr[i] + static_cast<ptrdiff_t>(row) * plane.rowInc, 0, rowBytes);
+        }
+    }
+    allocation->unmap(addr, rect, nullptr);
+    return true;
+}
+
+// Estimate the memory used by a graphic buffer. The exact size depends on the alignment applied by
+// gralloc, but an estimation is good enough to bound the size of the cache.
+size_t estimateAllocationSize(uint32_t width, uint32_t height, uint32_t format) {
+    const size_t pixels = static_cast<size_t>(width) * height;
+    switch (format) {
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+    case HAL_PIXEL_FORMAT_RGBA_1010102:
+        return pixels * 4;
+    case HAL_PIXEL_FORMAT_RGB_565:
+        return pixels * 2;
+    case HAL_PIXEL_FORMAT_YCBCR_P010:
+        return pixels * 3;
+    default:
+        // Assume a YUV 4:2:0 format, which is used by most video buffers.
+        return pixels * 3 / 2;
+    }
+}
+
+// The process-wide cache of the graphic allocations released by the recycling allocators. A
+// background thread frees the allocations which were not reused in time.
+class GraphicAllocationCache {
+public:
+    static GraphicAllocationCache& getInstance() {
+        // Never destroyed, so allocations released while the process exits can still be handled.
+        static GraphicAllocationCache* sInstance = new GraphicAllocationCache();
+        return *sInstance;
+    }
+
+    // Take a cached allocation matching |key|, or return nullptr if there is none.
+    std::shared_ptr<C2GraphicAllocation> take(const AllocationKey& key) {
+        std::lock_guard<std::mutex> lock(mLock);
+
+        // Prefer the most recently released allocation, the oldest ones will expire first.
+        for (auto it = mEntries.rbegin(); it != mEntries.rend(); ++it) {
+            if (it->mKey != key) continue;
+
+            std::shared_ptr<C2GraphicAllocation> allocation = std::move(it->mAllocation);
+            mCachedBytes -= it->mSize;
+            mEntries.erase(std::next(it).base());
+            ALOGV("%s(): reusing allocation, %zu allocations (%zu bytes) cached", __func__,
+                  mEntries.size(), mCachedBytes);
+            return allocation;
+        }
+        return nullptr;
+    }
+
+    // Keep the released |allocation| matching |key| in the cache.
+    void put(const AllocationKey& key, std::shared_ptr<C2GraphicAllocation> allocation) {
+        const size_t size =
+                estimateAllocationSize(std::get<0>(key), std::get<1>(key), std::get<2>(key));
+        if (size > kMaxCachedBytes) return;
+
+        // The evicted allocations are freed after releasing the lock.
+        std::vector<std::shared_ptr<C2GraphicAllocation>> evicted;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+
+            mEntries.push_back({key, size, std::move(allocation), Clock::now() + kMaxIdleTime});
+            mCachedBytes += size;
+            while (mCachedBytes > kMaxCachedBytes) {
+                evicted.push_back(popOldestLocked());
+            }
+            ALOGV("%s(): %zu allocations (%zu bytes) cached", __func__, mEntries.size(),
+                  mCachedBytes);
+
+            if (!mEvictionThread.joinable()) {
+                mEvictionThread = std::thread(&GraphicAllocationCache::evictionLoop, this);
+            }
+        }
+        mCondition.notify_one();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        AllocationKey mKey;
+        size_t mSize;
+        std::shared_ptr<C2GraphicAllocation> mAllocation;
+        // The time after which the allocation is freed if it's not reused.
+        Clock::time_point mExpiry;
+    };
+
+    GraphicAllocationCache() = default;
+
+    std::shared_ptr<C2GraphicAllocation> popOldestLocked() REQUIRES(mLock) {
+        std::shared_ptr<C2GraphicAllocation> allocation = std::move(mEntries.front().mAllocation);
+        mCachedBytes -= mEntries.front().mSize;
+        mEntries.pop_front();
+        return allocation;
+    }
+
+    // Free the allocations when they expire, runs on |mEvictionThread|.
+    void evictionLoop() {
+        std::unique_lock<std::mutex> lock(mLock);
+        while (true) {
+            if (mEntries.empty()) {
+                mCondition.wait(lock);
+                continue;
+            }
+
+            // The entries are ordered by expiry time, as they all have the same idle time.
+            if (Clock::now() < mEntries.front().mExpiry) {
+                mCondition.wait_until(lock, mEntries.front().mExpiry);
+                continue;
+            }
+
+            std::shared_ptr<C2GraphicAllocation> allocation = popOldestLocked();
+            ALOGV("%s(): freeing expired allocation, %zu allocations (%zu bytes) cached", __func__,
+                  mEntries.size(), mCachedBytes);
+            lock.unlock();
+            allocation.reset();
+            lock.lock();
+        }
+    }
+
+    std::mutex mLock;
+    std::condition_variable mCondition;
+    // The cached allocations, the least recently released first.
+    std::list<Entry> mEntries GUARDED_BY(mLock);
+    size_t mCachedBytes GUARDED_BY(mLock) = 0;
+    // Started when the first allocation is cached.
+    std::thread mEvictionThread GUARDED_BY(mLock);
+};
+
+// A graphic allocation which is put in the cache instead of being freed when it's destroyed.
+class RecyclableGraphicAllocation : public C2GraphicAllocation {
+public:
+    RecyclableGraphicAllocation(const AllocationKey& key,
+                                std::shared_ptr<C2GraphicAllocation> allocation)
+          : C2GraphicAllocation(allocation->width(), allocation->height()),
+            mKey(key),
+            mAllocation(std::move(allocation)) {}
+
+    ~RecyclableGraphicAllocation() override {
+        GraphicAllocationCache::getInstance().put(mKey, std::move(mAllocation));
+    }
+
+    c2_status_t map(C2Rect rect, C2MemoryUsage usage, C2Fence* fence, C2PlanarLayout* layout,
+                    uint8_t** addr) override {
+        return mAllocation->map(rect, usage, fence, layout, addr);
+    }
+    c2_status_t unmap(uint8_t** addr, C2Rect rect, C2Fence* fence) override {
+        return mAllocation->unmap(addr, rect, fence);
+    }
+    C2Allocator::id_t getAllocatorId() const override { return mAllocation->getAllocatorId(); }
+    const C2Handle* handle() const override { return mAllocation->handle(); }
+    bool equals(const std::shared_ptr<const C2GraphicAllocation>& other) const override {
+        return other && other->handle() == handle();
+    }
+
+private:
+    const AllocationKey mKey;
+    std::shared_ptr<C2GraphicAllocation> mAllocation;
+};
+
+}  // namespace
+
+C2RecyclingGraphicAllocator::C2RecyclingGraphicAllocator(std::shared_ptr<C2Allocator> allocator)
+      : mAllocator(std::move(allocator)) {}
+
+// static
+std::shared_ptr<C2BlockPool> C2RecyclingGraphicAllocator::getBasicGraphicBlockPool() {
+    static std::mutex sMutex;
+    static std::weak_ptr<C2BlockPool> sBlockPool;
+
+    std::lock_guard<std::mutex> lock(sMutex);
+    std::shared_ptr<C2BlockPool> blockPool = sBlockPool.lock();
+    if (blockPool) return blockPool;
+
+    std::shared_ptr<C2Allocator> allocator;
+    c2_status_t status = GetCodec2PlatformAllocatorStore()->fetchAllocator(
+            C2PlatformAllocatorStore::GRALLOC, &allocator);
+    if (status != C2_OK || !allocator) {
+        ALOGE("Failed to fetch gralloc allocator (err=%d)", status);
+        return nullptr;
+    }
+
+    blockPool = std::make_shared<C2BasicGraphicBlockPool>(
+            std::make_shared<C2RecyclingGraphicAllocator>(std::move(allocator)));
+    sBlockPool = blockPool;
+    return blockPool;
+}
+
+C2Allocator::id_t C2RecyclingGraphicAllocator::getId() const {
+    return mAllocator->getId();
+}
+
+C2String C2RecyclingGraphicAllocator::getName() const {
+    return mAllocator->getName();
+}
+
+std::shared_ptr<const C2Allocator::Traits> C2RecyclingGraphicAllocator::getTraits() const {
+    return mAllocator->getTraits();
+}
+
+c2_status_t C2RecyclingGraphicAllocator::newGraphicAllocation(
+        uint32_t width, uint32_t height, uint32_t format, C2MemoryUsage usage,
+        std::shared_ptr<C2GraphicAllocation>* allocation) {
+    ALOG_ASSERT(allocation != nullptr);
+
+    if (!isRecyclable(usage)) {
+        return mAllocator->newGraphicAllocation(width, height, format, usage, allocation);
+    }
+
+    const AllocationKey key(width, height, format, usage.expected);
+    std::shared_ptr<C2GraphicAllocation> inner = GraphicAllocationCache::getInstance().take(key);
+    if (inner && !clearAllocation(inner.get())) {
+        inner.reset();
+    }
+    if (!inner) {
+        c2_status_t status = mAllocator->newGraphicAllocation(width, height, format, usage, &inner);
+        if (status != C2_OK) return status;
+    }
+
+    *allocation = std::make_shared<RecyclableGraphicAllocation>(key, std::move(inner));
+    return C2_OK;
+}
+
+c2_status_t C2RecyclingGraphicAllocator::priorGraphicAllocation(
+        const C2Handle* handle, std::shared_ptr<C2GraphicAllocation>* allocation) {
+    return mAllocator->priorGraphicAllocation(handle, allocation);
+}
+
+bool C2RecyclingGraphicAllocator::checkHandle(const C2Handle* const handle) const {
+    return mAllocator->checkHandle(handle);
+}
+
+}  // namespace android
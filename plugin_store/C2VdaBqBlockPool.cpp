@@ -11,9 +11,14 @@
 
 #include <errno.h>
 
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <map>
 #include <mutex>
+#include <set>
 #include <thread>
+#include <vector>
 
 #include <utils/Trace.h>
 
@@ -424,19 +429,6 @@ struct C2VdaBqBlockPoolData : public _C2BlockPoolData {
     virtual ~C2VdaBqBlockPoolData() override;
 };
 
-c2_status_t MarkBlockPoolDataAsShared(const C2ConstGraphicBlock& sharedBlock) {
-    std::shared_ptr<_C2BlockPoolData> data = _C2BlockFactory::GetGraphicBlockPoolData(sharedBlock);
-    const std::shared_ptr<C2VdaBqBlockPoolData> poolData =
-            std::static_pointer_cast<C2VdaBqBlockPoolData>(data);
-    if (poolData->mShared) {
-        ALOGE("C2VdaBqBlockPoolData(id=%" PRIu64 ", slot=%d) is already marked as shared...",
-              poolData->bqId, poolData->bqSlot);
-        return C2_BAD_STATE;
-    }
-    poolData->mShared = true;
-    return C2_OK;
-}
-
 // static
 std::optional<uint32_t> C2VdaBqBlockPool::getBufferIdFromGraphicBlock(const C2Block2D& block) {
     native_handle_t* grallocHandle = android::UnwrapNativeCodec2GrallocHandle(block.handle());
@@ -485,11 +477,15 @@ public:
     void setRenderCallback(const C2BufferQueueBlockPool::OnRenderCallback& renderCallback);
     void configureProducer(const sp<HGraphicBufferProducer>& producer);
     c2_status_t requestNewBufferSet(int32_t bufferCount);
+    c2_status_t growBufferSet(int32_t bufferCount);
     c2_status_t updateGraphicBlock(bool willCancel, uint32_t oldSlot, uint32_t* newSlot,
                                    std::shared_ptr<C2GraphicBlock>* block /* nonnull */);
     c2_status_t getMinBuffersForDisplay(size_t* bufferCount);
     bool setNotifyBlockAvailableCb(::base::OnceClosure cb);
 
+    // Called by MarkBlockPoolDataAsShared() when the block of |slotId| is shared to the client.
+    void onBlockShared(uint64_t producerId, int32_t slotId);
+
 private:
     friend struct C2VdaBqBlockPoolData;
 
@@ -506,10 +502,56 @@ private:
         C2AndroidMemoryUsage mUsage = C2MemoryUsage(0);
     };
 
-    // For C2VdaBqBlockPoolData to detach corresponding slot buffer from BufferQueue.
+    // The state of a slot of |mSlots|. The transitions from kAllocated to kDetaching, and from
+    // kDetaching to kDetached or back to kAllocated, are done by detachBuffer() without holding
+    // |mMutex|, all the others with |mMutex| held.
+    enum class SlotState : uint32_t {
+        // No buffer is allocated for the slot.
+        kFree,
+        // A buffer is allocated for the slot and stored at |mAllocation|.
+        kAllocated,
+        // The buffer is being detached by detachBuffer(). The slot may already be free on the
+        // producer side, so |mAllocation| must not be handed out anymore.
+        kDetaching,
+        // The buffer was detached by detachBuffer(). |mAllocation| is dropped the next time the
+        // slots are accessed with |mMutex| held.
+        kDetached,
+    };
+
+    struct Slot {
+        // Only accessed with |mMutex| held.
+        std::shared_ptr<C2GraphicAllocation> mAllocation;
+        std::atomic<SlotState> mState{SlotState::kFree};
+        // Whether the block of the slot is held by the component, i.e. fetched but neither
+        // released nor shared to the client yet. Only accessed with |mProducerMutex| held.
+        bool mHeldByComponent = false;
+    };
+
+    // For C2VdaBqBlockPoolData to detach corresponding slot buffer from BufferQueue. Called when
+    // the blocks are released, possibly on the client's threads, so |mMutex| is never locked.
     void detachBuffer(uint64_t producerId, int32_t slotId);
     void cancelBuffer(uint64_t producerId, int32_t slotId);
 
+    // Resolve the block of |producerId| and |*slotId| released by the component to the slot of
+    // the current producer, following the migration of the slot if the producer was switched
+    // since the block was fetched. Return the current producer, or nullptr if the block doesn't
+    // belong to it anymore.
+    std::shared_ptr<H2BGraphicBufferProducer> takeReleasedSlot(uint64_t producerId,
+                                                               int32_t* slotId);
+
+    // The slot table accessors, with |mMutex| held.
+    // Return whether a buffer is allocated for |slot|.
+    bool isSlotAllocatedLocked(int32_t slot);
+    // Return the number of slots with an allocated buffer.
+    size_t numAllocatedSlotsLocked();
+    void setSlotAllocationLocked(int32_t slot, std::shared_ptr<C2GraphicAllocation> allocation);
+    void clearSlotsLocked();
+    // Record that the block of |slot| is handed out to the component, so it's migrated instead of
+    // cancelled if the producer is switched before the block is released.
+    void markSlotHeldLocked(int32_t slot);
+    // Drop the buffers of the slots detached by detachBuffer().
+    void reclaimDetachedSlotsLocked();
+
     // Queries the generation and usage flags from the given producer by dequeuing and requesting a
     // buffer (the buffer is then detached and freed).
     c2_status_t queryGenerationAndUsage(H2BGraphicBufferProducer* const producer, uint32_t width,
@@ -517,40 +559,57 @@ private:
                                         C2AndroidMemoryUsage androidUsage, uint32_t* generation,
                                         uint64_t* usage);
 
-    // Switches producer and transfers allocated buffers from old producer to the new one.
-    bool switchProducer(H2BGraphicBufferProducer* const newProducer, uint64_t newProducerId);
+    // Attaches the allocated buffers to the new producer. |slotChanges| is filled with the slot
+    // indices from the old producer to the new one, and |newSlotAllocations| with the allocations
+    // of the new slots. The producer is replaced by configureProducer() afterwards.
+    bool switchProducer(
+            H2BGraphicBufferProducer* const newProducer, uint64_t newProducerId,
+            std::map<int32_t, int32_t>* slotChanges,
+            std::map<int32_t, std::shared_ptr<C2GraphicAllocation>>* newSlotAllocations);
 
     const std::shared_ptr<C2Allocator> mAllocator;
 
-    std::unique_ptr<H2BGraphicBufferProducer> mProducer;
-    uint64_t mProducerId;
+    // Written with both |mMutex| and |mProducerMutex| held, so either one is enough to read them.
+    std::shared_ptr<H2BGraphicBufferProducer> mProducer;
+    uint64_t mProducerId = 0;
     C2BufferQueueBlockPool::OnRenderCallback mRenderCallback;
 
     // Function mutex to lock at the start of each API function call for protecting the
-    // synchronization of all member variables.
+    // synchronization of all member variables. The calls to the producer made while fetching and
+    // releasing buffers are done without holding it.
     std::mutex mMutex;
+    // Only held to read or replace |mProducer| and |mProducerId|, and to track the blocks held by
+    // the component, so releasing a buffer never waits for a fetch in progress.
+    std::mutex mProducerMutex;
     // The mutex of excluding the procedures of configuring producer and allocating buffers. They
     // should be blocked mutually. Set the timeout for acquiring lock in case of any deadlock.
     // Configuring producer: configureProducer() called by CCodec.
     // Allocating buffers: requestNewBufferSet(), then a loop of fetchGraphicBlock() called by
-    //                     compoenent until |mSlotAllocations|.size() equals |mBuffersRequested|.
+    //                     compoenent until the allocated slots reach |mBuffersRequested|.
     std::timed_mutex mConfigureProducerAndAllocateBuffersMutex;
     // The unique lock of the procedure of allocating buffers. It should be locked in the beginning
     // of requestNewBufferSet() and unlock in the end of the loop of fetchGraphicBlock(). Note that
     // all calls should be in the same thread.
     std::unique_lock<std::timed_mutex> mAllocateBuffersLock;
 
-    // The map restored C2GraphicAllocation from corresponding slot index.
-    std::map<int32_t, std::shared_ptr<C2GraphicAllocation>> mSlotAllocations;
-    // Number of buffers requested on requestNewBufferSet() call.
+    // The table restoring C2GraphicAllocation from corresponding slot index.
+    std::array<Slot, NUM_BUFFER_SLOTS> mSlots;
+    // The number of slots not in kFree state, with |mMutex| held.
+    size_t mNumAllocatedSlots = 0;
+    // Number of buffers requested on requestNewBufferSet() call, raised by growBufferSet().
     size_t mBuffersRequested;
+    // The maxDequeuedBufferCount last set to |mProducer|.
+    size_t mMaxDequeuedBuffers = 0u;
     // Currently requested buffer formats.
     BufferFormat mBufferFormat;
-    // The map recorded the slot indices from old producer to new producer.
-    std::map<int32_t, int32_t> mProducerChangeSlotMap;
-    // The counter for representing the buffer count in client. Only used in producer switching
-    // case. It will be reset in switchProducer(), and accumulated in updateGraphicBlock() routine.
-    uint32_t mBuffersInClient = 0u;
+    // The slot indices on the current producer of the blocks held by the component when the
+    // producer was switched, keyed by the id of the producer the blocks were fetched from and by
+    // their slot on it. The blocks keep their producer id, and are resolved to the current slots
+    // when released. The entries are followed through the next switches, and are kept until all
+    // their blocks are released. Only accessed with |mProducerMutex| held.
+    std::map<uint64_t, std::map<int32_t, int32_t>> mMigratedSlots;
+    // The id of the producer replaced by the last switch, used by updateGraphicBlock().
+    uint64_t mPreviousProducerId = 0;
     // The indicator to record if producer has been switched. Set to true when producer is switched.
     // Toggle off when requestNewBufferSet() is called. We forcedly detach all slots to make sure
     // all slots are available, except the ones owned by client.
@@ -567,6 +626,26 @@ private:
     ::base::OnceClosure mNotifyBlockAvailableCb GUARDED_BY(mBufferReleaseMutex);
 };
 
+c2_status_t MarkBlockPoolDataAsShared(const C2ConstGraphicBlock& sharedBlock) {
+    std::shared_ptr<_C2BlockPoolData> data = _C2BlockFactory::GetGraphicBlockPoolData(sharedBlock);
+    // The block is not fetched from a C2VdaBqBlockPool, e.g. a frame scaled by the component.
+    if (!data || data->getType() != _C2BlockPoolData::TYPE_BUFFERQUEUE) {
+        return C2_OK;
+    }
+    const std::shared_ptr<C2VdaBqBlockPoolData> poolData =
+            std::static_pointer_cast<C2VdaBqBlockPoolData>(data);
+    if (poolData->mShared) {
+        ALOGE("C2VdaBqBlockPoolData(id=%" PRIu64 ", slot=%d) is already marked as shared...",
+              poolData->bqId, poolData->bqSlot);
+        return C2_BAD_STATE;
+    }
+    poolData->mShared = true;
+    if (poolData->localPool) {
+        poolData->localPool->onBlockShared(poolData->bqId, poolData->bqSlot);
+    }
+    return C2_OK;
+}
+
 C2VdaBqBlockPool::Impl::Impl(const std::shared_ptr<C2Allocator>& allocator)
       : mAllocator(allocator),
         mAllocateBuffersLock(mConfigureProducerAndAllocateBuffersMutex, std::defer_lock),
@@ -576,9 +655,18 @@ c2_status_t C2VdaBqBlockPool::Impl::fetchGraphicBlock(
         uint32_t width, uint32_t height, uint32_t format, C2MemoryUsage usage,
         std::shared_ptr<C2GraphicBlock>* block /* nonnull */) {
     ALOGV("%s()", __func__);
-    std::lock_guard<std::mutex> lock(mMutex);
 
-    if (!mProducer) {
+    std::shared_ptr<H2BGraphicBufferProducer> producer;
+    uint64_t producerId;
+    C2BufferQueueBlockPool::OnRenderCallback renderCallback;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        producer = mProducer;
+        producerId = mProducerId;
+        renderCallback = mRenderCallback;
+    }
+
+    if (!producer) {
         // Producer will not be configured in byte-buffer mode. Allocate buffers from allocator
         // directly as a basic graphic block pool.
         std::shared_ptr<C2GraphicAllocation> alloc;
@@ -590,19 +678,15 @@ c2_status_t C2VdaBqBlockPool::Impl::fetchGraphicBlock(
         return C2_OK;
     }
 
-    // The existence of |mProducerChangeSlotMap| indicates producer is just switched. Use return
-    // code C2_BAD_STATE to inform the component to handle the procedure of producer change.
-    // TODO(johnylin): consider to inform producer change to component in an active way.
-    if (!mProducerChangeSlotMap.empty()) {
-        return C2_BAD_STATE;
-    }
-
+    // The producer calls are made without holding |mMutex|, so the buffers released meanwhile are
+    // cancelled to the producer right away. The producer switch is checked once the slot is
+    // dequeued.
     C2AndroidMemoryUsage androidUsage = usage;
     uint32_t pixelFormat = format;
     int32_t slot;
     sp<Fence> fence = new Fence();
     status_t status =
-            mProducer->dequeueBuffer(width, height, pixelFormat, androidUsage, &slot, &fence);
+            producer->dequeueBuffer(width, height, pixelFormat, androidUsage, &slot, &fence);
     // The C2VdaBqBlockPool does not fully own the bufferqueue. After buffers are dequeued here,
     // they are passed into the codec2 framework, processed, and eventually queued into the
     // bufferqueue. The C2VdaBqBlockPool cannot determine exactly when a buffer gets queued.
@@ -626,7 +710,7 @@ c2_status_t C2VdaBqBlockPool::Impl::fetchGraphicBlock(
     if (fence) {
         status_t fenceStatus = fence->wait(kFenceWaitTimeMs);
         if (fenceStatus != android::NO_ERROR) {
-            if (mProducer->cancelBuffer(slot, fence) != android::NO_ERROR) {
+            if (producer->cancelBuffer(slot, fence) != android::NO_ERROR) {
                 return C2_CORRUPTED;
             }
 
@@ -638,29 +722,54 @@ c2_status_t C2VdaBqBlockPool::Impl::fetchGraphicBlock(
             return asC2Error(fenceStatus);
         }
 
-        if (mRenderCallback) {
+        if (renderCallback) {
             nsecs_t signalTime = fence->getSignalTime();
             if (signalTime >= 0 && signalTime < INT64_MAX) {
-                mRenderCallback(mProducerId, slot, signalTime);
+                renderCallback(producerId, slot, signalTime);
             } else {
                 ALOGV("got fence signal time of %" PRId64 " nsec", signalTime);
             }
         }
     }
 
-    auto iter = mSlotAllocations.find(slot);
-    if (iter == mSlotAllocations.end()) {
-        if (mSlotAllocations.size() >= mBuffersRequested) {
-            // The dequeued slot has a pre-allocated buffer whose size and format is as same as
-            // currently requested (but was not dequeued during allocation cycle). Just detach it to
-            // free this slot. And try dequeueBuffer again.
-            ALOGD("dequeued a new slot index but already allocated enough buffers. Detach it.");
-
-            if (mProducer->detachBuffer(slot) != android::NO_ERROR) {
-                return C2_CORRUPTED;
-            }
+    std::shared_ptr<C2GraphicAllocation> alloc;
+    bool detachSlot = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (producerId != mProducerId) {
+            // The producer is switched while dequeuing, the slot belongs to the previous producer
+            // and was detached from it by the switch. Dequeue again from the current producer.
+            ALOGV("%s(): producer is switched while dequeuing slot %d", __func__, slot);
             return C2_TIMED_OUT;
         }
+        reclaimDetachedSlotsLocked();
+        const SlotState state = mSlots[slot].mState.load();
+        if (state == SlotState::kAllocated && status != BUFFER_NEEDS_REALLOCATION) {
+            alloc = mSlots[slot].mAllocation;
+            markSlotHeldLocked(slot);
+        } else if (state == SlotState::kFree) {
+            detachSlot = numAllocatedSlotsLocked() >= mBuffersRequested;
+        }
+        // Otherwise the buffer of the slot was replaced on the producer side, e.g. the slot was
+        // detached and dequeued again before detachBuffer() marked it. The slot keeps counting as
+        // allocated, and its allocation is replaced below.
+    }
+
+    if (detachSlot) {
+        // The dequeued slot has a pre-allocated buffer whose size and format is as same as
+        // currently requested (but was not dequeued during allocation cycle). Just detach it to
+        // free this slot. And try dequeueBuffer again.
+        ALOGD("dequeued a new slot index but already allocated enough buffers. Detach it.");
+
+        if (producer->detachBuffer(slot) != android::NO_ERROR) {
+            return C2_CORRUPTED;
+        }
+        return C2_TIMED_OUT;
+    }
+
+    if (!alloc) {
+        // BUFFER_NEEDS_REALLOCATION is always honored, even if the slot is marked as allocated, as
+        // the slot's buffer might have been detached concurrently.
         if (status != BUFFER_NEEDS_REALLOCATION) {
             // The dequeued slot has a pre-allocated buffer whose size and format is as same as
             // currently requested, so there is no BUFFER_NEEDS_REALLOCATION flag. However since the
@@ -671,56 +780,70 @@ c2_status_t C2VdaBqBlockPool::Impl::fetchGraphicBlock(
 
         // Call requestBuffer to allocate buffer for the slot and obtain the reference.
         sp<GraphicBuffer> slotBuffer = new GraphicBuffer();
-        status = mProducer->requestBuffer(slot, &slotBuffer);
+        status = producer->requestBuffer(slot, &slotBuffer);
         if (status != android::NO_ERROR) {
-            if (mProducer->cancelBuffer(slot, fence) != android::NO_ERROR) {
+            if (producer->cancelBuffer(slot, fence) != android::NO_ERROR) {
                 return C2_CORRUPTED;
             }
             return asC2Error(status);
         }
 
         // Convert GraphicBuffer to C2GraphicAllocation and wrap producer id and slot index
-        ALOGV("buffer wraps { producer id: %" PRIu64 ", slot: %d }", mProducerId, slot);
+        ALOGV("buffer wraps { producer id: %" PRIu64 ", slot: %d }", producerId, slot);
         C2Handle* c2Handle = android::WrapNativeCodec2GrallocHandle(
                 slotBuffer->handle, slotBuffer->width, slotBuffer->height, slotBuffer->format,
                 slotBuffer->usage, slotBuffer->stride, slotBuffer->getGenerationNumber(),
-                mProducerId, slot);
+                producerId, slot);
         if (!c2Handle) {
             ALOGE("WrapNativeCodec2GrallocHandle failed");
             return C2_NO_MEMORY;
         }
 
-        std::shared_ptr<C2GraphicAllocation> alloc;
         c2_status_t err = mAllocator->priorGraphicAllocation(c2Handle, &alloc);
         if (err != C2_OK) {
             ALOGE("priorGraphicAllocation failed: %d", err);
             return err;
         }
 
-        mSlotAllocations[slot] = std::move(alloc);
-        if (mSlotAllocations.size() == mBuffersRequested) {
+        // Only the fetching thread allocates buffers, and the producer cannot be configured until
+        // the buffer set is allocated, see |mAllocateBuffersLock|. A slot may also be refilled
+        // with the buffer the client attached after a producer switch, in which case allocation
+        // is already disallowed.
+        bool allocatedEnough;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (producerId != mProducerId) {
+                ALOGV("%s(): producer is switched while allocating slot %d", __func__, slot);
+                return C2_TIMED_OUT;
+            }
+            setSlotAllocationLocked(slot, alloc);
+            markSlotHeldLocked(slot);
+            allocatedEnough = numAllocatedSlotsLocked() == mBuffersRequested;
+            if (allocatedEnough) {
+                // Store buffer formats for future usage.
+                mBufferFormat = BufferFormat(width, height, pixelFormat, androidUsage);
+            }
+        }
+        if (allocatedEnough && mAllocateBuffersLock.owns_lock()) {
             // Already allocated enough buffers, set allowAllocation to false to restrict the
             // eligible slots to allocated ones for future dequeue.
-            status = mProducer->allowAllocation(false);
+            status = producer->allowAllocation(false);
             if (status != android::NO_ERROR) {
                 return asC2Error(status);
             }
-            // Store buffer formats for future usage.
-            mBufferFormat = BufferFormat(width, height, pixelFormat, androidUsage);
-            ALOG_ASSERT(mAllocateBuffersLock.owns_lock());
             mAllocateBuffersLock.unlock();
         }
     }
 
     uint32_t width_l, height_l, format_l, stride_l, igbp_slot_l, generation;
     uint64_t usage_l, igbp_id_l;
-    android::_UnwrapNativeCodec2GrallocMetadata(mSlotAllocations[slot]->handle(), &width_l,
-                                                &height_l, &format_l, &usage_l, &stride_l,
-                                                &generation, &igbp_id_l, &igbp_slot_l);
-    ALOGE("slot generation:%d", generation);
-    auto poolData = std::make_shared<C2VdaBqBlockPoolData>(generation, mProducerId, slot,
+    android::_UnwrapNativeCodec2GrallocMetadata(alloc->handle(), &width_l, &height_l, &format_l,
+                                                &usage_l, &stride_l, &generation, &igbp_id_l,
+                                                &igbp_slot_l);
+    ALOGV("slot generation:%d", generation);
+    auto poolData = std::make_shared<C2VdaBqBlockPoolData>(generation, producerId, slot,
                                                            shared_from_this());
-    *block = _C2BlockFactory::CreateGraphicBlock(mSlotAllocations[slot], std::move(poolData));
+    *block = _C2BlockFactory::CreateGraphicBlock(alloc, std::move(poolData));
     return C2_OK;
 }
 
@@ -826,7 +949,7 @@ c2_status_t C2VdaBqBlockPool::Impl::requestNewBufferSet(int32_t bufferCount) {
         // are not owned by client.
         ALOGI("requestNewBufferSet: detachBuffer all slots forcedly");
         for (int32_t slot = 0; slot < static_cast<int32_t>(NUM_BUFFER_SLOTS); ++slot) {
-            if (mSlotAllocations.find(slot) != mSlotAllocations.end()) {
+            if (isSlotAllocatedLocked(slot)) {
                 // Skip detaching the buffer which is owned by client now.
                 continue;
             }
@@ -841,21 +964,26 @@ c2_status_t C2VdaBqBlockPool::Impl::requestNewBufferSet(int32_t bufferCount) {
         mProducerSwitched = false;
     }
 
+    const size_t numDequeuedBuffers = numAllocatedSlotsLocked();
     ALOGV("Requested new buffer count: %d, still dequeued buffer count: %zu", bufferCount,
-          mSlotAllocations.size());
+          numDequeuedBuffers);
 
-    // The remained slot indices in |mSlotAllocations| now are still dequeued (un-available).
+    // The remained allocated slots in |mSlots| now are still dequeued (un-available).
     // maxDequeuedBufferCount should be set to "new requested buffer count" + "still dequeued buffer
     // count" to make sure it has enough available slots to request buffer from.
-    status_t status = mProducer->setMaxDequeuedBufferCount(bufferCount + mSlotAllocations.size());
+    status_t status = mProducer->setMaxDequeuedBufferCount(bufferCount + numDequeuedBuffers);
     if (status != android::NO_ERROR) {
         return asC2Error(status);
     }
+    mMaxDequeuedBuffers = bufferCount + numDequeuedBuffers;
 
     // Release all remained slot buffer references here. CCodec should either cancel or queue its
     // owned buffers from this set before the next resolution change.
-    mSlotAllocations.clear();
-    mProducerChangeSlotMap.clear();
+    clearSlotsLocked();
+    {
+        std::lock_guard<std::mutex> producerLock(mProducerMutex);
+        mMigratedSlots.clear();
+    }
     mBuffersRequested = static_cast<size_t>(bufferCount);
 
     status = mProducer->allowAllocation(true);
@@ -865,6 +993,52 @@ c2_status_t C2VdaBqBlockPool::Impl::requestNewBufferSet(int32_t bufferCount) {
     return C2_OK;
 }
 
+c2_status_t C2VdaBqBlockPool::Impl::growBufferSet(int32_t bufferCount) {
+    // The allocating buffers lock is released by fetchGraphicBlock() once the current buffer set
+    // is fully allocated. Acquire it again to allocate the added buffers. Like fetchGraphicBlock(),
+    // this should be called on the same thread as requestNewBufferSet().
+    const bool lockAcquired = !mAllocateBuffersLock.owns_lock();
+    if (lockAcquired && !mAllocateBuffersLock.try_lock_for(kTimedMutexTimeoutMs)) {
+        ALOGE("Cannot acquire allocate buffers / configure producer lock over %" PRId64 " ms...",
+              static_cast<int64_t>(kTimedMutexTimeoutMs.count()));
+        return C2_BLOCKING;
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    c2_status_t err = C2_OK;
+    if (!mProducer) {
+        ALOGD("No HGraphicBufferProducer is configured...");
+        err = C2_NO_INIT;
+    } else if (bufferCount <= 0 || static_cast<size_t>(bufferCount) <= mBuffersRequested) {
+        ALOGE("Invalid grown buffer count = %d, current count = %zu", bufferCount,
+              mBuffersRequested);
+        err = C2_BAD_VALUE;
+    }
+    if (err != C2_OK) {
+        // Nothing will be allocated, so fetchGraphicBlock() would never release the lock.
+        if (lockAcquired) mAllocateBuffersLock.unlock();
+        return err;
+    }
+
+    const size_t numAddedBuffers = bufferCount - mBuffersRequested;
+    ALOGV("Grow buffer count from %zu to %d", mBuffersRequested, bufferCount);
+    status_t status = mProducer->setMaxDequeuedBufferCount(mMaxDequeuedBuffers + numAddedBuffers);
+    if (status != android::NO_ERROR) {
+        if (lockAcquired) mAllocateBuffersLock.unlock();
+        return asC2Error(status);
+    }
+    status = mProducer->allowAllocation(true);
+    if (status != android::NO_ERROR) {
+        ALOGE("Failed to allow allocation for the grown buffer set");
+        mProducer->setMaxDequeuedBufferCount(mMaxDequeuedBuffers);
+        if (lockAcquired) mAllocateBuffersLock.unlock();
+        return asC2Error(status);
+    }
+    mMaxDequeuedBuffers += numAddedBuffers;
+    mBuffersRequested = static_cast<size_t>(bufferCount);
+    return C2_OK;
+}
+
 void C2VdaBqBlockPool::Impl::configureProducer(const sp<HGraphicBufferProducer>& producer) {
     ALOGV("configureProducer");
     if (producer == nullptr) {
@@ -880,22 +1054,25 @@ void C2VdaBqBlockPool::Impl::configureProducer(const sp<HGraphicBufferProducer>&
         return;
     }
 
-    std::lock_guard<std::mutex> lock(mMutex);
-    auto newProducer = std::make_unique<H2BGraphicBufferProducer>(producer);
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto newProducer = std::make_shared<H2BGraphicBufferProducer>(producer);
     uint64_t producerId;
     if (newProducer->getUniqueId(&producerId) != android::NO_ERROR) {
         return;
     }
 
-    if (mProducer && mProducerId != producerId) {
+    const auto switchStartTime = std::chrono::steady_clock::now();
+    const bool isSwitching = mProducer && mProducerId != producerId;
+    std::map<int32_t, int32_t> slotChanges;
+    std::map<int32_t, std::shared_ptr<C2GraphicAllocation>> newSlotAllocations;
+    if (isSwitching) {
         ALOGI("Producer (Surface) is going to switch... ( %" PRIu64 " -> %" PRIu64 " )",
               mProducerId, producerId);
-        if (!switchProducer(newProducer.get(), producerId)) {
-            mProducerChangeSlotMap.clear();
+        if (!switchProducer(newProducer.get(), producerId, &slotChanges, &newSlotAllocations)) {
             return;
         }
     } else {
-        mSlotAllocations.clear();
+        clearSlotsLocked();
     }
 
     if (newProducer->setDequeueTimeout(0) != android::NO_ERROR) {
@@ -912,34 +1089,104 @@ void C2VdaBqBlockPool::Impl::configureProducer(const sp<HGraphicBufferProducer>&
 
     // HGraphicBufferProducer could (and should) be replaced if the client has set a new generation
     // number to producer. The old HGraphicBufferProducer will be disconnected and deprecated then.
-    mProducer = std::move(newProducer);
-    mProducerId = producerId;
+    std::shared_ptr<H2BGraphicBufferProducer> oldProducer;
+    std::vector<int32_t> slotsToCancel;
+    {
+        std::lock_guard<std::mutex> producerLock(mProducerMutex);
+        if (isSwitching) {
+            // The buffers whose blocks are held by the component are migrated: the blocks keep
+            // working as they are, and their new slots are cancelled once they are released. The
+            // other buffers are cancelled to the new producer right away. This is decided along
+            // with the producer replacement, so no block can be released in between. The blocks
+            // migrated by the previous switches and not released yet follow their slots.
+            std::set<int32_t> previouslyMigratedSlots;
+            for (auto it = mMigratedSlots.begin(); it != mMigratedSlots.end();) {
+                std::map<int32_t, int32_t>& migratedSlots = it->second;
+                for (auto slotIt = migratedSlots.begin(); slotIt != migratedSlots.end();) {
+                    auto slotChange = slotChanges.find(slotIt->second);
+                    if (slotChange == slotChanges.end()) {
+                        slotIt = migratedSlots.erase(slotIt);
+                        continue;
+                    }
+                    previouslyMigratedSlots.insert(slotChange->first);
+                    slotIt->second = slotChange->second;
+                    ++slotIt;
+                }
+                it = migratedSlots.empty() ? mMigratedSlots.erase(it) : std::next(it);
+            }
+            std::map<int32_t, int32_t> migratedSlots;
+            for (const auto& slotChange : slotChanges) {
+                if (!mSlots[slotChange.first].mHeldByComponent) {
+                    slotsToCancel.push_back(slotChange.second);
+                } else if (previouslyMigratedSlots.count(slotChange.first) == 0) {
+                    migratedSlots[slotChange.first] = slotChange.second;
+                }
+            }
+            if (!migratedSlots.empty()) mMigratedSlots[mProducerId] = std::move(migratedSlots);
+
+            clearSlotsLocked();
+            for (Slot& entry : mSlots) entry.mHeldByComponent = false;
+            for (auto& slotAllocation : newSlotAllocations) {
+                setSlotAllocationLocked(slotAllocation.first, std::move(slotAllocation.second));
+            }
+            for (const auto& producerSlots : mMigratedSlots) {
+                for (const auto& migratedSlot : producerSlots.second) {
+                    mSlots[migratedSlot.second].mHeldByComponent = true;
+                }
+            }
+            mPreviousProducerId = mProducerId;
+            mProducerSwitched = true;
+        }
+        oldProducer = std::move(mProducer);
+        mProducer = newProducer;
+        mProducerId = producerId;
+    }
+    if (!isSwitching) return;
+
+    // The remaining calls to the producers don't touch the slot table, let the buffers be fetched
+    // from the new producer meanwhile.
+    lock.unlock();
+    for (int32_t slot : slotsToCancel) {
+        if (newProducer->cancelBuffer(slot, new Fence()) != android::NO_ERROR) {
+            ALOGW("cancelBuffer slot=%d to new producer failed", slot);
+        }
+    }
+    for (const auto& slotChange : slotChanges) {
+        status_t status = oldProducer->detachBuffer(slotChange.first);
+        if (status != android::NO_ERROR) {
+            ALOGW("detachBuffer slot=%d from old producer failed: %d", slotChange.first, status);
+        }
+    }
+
+    const int64_t switchTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                                         std::chrono::steady_clock::now() - switchStartTime)
+                                         .count();
+    ALOGI("Producer switched in %" PRId64 " us, %zu buffers moved, %zu held by the component",
+          switchTimeUs, slotChanges.size(), slotChanges.size() - slotsToCancel.size());
+    ATRACE_INT("C2VdaBqBlockPool::switchProducerUs", static_cast<int32_t>(switchTimeUs));
 }
 
-bool C2VdaBqBlockPool::Impl::switchProducer(H2BGraphicBufferProducer* const newProducer,
-                                            uint64_t newProducerId) {
+bool C2VdaBqBlockPool::Impl::switchProducer(
+        H2BGraphicBufferProducer* const newProducer, uint64_t newProducerId,
+        std::map<int32_t, int32_t>* slotChanges,
+        std::map<int32_t, std::shared_ptr<C2GraphicAllocation>>* newSlotAllocations) {
+    ATRACE_CALL();
     if (mAllocator->getId() == android::V4L2AllocatorId::SECURE_GRAPHIC) {
         // TODO(johnylin): support this when we meet the use case in the future.
         ALOGE("Switch producer for secure buffer is not supported...");
         return false;
     }
 
-    // Set maxDequeuedBufferCount to new producer.
-    // Just like requestNewBufferSet(), maxDequeuedBufferCount should be set to "requested buffer
-    // count" + "buffer count in client" to make sure it has enough available slots to request
-    // buffers from.
-    // "Requested buffer count" could be obtained by the size of |mSlotAllocations|. However, it is
-    // not able to know "buffer count in client" in blockpool's aspect. The alternative solution is
-    // to set the worse case first, which is equal to the size of |mSlotAllocations|. And in the end
-    // of updateGraphicBlock() routine, we could get the arbitrary "buffer count in client" by
-    // counting the calls of updateGraphicBlock(willCancel=true). Then we set maxDequeuedBufferCount
-    // again to the correct value.
-    if (newProducer->setMaxDequeuedBufferCount(mSlotAllocations.size() * 2) != android::NO_ERROR) {
+    // Set maxDequeuedBufferCount to new producer. All the buffers are attached to the new producer
+    // as dequeued, and the ones not held by the component are cancelled right after the switch.
+    // The client may attach the buffers it holds to slots of its own on the new producer, so keep
+    // as many extra slots available as buffers. The buffers attached by the client are adopted by
+    // fetchGraphicBlock() in place of the migrated ones it shared.
+    const size_t numAllocatedSlots = numAllocatedSlotsLocked();
+    if (newProducer->setMaxDequeuedBufferCount(numAllocatedSlots * 2) != android::NO_ERROR) {
         return false;
     }
-
-    // Reset "buffer count in client". It will be accumulated in updateGraphicBlock() routine.
-    mBuffersInClient = 0;
+    mMaxDequeuedBuffers = numAllocatedSlots * 2;
 
     // Set allowAllocation to new producer.
     if (newProducer->allowAllocation(true) != android::NO_ERROR) {
@@ -958,20 +1205,21 @@ bool C2VdaBqBlockPool::Impl::switchProducer(H2BGraphicBufferProducer* const newP
         return false;
     }
 
-    // Attach all buffers to new producer.
-    mProducerChangeSlotMap.clear();
+    // Attach all buffers to new producer. The IGraphicBufferProducer HIDL interface has no batched
+    // variant, so this takes one call per buffer. The buffers themselves are never reallocated.
     int32_t slot;
-    std::map<int32_t, std::shared_ptr<C2GraphicAllocation>> newSlotAllocations;
-    std::map<int32_t, uint32_t> newSlotGeneration;
-    for (auto iter = mSlotAllocations.begin(); iter != mSlotAllocations.end(); ++iter) {
+    for (int32_t oldSlot = 0; oldSlot < static_cast<int32_t>(NUM_BUFFER_SLOTS); ++oldSlot) {
+        if (!isSlotAllocatedLocked(oldSlot)) continue;
+        const std::shared_ptr<C2GraphicAllocation>& oldAlloc = mSlots[oldSlot].mAllocation;
+
         // Convert C2GraphicAllocation to GraphicBuffer.
         uint32_t width, height, format, stride, igbp_slot, generation;
         uint64_t usage, igbp_id;
-        android::_UnwrapNativeCodec2GrallocMetadata(iter->second->handle(), &width, &height,
-                                                    &format, &usage, &stride, &generation, &igbp_id,
+        android::_UnwrapNativeCodec2GrallocMetadata(oldAlloc->handle(), &width, &height, &format,
+                                                    &usage, &stride, &generation, &igbp_id,
                                                     &igbp_slot);
         native_handle_t* grallocHandle =
-                android::UnwrapNativeCodec2GrallocHandle(iter->second->handle());
+                android::UnwrapNativeCodec2GrallocHandle(oldAlloc->handle());
 
         // Update generation number and usage.
         sp<GraphicBuffer> graphicBuffer =
@@ -1004,11 +1252,10 @@ bool C2VdaBqBlockPool::Impl::switchProducer(H2BGraphicBufferProducer* const newP
             return false;
         }
 
-        // Store to |newSlotAllocations| and also store old-to-new producer slot map.
-        ALOGV("Transfered buffer from old producer to new, slot prev: %d -> new %d", iter->first,
+        ALOGV("Transfered buffer from old producer to new, slot prev: %d -> new %d", oldSlot,
               slot);
-        newSlotAllocations[slot] = std::move(alloc);
-        mProducerChangeSlotMap[iter->first] = slot;
+        (*newSlotAllocations)[slot] = std::move(alloc);
+        (*slotChanges)[oldSlot] = slot;
     }
 
     // Set allowAllocation to false so producer could not allocate new buffers.
@@ -1016,17 +1263,6 @@ bool C2VdaBqBlockPool::Impl::switchProducer(H2BGraphicBufferProducer* const newP
         ALOGE("allowAllocation(false) failed");
         return false;
     }
-
-    // Try to detach all buffers from old producer.
-    for (const auto& slotAllocation : mSlotAllocations) {
-        status_t status = mProducer->detachBuffer(slotAllocation.first);
-        if (status != android::NO_ERROR) {
-            ALOGW("detachBuffer slot=%d from old producer failed: %d", slotAllocation.first,
-                  status);
-        }
-    }
-
-    mSlotAllocations = std::move(newSlotAllocations);
     return true;
 }
 
@@ -1035,56 +1271,53 @@ c2_status_t C2VdaBqBlockPool::Impl::updateGraphicBlock(
         std::shared_ptr<C2GraphicBlock>* block /* nonnull */) {
     std::lock_guard<std::mutex> lock(mMutex);
 
-    if (mProducerChangeSlotMap.empty()) {
-        ALOGD("A new buffer set is requested right after producer change, no more update needed.");
-        return C2_CANCELED;
-    }
+    int32_t slot;
+    std::shared_ptr<H2BGraphicBufferProducer> producer;
+    {
+        std::lock_guard<std::mutex> producerLock(mProducerMutex);
+        auto producerIt = mMigratedSlots.find(mPreviousProducerId);
+        if (producerIt == mMigratedSlots.end()) {
+            ALOGD("No migrated block left after producer change, no more update needed.");
+            return C2_CANCELED;
+        }
 
-    auto it = mProducerChangeSlotMap.find(static_cast<int32_t>(oldSlot));
-    if (it == mProducerChangeSlotMap.end()) {
-        ALOGE("Cannot find old slot = %u in map...", oldSlot);
-        return C2_NOT_FOUND;
+        std::map<int32_t, int32_t>& migratedSlots = producerIt->second;
+        auto it = migratedSlots.find(static_cast<int32_t>(oldSlot));
+        if (it == migratedSlots.end()) {
+            ALOGE("Cannot find old slot = %u in map...", oldSlot);
+            return C2_NOT_FOUND;
+        }
+        slot = it->second;
+        migratedSlots.erase(it);
+        if (migratedSlots.empty()) mMigratedSlots.erase(producerIt);
+        if (willCancel) mSlots[slot].mHeldByComponent = false;
+        producer = mProducer;
     }
-
-    int32_t slot = it->second;
     *newSlot = static_cast<uint32_t>(slot);
-    mProducerChangeSlotMap.erase(it);
 
     if (willCancel) {
         sp<Fence> fence = new Fence();
         // The old C2GraphicBlock might be owned by client. Cancel this slot.
-        if (mProducer->cancelBuffer(slot, fence) != android::NO_ERROR) {
+        if (producer->cancelBuffer(slot, fence) != android::NO_ERROR) {
             return C2_CORRUPTED;
         }
-        // Client might try to attach the old buffer to the current producer on client's end,
-        // although it is useless for us anymore. However it will still occupy an available slot.
-        mBuffersInClient++;
-    } else {
+    } else if (isSlotAllocatedLocked(slot)) {
         // The old C2GraphicBlock is still owned by component, replace by the new one and keep this
-        // slot dequeued.
+        // slot dequeued. Releasing the old block is then a no-op as its slot is not migrated
+        // anymore.
         uint32_t width_l, height_l, format_l, stride_l, igbp_slot_l, generation;
         uint64_t usage_l, igbp_id_l;
-        android::_UnwrapNativeCodec2GrallocMetadata(mSlotAllocations[slot]->handle(), &width_l,
+        android::_UnwrapNativeCodec2GrallocMetadata(mSlots[slot].mAllocation->handle(), &width_l,
                                                     &height_l, &format_l, &usage_l, &stride_l,
                                                     &generation, &igbp_id_l, &igbp_slot_l);
         auto poolData = std::make_shared<C2VdaBqBlockPoolData>(generation, mProducerId,
                                                                slot, shared_from_this());
-        *block = _C2BlockFactory::CreateGraphicBlock(mSlotAllocations[slot], std::move(poolData));
-    }
-
-    if (mProducerChangeSlotMap.empty()) {
-        // The updateGraphicBlock() routine is about to finish.
-        // Set the correct maxDequeuedBufferCount to producer, which is "requested buffer count" +
-        // "buffer count in client".
-        ALOGV("Requested buffer count: %zu, buffer count in client: %u", mSlotAllocations.size(),
-              mBuffersInClient);
-        if (mProducer->setMaxDequeuedBufferCount(mSlotAllocations.size() + mBuffersInClient) !=
-            android::NO_ERROR) {
-            return C2_CORRUPTED;
-        }
-        mProducerSwitched = true;
+        *block = _C2BlockFactory::CreateGraphicBlock(mSlots[slot].mAllocation,
+                                                     std::move(poolData));
+    } else {
+        ALOGE("Migrated slot = %d is not allocated anymore...", slot);
+        return C2_NOT_FOUND;
     }
-
     return C2_OK;
 }
 
@@ -1111,30 +1344,113 @@ c2_status_t C2VdaBqBlockPool::Impl::getMinBuffersForDisplay(size_t* bufferCount)
 
 void C2VdaBqBlockPool::Impl::detachBuffer(uint64_t producerId, int32_t slotId) {
     ALOGV("detachBuffer: producer id = %" PRIu64 ", slot = %d", producerId, slotId);
-    std::lock_guard<std::mutex> lock(mMutex);
-    if (producerId == mProducerId && mProducer) {
-        if (mProducer->detachBuffer(slotId) != android::NO_ERROR) {
-            return;
-        }
-
-        auto it = mSlotAllocations.find(slotId);
-        // It may happen that the slot is not included in |mSlotAllocations|, which means it is
-        // released after resolution change.
-        if (it != mSlotAllocations.end()) {
-            mSlotAllocations.erase(it);
-        }
+    std::shared_ptr<H2BGraphicBufferProducer> producer = takeReleasedSlot(producerId, &slotId);
+    if (!producer) {
+        return;
     }
+
+    // Mark the slot before detaching its buffer, as the producer can hand the freed slot to
+    // fetchGraphicBlock() as soon as it's detached. It may happen that the slot is not allocated,
+    // which means it is released after resolution change.
+    std::atomic<SlotState>& state = mSlots[slotId].mState;
+    SlotState expected = SlotState::kAllocated;
+    const bool detaching = state.compare_exchange_strong(expected, SlotState::kDetaching);
+
+    status_t status = producer->detachBuffer(slotId);
+    if (!detaching) return;
+
+    // The buffer is dropped by the next call holding |mMutex|. If the slot was meanwhile refilled
+    // by fetchGraphicBlock() or cleared, it's left as is.
+    expected = SlotState::kDetaching;
+    state.compare_exchange_strong(
+            expected, status == android::NO_ERROR ? SlotState::kDetached : SlotState::kAllocated);
 }
 
 void C2VdaBqBlockPool::Impl::cancelBuffer(uint64_t producerId, int32_t slotId) {
     ALOGV("cancelBuffer: producer id = %" PRIu64 ", slot = %d", producerId, slotId);
-    std::lock_guard<std::mutex> lock(mMutex);
+    std::shared_ptr<H2BGraphicBufferProducer> producer = takeReleasedSlot(producerId, &slotId);
+    if (!producer) {
+        return;
+    }
     sp<Fence> fence = new Fence();
-    if (producerId == mProducerId && mProducer) {
-        if (mProducer->cancelBuffer(slotId, fence) != android::NO_ERROR) {
+    producer->cancelBuffer(slotId, fence);
+}
+
+void C2VdaBqBlockPool::Impl::onBlockShared(uint64_t producerId, int32_t slotId) {
+    ALOGV("onBlockShared: producer id = %" PRIu64 ", slot = %d", producerId, slotId);
+    {
+        std::lock_guard<std::mutex> lock(mProducerMutex);
+        if (producerId == mProducerId) {
+            // The client queues or cancels the buffer to the producer by itself.
+            mSlots[slotId].mHeldByComponent = false;
             return;
         }
     }
+
+    // The block was fetched before the producer switch. The client attaches the buffer to a slot
+    // of its own on the current producer, so free the slot it was migrated to. The buffer is
+    // adopted again by fetchGraphicBlock() when the client's slot is dequeued.
+    detachBuffer(producerId, slotId);
+}
+
+std::shared_ptr<H2BGraphicBufferProducer> C2VdaBqBlockPool::Impl::takeReleasedSlot(
+        uint64_t producerId, int32_t* slotId) {
+    std::lock_guard<std::mutex> lock(mProducerMutex);
+    if (producerId != mProducerId) {
+        auto producerIt = mMigratedSlots.find(producerId);
+        if (producerIt == mMigratedSlots.end()) return nullptr;
+        std::map<int32_t, int32_t>& migratedSlots = producerIt->second;
+        auto it = migratedSlots.find(*slotId);
+        if (it == migratedSlots.end()) return nullptr;
+
+        ALOGV("Released migrated slot %d -> %d", *slotId, it->second);
+        *slotId = it->second;
+        migratedSlots.erase(it);
+        if (migratedSlots.empty()) mMigratedSlots.erase(producerIt);
+    }
+    mSlots[*slotId].mHeldByComponent = false;
+    return mProducer;
+}
+
+bool C2VdaBqBlockPool::Impl::isSlotAllocatedLocked(int32_t slot) {
+    return mSlots[slot].mState.load() == SlotState::kAllocated;
+}
+
+size_t C2VdaBqBlockPool::Impl::numAllocatedSlotsLocked() {
+    reclaimDetachedSlotsLocked();
+    return mNumAllocatedSlots;
+}
+
+void C2VdaBqBlockPool::Impl::setSlotAllocationLocked(
+        int32_t slot, std::shared_ptr<C2GraphicAllocation> allocation) {
+    Slot& entry = mSlots[slot];
+    if (entry.mState.exchange(SlotState::kAllocated) == SlotState::kFree) {
+        mNumAllocatedSlots++;
+    }
+    entry.mAllocation = std::move(allocation);
+}
+
+void C2VdaBqBlockPool::Impl::markSlotHeldLocked(int32_t slot) {
+    std::lock_guard<std::mutex> lock(mProducerMutex);
+    mSlots[slot].mHeldByComponent = true;
+}
+
+void C2VdaBqBlockPool::Impl::clearSlotsLocked() {
+    for (Slot& entry : mSlots) {
+        entry.mState = SlotState::kFree;
+        entry.mAllocation.reset();
+    }
+    mNumAllocatedSlots = 0;
+}
+
+void C2VdaBqBlockPool::Impl::reclaimDetachedSlotsLocked() {
+    for (Slot& entry : mSlots) {
+        SlotState expected = SlotState::kDetached;
+        if (entry.mState.compare_exchange_strong(expected, SlotState::kFree)) {
+            entry.mAllocation.reset();
+            mNumAllocatedSlots--;
+        }
+    }
 }
 
 bool C2VdaBqBlockPool::Impl::setNotifyBlockAvailableCb(::base::OnceClosure cb) {
@@ -1190,6 +1506,13 @@ c2_status_t C2VdaBqBlockPool::requestNewBufferSet(int32_t bufferCount) {
     return C2_NO_INIT;
 }
 
+c2_status_t C2VdaBqBlockPool::growBufferSet(int32_t bufferCount) {
+    if (mImpl) {
+        return mImpl->growBufferSet(bufferCount);
+    }
+    return C2_NO_INIT;
+}
+
 void C2VdaBqBlockPool::configureProducer(const sp<HGraphicBufferProducer>& producer) {
     if (mImpl) {
         mImpl->configureProducer(producer);
@@ -111,4 +111,16 @@ c2_status_t C2VdaPooledBlockPool::requestNewBufferSet(int32_t bufferCount) {
     return C2_OK;
 }
 
+c2_status_t C2VdaPooledBlockPool::growBufferSet(int32_t bufferCount) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (bufferCount <= 0 || static_cast<size_t>(bufferCount) < mBufferCount) {
+        ALOGE("Invalid grown buffer count = %d, current count = %zu", bufferCount, mBufferCount);
+        return C2_BAD_VALUE;
+    }
+
+    ALOGV("Grow buffer count from %zu to %d", mBufferCount, bufferCount);
+    mBufferCount = bufferCount;
+    return C2_OK;
+}
+
 }  // namespace android
@@ -18,6 +18,7 @@
 
 #include <utils/Trace.h>
 
+#include <v4l2_codec2/plugin_store/C2RecyclingGraphicAllocator.h>
 #include <v4l2_codec2/plugin_store/C2VdaBqBlockPool.h>
 #include <v4l2_codec2/plugin_store/C2VdaPooledBlockPool.h>
 #include <v4l2_codec2/plugin_store/V4L2AllocatorId.h>
@@ -71,7 +72,10 @@ C2BlockPool* createBlockPool(C2Allocator::id_t allocatorId, C2BlockPool::local_i
 
     switch (allocatorId) {
     case V4L2AllocatorId::V4L2_BUFFERPOOL:
-        return new C2VdaPooledBlockPool(allocator, poolId);
+        // The buffers freed when a session is stopped are recycled by the next sessions. The
+        // recycling allocator clears them before reuse and never recycles protected buffers.
+        return new C2VdaPooledBlockPool(
+                std::make_shared<C2RecyclingGraphicAllocator>(std::move(allocator)), poolId);
 
     case V4L2AllocatorId::V4L2_BUFFERQUEUE:
         return new C2VdaBqBlockPool(allocator, poolId);
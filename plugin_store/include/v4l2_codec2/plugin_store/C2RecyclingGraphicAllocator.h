@@ -0,0 +1,48 @@
+// Copyright 2020 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ANDROID_V4L2_CODEC2_PLUGIN_STORE_C2_RECYCLING_GRAPHIC_ALLOCATOR_H
+#define ANDROID_V4L2_CODEC2_PLUGIN_STORE_C2_RECYCLING_GRAPHIC_ALLOCATOR_H
+
+#include <memory>
+
+#include <C2Buffer.h>
+
+namespace android {
+
+// A graphic allocator wrapping another allocator. Graphic allocations released by their users are
+// not freed right away, but kept in a process-wide cache for a limited time and up to a total size.
+// New allocations with the same size, format and usage are taken from the cache, so sessions
+// started shortly after a previous one was stopped don't need to allocate their buffers again.
+// As the cache is shared by the sessions of all clients, the cached allocations are cleared before
+// being reused. Only allocations the CPU can write to are cached, and never protected ones.
+// Allocations imported through priorGraphicAllocation() are never cached.
+class C2RecyclingGraphicAllocator : public C2Allocator {
+public:
+    explicit C2RecyclingGraphicAllocator(std::shared_ptr<C2Allocator> allocator);
+    ~C2RecyclingGraphicAllocator() override = default;
+
+    // Get a basic graphic block pool allocating from the platform gralloc allocator through the
+    // recycling cache, shared by the whole process.
+    static std::shared_ptr<C2BlockPool> getBasicGraphicBlockPool();
+
+    // Implementation of the C2Allocator interface.
+    id_t getId() const override;
+    C2String getName() const override;
+    std::shared_ptr<const Traits> getTraits() const override;
+    c2_status_t newGraphicAllocation(uint32_t width, uint32_t height, uint32_t format,
+                                     C2MemoryUsage usage,
+                                     std::shared_ptr<C2GraphicAllocation>* allocation) override;
+    c2_status_t priorGraphicAllocation(const C2Handle* handle,
+                                       std::shared_ptr<C2GraphicAllocation>* allocation) override;
+    bool checkHandle(const C2Handle* const handle) const override;
+
+private:
+    // The allocator used when no cached allocation matches.
+    const std::shared_ptr<C2Allocator> mAllocator;
+};
+
+}  // namespace android
+
+#endif  // ANDROID_V4L2_CODEC2_PLUGIN_STORE_C2_RECYCLING_GRAPHIC_ALLOCATOR_H
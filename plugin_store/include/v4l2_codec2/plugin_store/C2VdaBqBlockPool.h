@@ -70,7 +70,9 @@ public:
      * When the size of |mSlotAllocations| reaches the requested buffer count, set disallow
      * allocation to producer. After that buffer set is started to be recycled by dequeue.
      *
-     * \retval C2_BAD_STATE informs the caller producer is switched.
+     * A producer switch is transparent to the caller: the buffers are moved to the new producer
+     * by configureProducer(), and the blocks fetched before the switch keep working until they
+     * are released or shared.
      */
     c2_status_t fetchGraphicBlock(uint32_t width, uint32_t height, uint32_t format,
                                   C2MemoryUsage usage,
@@ -99,7 +101,24 @@ public:
     c2_status_t requestNewBufferSet(int32_t bufferCount);
 
     /**
-     * Updates the buffer from producer switch.
+     * Allows the allocation of more buffers on top of the current buffer set. The buffers already
+     * allocated are kept, and maxDequeuedBufferCount is raised by the number of added buffers.
+     *
+     * \note C2VdaBqBlockPool-specific function
+     *
+     * \param bufferCount  the new total number of buffers, greater than the current one.
+     *
+     * \retval C2_OK        the operation was successful.
+     * \retval C2_NO_INIT   this class is not initialized, or producer is not assigned.
+     * \retval C2_BAD_VALUE |bufferCount| is not greater than the current buffer count.
+     * \retval C2_BLOCKING  the producer is being configured.
+     * \retval C2_CORRUPTED some unknown, unrecoverable error occured during operation (unexpected).
+     */
+    c2_status_t growBufferSet(int32_t bufferCount);
+
+    /**
+     * Updates the buffer from producer switch. Not needed anymore since the blocks fetched before
+     * a switch are migrated automatically, kept for the callers tracking the slots by themselves.
      *
      * \note C2VdaBqBlockPool-specific function
      *
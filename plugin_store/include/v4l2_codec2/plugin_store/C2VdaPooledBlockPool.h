@@ -30,6 +30,11 @@ public:
     // |bufferCount| is the number of requested buffers.
     c2_status_t requestNewBufferSet(int32_t bufferCount);
 
+    // Allow the pool to allocate more buffers on top of the current buffer set, keeping the
+    // buffers already allocated.
+    // |bufferCount| is the new total number of buffers, not less than the current one.
+    c2_status_t growBufferSet(int32_t bufferCount);
+
     // Return C2_OK and store a buffer in |block| if a buffer is successfully fetched.
     // Return C2_TIMED_OUT if the pool already allocated |mBufferCount| buffers but they are all in
     // use.
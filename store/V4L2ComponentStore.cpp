@@ -109,7 +109,14 @@ std::vector<std::shared_ptr<const C2Component::Traits>> V4L2ComponentStore::list
     ALOGV("%s()", __func__);
 
     std::vector<std::shared_ptr<const C2Component::Traits>> ret;
-    ret.push_back(GetTraits(V4L2ComponentName::kH264Encoder));
+    // The encoders are only listed if the device supports their codec, their interface fails to be
+    // created otherwise.
+    for (const std::string& name :
+         {V4L2ComponentName::kH264Encoder, V4L2ComponentName::kH265Encoder,
+          V4L2ComponentName::kVP8Encoder, V4L2ComponentName::kVP9Encoder}) {
+        auto traits = GetTraits(name);
+        if (traits != nullptr) ret.push_back(std::move(traits));
+    }
     ret.push_back(GetTraits(V4L2ComponentName::kH264Decoder));
     //ret.push_back(GetTraits(V4L2ComponentName::kH264SecureDecoder));
     ret.push_back(GetTraits(V4L2ComponentName::kH265Decoder));
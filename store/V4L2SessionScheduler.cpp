@@ -0,0 +1,117 @@
+// Copyright 2020 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// #define LOG_NDEBUG 0
+#define LOG_TAG "V4L2SessionScheduler"
+
+#include <v4l2_codec2/store/V4L2SessionScheduler.h>
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include <log/log.h>
+
+namespace android {
+namespace {
+
+// A realtime session is considered active if it queued an input buffer within this window.
+constexpr std::chrono::milliseconds kRealtimeActiveWindow(100);
+// The rate of a metered session which doesn't specify its operating rate, in frames per second.
+constexpr float kDefaultMeteredRate = 30.0f;
+// The maximal rate of a metered session, in frames per second. The framework might request
+// operating rate as FLT_MAX to mean "as fast as possible".
+constexpr float kMaxMeteredRate = 120.0f;
+
+}  // namespace
+
+// static
+V4L2SessionScheduler& V4L2SessionScheduler::getInstance() {
+    static V4L2SessionScheduler sScheduler;
+    return sScheduler;
+}
+
+V4L2SessionScheduler::SessionId V4L2SessionScheduler::registerSession() {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    const SessionId id = mNextSessionId++;
+    mSessions.emplace(id, Session());
+    ALOGV("%s(): id=%u, %zu sessions", __func__, id, mSessions.size());
+    return id;
+}
+
+void V4L2SessionScheduler::unregisterSession(SessionId id) {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    mSessions.erase(id);
+    ALOGV("%s(): id=%u, %zu sessions", __func__, id, mSessions.size());
+}
+
+void V4L2SessionScheduler::updateSession(SessionId id, int32_t priority, float operatingRate) {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    auto it = mSessions.find(id);
+    if (it == mSessions.end()) {
+        ALOGE("%s(): unknown session id=%u", __func__, id);
+        return;
+    }
+
+    Session& session = it->second;
+    if (session.mPriority != priority || session.mOperatingRate != operatingRate) {
+        ALOGV("%s(): id=%u, priority=%d, operatingRate=%f", __func__, id, priority,
+              operatingRate);
+        session.mPriority = priority;
+        session.mOperatingRate = operatingRate;
+    }
+}
+
+std::chrono::microseconds V4L2SessionScheduler::acquireQueueSlot(SessionId id) {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    auto it = mSessions.find(id);
+    if (it == mSessions.end()) {
+        ALOGE("%s(): unknown session id=%u", __func__, id);
+        return std::chrono::microseconds(0);
+    }
+
+    Session& session = it->second;
+    const Clock::time_point now = Clock::now();
+    if (!isRealtime(session) && session.mHasQueued && hasActiveRealtimeSession(now)) {
+        const Clock::duration elapsed = now - session.mLastQueueTime;
+        const Clock::duration interval = getMeteredInterval(session);
+        if (elapsed < interval) {
+            auto delay = std::chrono::duration_cast<std::chrono::microseconds>(interval - elapsed);
+            ALOGV("%s(): id=%u is metered, delay=%" PRId64 "us", __func__, id,
+                  static_cast<int64_t>(delay.count()));
+            return std::max(delay, std::chrono::microseconds(1));
+        }
+    }
+
+    session.mLastQueueTime = now;
+    session.mHasQueued = true;
+    return std::chrono::microseconds(0);
+}
+
+bool V4L2SessionScheduler::hasActiveRealtimeSession(Clock::time_point now) const {
+    return std::any_of(mSessions.begin(), mSessions.end(), [now](const auto& kv) {
+        const Session& session = kv.second;
+        return isRealtime(session) && session.mHasQueued &&
+               now - session.mLastQueueTime < kRealtimeActiveWindow;
+    });
+}
+
+// static
+V4L2SessionScheduler::Clock::duration V4L2SessionScheduler::getMeteredInterval(
+        const Session& session) {
+    float rate = kDefaultMeteredRate;
+    if (session.mOperatingRate > 0.0f) {
+        rate = std::min(session.mOperatingRate, kMaxMeteredRate);
+    }
+
+    // A lower priority (larger value) stretches the interval proportionally.
+    const float seconds = static_cast<float>(std::max(session.mPriority, 1)) / rate;
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(seconds));
+}
+
+}  // namespace android
@@ -0,0 +1,72 @@
+// Copyright 2020 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ANDROID_V4L2_CODEC2_STORE_V4L2_SESSION_SCHEDULER_H
+#define ANDROID_V4L2_CODEC2_STORE_V4L2_SESSION_SCHEDULER_H
+
+#include <stdint.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+
+#include <android-base/thread_annotations.h>
+
+namespace android {
+
+// Process-wide scheduler shared by all V4L2 codec sessions. Components ask the scheduler before
+// queuing an input buffer to the device. Realtime sessions (e.g. foreground playback) are never
+// delayed, while non-realtime sessions (e.g. thumbnail extraction or transcoding) are metered
+// according to their priority and requested operating rate whenever a realtime session is active,
+// and run unthrottled to fill the idle capacity otherwise.
+class V4L2SessionScheduler {
+public:
+    using SessionId = uint32_t;
+    using Clock = std::chrono::steady_clock;
+
+    static V4L2SessionScheduler& getInstance();
+
+    V4L2SessionScheduler(const V4L2SessionScheduler&) = delete;
+    V4L2SessionScheduler& operator=(const V4L2SessionScheduler&) = delete;
+
+    // Register a new session. The returned ID is used for all other calls.
+    SessionId registerSession();
+    // Unregister the session. The ID must not be used after this call.
+    void unregisterSession(SessionId id);
+
+    // Update the scheduling parameters of the session. |priority| follows C2_PARAMKEY_PRIORITY:
+    // 0 means realtime and a larger value means a lower priority. |operatingRate| follows
+    // C2_PARAMKEY_OPERATING_RATE in frames per second, 0 if not specified.
+    void updateSession(SessionId id, int32_t priority, float operatingRate);
+
+    // Ask whether the session could queue an input buffer to the device now. Returns zero if the
+    // session is allowed, in which case the queuing is accounted to the session. Otherwise returns
+    // the duration the session should wait before asking again.
+    std::chrono::microseconds acquireQueueSlot(SessionId id);
+
+private:
+    struct Session {
+        int32_t mPriority = 0;
+        float mOperatingRate = 0.0f;
+        // The time of the last input buffer queued by the session, if any.
+        Clock::time_point mLastQueueTime;
+        bool mHasQueued = false;
+    };
+
+    V4L2SessionScheduler() = default;
+
+    static bool isRealtime(const Session& session) { return session.mPriority <= 0; }
+    // Whether any realtime session queued an input buffer recently.
+    bool hasActiveRealtimeSession(Clock::time_point now) const REQUIRES(mLock);
+    // The minimal interval between two queued input buffers of a metered session.
+    static Clock::duration getMeteredInterval(const Session& session);
+
+    mutable std::mutex mLock;
+    SessionId mNextSessionId GUARDED_BY(mLock) = 0;
+    std::map<SessionId, Session> mSessions GUARDED_BY(mLock);
+};
+
+}  // namespace android
+
+#endif  // ANDROID_V4L2_CODEC2_STORE_V4L2_SESSION_SCHEDULER_H
@@ -16,6 +16,7 @@
 #include <gtest/gtest.h>
 #include <utils/Log.h>
 
+#include <v4l2_codec2/common/V4L2ComponentParams.h>
 #include <v4l2_codec2/components/V4L2EncodeComponent.h>
 #include <v4l2_codec2/components/V4L2EncodeInterface.h>
 
@@ -203,6 +204,104 @@ TEST_F(C2VEACompIntfTest, TestKeyFramePeriodUs) {
     TRACED_FAILURE(testWritableParam(&period));
 }
 
+TEST_F(C2VEACompIntfTest, TestBitrateMode) {
+    C2StreamBitrateModeTuning::output mode(0u, C2Config::BITRATE_VARIABLE);
+    TRACED_FAILURE(testWritableParam(&mode));
+    mode.value = C2Config::BITRATE_IGNORE;
+    TRACED_FAILURE(testWritableParam(&mode));
+    mode.value = C2Config::BITRATE_CONST;
+    TRACED_FAILURE(testWritableParam(&mode));
+}
+
+TEST_F(C2VEACompIntfTest, TestQpRange) {
+    C2StreamV4L2QpRangeTuning::output qpRange(0u, 10, 40, 20, 22);
+    TRACED_FAILURE(testWritableParam(&qpRange));
+    qpRange.minQp = 0;
+    qpRange.maxQp = 51;
+    TRACED_FAILURE(testWritableParam(&qpRange));
+    // The minimum must not be larger than the maximum.
+    qpRange.minQp = 40;
+    qpRange.maxQp = 30;
+    TRACED_FAILURE(testInvalidWritableParam(&qpRange));
+}
+
+TEST_F(C2VEACompIntfTest, TestTemporalLayering) {
+    std::shared_ptr<C2StreamTemporalLayeringTuning::output> layering(
+            C2StreamTemporalLayeringTuning::output::AllocShared(2u, 0u, 3u, 0u));
+    layering->m.bitrateRatios[0] = 0.5f;
+    layering->m.bitrateRatios[1] = 0.25f;
+
+    std::vector<C2Param*> params{layering.get()};
+    std::vector<std::unique_ptr<C2SettingResult>> failures;
+    ASSERT_EQ(C2_OK, mIntf->config_vb(params, C2_DONT_BLOCK, &failures));
+
+    // The bitrate ratios are cumulative, so they must be increasing.
+    std::vector<std::unique_ptr<C2Param>> heapParams;
+    ASSERT_EQ(C2_OK, mIntf->query_vb({}, {layering->index()}, C2_DONT_BLOCK, &heapParams));
+    ASSERT_EQ(1u, heapParams.size());
+    auto* value = static_cast<C2StreamTemporalLayeringTuning::output*>(heapParams[0].get());
+    EXPECT_EQ(3u, value->m.layerCount);
+    EXPECT_EQ(0u, value->m.bLayerCount);
+    ASSERT_EQ(2u, value->flexCount());
+    EXPECT_EQ(0.5f, value->m.bitrateRatios[0]);
+    EXPECT_EQ(0.5f, value->m.bitrateRatios[1]);
+}
+
+TEST_F(C2VEACompIntfTest, TestSliceCount) {
+    C2StreamV4L2SliceCountTuning::output sliceCount(0u, 4);
+    TRACED_FAILURE(testWritableParam(&sliceCount));
+    sliceCount.value = 0;
+    TRACED_FAILURE(testWritableParam(&sliceCount));
+    sliceCount.value = 1000;
+    TRACED_FAILURE(testInvalidWritableParam(&sliceCount));
+}
+
+TEST_F(C2VEACompIntfTest, TestRoiRects) {
+    std::shared_ptr<C2StreamV4L2RoiRectsTuning::input> rects(
+            C2StreamV4L2RoiRectsTuning::input::AllocShared(2u, 0u));
+    rects->m.values[0] = C2V4L2RoiRectStruct(0, 0, 64, 64, -10);
+    rects->m.values[1] = C2V4L2RoiRectStruct(128, 32, 16, 16, 5);
+
+    std::vector<C2Param*> params{rects.get()};
+    std::vector<std::unique_ptr<C2SettingResult>> failures;
+    ASSERT_EQ(C2_OK, mIntf->config_vb(params, C2_DONT_BLOCK, &failures));
+
+    std::vector<std::unique_ptr<C2Param>> heapParams;
+    ASSERT_EQ(C2_OK, mIntf->query_vb({}, {rects->index()}, C2_DONT_BLOCK, &heapParams));
+    ASSERT_EQ(1u, heapParams.size());
+    auto* value = static_cast<C2StreamV4L2RoiRectsTuning::input*>(heapParams[0].get());
+    ASSERT_EQ(2u, value->flexCount());
+    EXPECT_EQ(64u, value->m.values[0].width);
+    EXPECT_EQ(-10, value->m.values[0].qpDelta);
+    EXPECT_EQ(128u, value->m.values[1].left);
+    EXPECT_EQ(5, value->m.values[1].qpDelta);
+}
+
+TEST_F(C2VEACompIntfTest, TestEncodeSessionStats) {
+    // No frames are encoded yet, and the QP is unknown. The statistics can't be configured.
+    C2StreamV4L2EncodeSessionStatsInfo::output expected(0u);
+    EXPECT_EQ(0u, expected.frameCount);
+    EXPECT_EQ(-1, expected.averageQp);
+    C2StreamV4L2EncodeSessionStatsInfo::output invalid(0u);
+    invalid.frameCount = 1;
+    invalid.averageQp = 30;
+    TRACED_FAILURE(testReadOnlyParam(&expected, &invalid));
+}
+
+TEST_F(C2VEACompIntfTest, TestPriority) {
+    C2ComponentPriorityTuning priority(1);
+    TRACED_FAILURE(testWritableParam(&priority));
+    priority.value = 0;
+    TRACED_FAILURE(testWritableParam(&priority));
+}
+
+TEST_F(C2VEACompIntfTest, TestOperatingRate) {
+    C2ComponentOperatingRateTuning rate(120.);
+    TRACED_FAILURE(testWritableParam(&rate));
+    rate.value = 0.;
+    TRACED_FAILURE(testWritableParam(&rate));
+}
+
 TEST_F(C2VEACompIntfTest, TestInputAllocatorIds) {
     std::shared_ptr<C2PortAllocatorsTuning::input> expected(
             C2PortAllocatorsTuning::input::AllocShared(kInputAllocators));
@@ -21,6 +21,10 @@ namespace {
 // <android_root>/frameworks/base/media/java/android/media/MediaCodecInfo.java.
 constexpr int32_t COLOR_FormatYUV420Planar = 19;
 constexpr int32_t BITRATE_MODE_CBR = 2;
+constexpr int32_t AVCProfileMain = 2;
+
+// The vendor parameter key of the number of consecutive B-frames of the V4L2 encoder.
+constexpr char kVendorKeyBFrames[] = "vendor.v4l2-b-frames.value";
 
 // The time interval between two key frames.
 constexpr int32_t kIFrameIntervalSec = 10;
@@ -117,8 +121,9 @@ void MediaCodecEncoder::Rewind() {
     input_file_->Rewind();
 }
 
-bool MediaCodecEncoder::Configure(int32_t bitrate, int32_t framerate) {
-    ALOGV("Configure encoder bitrate=%d, framerate=%d", bitrate, framerate);
+bool MediaCodecEncoder::Configure(int32_t bitrate, int32_t framerate, int32_t num_b_frames) {
+    ALOGV("Configure encoder bitrate=%d, framerate=%d, num_b_frames=%d", bitrate, framerate,
+          num_b_frames);
     AMediaFormat* format = AMediaFormat_new();
     AMediaFormat_setString(format, AMEDIAFORMAT_KEY_MIME, "video/avc");
     AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_COLOR_FORMAT, COLOR_FormatYUV420Planar);
@@ -128,6 +133,10 @@ bool MediaCodecEncoder::Configure(int32_t bitrate, int32_t framerate) {
     AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_HEIGHT, kVisibleSize.height);
     AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_BIT_RATE, bitrate);
     AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_FRAME_RATE, framerate);
+    if (num_b_frames > 0) {
+        AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_PROFILE, AVCProfileMain);
+        AMediaFormat_setInt32(format, kVendorKeyBFrames, num_b_frames);
+    }
     bool ret = AMediaCodec_configure(codec_, format, nullptr /* surface */, nullptr /* crtpto */,
                                      AMEDIACODEC_CONFIGURE_FLAG_ENCODE) == AMEDIA_OK;
     AMediaFormat_delete(format);
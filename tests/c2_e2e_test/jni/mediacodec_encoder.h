@@ -33,8 +33,9 @@ public:
     // Rewind the frame index to the beginning of the input stream.
     void Rewind();
 
-    // Wrapper of AMediaCodec_configure.
-    bool Configure(int32_t bitrate, int32_t framerate);
+    // Wrapper of AMediaCodec_configure. |num_b_frames| is the number of consecutive B-frames the
+    // encoder may insert, which requires the H.264 Main profile.
+    bool Configure(int32_t bitrate, int32_t framerate, int32_t num_b_frames = 0);
 
     // Wrapper of AMediaCodec_start.
     bool Start();
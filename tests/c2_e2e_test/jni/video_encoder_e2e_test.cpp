@@ -52,6 +52,7 @@ struct CmdlineArgs {
     std::string test_stream_data;
     bool run_at_fps = false;
     size_t num_encoded_frames = 0;
+    int num_b_frames = 0;
 };
 
 class C2VideoEncoderTestEnvironment : public testing::Environment {
@@ -147,6 +148,7 @@ public:
 
     bool run_at_fps() const { return args_.run_at_fps; }
     size_t num_encoded_frames() const { return args_.num_encoded_frames; }
+    int num_b_frames() const { return args_.num_b_frames; }
 
 private:
     const CmdlineArgs args_;
@@ -184,7 +186,8 @@ protected:
         encoder_->Rewind();
 
         ASSERT_TRUE(encoder_->Configure(static_cast<int32_t>(g_env->requested_bitrate()),
-                                        static_cast<int32_t>(g_env->requested_framerate())));
+                                        static_cast<int32_t>(g_env->requested_framerate()),
+                                        static_cast<int32_t>(g_env->num_b_frames())));
         ASSERT_TRUE(encoder_->Start());
     }
 
@@ -317,14 +320,41 @@ TEST_F(C2VideoEncoderE2ETest, PerfLatency) {
     recorder.PrintResult();
 }
 
+// Measure the compression and the encode latency together, to compare the trade-off of encoder
+// configurations like the number of B-frames (see --num_b_frames).
+TEST_F(C2VideoEncoderE2ETest, PerfCompressionLatency) {
+    encoder_->set_num_encoded_frames(
+            std::max(encoder_->num_encoded_frames(), kMinNumEncodedFrames));
+
+    LatencyRecorder recorder;
+    total_output_buffer_size_ = 0;
+    encoder_->SetEncodeInputBufferCb(
+            std::bind(&LatencyRecorder::OnEncodeInputBuffer, &recorder, std::placeholders::_1));
+    encoder_->SetOutputBufferReadyCb([this, &recorder](const uint8_t* data,
+                                                       const AMediaCodecBufferInfo& info) {
+        AccumulateOutputBufferSize(data, info);
+        recorder.OnOutputBufferReady(data, info);
+    });
+    encoder_->set_run_at_fps(true);
+
+    EXPECT_TRUE(encoder_->Encode());
+
+    double measured_bitrate =
+            CalculateAverageBitrate(encoder_->num_encoded_frames(), g_env->requested_framerate());
+    printf("Number of B-frames: %d\n", g_env->num_b_frames());
+    printf("Measured encoded bitrate: %.0f bps\n", measured_bitrate);
+    recorder.PrintResult();
+}
+
 }  // namespace android
 
 bool GetOption(int argc, char** argv, android::CmdlineArgs* args) {
-    const char* const optstring = "t:rn:";
+    const char* const optstring = "t:rn:b:";
     static const struct option opts[] = {
             {"test_stream_data", required_argument, nullptr, 't'},
             {"run_at_fps", no_argument, nullptr, 'r'},
             {"num_encoded_frames", required_argument, nullptr, 'n'},
+            {"num_b_frames", required_argument, nullptr, 'b'},
             {nullptr, 0, nullptr, 0},
     };
 
@@ -340,6 +370,9 @@ bool GetOption(int argc, char** argv, android::CmdlineArgs* args) {
         case 'n':
             args->num_encoded_frames = static_cast<size_t>(atoi(optarg));
             break;
+        case 'b':
+            args->num_b_frames = atoi(optarg);
+            break;
         default:
             printf("[WARN] Unknown option: getopt_long() returned code 0x%x.\n", opt);
             break;
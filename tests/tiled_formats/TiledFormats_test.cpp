@@ -0,0 +1,147 @@
+// Copyright 2020 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "TiledFormats_test"
+
+#include <v4l2_codec2/common/TiledFormats.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <v4l2_device.h>
+
+#ifndef V4L2_PIX_FMT_QC08C
+#define V4L2_PIX_FMT_QC08C v4l2_fourcc('Q', '0', '8', 'C')
+#endif
+
+namespace android {
+namespace {
+
+// A V4L2 device which only answers the format ioctls of the CAPTURE queue of a decoder.
+class FakeV4L2Device : public media::V4L2Device {
+public:
+    FakeV4L2Device(std::vector<uint32_t> captureFormats, bool acceptTiledFormats)
+          : mCaptureFormats(std::move(captureFormats)), mAcceptTiledFormats(acceptTiledFormats) {}
+
+    uint32_t currentPixelFormat() const { return mCurrentPixelFormat; }
+
+    bool Open(Type, uint32_t) override { return true; }
+
+    int Ioctl(int request, void* arg) override {
+        switch (request) {
+        case VIDIOC_ENUM_FMT: {
+            auto* fmtdesc = static_cast<struct v4l2_fmtdesc*>(arg);
+            if (fmtdesc->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ||
+                fmtdesc->index >= mCaptureFormats.size()) {
+                errno = EINVAL;
+                return -1;
+            }
+            fmtdesc->pixelformat = mCaptureFormats[fmtdesc->index];
+            return 0;
+        }
+        case VIDIOC_S_FMT: {
+            auto* format = static_cast<struct v4l2_format*>(arg);
+            const uint32_t pixelFormat = format->fmt.pix_mp.pixelformat;
+            if (std::find(mCaptureFormats.begin(), mCaptureFormats.end(), pixelFormat) ==
+                        mCaptureFormats.end() ||
+                (findTiledFormat(pixelFormat) && !mAcceptTiledFormats)) {
+                // Like the drivers, adjust the format to a supported one.
+                format->fmt.pix_mp.pixelformat = mCurrentPixelFormat;
+                return 0;
+            }
+            mCurrentPixelFormat = pixelFormat;
+            return 0;
+        }
+        default:
+            errno = ENOTTY;
+            return -1;
+        }
+    }
+
+    bool Poll(bool, bool*) override { return false; }
+    bool SetDevicePollInterrupt() override { return true; }
+    bool ClearDevicePollInterrupt() override { return true; }
+    void* Mmap(void*, unsigned int, int, int, unsigned int) override { return nullptr; }
+    void Munmap(void*, unsigned int) override {}
+    std::vector<::base::ScopedFD> GetDmabufsForV4L2Buffer(int, size_t, enum v4l2_buf_type) override {
+        return {};
+    }
+    std::vector<uint32_t> PreferredInputFormat(Type) override { return {}; }
+    std::vector<uint32_t> GetSupportedImageProcessorPixelformats(v4l2_buf_type) override {
+        return {};
+    }
+    media::VideoDecodeAccelerator::SupportedProfiles GetSupportedDecodeProfiles(
+            const size_t, const uint32_t[]) override {
+        return {};
+    }
+    media::VideoEncodeAccelerator::SupportedProfiles GetSupportedEncodeProfiles() override {
+        return {};
+    }
+    bool IsImageProcessingSupported() override { return false; }
+    bool IsJpegDecodingSupported() override { return false; }
+    bool IsJpegEncodingSupported() override { return false; }
+
+private:
+    ~FakeV4L2Device() override = default;
+    bool Initialize() override { return true; }
+
+    const std::vector<uint32_t> mCaptureFormats;
+    const bool mAcceptTiledFormats;
+    uint32_t mCurrentPixelFormat = V4L2_PIX_FMT_NV12;
+};
+
+struct v4l2_format nv12Format() {
+    struct v4l2_format format;
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    format.fmt.pix_mp.width = 1920;
+    format.fmt.pix_mp.height = 1088;
+    format.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_NV12;
+    return format;
+}
+
+}  // namespace
+
+TEST(TiledFormatsTest, NegotiateAdvertisedTiledFormat) {
+    scoped_refptr<FakeV4L2Device> device =
+            new FakeV4L2Device({V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_QC08C}, true);
+
+    const TiledFormat* tiledFormat = setTiledFormat(device.get(), nv12Format());
+    ASSERT_NE(tiledFormat, nullptr);
+    EXPECT_EQ(tiledFormat->v4l2PixFmt, static_cast<uint32_t>(V4L2_PIX_FMT_QC08C));
+    EXPECT_EQ(tiledFormat->linearV4L2PixFmt, static_cast<uint32_t>(V4L2_PIX_FMT_NV12));
+    EXPECT_NE(tiledFormat->modifier, kLinearModifier);
+    // The layout has to be requested from gralloc when allocating the output buffers.
+    EXPECT_NE(tiledFormat->usage, 0u);
+    EXPECT_EQ(device->currentPixelFormat(), static_cast<uint32_t>(V4L2_PIX_FMT_QC08C));
+    EXPECT_EQ(findTiledFormat(device->currentPixelFormat()), tiledFormat);
+}
+
+TEST(TiledFormatsTest, NoTiledFormatAdvertised) {
+    scoped_refptr<FakeV4L2Device> device = new FakeV4L2Device({V4L2_PIX_FMT_NV12}, true);
+
+    EXPECT_EQ(setTiledFormat(device.get(), nv12Format()), nullptr);
+    EXPECT_EQ(device->currentPixelFormat(), static_cast<uint32_t>(V4L2_PIX_FMT_NV12));
+}
+
+TEST(TiledFormatsTest, TiledFormatRefusedBySetFormat) {
+    scoped_refptr<FakeV4L2Device> device =
+            new FakeV4L2Device({V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_QC08C}, false);
+
+    EXPECT_EQ(setTiledFormat(device.get(), nv12Format()), nullptr);
+    EXPECT_EQ(device->currentPixelFormat(), static_cast<uint32_t>(V4L2_PIX_FMT_NV12));
+}
+
+TEST(TiledFormatsTest, LinearFormatIsNotTiled) {
+    EXPECT_EQ(findTiledFormat(V4L2_PIX_FMT_NV12), nullptr);
+    EXPECT_NE(findTiledFormat(V4L2_PIX_FMT_QC08C), nullptr);
+}
+
+}  // namespace android